@@ -0,0 +1,681 @@
+/*
+// IoT Controller
+// History Archive Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "archive.h"
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Info
+// history/<device name>.<series>.<segment>.seg --> Header page, then ARCHIVE_SEGMENT_BLOCKS slots of compressed blocks
+// history/<device name>.<series>.rollup --> Header, then per minute rollups of compacted segments
+*/
+
+// NOTE: Writes are ordered so a crash never damages what was already written:
+// - A full block is written to its slot and synced, only then the header's committed count is raised (And synced)
+// - The block still being appended to is rewritten in the slot after the committed ones, its checksum tells if it is intact
+// - Compaction appends rollups past the committed ones before raising the header's count, and deletes the segment last
+// Segments are only mapped when a read reaches back past what is still in memory, so startup never touches them.
+// Reads that reach back past the oldest segment get the minute rollups instead (One sample per minute, its mean).
+// The history thread only keeps segment files open for the length of a flush pass, a fleet of idle series holds no descriptors.
+
+// Devices
+extern int deviceCount;
+extern configPtr_device_t configPtr_devices[];
+
+static pthread_mutex_t archiveViewMutex = PTHREAD_MUTEX_INITIALIZER;
+static archiveHandler_view_t* views[MAX_DEVICES][HISTORY_SERIES_COUNT] = { { NULL } };
+static archiveHandler_file_t files[MAX_DEVICES][HISTORY_SERIES_COUNT]; // Only used by the history thread
+
+#define ARCHIVE_SEGMENT_BYTES (ARCHIVE_HEADER_BYTES + ARCHIVE_SEGMENT_BLOCKS * sizeof(archiveHandler_slot_t))
+
+static uint32_t archiveHandler_checksum(const void* data, size_t length, uint32_t hash) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t archiveHandler_headerChecksum(const archiveHandler_header_t* header) {
+    return archiveHandler_checksum(header, offsetof(archiveHandler_header_t, checksum), 2166136261u);
+}
+
+static uint32_t archiveHandler_rollupChecksum(const archiveHandler_rollupHeader_t* header) {
+    return archiveHandler_checksum(header, offsetof(archiveHandler_rollupHeader_t, checksum), 2166136261u);
+}
+
+static uint32_t archiveHandler_slotChecksum(const archiveHandler_slot_t* slot) {
+    uint32_t hash = archiveHandler_checksum(&slot->sequence, sizeof(slot->sequence), 2166136261u);
+    return archiveHandler_checksum(&slot->block, sizeof(slot->block), hash);
+}
+
+// Build the path of a file belonging to a series ("history/<device name>.<series>.<suffix>")
+void archiveHandler_seriesPath(char path[ARCHIVE_MAX_PATH], int device, int series, const char* suffix) {
+    // Device names may contain '/' (Zigbee friendly names)
+    char name[256];
+    snprintf(name, sizeof(name), "%s", configPtr_devices[device].name);
+    for (char* c = name; *c != '\0'; c++) {
+        if (*c == '/' || *c == '\\') { *c = '_'; }
+    }
+    if (name[0] == '.') { name[0] = '_'; }
+    snprintf(path, ARCHIVE_MAX_PATH, "%s/%s.%d.%s", ARCHIVE_DIRECTORY, name, series, suffix);
+}
+
+// Build the path of a segment, or of the rollup file if 'segment' is -1
+static void archiveHandler_path(char path[ARCHIVE_MAX_PATH], int device, int series, int64_t segment) {
+    char suffix[32];
+    if (segment < 0) {
+        snprintf(suffix, sizeof(suffix), "rollup");
+    } else {
+        snprintf(suffix, sizeof(suffix), "%lld.seg", (long long)segment);
+    }
+    archiveHandler_seriesPath(path, device, series, suffix);
+}
+
+static int archiveHandler_segmentExists(int device, int series, uint64_t segment) {
+    char path[ARCHIVE_MAX_PATH];
+    archiveHandler_path(path, device, series, (int64_t)segment);
+    return access(path, F_OK) == 0;
+}
+
+// Read the rollup header, a missing file is an empty archive
+static int archiveHandler_readRollupHeader(int device, int series, archiveHandler_rollupHeader_t* header) {
+    char path[ARCHIVE_MAX_PATH];
+    archiveHandler_path(path, device, series, -1);
+    memset(header, 0, sizeof(archiveHandler_rollupHeader_t));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { return 0; }
+    ssize_t length = pread(fd, header, sizeof(archiveHandler_rollupHeader_t), 0);
+    close(fd);
+    if (length != sizeof(archiveHandler_rollupHeader_t) || header->magic != ARCHIVE_ROLLUP_MAGIC || header->checksum != archiveHandler_rollupChecksum(header)) {
+        printf("ERROR: History rollup file %s is damaged.\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+int archiveHandler_init() {
+    if (mkdir(ARCHIVE_DIRECTORY, 0755) != 0 && access(ARCHIVE_DIRECTORY, F_OK) != 0) {
+        printf("ERROR: Could not create the history directory '%s'.\n", ARCHIVE_DIRECTORY);
+        return 1;
+    }
+    return 0;
+}
+
+// Open a segment for writing (Creating it if needed), only called from the history thread
+static archiveHandler_file_t* archiveHandler_openSegment(int device, int series, uint64_t segment) {
+    archiveHandler_file_t* file = &files[device][series];
+    if (file->open == 1 && file->segment == segment) { return file; }
+    if (file->open == 1) {
+        close(file->fd);
+        file->open = 0;
+    }
+
+    char path[ARCHIVE_MAX_PATH];
+    archiveHandler_path(path, device, series, (int64_t)segment);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        printf("ERROR: Could not open history segment %s.\n", path);
+        return NULL;
+    }
+
+    struct stat info;
+    archiveHandler_header_t header;
+    if (fstat(fd, &info) != 0) { goto openSegment_cleanup_fail; }
+    if (info.st_size == 0) {
+        // New segment
+        header = (archiveHandler_header_t){ ARCHIVE_MAGIC, ARCHIVE_VERSION, (uint32_t)series, 0, segment, 0, 0 };
+        header.checksum = archiveHandler_headerChecksum(&header);
+        if (ftruncate(fd, ARCHIVE_SEGMENT_BYTES) != 0) { goto openSegment_cleanup_fail; }
+        if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) { goto openSegment_cleanup_fail; }
+        if (fdatasync(fd) != 0) { goto openSegment_cleanup_fail; }
+    } else if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != ARCHIVE_MAGIC || header.checksum != archiveHandler_headerChecksum(&header)) {
+        printf("ERROR: History segment %s has a damaged header.\n", path);
+        goto openSegment_cleanup_fail;
+    }
+
+    file->fd = fd;
+    file->segment = segment;
+    file->header = header;
+    file->open = 1;
+    return file;
+
+openSegment_cleanup_fail:
+    printf("ERROR: Could not prepare history segment %s.\n", path);
+    close(fd);
+    return NULL;
+}
+
+static int archiveHandler_commit(archiveHandler_file_t* file, uint32_t committed) {
+    file->header.committed = committed;
+    file->header.checksum = archiveHandler_headerChecksum(&file->header);
+    if (pwrite(file->fd, &file->header, sizeof(file->header), 0) != sizeof(file->header)) { return 1; }
+    return fdatasync(file->fd) != 0;
+}
+
+// Find where the previous run stopped. Its last partial block is committed as it is, new blocks go after it
+int archiveHandler_recover(int device, int series, uint64_t* next) {
+    archiveHandler_rollupHeader_t rollup;
+    if (archiveHandler_readRollupHeader(device, series, &rollup) != 0) { return 1; }
+
+    uint64_t last = rollup.compactedSegments;
+    if (archiveHandler_segmentExists(device, series, last) == 0) {
+        *next = last * ARCHIVE_SEGMENT_BLOCKS;
+        return 0;
+    }
+    while (archiveHandler_segmentExists(device, series, last + 1) == 1) { last++; }
+
+    archiveHandler_file_t* file = archiveHandler_openSegment(device, series, last);
+    if (file == NULL) { return 1; }
+
+    uint32_t committed = file->header.committed;
+    if (committed < ARCHIVE_SEGMENT_BLOCKS) {
+        archiveHandler_slot_t slot;
+        off_t offset = ARCHIVE_HEADER_BYTES + (off_t)committed * sizeof(archiveHandler_slot_t);
+        if (pread(file->fd, &slot, sizeof(slot), offset) == sizeof(slot) &&
+            slot.sequence == last * ARCHIVE_SEGMENT_BLOCKS + committed && slot.checksum == archiveHandler_slotChecksum(&slot)) {
+            committed++;
+            if (archiveHandler_commit(file, committed) != 0) { return 1; }
+        }
+    }
+
+    *next = last * ARCHIVE_SEGMENT_BLOCKS + committed;
+    return 0;
+}
+
+// Write a block to its slot. Full blocks are committed, the others can be rewritten until they are
+int archiveHandler_writeBlock(int device, int series, uint64_t sequence, const historyHandler_block_t* block, int full) {
+    uint32_t index = (uint32_t)(sequence % ARCHIVE_SEGMENT_BLOCKS);
+    archiveHandler_file_t* file = archiveHandler_openSegment(device, series, sequence / ARCHIVE_SEGMENT_BLOCKS);
+    if (file == NULL) { return 1; }
+
+    static archiveHandler_slot_t slot;
+    slot.sequence = sequence;
+    slot.reserved = 0;
+    memcpy(&slot.block, block, sizeof(historyHandler_block_t));
+    slot.checksum = archiveHandler_slotChecksum(&slot);
+
+    off_t offset = ARCHIVE_HEADER_BYTES + (off_t)index * sizeof(archiveHandler_slot_t);
+    if (pwrite(file->fd, &slot, sizeof(slot), offset) != sizeof(slot)) {
+        printf("ERROR: Could not write to the history archive.\n");
+        return 1;
+    }
+
+    if (full == 1 && file->header.committed < index + 1) {
+        if (fdatasync(file->fd) != 0 || archiveHandler_commit(file, index + 1) != 0) {
+            printf("ERROR: Could not commit to the history archive.\n");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Close the segments written during a flush pass, only called from the history thread
+void archiveHandler_closeFiles() {
+    for (int device = 0; device < deviceCount; device++) {
+        for (int series = 0; series < HISTORY_SERIES_COUNT; series++) {
+            archiveHandler_file_t* file = &files[device][series];
+            if (file->open == 0) { continue; }
+            close(file->fd);
+            file->open = 0;
+        }
+    }
+}
+
+static archiveHandler_view_t* archiveHandler_getView(int device, int series) {
+    archiveHandler_view_t* view = views[device][series];
+    if (view == NULL) {
+        view = (archiveHandler_view_t*)calloc(1, sizeof(archiveHandler_view_t));
+        if (view == NULL) {
+            printf("ERROR: Could not allocate memory on the heap.\n");
+            return NULL;
+        }
+        views[device][series] = view;
+    }
+
+    if (view->probed == 0) {
+        archiveHandler_rollupHeader_t rollup;
+        if (archiveHandler_readRollupHeader(device, series, &rollup) != 0) { return NULL; }
+        view->firstSegment = rollup.compactedSegments;
+        view->probed = 1;
+    }
+
+    // Segments written since the last read
+    while (archiveHandler_segmentExists(device, series, view->firstSegment + view->segmentCount) == 1) {
+        if (view->segmentCount == view->mapCapacity) {
+            uint64_t capacity = view->mapCapacity == 0 ? 16 : view->mapCapacity * 2;
+            void** maps = (void**)realloc(view->maps, capacity * sizeof(void*));
+            if (maps == NULL) {
+                printf("ERROR: Could not allocate memory on the heap.\n");
+                return NULL;
+            }
+            memset(maps + view->mapCapacity, 0, (capacity - view->mapCapacity) * sizeof(void*));
+            view->maps = maps;
+            view->mapCapacity = capacity;
+        }
+        view->segmentCount++;
+    }
+    return view;
+}
+
+static const uint8_t* archiveHandler_map(archiveHandler_view_t* view, int device, int series, uint64_t segment) {
+    uint64_t index = segment - view->firstSegment;
+    if (view->maps[index] != NULL) { return (const uint8_t*)view->maps[index]; }
+
+    char path[ARCHIVE_MAX_PATH];
+    archiveHandler_path(path, device, series, (int64_t)segment);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { return NULL; }
+    struct stat info;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= ARCHIVE_SEGMENT_BYTES) {
+        map = mmap(NULL, ARCHIVE_SEGMENT_BYTES, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("ERROR: Could not map history segment %s.\n", path);
+        return NULL;
+    }
+    view->maps[index] = map;
+    return (const uint8_t*)map;
+}
+
+// Time of the oldest sample still in a segment, INT64_MAX if there is none. Must be called with the view mutex held
+static int64_t archiveHandler_firstTime(archiveHandler_view_t* view, int device, int series) {
+    if (view->segmentCount == 0) { return INT64_MAX; }
+    const uint8_t* map = archiveHandler_map(view, device, series, view->firstSegment);
+    if (map == NULL) { return INT64_MAX; }
+    const archiveHandler_slot_t* slot = (const archiveHandler_slot_t*)(map + ARCHIVE_HEADER_BYTES);
+    if (slot->sequence != view->firstSegment * ARCHIVE_SEGMENT_BLOCKS) { return INT64_MAX; }
+    return slot->block.firstTime;
+}
+
+// Copy up to 'max' minute rollups that start within [from, to] (Oldest first) to 'out', returns the amount copied or -1
+// on failure. Read on from the last minute returned + 1 until nothing is left
+// NOTE: Only rollups older than the oldest segment are returned. Compaction writes a segment's rollups before it lets go
+// of the segment, so for a moment both exist, and reading up to the segment never counts its samples twice.
+int archiveHandler_readMinutes(int device, int series, int64_t from, int64_t to, archiveHandler_minute_t* out, int max) {
+    char path[ARCHIVE_MAX_PATH];
+    archiveHandler_rollupHeader_t header;
+    int count = -1;
+
+    pthread_mutex_lock(&archiveViewMutex);
+    archiveHandler_view_t* view = archiveHandler_getView(device, series);
+    if (view == NULL || archiveHandler_readRollupHeader(device, series, &header) != 0) {
+        pthread_mutex_unlock(&archiveViewMutex);
+        return -1;
+    }
+    int64_t rawStart = archiveHandler_firstTime(view, device, series);
+    if (rawStart <= to) { to = rawStart - 1; }
+    if (header.records == 0 || from > to || max <= 0) {
+        pthread_mutex_unlock(&archiveViewMutex);
+        return 0;
+    }
+
+    archiveHandler_path(path, device, series, -1);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        pthread_mutex_unlock(&archiveViewMutex);
+        printf("ERROR: Could not open history rollup file %s.\n", path);
+        return -1;
+    }
+
+    // Rollups are in time order, find the first one at or after 'from'
+    uint64_t low = 0;
+    uint64_t high = header.records;
+    archiveHandler_minute_t minute;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        off_t offset = sizeof(archiveHandler_rollupHeader_t) + (off_t)middle * sizeof(archiveHandler_minute_t);
+        if (pread(fd, &minute, sizeof(minute), offset) != sizeof(minute)) { goto readMinutes_cleanup; }
+        if (minute.minute < from) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    uint64_t wanted = header.records - low < (uint64_t)max ? header.records - low : (uint64_t)max;
+    off_t offset = sizeof(archiveHandler_rollupHeader_t) + (off_t)low * sizeof(archiveHandler_minute_t);
+    ssize_t length = pread(fd, out, wanted * sizeof(archiveHandler_minute_t), offset);
+    if (length < 0) { goto readMinutes_cleanup; }
+    count = (int)(length / sizeof(archiveHandler_minute_t));
+    while (count > 0 && out[count - 1].minute > to) { count--; }
+    int more = (uint64_t)count == wanted && low + wanted < header.records;
+
+    // A minute that spans two compacted segments has a rollup from each, they are merged into one
+    int merged = 0;
+    for (int i = 0; i < count; i++) {
+        if (merged > 0 && out[merged - 1].minute == out[i].minute) {
+            archiveHandler_minute_t* rollup = &out[merged - 1];
+            if (out[i].min < rollup->min) { rollup->min = out[i].min; }
+            if (out[i].max > rollup->max) { rollup->max = out[i].max; }
+            rollup->sum += out[i].sum;
+            rollup->count += out[i].count;
+            continue;
+        }
+        out[merged++] = out[i];
+    }
+
+    // The last minute may go on in the rollups after the ones read, it is left to the next read
+    if (more == 1 && merged > 1) { merged--; }
+    count = merged;
+
+readMinutes_cleanup:
+    close(fd);
+    pthread_mutex_unlock(&archiveViewMutex);
+    if (count < 0) { printf("ERROR: Could not read history rollups from %s.\n", path); }
+    return count;
+}
+
+// Stream the minute rollups within [from, to] (Oldest first) to 'sink', one sample per minute (At its start) holding its mean
+int archiveHandler_streamMinutes(int device, int series, int64_t from, int64_t to, historyHandler_sink_t sink, void* context) {
+    archiveHandler_minute_t* minutes = (archiveHandler_minute_t*)malloc(ARCHIVE_MINUTE_CHUNK * sizeof(archiveHandler_minute_t));
+    historyHandler_sample_t* samples = (historyHandler_sample_t*)malloc(ARCHIVE_MINUTE_CHUNK * sizeof(historyHandler_sample_t));
+    int rc = 0;
+    if (minutes == NULL || samples == NULL) {
+        printf("ERROR: Could not allocate memory on the heap.\n");
+        rc = 1;
+        goto streamMinutes_cleanup;
+    }
+
+    while (rc == 0) {
+        int count = archiveHandler_readMinutes(device, series, from, to, minutes, ARCHIVE_MINUTE_CHUNK);
+        if (count < 0) {
+            rc = 1;
+            break;
+        }
+        if (count == 0) { break; }
+
+        for (int i = 0; i < count; i++) {
+            samples[i].time = minutes[i].minute;
+            samples[i].value = minutes[i].sum / minutes[i].count;
+        }
+        rc = sink(context, samples, count);
+        from = minutes[count - 1].minute + 1;
+    }
+
+streamMinutes_cleanup:
+    free(minutes);
+    free(samples);
+    return rc;
+}
+
+// Copy the archived blocks overlapping [from, to] (Oldest first) into a newly allocated array (Freed by the caller).
+// Blocks from 'limit' on are skipped (Still in memory), returns the amount of blocks or -1 on failure
+int archiveHandler_read(int device, int series, uint64_t limit, int64_t from, int64_t to, historyHandler_block_t** out) {
+    *out = NULL;
+    historyHandler_block_t* blocks = NULL;
+    int count = 0;
+    int capacity = 0;
+
+    pthread_mutex_lock(&archiveViewMutex);
+    archiveHandler_view_t* view = archiveHandler_getView(device, series);
+    if (view == NULL) { goto read_cleanup_fail; }
+
+    // Newest segment first, blocks are in time order so the walk stops at the first block older than 'from'
+    for (uint64_t s = view->segmentCount; s > 0; s--) {
+        uint64_t segment = view->firstSegment + s - 1;
+        const uint8_t* map = archiveHandler_map(view, device, series, segment);
+        if (map == NULL) { continue; }
+
+        const archiveHandler_header_t* header = (const archiveHandler_header_t*)map;
+        uint32_t committed = header->committed;
+        if (header->magic != ARCHIVE_MAGIC || committed > ARCHIVE_SEGMENT_BLOCKS) { continue; }
+
+        for (uint32_t i = committed < ARCHIVE_SEGMENT_BLOCKS ? committed + 1 : committed; i > 0; i--) {
+            const archiveHandler_slot_t* slot = (const archiveHandler_slot_t*)(map + ARCHIVE_HEADER_BYTES + (size_t)(i - 1) * sizeof(archiveHandler_slot_t));
+            uint64_t sequence = segment * ARCHIVE_SEGMENT_BLOCKS + (i - 1);
+            if (sequence >= limit || slot->sequence != sequence) { continue; }
+
+            // Committed slots never change, only the one being appended to has to be checked
+            if (i - 1 == committed && slot->checksum != archiveHandler_slotChecksum(slot)) { continue; }
+
+            if (slot->block.lastTime < from) { goto read_done; }
+            if (slot->block.firstTime > to) { continue; }
+
+            if (count == capacity) {
+                capacity = capacity == 0 ? 16 : capacity * 2;
+                historyHandler_block_t* grown = (historyHandler_block_t*)realloc(blocks, capacity * sizeof(historyHandler_block_t));
+                if (grown == NULL) {
+                    printf("ERROR: Could not allocate memory on the heap.\n");
+                    goto read_cleanup_fail;
+                }
+                blocks = grown;
+            }
+            memcpy(&blocks[count++], &slot->block, sizeof(historyHandler_block_t));
+        }
+    }
+
+read_done:
+    pthread_mutex_unlock(&archiveViewMutex);
+
+    // Collected newest first
+    for (int i = 0; i < count / 2; i++) {
+        historyHandler_block_t swap = blocks[i];
+        blocks[i] = blocks[count - 1 - i];
+        blocks[count - 1 - i] = swap;
+    }
+    *out = blocks;
+    return count;
+
+read_cleanup_fail:
+    pthread_mutex_unlock(&archiveViewMutex);
+    free(blocks);
+    return -1;
+}
+
+// Stream the archived samples within [from, to] (Oldest first) to 'sink'. Blocks are copied out one segment at a time,
+// so memory use does not depend on the size of the range. Blocks from 'limit' on are skipped (Still in memory)
+int archiveHandler_stream(int device, int series, uint64_t limit, int64_t from, int64_t to, historyHandler_sink_t sink, void* context) {
+    historyHandler_block_t* blocks = (historyHandler_block_t*)malloc(ARCHIVE_SEGMENT_BLOCKS * sizeof(historyHandler_block_t));
+    historyHandler_sample_t* samples = (historyHandler_sample_t*)malloc(HISTORY_MAX_BLOCK_SAMPLES * sizeof(historyHandler_sample_t));
+    uint64_t segment = 0;
+    int started = 0;
+    int done = 0;
+    int rc = 0;
+    if (blocks == NULL || samples == NULL) {
+        printf("ERROR: Could not allocate memory on the heap.\n");
+        rc = 1;
+        goto stream_cleanup;
+    }
+
+    while (done == 0 && rc == 0) {
+        int count = 0;
+
+        pthread_mutex_lock(&archiveViewMutex);
+        archiveHandler_view_t* view = archiveHandler_getView(device, series);
+        if (view == NULL) {
+            pthread_mutex_unlock(&archiveViewMutex);
+            rc = 1;
+            break;
+        }
+        // Segments can be compacted away between two iterations
+        if (started == 0 || segment < view->firstSegment) {
+            segment = view->firstSegment;
+            started = 1;
+        }
+        if (segment >= view->firstSegment + view->segmentCount) {
+            pthread_mutex_unlock(&archiveViewMutex);
+            break;
+        }
+
+        const uint8_t* map = archiveHandler_map(view, device, series, segment);
+        const archiveHandler_header_t* header = (const archiveHandler_header_t*)map;
+        if (map != NULL && header->magic == ARCHIVE_MAGIC && header->committed <= ARCHIVE_SEGMENT_BLOCKS) {
+            uint32_t committed = header->committed;
+            uint32_t slots = committed < ARCHIVE_SEGMENT_BLOCKS ? committed + 1 : committed;
+            for (uint32_t i = 0; i < slots; i++) {
+                const archiveHandler_slot_t* slot = (const archiveHandler_slot_t*)(map + ARCHIVE_HEADER_BYTES + (size_t)i * sizeof(archiveHandler_slot_t));
+                uint64_t sequence = segment * ARCHIVE_SEGMENT_BLOCKS + i;
+                if (sequence >= limit || (slot->sequence == sequence && slot->block.firstTime > to)) {
+                    done = 1;
+                    break;
+                }
+                if (slot->sequence != sequence) { continue; }
+                if (i == committed && slot->checksum != archiveHandler_slotChecksum(slot)) { continue; }
+                if (slot->block.lastTime < from) { continue; }
+                memcpy(&blocks[count++], &slot->block, sizeof(historyHandler_block_t));
+            }
+        }
+        pthread_mutex_unlock(&archiveViewMutex);
+
+        for (int i = 0; i < count && rc == 0; i++) {
+            rc = historyHandler_streamBlock(&blocks[i], from, to, samples, sink, context);
+        }
+        segment++;
+    }
+
+stream_cleanup:
+    free(blocks);
+    free(samples);
+    return rc;
+}
+
+// Fold the samples of a block into per minute rollups
+static int archiveHandler_rollupBlock(const historyHandler_block_t* block, archiveHandler_minute_t** minutes, int* count, int* capacity) {
+    historyHandler_sample_t* samples = (historyHandler_sample_t*)malloc(block->count * sizeof(historyHandler_sample_t));
+    if (samples == NULL) {
+        printf("ERROR: Could not allocate memory on the heap.\n");
+        return 1;
+    }
+    historyHandler_decode(block, samples);
+
+    for (uint32_t i = 0; i < block->count; i++) {
+        int64_t minute = samples[i].time - (samples[i].time % 60);
+        float value = (float)samples[i].value;
+        if (*count > 0 && (*minutes)[*count - 1].minute == minute) {
+            archiveHandler_minute_t* rollup = &(*minutes)[*count - 1];
+            if (value < rollup->min) { rollup->min = value; }
+            if (value > rollup->max) { rollup->max = value; }
+            rollup->sum += samples[i].value;
+            rollup->count++;
+            continue;
+        }
+        if (*count == *capacity) {
+            *capacity = *capacity == 0 ? 1024 : *capacity * 2;
+            archiveHandler_minute_t* grown = (archiveHandler_minute_t*)realloc(*minutes, *capacity * sizeof(archiveHandler_minute_t));
+            if (grown == NULL) {
+                printf("ERROR: Could not allocate memory on the heap.\n");
+                free(samples);
+                return 1;
+            }
+            *minutes = grown;
+        }
+        (*minutes)[(*count)++] = (archiveHandler_minute_t){ minute, 1, value, value, samples[i].value };
+    }
+
+    free(samples);
+    return 0;
+}
+
+// Replace segments that ended before 'before' with per minute rollups. The newest segment is never compacted
+int archiveHandler_compact(int device, int series, int64_t before) {
+    char path[ARCHIVE_MAX_PATH];
+    archiveHandler_rollupHeader_t header;
+    archiveHandler_minute_t* minutes = NULL;
+    int rc = 0;
+
+    if (archiveHandler_readRollupHeader(device, series, &header) != 0) { return 1; }
+
+    // Left behind by a crash between committing the rollups and deleting the segment
+    if (header.compactedSegments > 0 && archiveHandler_segmentExists(device, series, header.compactedSegments - 1) == 1) {
+        archiveHandler_path(path, device, series, (int64_t)header.compactedSegments - 1);
+        unlink(path);
+    }
+    if (archiveHandler_segmentExists(device, series, header.compactedSegments) == 0 ||
+        archiveHandler_segmentExists(device, series, header.compactedSegments + 1) == 0) {
+        return 0;
+    }
+
+    archiveHandler_path(path, device, series, -1);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        printf("ERROR: Could not open history rollup file %s.\n", path);
+        return 1;
+    }
+    if (header.magic == 0) {
+        header = (archiveHandler_rollupHeader_t){ ARCHIVE_ROLLUP_MAGIC, ARCHIVE_VERSION, (uint32_t)series, 0, 0, 0, 0, 0 };
+    }
+
+    while (archiveHandler_segmentExists(device, series, header.compactedSegments + 1) == 1) {
+        uint64_t segment = header.compactedSegments;
+        archiveHandler_path(path, device, series, (int64_t)segment);
+        int segmentFd = open(path, O_RDONLY);
+        if (segmentFd < 0) { break; }
+        void* map = mmap(NULL, ARCHIVE_SEGMENT_BYTES, PROT_READ, MAP_SHARED, segmentFd, 0);
+        close(segmentFd);
+        if (map == MAP_FAILED) {
+            rc = 1;
+            break;
+        }
+
+        const archiveHandler_header_t* segmentHeader = (const archiveHandler_header_t*)map;
+        uint32_t committed = segmentHeader->committed;
+        const archiveHandler_slot_t* slots = (const archiveHandler_slot_t*)((const uint8_t*)map + ARCHIVE_HEADER_BYTES);
+        if (segmentHeader->magic != ARCHIVE_MAGIC || committed == 0 || committed > ARCHIVE_SEGMENT_BLOCKS ||
+            slots[committed - 1].block.lastTime >= before) {
+            munmap(map, ARCHIVE_SEGMENT_BYTES);
+            break;
+        }
+
+        int count = 0;
+        int capacity = 0;
+        for (uint32_t i = 0; i < committed && rc == 0; i++) {
+            rc = archiveHandler_rollupBlock(&slots[i].block, &minutes, &count, &capacity);
+        }
+        munmap(map, ARCHIVE_SEGMENT_BYTES);
+        if (rc != 0) { break; }
+
+        // Rollups first, then the header that makes them count
+        off_t offset = sizeof(archiveHandler_rollupHeader_t) + (off_t)header.records * sizeof(archiveHandler_minute_t);
+        if (pwrite(fd, minutes, count * sizeof(archiveHandler_minute_t), offset) != (ssize_t)(count * sizeof(archiveHandler_minute_t)) || fdatasync(fd) != 0) {
+            printf("ERROR: Could not write history rollups.\n");
+            rc = 1;
+            break;
+        }
+        header.compactedSegments = segment + 1;
+        header.records += count;
+        header.checksum = archiveHandler_rollupChecksum(&header);
+        if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) || fdatasync(fd) != 0) {
+            printf("ERROR: Could not write history rollups.\n");
+            rc = 1;
+            break;
+        }
+
+        // Readers let go of the segment before it is deleted
+        pthread_mutex_lock(&archiveViewMutex);
+        archiveHandler_view_t* view = views[device][series];
+        if (view != NULL && view->probed == 1 && view->firstSegment == segment) {
+            if (view->segmentCount > 0) {
+                if (view->maps[0] != NULL) { munmap(view->maps[0], ARCHIVE_SEGMENT_BYTES); }
+                memmove(view->maps, view->maps + 1, (view->mapCapacity - 1) * sizeof(void*));
+                view->maps[view->mapCapacity - 1] = NULL;
+                view->segmentCount--;
+            }
+            view->firstSegment = segment + 1;
+        }
+        pthread_mutex_unlock(&archiveViewMutex);
+        unlink(path);
+
+        printf("Compacted history segment %s into %d minute rollups.\n", path, count);
+    }
+
+    close(fd);
+    free(minutes);
+    return rc;
+}
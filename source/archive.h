@@ -0,0 +1,97 @@
+#ifndef _ARCHIVE_H
+#define _ARCHIVE_H
+#include <stdint.h>
+#include "history.h"
+
+// Directory the archive lives in (Relative to the working directory, like config.json)
+#define ARCHIVE_DIRECTORY "history"
+
+// Blocks per segment file, segments are created at full size (Sparse) so a mapping never has to grow
+#define ARCHIVE_SEGMENT_BLOCKS 256
+
+// The header takes a page of its own so the slots after it are never written together with it
+#define ARCHIVE_HEADER_BYTES 4096
+
+#define ARCHIVE_MAGIC 0x48544F49 // "IOTH"
+#define ARCHIVE_ROLLUP_MAGIC 0x52544F49 // "IOTR"
+#define ARCHIVE_VERSION 1
+
+// How often new samples are written, and how often old segments are compacted (Seconds)
+#define ARCHIVE_FLUSH_INTERVAL_MS 5000
+#define ARCHIVE_COMPACT_INTERVAL 3600
+
+// Segments older than this are compacted into per minute rollups (Seconds)
+#define ARCHIVE_RAW_RETENTION (90 * 86400)
+
+// Minute rollups read per pread when streaming them
+#define ARCHIVE_MINUTE_CHUNK 1024
+
+#define ARCHIVE_MAX_PATH 512
+
+// Segment header. 'committed' slots are complete and never change again, the slot right after may hold a partial block
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t series;
+    uint32_t committed;
+    uint64_t segment;
+    uint32_t checksum; // Of everything above
+    uint32_t reserved;
+} archiveHandler_header_t;
+
+typedef struct {
+    uint64_t sequence;
+    uint32_t checksum; // Of the sequence and block, a torn write never passes
+    uint32_t reserved;
+    historyHandler_block_t block;
+} archiveHandler_slot_t;
+
+// Rollup file header, only the first 'records' records are valid
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t series;
+    uint32_t reserved;
+    uint64_t compactedSegments; // Segments before this one were compacted (And deleted)
+    uint64_t records;
+    uint32_t checksum;
+    uint32_t reserved2;
+} archiveHandler_rollupHeader_t;
+
+typedef struct {
+    int64_t minute; // Unix seconds of the start of the minute
+    uint32_t count;
+    float min;
+    float max;
+    double sum;
+} archiveHandler_minute_t;
+
+// Mapped segments of one series, only touched with the archive view mutex held
+typedef struct {
+    int probed;
+    uint64_t firstSegment;
+    uint64_t segmentCount; // Segments [firstSegment, firstSegment + segmentCount) exist
+    void** maps; // Indexed by segment - firstSegment, NULL until first read
+    uint64_t mapCapacity;
+} archiveHandler_view_t;
+
+// File the history thread is writing to (Closed after every flush pass, so idle series hold no descriptor)
+typedef struct {
+    int open;
+    int fd;
+    uint64_t segment;
+    archiveHandler_header_t header;
+} archiveHandler_file_t;
+
+int archiveHandler_init();
+void archiveHandler_seriesPath(char path[ARCHIVE_MAX_PATH], int device, int series, const char* suffix);
+int archiveHandler_recover(int device, int series, uint64_t* next);
+int archiveHandler_writeBlock(int device, int series, uint64_t sequence, const historyHandler_block_t* block, int full);
+void archiveHandler_closeFiles();
+int archiveHandler_read(int device, int series, uint64_t limit, int64_t from, int64_t to, historyHandler_block_t** out);
+int archiveHandler_stream(int device, int series, uint64_t limit, int64_t from, int64_t to, historyHandler_sink_t sink, void* context);
+int archiveHandler_readMinutes(int device, int series, int64_t from, int64_t to, archiveHandler_minute_t* out, int max);
+int archiveHandler_streamMinutes(int device, int series, int64_t from, int64_t to, historyHandler_sink_t sink, void* context);
+int archiveHandler_compact(int device, int series, int64_t before);
+
+#endif
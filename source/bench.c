@@ -0,0 +1,366 @@
+/*
+// IoT Controller
+// Benchmark Entry Point
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "driver.h"
+#include "shadow.h"
+#include "wait.h"
+#include "color.h"
+#include "queue.h"
+#include "states.h"
+#include "mqtt.h"
+
+/* Info
+// iot_controller_bench [passes] --> Runs every benchmark below 'passes' times (Default: BENCH_PASSES) and prints the results
+// Drivers: Every recorded message is routed to each of BENCH_DEVICES devices of its driver through driverHandler_route,
+// the same call the MQTT callback makes (Topic split, device lookup, handleMessage, shared state table update)
+// Scene: One scene (Power, brightness, warmth, color) applied to BENCH_SCENE_DEVICES lights, one message per command
+// against one backlog message per device, the way the command dispatcher merges them
+// Colors: Bulk conversion of BENCH_COLORS colors, picker floats to commands and reported strings back to picker floats
+*/
+
+// NOTE: Nothing here connects to the broker or reads the config, the devices are registered the way drivers import them.
+// Everything the benchmarks write (History archive, rollups) goes to a temporary directory that is removed afterwards.
+// Drivers log to stdout, so stdout is sent to /dev/null while the benchmarks run and the results go to the original stdout.
+// A driver added to DRIVER_LIST without recorded messages below is reported, so its ingestion path is never left unmeasured.
+// Without a broker every publish fails right away, so the scene benchmark times encoding and merging, and counts the messages
+// that would have gone out instead of the ones that did.
+
+// Devices registered per driver
+#define BENCH_DEVICES 1000
+
+// Default amount of passes over the devices per message
+#define BENCH_PASSES 50
+
+// Lights a scene is applied to
+#define BENCH_SCENE_DEVICES 100
+
+// Colors converted per pass
+#define BENCH_COLORS 10000
+
+// Devices
+extern int deviceCount;
+extern configPtr_device_t configPtr_devices[];
+
+#define BENCH_DRIVER_ENTRY(id, driver, control, info) [DRIVER_##id] = &driver,
+static const driverHandler_driver_t* drivers[DRIVER_COUNT] = {
+    DRIVER_LIST(BENCH_DRIVER_ENTRY)
+};
+
+// A message as the broker delivered it, '%s' in the topic is the device name
+typedef struct {
+    int driver;
+    const char* topic;
+    const char* content;
+} bench_message_t;
+
+static const bench_message_t messages[] = {
+    { DRIVER_OPENBK_LIGHT, "%s/connected", "online" },
+    { DRIVER_OPENBK_LIGHT, "stat/%s/RESULT",
+        "{\"Time\":\"1970-01-01T00:00:00\",\"Uptime\":\"0T05:12:44\",\"UptimeSec\":18764,\"Heap\":92000,\"SleepMode\":\"Dynamic\","
+        "\"Sleep\":50,\"LoadAvg\":19,\"MqttCount\":3,\"POWER\":\"ON\",\"Dimmer\":74,\"Color\":\"FF8000\",\"HSBColor\":\"30,100,74\","
+        "\"Channel\":[100,50,0],\"Fade\":\"OFF\",\"Speed\":1,\"LedTable\":0,\"Wifi\":{\"AP\":1,\"SSId\":\"iot-network\","
+        "\"BSSId\":\"30:B5:C2:5D:70:72\",\"Channel\":6,\"Mode\":\"11n\",\"RSSI\":62,\"Signal\":-69,\"LinkCount\":1,\"Downtime\":\"0T00:00:03\"}}" },
+    { DRIVER_OPENBK_POWERMON, "%s/voltage/get", "231.4" },
+    { DRIVER_OPENBK_POWERMON, "%s/power/get", "57.3" },
+    { DRIVER_OPENBK_POWERMON, "%s/1/get", "1" },
+    { DRIVER_OPENBK_POWERMON, "stat/%s/RESULT", "{\"POWER\":\"ON\"}" },
+    { DRIVER_TASMOTA, "tele/%s/STATE",
+        "{\"Time\":\"2025-03-14T09:26:53\",\"Uptime\":\"2T04:11:07\",\"UptimeSec\":187867,\"Heap\":26,\"SleepMode\":\"Dynamic\","
+        "\"Sleep\":50,\"LoadAvg\":19,\"MqttCount\":4,\"POWER\":\"ON\",\"Dimmer\":74,\"Color\":\"BD5E00\",\"HSBColor\":\"30,100,74\","
+        "\"White\":0,\"CT\":327,\"Channel\":[74,37,0],\"Scheme\":0,\"Fade\":\"OFF\",\"Speed\":1,\"LedTable\":\"ON\","
+        "\"Wifi\":{\"AP\":1,\"SSId\":\"iot-network\",\"BSSId\":\"30:B5:C2:5D:70:72\",\"Channel\":6,\"Mode\":\"11n\",\"RSSI\":62,"
+        "\"Signal\":-69,\"LinkCount\":1,\"Downtime\":\"0T00:00:03\"}}" },
+    { DRIVER_TASMOTA, "tele/%s/SENSOR",
+        "{\"Time\":\"2025-03-14T09:26:53\",\"ENERGY\":{\"TotalStartTime\":\"2024-11-02T18:40:11\",\"Total\":41.733,"
+        "\"Yesterday\":0.412,\"Today\":0.189,\"Power\":57,\"ApparentPower\":61,\"ReactivePower\":21,\"Factor\":0.94,"
+        "\"Voltage\":231,\"Current\":0.264}}" },
+    { DRIVER_TASMOTA, "stat/%s/RESULT", "{\"POWER\":\"ON\",\"Dimmer\":74}" },
+    { DRIVER_TASMOTA, "stat/%s/POWER", "ON" },
+    { DRIVER_ZIGBEE2MQTT, "zigbee2mqtt/%s",
+        "{\"brightness\":188,\"color\":{\"x\":0.4599,\"y\":0.4106},\"color_mode\":\"color_temp\",\"color_temp\":370,"
+        "\"linkquality\":112,\"state\":\"ON\",\"update\":{\"installed_version\":587814449,\"latest_version\":587814449,"
+        "\"state\":\"idle\"}}" },
+    { DRIVER_ZIGBEE2MQTT, "zigbee2mqtt/%s/availability", "{\"state\":\"online\"}" }
+};
+
+// Mqtt
+extern atomic_int mqttMessagesSaved;
+
+static FILE* out = NULL;
+static int firstDevice[DRIVER_COUNT]; // First device of each driver
+
+// Remove a directory and everything in it
+static void bench_removeDirectory(const char* path) {
+    DIR* directory = opendir(path);
+    if (directory != NULL) {
+        struct dirent* entry;
+        char child[1024];
+        while ((entry = readdir(directory)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) { continue; }
+            snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+            struct stat info;
+            if (lstat(child, &info) == 0 && S_ISDIR(info.st_mode)) {
+                bench_removeDirectory(child);
+            } else {
+                unlink(child);
+            }
+        }
+        closedir(directory);
+    }
+    rmdir(path);
+}
+
+static int bench_compareU64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Register BENCH_DEVICES devices per driver
+static int bench_registerDevices() {
+    char name[64];
+    for (int driver = 1; driver < DRIVER_COUNT; driver++) {
+        firstDevice[driver] = deviceCount;
+        for (int i = 0; i < BENCH_DEVICES; i++) {
+            snprintf(name, sizeof(name), "bench-%s-%d", drivers[driver]->mode, i);
+            if (configHandler_registerDevice(drivers[driver]->mode, name, name, "light") == -1) { return 1; }
+        }
+    }
+    return 0;
+}
+
+// Route one recorded message to every device of its driver per pass, prints the cost per message
+static int bench_drivers(int passes) {
+    // Every driver needs at least one recorded message
+    for (int driver = 1; driver < DRIVER_COUNT; driver++) {
+        int found = 0;
+        for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); i++) {
+            if (messages[i].driver == driver) { found = 1; }
+        }
+        if (found == 0) {
+            fprintf(out, "WARNING: Driver '%s' has no recorded messages.\n", drivers[driver]->mode);
+        }
+    }
+
+    uint64_t* timings = (uint64_t*)malloc(passes * sizeof(uint64_t));
+    char** topics = (char**)malloc(BENCH_DEVICES * sizeof(char*));
+    if (timings == NULL || topics == NULL) {
+        fprintf(out, "ERROR: Could not allocate memory on the heap.\n");
+        free(timings);
+        free(topics);
+        return 1;
+    }
+
+    fprintf(out, "Drivers (%d devices each, ns per message):\n", BENCH_DEVICES);
+    fprintf(out, "%-16s %-32s %8s %8s %8s\n", "Driver", "Topic", "First", "Median", "Best");
+    char content[1024];
+    for (size_t m = 0; m < sizeof(messages) / sizeof(messages[0]); m++) {
+        const bench_message_t* message = &messages[m];
+        size_t length = strlen(message->content);
+        if (length >= sizeof(content)) { continue; }
+
+        // Topics are built up front, so only the routing is timed
+        for (int i = 0; i < BENCH_DEVICES; i++) {
+            const char* name = configPtr_devices[firstDevice[message->driver] + i].name;
+            size_t size = strlen(message->topic) + strlen(name) + 1;
+            topics[i] = (char*)malloc(size);
+            if (topics[i] != NULL) { snprintf(topics[i], size, message->topic, name); }
+        }
+
+        for (int pass = 0; pass < passes; pass++) {
+            uint64_t start = waitHandler_monotonicNs();
+            for (int i = 0; i < BENCH_DEVICES; i++) {
+                // Handlers own nothing of the content, but the broker's buffer is fresh for every message
+                memcpy(content, message->content, length + 1);
+                if (topics[i] != NULL) { driverHandler_route(topics[i], content); }
+            }
+            timings[pass] = (waitHandler_monotonicNs() - start) / BENCH_DEVICES;
+        }
+        for (int i = 0; i < BENCH_DEVICES; i++) { free(topics[i]); }
+
+        // The first pass includes what every device sets up once (History series, rollup files)
+        uint64_t firstPass = timings[0];
+        qsort(timings, passes, sizeof(uint64_t), bench_compareU64);
+        fprintf(out, "%-16s %-32s %8llu %8llu %8llu\n", drivers[message->driver]->mode, message->topic,
+            (unsigned long long)firstPass, (unsigned long long)timings[passes / 2], (unsigned long long)timings[0]);
+    }
+    fprintf(out, "\n");
+
+    free(timings);
+    free(topics);
+    return 0;
+}
+
+// Median of a set of timings (Sorts them)
+static uint64_t bench_median(uint64_t* timings, int count) {
+    qsort(timings, count, sizeof(uint64_t), bench_compareU64);
+    return timings[count / 2];
+}
+
+// A scene applied to BENCH_SCENE_DEVICES lights, command by command and merged into backlog messages, us per scene
+static int bench_scene(int passes) {
+    static const int actions[] = {
+        FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_ON,
+        FLAG_DISPATCH_ACTION_OPENBK_LIGHT_BRIGHTNESS,
+        FLAG_DISPATCH_ACTION_OPENBK_LIGHT_WARMTH,
+        FLAG_DISPATCH_ACTION_OPENBK_LIGHT_COLOR
+    };
+    static const uint32_t contents[] = { 0, 74, 40, 0xFF8000 };
+    const int perDevice = sizeof(actions) / sizeof(actions[0]);
+    const int count = BENCH_SCENE_DEVICES * perDevice;
+
+    mqttHandler_pendingCommand_t* commands = (mqttHandler_pendingCommand_t*)malloc(count * sizeof(mqttHandler_pendingCommand_t));
+    uint64_t* timings = (uint64_t*)malloc(passes * sizeof(uint64_t));
+    if (commands == NULL || timings == NULL) {
+        fprintf(out, "ERROR: Could not allocate memory on the heap.\n");
+        free(commands);
+        free(timings);
+        return 1;
+    }
+
+    // Already ordered by device, like the dispatcher hands them over after sorting
+    for (int i = 0; i < count; i++) {
+        commands[i].command.type = FLAG_DISPATCH_TYPE_OPENBK_LIGHT;
+        commands[i].command.action = actions[i % perDevice];
+        commands[i].command.device = firstDevice[DRIVER_OPENBK_LIGHT] + i / perDevice;
+        commands[i].command.flags = 0;
+        commands[i].command.content = contents[i % perDevice];
+        commands[i].order = i % perDevice;
+    }
+
+    fprintf(out, "Scene (%d attributes on %d lights, us per scene):\n", perDevice, BENCH_SCENE_DEVICES);
+    fprintf(out, "%-40s %8s %8s\n", "Dispatch", "Median", "Messages");
+
+    for (int pass = 0; pass < passes; pass++) {
+        uint64_t start = waitHandler_monotonicNs();
+        for (int i = 0; i < count; i++) { mqttHandler_dispatchCommand(&commands[i].command); }
+        timings[pass] = waitHandler_monotonicNs() - start;
+    }
+    fprintf(out, "%-40s %8.1f %8d\n", "One message per command", bench_median(timings, passes) / 1000.0, count);
+
+    int saved = atomic_load(&mqttMessagesSaved);
+    for (int pass = 0; pass < passes; pass++) {
+        uint64_t start = waitHandler_monotonicNs();
+        for (int i = 0; i < count; i += perDevice) { mqttHandler_dispatchBacklog(&commands[i], perDevice); }
+        timings[pass] = waitHandler_monotonicNs() - start;
+    }
+    saved = (atomic_load(&mqttMessagesSaved) - saved) / passes;
+    fprintf(out, "%-40s %8.1f %8d\n\n", "Backlog message per device", bench_median(timings, passes) / 1000.0, count - saved);
+
+    free(commands);
+    free(timings);
+    return 0;
+}
+
+// Encode and decode kernels of the color picker, ns per color
+static int bench_colors(int passes) {
+    float (*rgb)[3] = (float (*)[3])malloc(BENCH_COLORS * sizeof(float[3]));
+    uint32_t* packed = (uint32_t*)malloc(BENCH_COLORS * sizeof(uint32_t));
+    char (*hex)[COLOR_HEX_LEN + 1] = (char (*)[COLOR_HEX_LEN + 1])malloc(BENCH_COLORS * sizeof(char[COLOR_HEX_LEN + 1]));
+    char (*triplets)[16] = (char (*)[16])malloc(BENCH_COLORS * sizeof(char[16]));
+    char (*hsb)[16] = (char (*)[16])malloc(BENCH_COLORS * sizeof(char[16]));
+    const char** strings = (const char**)malloc(BENCH_COLORS * sizeof(char*));
+    uint64_t* timings = (uint64_t*)malloc(passes * sizeof(uint64_t));
+    int rc = 0;
+    if (rgb == NULL || packed == NULL || hex == NULL || triplets == NULL || hsb == NULL || strings == NULL || timings == NULL) {
+        fprintf(out, "ERROR: Could not allocate memory on the heap.\n");
+        rc = 1;
+        goto colors_cleanup;
+    }
+
+    // What devices report: "RRGGBB", "R,G,B" and "H,S,B"
+    for (int i = 0; i < BENCH_COLORS; i++) {
+        uint32_t color = (uint32_t)i * 2654435761u & 0xFFFFFF;
+        colorHandler_unpackRgb(color, rgb[i]);
+        snprintf(triplets[i], sizeof(triplets[i]), "%u,%u,%u", (color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF);
+        snprintf(hsb[i], sizeof(hsb[i]), "%d,%d,%d", (i * 7) % 360, (i * 3) % 101, (i * 11) % 101);
+    }
+
+    fprintf(out, "Colors (%d per pass, ns per color):\n", BENCH_COLORS);
+    for (int pass = 0; pass < passes; pass++) {
+        uint64_t start = waitHandler_monotonicNs();
+        colorHandler_packRgbBulk((const float (*)[3])rgb, packed, BENCH_COLORS);
+        colorHandler_encodeHexBulk(packed, hex, BENCH_COLORS);
+        timings[pass] = waitHandler_monotonicNs() - start;
+    }
+    fprintf(out, "%-40s %8.1f\n", "Picker to 'RRGGBB' (Pack + encode)", bench_median(timings, passes) / (double)BENCH_COLORS);
+
+    for (int i = 0; i < BENCH_COLORS; i++) { strings[i] = hex[i]; }
+    for (int pass = 0; pass < passes; pass++) {
+        uint64_t start = waitHandler_monotonicNs();
+        colorHandler_decodeColorBulk(strings, rgb, BENCH_COLORS);
+        timings[pass] = waitHandler_monotonicNs() - start;
+    }
+    fprintf(out, "%-40s %8.1f\n", "'RRGGBB' to picker", bench_median(timings, passes) / (double)BENCH_COLORS);
+
+    for (int i = 0; i < BENCH_COLORS; i++) { strings[i] = triplets[i]; }
+    for (int pass = 0; pass < passes; pass++) {
+        uint64_t start = waitHandler_monotonicNs();
+        colorHandler_decodeColorBulk(strings, rgb, BENCH_COLORS);
+        timings[pass] = waitHandler_monotonicNs() - start;
+    }
+    fprintf(out, "%-40s %8.1f\n", "'R,G,B' to picker", bench_median(timings, passes) / (double)BENCH_COLORS);
+
+    for (int pass = 0; pass < passes; pass++) {
+        uint64_t start = waitHandler_monotonicNs();
+        for (int i = 0; i < BENCH_COLORS; i++) { colorHandler_decodeHsb(hsb[i], rgb[i]); }
+        timings[pass] = waitHandler_monotonicNs() - start;
+    }
+    fprintf(out, "%-40s %8.1f\n\n", "'H,S,B' to picker", bench_median(timings, passes) / (double)BENCH_COLORS);
+
+colors_cleanup:
+    free(rgb);
+    free(packed);
+    free(hex);
+    free(triplets);
+    free(hsb);
+    free(strings);
+    free(timings);
+    return rc;
+}
+
+int main(int argc, char** argv) {
+    int passes = argc > 1 ? atoi(argv[1]) : BENCH_PASSES;
+    if (passes < 1) {
+        printf("ERROR: The amount of passes has to be at least 1.\n");
+        return 1;
+    }
+
+    // Keep the results, drop the driver logging
+    fflush(stdout);
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    if (out == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        printf("ERROR: Could not redirect stdout.\n");
+        return 1;
+    }
+    setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
+    char directory[] = "/tmp/iot-controller-bench-XXXXXX";
+    if (mkdtemp(directory) == NULL || chdir(directory) != 0) {
+        fprintf(out, "ERROR: Could not create a temporary directory.\n");
+        return 1;
+    }
+
+    if (bench_registerDevices() != 0) { return 1; }
+    shadowHandler_init();
+
+    int rc = bench_drivers(passes);
+    rc |= bench_scene(passes);
+    rc |= bench_colors(passes);
+
+    bench_removeDirectory(directory);
+    fclose(out);
+    return rc;
+}
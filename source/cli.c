@@ -0,0 +1,156 @@
+/*
+// IoT Controller
+// Command Line Client Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "cli.h"
+#include "control.h"
+#include "config.h"
+#include "mqtt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Info
+// iot_controller set <targets> power <on|off|toggle> --> on/off/toggle <targets>
+// iot_controller set <targets> brightness <0 - 100> --> dim <targets> <value>
+// iot_controller set <targets> warmth <0 - 100> --> warmth <targets> <value>
+// iot_controller set <targets> color <RRGGBB> --> color <targets> <value>
+// iot_controller get <device> --> state <device>
+// iot_controller <request> --> Any other control socket request, sent as is (See control.c)
+*/
+
+// NOTE: A running instance gets the request over its control socket, so the command costs one connect and one round trip.
+// Without one, the config is read and the command is published straight to the broker before exiting ('toggle' and 'get' need
+// the state only a running instance knows). The reply is printed, the exit code is 0 for "ok" and 1 otherwise.
+
+// Turn the arguments into one control socket request, returns 1 if they make no sense
+static int cliHandler_buildRequest(int argc, char** argv, char* line, int lineSize) {
+    if (argc == 4 && strcmp(argv[0], "set") == 0) {
+        const char* field = argv[2];
+        const char* value = argv[3];
+        if (strcmp(field, "power") == 0) {
+            snprintf(line, lineSize, "%s %s", value, argv[1]);
+            return strcmp(value, "on") != 0 && strcmp(value, "off") != 0 && strcmp(value, "toggle") != 0;
+        }
+        if (strcmp(field, "brightness") == 0) {
+            snprintf(line, lineSize, "dim %s %s", argv[1], value);
+        } else if (strcmp(field, "warmth") == 0 || strcmp(field, "color") == 0) {
+            snprintf(line, lineSize, "%s %s %s", field, argv[1], value);
+        } else {
+            return 1;
+        }
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[0], "get") == 0) {
+        snprintf(line, lineSize, "state %s", argv[1]);
+        return 0;
+    }
+
+    int length = 0;
+    line[0] = '\0';
+    for (int i = 0; i < argc; i++) {
+        length += snprintf(line + length, lineSize - length, i == 0 ? "%s" : " %s", argv[i]);
+        if (length >= lineSize) { return 1; }
+    }
+    return 0;
+}
+
+// Returns the connected socket, or -1 if nothing listens on it
+static int cliHandler_connect() {
+    char path[CONTROL_MAX_PATH];
+    controlHandler_socketPath(path);
+    struct sockaddr_un address = { 0 };
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) { return -1; }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) { return -1; }
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Send the request to the running instance and print its reply
+static int cliHandler_forward(int fd, const char* line) {
+    char request[CONTROL_MAX_LINE + 1];
+    char reply[CONTROL_MAX_LINE];
+    int length = snprintf(request, sizeof(request), "%s\n", line);
+
+    for (int sent = 0; sent < length; ) {
+        ssize_t written = write(fd, request + sent, length - sent);
+        if (written < 0 && errno == EINTR) { continue; }
+        if (written <= 0) { goto forward_cleanup_fail; }
+        sent += (int)written;
+    }
+
+    // Nothing else is sent on this connection, so the reply is everything up to the first newline
+    int got = 0;
+    while (got == 0 || reply[got - 1] != '\n') {
+        if (got == (int)sizeof(reply)) { goto forward_cleanup_fail; }
+        ssize_t received = read(fd, reply + got, sizeof(reply) - got);
+        if (received < 0 && errno == EINTR) { continue; }
+        if (received <= 0) { goto forward_cleanup_fail; }
+        got += (int)received;
+    }
+    close(fd);
+
+    fwrite(reply, 1, got, stdout);
+    return strncmp(reply, "ok", 2) != 0;
+
+forward_cleanup_fail:
+    printf("ERROR: Lost the connection to the running instance.\n");
+    close(fd);
+    return 1;
+}
+
+// No instance running, publish the command straight to the broker
+static int cliHandler_oneShot(char* line) {
+    char reply[CONTROL_MAX_LINE];
+
+    if (configHandler_read() != 0) { return 1; }
+    if (mqttHandler_init() != 0) { return 1; }
+    if (mqttHandler_connectOnce() != MQTTCLIENT_SUCCESS) {
+        mqttHandler_deinit();
+        return 1;
+    }
+
+    controlHandler_setDirect(1);
+    int result = controlHandler_execute(line, reply, sizeof(reply));
+    mqttHandler_deinit();
+
+    printf("%s\n", reply);
+    return result;
+}
+
+int cliHandler_run(int argc, char** argv) {
+    char line[CONTROL_MAX_LINE];
+    if (cliHandler_buildRequest(argc, argv, line, sizeof(line)) != 0) {
+        printf("ERROR: Could not understand the command.\n");
+        printf("Usage: iot_controller set <targets> <power|brightness|warmth|color> <value>\n");
+        printf("       iot_controller get <device>\n");
+        return 1;
+    }
+
+    int fd = cliHandler_connect();
+    if (fd >= 0) { return cliHandler_forward(fd, line); }
+    if (controlHandler_instanceRunning() == 0) { return cliHandler_oneShot(line); }
+
+    // The instance is still starting, its socket comes up once the devices are set up
+    for (int waited = 0; waited < CLI_STARTUP_WAIT_MS; waited += CLI_RETRY_MS) {
+        usleep(CLI_RETRY_MS * 1000);
+        fd = cliHandler_connect();
+        if (fd >= 0) { return cliHandler_forward(fd, line); }
+    }
+    printf("ERROR: The running instance did not open its control socket.\n");
+    return 1;
+}
@@ -0,0 +1,10 @@
+#ifndef _CLI_H
+#define _CLI_H
+
+// How long to wait for the socket of an instance that holds the lock but is still starting (Milliseconds)
+#define CLI_STARTUP_WAIT_MS 5000
+#define CLI_RETRY_MS 10
+
+int cliHandler_run(int argc, char** argv);
+
+#endif
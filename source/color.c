@@ -0,0 +1,163 @@
+/*
+// IoT Controller
+// Color Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "color.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// NOTE: Nothing in here allocates, every function works on caller provided buffers so it can be used
+// directly from the MQTT callback thread and from the window loop
+
+static const char hexDigits[16] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
+
+static inline int colorHandler_hexNibble(char c) {
+    if (c >= '0' && c <= '9') { return c - '0'; }
+    if (c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+    if (c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+    return -1;
+}
+
+static inline uint32_t colorHandler_toByte(float value) {
+    if (value <= 0.0f) { return 0; }
+    if (value >= 1.0f) { return 255; }
+    return (uint32_t)(value * 255.0f + 0.5f);
+}
+
+// Parse an unsigned decimal number, returns a pointer past the number or NULL if there was none
+static const char* colorHandler_parseUint(const char* str, int* out) {
+    int value = 0;
+    int digits = 0;
+    while (*str == ' ') { str++; }
+    while (*str >= '0' && *str <= '9') {
+        value = (value * 10) + (*str - '0');
+        str++;
+        digits++;
+    }
+    if (digits == 0) { return NULL; }
+    *out = value;
+    return str;
+}
+
+// Parse up to 3 comma separated decimal numbers, returns the amount parsed
+static int colorHandler_parseTriplet(const char* str, int values[3]) {
+    int count = 0;
+    while (count < 3) {
+        str = colorHandler_parseUint(str, &values[count]);
+        if (str == NULL) { break; }
+        count++;
+        while (*str == ' ') { str++; }
+        if (*str != ',') { break; }
+        str++;
+    }
+    return count;
+}
+
+// Pack a float[3] (0.0 - 1.0) color into 0x00RRGGBB
+uint32_t colorHandler_packRgb(const float rgb[3]) {
+    return (colorHandler_toByte(rgb[0]) << 16) | (colorHandler_toByte(rgb[1]) << 8) | colorHandler_toByte(rgb[2]);
+}
+
+void colorHandler_unpackRgb(uint32_t packed, float rgb[3]) {
+    rgb[0] = (float)((packed >> 16) & 0xFF) * (1.0f / 255.0f);
+    rgb[1] = (float)((packed >> 8) & 0xFF) * (1.0f / 255.0f);
+    rgb[2] = (float)(packed & 0xFF) * (1.0f / 255.0f);
+}
+
+// Encode 0x00RRGGBB into a null terminated "RRGGBB" string (As used by OpenBK's led_basecolor_rgb)
+void colorHandler_encodeHex(uint32_t packed, char out[COLOR_HEX_LEN + 1]) {
+    out[0] = hexDigits[(packed >> 20) & 0xF];
+    out[1] = hexDigits[(packed >> 16) & 0xF];
+    out[2] = hexDigits[(packed >> 12) & 0xF];
+    out[3] = hexDigits[(packed >> 8) & 0xF];
+    out[4] = hexDigits[(packed >> 4) & 0xF];
+    out[5] = hexDigits[packed & 0xF];
+    out[6] = '\0';
+}
+
+// Decode a "RRGGBB" / "#RRGGBB" string, any extra channels after RGB (e.g. RGBCW) are ignored
+int colorHandler_decodeHex(const char* str, float rgb[3]) {
+    if (str == NULL) { return 1; }
+    if (*str == '#') { str++; }
+
+    uint32_t packed = 0;
+    for (int i = 0; i < COLOR_HEX_LEN; i++) {
+        int nibble = colorHandler_hexNibble(str[i]);
+        if (nibble < 0) { return 1; }
+        packed = (packed << 4) | (uint32_t)nibble;
+    }
+    colorHandler_unpackRgb(packed, rgb);
+    return 0;
+}
+
+// Decode a "Hue,Saturation,Brightness" string (0-360, 0-100, 0-100) into RGB
+int colorHandler_decodeHsb(const char* str, float rgb[3]) {
+    if (str == NULL) { return 1; }
+
+    int values[3];
+    if (colorHandler_parseTriplet(str, values) != 3) { return 1; }
+
+    float h = (float)(values[0] % 360) / 60.0f;
+    float s = (values[1] > 100 ? 100 : values[1]) / 100.0f;
+    float v = (values[2] > 100 ? 100 : values[2]) / 100.0f;
+
+    int sector = (int)h;
+    float f = h - (float)sector;
+    float p = v * (1.0f - s);
+    float q = v * (1.0f - (s * f));
+    float t = v * (1.0f - (s * (1.0f - f)));
+
+    switch (sector) {
+        case 0: rgb[0] = v; rgb[1] = t; rgb[2] = p; break;
+        case 1: rgb[0] = q; rgb[1] = v; rgb[2] = p; break;
+        case 2: rgb[0] = p; rgb[1] = v; rgb[2] = t; break;
+        case 3: rgb[0] = p; rgb[1] = q; rgb[2] = v; break;
+        case 4: rgb[0] = t; rgb[1] = p; rgb[2] = v; break;
+        default: rgb[0] = v; rgb[1] = p; rgb[2] = q; break;
+    }
+    return 0;
+}
+
+// Decode a device 'Color' field, which is either hex ("FF8000") or decimal ("255,128,0") depending on the firmware settings
+int colorHandler_decodeColor(const char* str, float rgb[3]) {
+    if (str == NULL) { return 1; }
+
+    for (const char* c = str; *c != '\0'; c++) {
+        if (*c == ',') {
+            int values[3];
+            if (colorHandler_parseTriplet(str, values) != 3) { return 1; }
+            for (int i = 0; i < 3; i++) {
+                rgb[i] = (float)(values[i] > 255 ? 255 : values[i]) * (1.0f / 255.0f);
+            }
+            return 0;
+        }
+    }
+
+    return colorHandler_decodeHex(str, rgb);
+}
+
+void colorHandler_packRgbBulk(const float (*rgb)[3], uint32_t* packed, int count) {
+    for (int i = 0; i < count; i++) {
+        packed[i] = colorHandler_packRgb(rgb[i]);
+    }
+}
+
+void colorHandler_encodeHexBulk(const uint32_t* packed, char (*out)[COLOR_HEX_LEN + 1], int count) {
+    for (int i = 0; i < count; i++) {
+        colorHandler_encodeHex(packed[i], out[i]);
+    }
+}
+
+// Returns the amount of strings that failed to decode, failed entries are left untouched
+int colorHandler_decodeColorBulk(const char* const* str, float (*rgb)[3], int count) {
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (colorHandler_decodeColor(str[i], rgb[i]) != 0) {
+            failed++;
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,21 @@
+#ifndef _COLOR_H
+#define _COLOR_H
+#include <stdint.h>
+
+// Length of an encoded "RRGGBB" hex string, excluding the null terminator
+#define COLOR_HEX_LEN 6
+
+// Single color conversion
+uint32_t colorHandler_packRgb(const float rgb[3]);
+void colorHandler_unpackRgb(uint32_t packed, float rgb[3]);
+void colorHandler_encodeHex(uint32_t packed, char out[COLOR_HEX_LEN + 1]);
+int colorHandler_decodeHex(const char* str, float rgb[3]);
+int colorHandler_decodeHsb(const char* str, float rgb[3]);
+int colorHandler_decodeColor(const char* str, float rgb[3]);
+
+// Bulk conversion (Many devices at once)
+void colorHandler_packRgbBulk(const float (*rgb)[3], uint32_t* packed, int count);
+void colorHandler_encodeHexBulk(const uint32_t* packed, char (*out)[COLOR_HEX_LEN + 1], int count);
+int colorHandler_decodeColorBulk(const char* const* str, float (*rgb)[3], int count);
+
+#endif
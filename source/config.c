@@ -6,14 +6,15 @@
 */
 
 #include "config.h"
+#include "color.h"
+#include "driver.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdatomic.h>
 #include <cjson/cJSON.h>
 
-#define MAX_DEVICES 8
-
 const char* configFilename = "config.json";
 char* configPtr = NULL;
 static int rc = 0;
@@ -24,18 +25,42 @@ char* configPtr_mqtt_port = NULL;
 char* configPtr_mqtt_clientName = NULL;
 char* configPtr_mqtt_username = NULL;
 char* configPtr_mqtt_password = NULL;
+int configPtr_dispatch_backlogWindowMs = 20;
+int configPtr_dispatch_backlogMax = 8;
 int deviceCount = 0;
 configPtr_device_t configPtr_devices[MAX_DEVICES];
+int groupCount = 0;
+configPtr_group_t configPtr_groups[MAX_GROUPS];
+int sceneCount = 0;
+configPtr_scene_t configPtr_scenes[MAX_SCENES];
+
+static void configHandler_initDeviceState(int device);
 
 int configHandler_read() {
     printf("%s +\n", __func__);
 
+    driverHandler_clearIndex();
+
     // Initialize pointers in devices struct array to null (Otherwise the free() step will SIGSEGV)
     for (int i = 0; i < MAX_DEVICES; i++) {
         configPtr_devices[i].mode = NULL;
         configPtr_devices[i].prettyName = NULL;
         configPtr_devices[i].name = NULL;
         configPtr_devices[i].type = NULL;
+        configPtr_devices[i].driver = DRIVER_UNKNOWN;
+        configPtr_devices[i].groupTopic = NULL;
+    }
+    for (int i = 0; i < MAX_GROUPS; i++) {
+        configPtr_groups[i].prettyName = NULL;
+        configPtr_groups[i].name = NULL;
+        configPtr_groups[i].memberCount = 0;
+        configPtr_groups[i].members = NULL;
+    }
+    for (int i = 0; i < MAX_SCENES; i++) {
+        configPtr_scenes[i].prettyName = NULL;
+        configPtr_scenes[i].name = NULL;
+        configPtr_scenes[i].targetCount = 0;
+        configPtr_scenes[i].targets = NULL;
     }
 
     // Open config file
@@ -122,6 +147,16 @@ int configHandler_read() {
     strcpy(configPtr_mqtt_username, jobj_mqtt_username->valuestring);
     strcpy(configPtr_mqtt_password, jobj_mqtt_password->valuestring);
 
+    // Fetch dispatcher settings (Optional)
+    cJSON* jobj_dispatch_root = cJSON_GetObjectItemCaseSensitive(jobj_configFile, "dispatcher");
+    if (jobj_dispatch_root != NULL) {
+        cJSON* jobj_dispatch_backlogWindowMs = cJSON_GetObjectItemCaseSensitive(jobj_dispatch_root, "backlogWindowMs");
+        cJSON* jobj_dispatch_backlogMax = cJSON_GetObjectItemCaseSensitive(jobj_dispatch_root, "backlogMax");
+        if (jobj_dispatch_backlogWindowMs != NULL) { configPtr_dispatch_backlogWindowMs = jobj_dispatch_backlogWindowMs->valueint; }
+        if (jobj_dispatch_backlogMax != NULL) { configPtr_dispatch_backlogMax = jobj_dispatch_backlogMax->valueint; }
+        if (configPtr_dispatch_backlogMax < 1) { configPtr_dispatch_backlogMax = 1; }
+    }
+
     // Fetch amount of devices
     cJSON* jobj_devices_root = cJSON_GetObjectItemCaseSensitive(jobj_configFile, "devices");
     if (jobj_devices_root == NULL) {
@@ -166,31 +201,169 @@ int configHandler_read() {
         configPtr_devices[i].name = strdup(jobj_devices_device_name->valuestring);
         rc = configHandler_callocSuccess(configPtr_devices[i].name);
         if (rc == 1) { goto configHandler_cleanup_fail; }
+        rc = driverHandler_indexDevice(i);
+        if (rc == 1) { goto configHandler_cleanup_fail; }
         configPtr_devices[i].type = strdup(jobj_devices_device_type->valuestring);
         rc = configHandler_callocSuccess(configPtr_devices[i].type);
         if (rc == 1) { goto configHandler_cleanup_fail; }
+
+        // Resolve the mode once, so nothing has to compare the strings later on
+        configPtr_devices[i].driver = driverHandler_resolve(configPtr_devices[i].mode);
+        if (configPtr_devices[i].driver == DRIVER_UNKNOWN) {
+            printf("WARNING: Device '%s' has mode '%s', which no driver handles.\n", configPtr_devices[i].name, configPtr_devices[i].mode);
+        }
+
+        // Group topic is optional
+        cJSON* jobj_devices_device_groupTopic = cJSON_GetObjectItemCaseSensitive(jobj_devices_device, "groupTopic");
+        if (jobj_devices_device_groupTopic != NULL) {
+            configPtr_devices[i].groupTopic = strdup(jobj_devices_device_groupTopic->valuestring);
+            rc = configHandler_callocSuccess(configPtr_devices[i].groupTopic);
+            if (rc == 1) { goto configHandler_cleanup_fail; }
+        }
+    }
+
+    // Fetch groups (Optional)
+    cJSON* jobj_groups_root = cJSON_GetObjectItemCaseSensitive(jobj_configFile, "groups");
+    if (jobj_groups_root != NULL) {
+        groupCount = cJSON_GetArraySize(jobj_groups_root);
+        if (groupCount > MAX_GROUPS) {
+            printf("ERROR: Group count is over the maximum allowed (%d).\n", MAX_GROUPS);
+            goto configHandler_cleanup_fail;
+        }
+    }
+
+    for (int i = 0; i < groupCount; i++) {
+        cJSON* jobj_groups_group = cJSON_GetArrayItem(jobj_groups_root, i);
+        if (jobj_groups_group == NULL) {
+            printf("ERROR: Could not fetch index %d of 'groups' array in JSON.\n", i);
+            goto configHandler_cleanup_fail;
+        }
+
+        cJSON* jobj_groups_group_prettyName = cJSON_GetObjectItemCaseSensitive(jobj_groups_group, "prettyName");
+        cJSON* jobj_groups_group_name = cJSON_GetObjectItemCaseSensitive(jobj_groups_group, "name");
+        cJSON* jobj_groups_group_members = cJSON_GetObjectItemCaseSensitive(jobj_groups_group, "members");
+
+        rc = configHandler_checkExists(jobj_groups_group_prettyName, "groups", "prettyName");
+        if (rc == 1) { goto configHandler_cleanup_fail; }
+        rc = configHandler_checkExists(jobj_groups_group_name, "groups", "name");
+        if (rc == 1) { goto configHandler_cleanup_fail; }
+        rc = configHandler_checkExists(jobj_groups_group_members, "groups", "members");
+        if (rc == 1) { goto configHandler_cleanup_fail; }
+
+        configPtr_groups[i].prettyName = strdup(jobj_groups_group_prettyName->valuestring);
+        rc = configHandler_callocSuccess(configPtr_groups[i].prettyName);
+        if (rc == 1) { goto configHandler_cleanup_fail; }
+        configPtr_groups[i].name = strdup(jobj_groups_group_name->valuestring);
+        rc = configHandler_callocSuccess(configPtr_groups[i].name);
+        if (rc == 1) { goto configHandler_cleanup_fail; }
+
+        int memberCount = cJSON_GetArraySize(jobj_groups_group_members);
+        configPtr_groups[i].members = (int*)calloc(memberCount > 0 ? memberCount : 1, sizeof(int));
+        if (configPtr_groups[i].members == NULL) {
+            printf("ERROR: Could not allocate memory on the heap.\n");
+            goto configHandler_cleanup_fail;
+        }
+
+        // Resolve member names to device indexes
+        for (int j = 0; j < memberCount; j++) {
+            cJSON* jobj_groups_group_member = cJSON_GetArrayItem(jobj_groups_group_members, j);
+            int device = configHandler_findDevice(jobj_groups_group_member->valuestring);
+            if (device == -1) {
+                printf("ERROR: Group '%s' contains unknown device '%s'.\n", configPtr_groups[i].name, jobj_groups_group_member->valuestring);
+                goto configHandler_cleanup_fail;
+            }
+            configPtr_groups[i].members[configPtr_groups[i].memberCount++] = device;
+        }
+    }
+
+    // Fetch scenes (Optional)
+    cJSON* jobj_scenes_root = cJSON_GetObjectItemCaseSensitive(jobj_configFile, "scenes");
+    if (jobj_scenes_root != NULL) {
+        sceneCount = cJSON_GetArraySize(jobj_scenes_root);
+        if (sceneCount > MAX_SCENES) {
+            printf("ERROR: Scene count is over the maximum allowed (%d).\n", MAX_SCENES);
+            goto configHandler_cleanup_fail;
+        }
+    }
+
+    for (int i = 0; i < sceneCount; i++) {
+        cJSON* jobj_scenes_scene = cJSON_GetArrayItem(jobj_scenes_root, i);
+        if (jobj_scenes_scene == NULL) {
+            printf("ERROR: Could not fetch index %d of 'scenes' array in JSON.\n", i);
+            goto configHandler_cleanup_fail;
+        }
+
+        cJSON* jobj_scenes_scene_prettyName = cJSON_GetObjectItemCaseSensitive(jobj_scenes_scene, "prettyName");
+        cJSON* jobj_scenes_scene_name = cJSON_GetObjectItemCaseSensitive(jobj_scenes_scene, "name");
+        cJSON* jobj_scenes_scene_devices = cJSON_GetObjectItemCaseSensitive(jobj_scenes_scene, "devices");
+
+        rc = configHandler_checkExists(jobj_scenes_scene_prettyName, "scenes", "prettyName");
+        if (rc == 1) { goto configHandler_cleanup_fail; }
+        rc = configHandler_checkExists(jobj_scenes_scene_name, "scenes", "name");
+        if (rc == 1) { goto configHandler_cleanup_fail; }
+        rc = configHandler_checkExists(jobj_scenes_scene_devices, "scenes", "devices");
+        if (rc == 1) { goto configHandler_cleanup_fail; }
+
+        configPtr_scenes[i].prettyName = strdup(jobj_scenes_scene_prettyName->valuestring);
+        rc = configHandler_callocSuccess(configPtr_scenes[i].prettyName);
+        if (rc == 1) { goto configHandler_cleanup_fail; }
+        configPtr_scenes[i].name = strdup(jobj_scenes_scene_name->valuestring);
+        rc = configHandler_callocSuccess(configPtr_scenes[i].name);
+        if (rc == 1) { goto configHandler_cleanup_fail; }
+
+        int targetCount = cJSON_GetArraySize(jobj_scenes_scene_devices);
+        configPtr_scenes[i].targets = (configPtr_sceneTarget_t*)calloc(targetCount > 0 ? targetCount : 1, sizeof(configPtr_sceneTarget_t));
+        if (configPtr_scenes[i].targets == NULL) {
+            printf("ERROR: Could not allocate memory on the heap.\n");
+            goto configHandler_cleanup_fail;
+        }
+
+        // Every target names a device and any of power/brightness/warmth/color
+        for (int j = 0; j < targetCount; j++) {
+            cJSON* jobj_scenes_target = cJSON_GetArrayItem(jobj_scenes_scene_devices, j);
+            cJSON* jobj_scenes_target_name = cJSON_GetObjectItemCaseSensitive(jobj_scenes_target, "name");
+            cJSON* jobj_scenes_target_power = cJSON_GetObjectItemCaseSensitive(jobj_scenes_target, "power");
+            cJSON* jobj_scenes_target_brightness = cJSON_GetObjectItemCaseSensitive(jobj_scenes_target, "brightness");
+            cJSON* jobj_scenes_target_warmth = cJSON_GetObjectItemCaseSensitive(jobj_scenes_target, "warmth");
+            cJSON* jobj_scenes_target_color = cJSON_GetObjectItemCaseSensitive(jobj_scenes_target, "color");
+
+            rc = configHandler_checkExists(jobj_scenes_target_name, "scenes", "name");
+            if (rc == 1) { goto configHandler_cleanup_fail; }
+
+            configPtr_sceneTarget_t* target = &configPtr_scenes[i].targets[configPtr_scenes[i].targetCount];
+            target->device = configHandler_findDevice(jobj_scenes_target_name->valuestring);
+            if (target->device == -1) {
+                printf("ERROR: Scene '%s' contains unknown device '%s'.\n", configPtr_scenes[i].name, jobj_scenes_target_name->valuestring);
+                goto configHandler_cleanup_fail;
+            }
+
+            // A scene tracks one target per device, a second entry could never be acknowledged
+            for (int k = 0; k < configPtr_scenes[i].targetCount; k++) {
+                if (configPtr_scenes[i].targets[k].device == target->device) {
+                    printf("ERROR: Scene '%s' contains device '%s' more than once.\n", configPtr_scenes[i].name, jobj_scenes_target_name->valuestring);
+                    goto configHandler_cleanup_fail;
+                }
+            }
+            target->power = jobj_scenes_target_power != NULL ? jobj_scenes_target_power->valueint : -1;
+            target->brightness = jobj_scenes_target_brightness != NULL ? jobj_scenes_target_brightness->valueint : -1;
+            target->warmth = jobj_scenes_target_warmth != NULL ? jobj_scenes_target_warmth->valueint : -1;
+            target->hasColor = 0;
+            if (jobj_scenes_target_color != NULL) {
+                float rgb[3];
+                if (colorHandler_decodeColor(jobj_scenes_target_color->valuestring, rgb) != 0) {
+                    printf("ERROR: Scene '%s' has an invalid color for device '%s'.\n", configPtr_scenes[i].name, jobj_scenes_target_name->valuestring);
+                    goto configHandler_cleanup_fail;
+                }
+                target->hasColor = 1;
+                target->color = colorHandler_packRgb(rgb);
+            }
+            configPtr_scenes[i].targetCount++;
+        }
     }
 
     // Initialize the device state variables
     for (int i = 0; i < deviceCount; i++) {
-        configPtr_devices[i].online = 0;
-        configPtr_devices[i].warmth = 0;
-        configPtr_devices[i].brightness = 0;
-        configPtr_devices[i].color[0] = 0;
-        configPtr_devices[i].color[1] = 0;
-        configPtr_devices[i].color[2] = 0;
-        configPtr_devices[i].deviceState.uptime = NULL;
-        configPtr_devices[i].deviceState.color = NULL;
-        configPtr_devices[i].deviceState.hsbcolor = NULL;
-        configPtr_devices[i].deviceState.power = NULL;
-        configPtr_devices[i].deviceState.wifi_ssid = NULL;
-        configPtr_devices[i].deviceState.wifi_bssid = NULL;
-        configPtr_devices[i].deviceState.wifi_mode = NULL;
-        configPtr_devices[i].deviceState.mqttCount = 0;
-        configPtr_devices[i].deviceState.dimmer = 0;
-        configPtr_devices[i].deviceState.wifi_channel = 0;
-        configPtr_devices[i].deviceState.wifi_rssi = 0;
-        configPtr_devices[i].deviceState.wifi_signal = 0;
+        configHandler_initDeviceState(i);
     }
     
     // Free objects
@@ -206,6 +379,67 @@ configHandler_cleanup_success:
     return 0;
 }
 
+static void configHandler_initDeviceState(int device) {
+    configPtr_devices[device].online = 0;
+    configPtr_devices[device].stale = 0;
+    configPtr_devices[device].deviceState.uptime = NULL;
+    configPtr_devices[device].deviceState.color = NULL;
+    configPtr_devices[device].deviceState.hsbcolor = NULL;
+    configPtr_devices[device].deviceState.power = NULL;
+    configPtr_devices[device].deviceState.wifi_ssid = NULL;
+    configPtr_devices[device].deviceState.wifi_bssid = NULL;
+    configPtr_devices[device].deviceState.wifi_mode = NULL;
+    configPtr_devices[device].deviceState.mqttCount = 0;
+    configPtr_devices[device].deviceState.dimmer = 0;
+    configPtr_devices[device].deviceState.wifi_channel = 0;
+    configPtr_devices[device].deviceState.wifi_rssi = 0;
+    configPtr_devices[device].deviceState.wifi_signal = 0;
+    atomic_store(&configPtr_devices[device].commandSentAt, 0);
+    configPtr_devices[device].commandLatency = -1;
+    atomic_store(&configPtr_devices[device].fanoutPending, 0);
+    configPtr_devices[device].lastSeen = 0;
+}
+
+// Add a device at runtime (Drivers importing devices that are not in the config), returns its index or -1 on failure
+// NOTE: Only one thread may register devices. Other threads see the device once deviceCount is bumped, after it is filled in
+int configHandler_registerDevice(const char* mode, const char* prettyName, const char* name, const char* type) {
+    int device = deviceCount;
+    if (device >= MAX_DEVICES) {
+        printf("ERROR: Can not register device '%s', the device count is at the maximum allowed (%d).\n", name, MAX_DEVICES);
+        return -1;
+    }
+
+    configPtr_devices[device].mode = strdup(mode);
+    configPtr_devices[device].prettyName = strdup(prettyName);
+    configPtr_devices[device].name = strdup(name);
+    configPtr_devices[device].type = strdup(type);
+    configPtr_devices[device].groupTopic = NULL;
+    if (configPtr_devices[device].mode == NULL || configPtr_devices[device].prettyName == NULL ||
+        configPtr_devices[device].name == NULL || configPtr_devices[device].type == NULL) {
+        printf("ERROR: Could not allocate memory on the heap.\n");
+        goto registerDevice_cleanup_fail;
+    }
+    configPtr_devices[device].driver = driverHandler_resolve(mode);
+    configHandler_initDeviceState(device);
+
+    if (driverHandler_indexDevice(device) != 0) { goto registerDevice_cleanup_fail; }
+
+    atomic_thread_fence(memory_order_release);
+    deviceCount = device + 1;
+    return device;
+
+registerDevice_cleanup_fail:
+    if (configPtr_devices[device].mode != NULL) { free(configPtr_devices[device].mode); configPtr_devices[device].mode = NULL; }
+    if (configPtr_devices[device].prettyName != NULL) { free(configPtr_devices[device].prettyName); configPtr_devices[device].prettyName = NULL; }
+    if (configPtr_devices[device].name != NULL) { free(configPtr_devices[device].name); configPtr_devices[device].name = NULL; }
+    if (configPtr_devices[device].type != NULL) { free(configPtr_devices[device].type); configPtr_devices[device].type = NULL; }
+    return -1;
+}
+
+int configHandler_findDevice(const char* name) {
+    return driverHandler_findDevice(name);
+}
+
 int configHandler_checkExists(cJSON* obj, const char* root, const char* name) {
     if (obj == NULL) {
         printf("ERROR: '%s' field does not contain item '%s' in JSON.\n", root, name);
@@ -238,5 +472,20 @@ void configHandler_freeConfigObjects() {
         if (configPtr_devices[i].prettyName != NULL) { free(configPtr_devices[i].prettyName); }
         if (configPtr_devices[i].name != NULL) { free(configPtr_devices[i].name); }
         if (configPtr_devices[i].type != NULL) { free(configPtr_devices[i].type); }
+        if (configPtr_devices[i].groupTopic != NULL) { free(configPtr_devices[i].groupTopic); }
+    }
+
+    // Free group struct objects
+    for (int i = 0; i < MAX_GROUPS; i++) {
+        if (configPtr_groups[i].prettyName != NULL) { free(configPtr_groups[i].prettyName); }
+        if (configPtr_groups[i].name != NULL) { free(configPtr_groups[i].name); }
+        if (configPtr_groups[i].members != NULL) { free(configPtr_groups[i].members); }
+    }
+
+    // Free scene struct objects
+    for (int i = 0; i < MAX_SCENES; i++) {
+        if (configPtr_scenes[i].prettyName != NULL) { free(configPtr_scenes[i].prettyName); }
+        if (configPtr_scenes[i].name != NULL) { free(configPtr_scenes[i].name); }
+        if (configPtr_scenes[i].targets != NULL) { free(configPtr_scenes[i].targets); }
     }
 }
@@ -1,7 +1,14 @@
 #ifndef _CONFIG_H
 #define _CONFIG_H
+#include <stdint.h>
+#include <stdatomic.h>
 #include <cjson/cJSON.h>
 
+// Maximum amount of devices/groups that can be specified in the config
+#define MAX_DEVICES 16384
+#define MAX_GROUPS 32
+#define MAX_SCENES 32
+
 // RSSI Min/Max for calculating Wifi signal percentage strength
 #define RSSI_MIN -90
 #define RSSI_MAX -30
@@ -29,16 +36,48 @@ typedef struct {
     char* prettyName;
     char* name;
     char* type; // TODO
+    int driver; // DRIVER_*, resolved from 'mode' when the config is read
+    char* groupTopic; // OpenBK group topic shared with other devices, NULL if not set
     
     int online;
-    float color[3];
-    int warmth;
-    int brightness;
+    int stale; // State was loaded from the snapshot and the device has not sent anything since
 
     mqttHandler_state_t deviceState;
+
+    // Command acknowledgement tracking (Commands are sent from the dispatcher/interface/control threads, acknowledged on the MQTT thread)
+    atomic_ullong commandSentAt; // Monotonic ns of the last command sent, 0 if acknowledged
+    int commandLatency; // Milliseconds between the last command and its State response
+    atomic_int fanoutPending;
+
+    uint64_t lastSeen; // Monotonic ns of the last message from the device, 0 if never seen
 } configPtr_device_t;
 
+typedef struct {
+    char* prettyName;
+    char* name;
+    int memberCount;
+    int* members; // Device indexes
+} configPtr_group_t;
+
+typedef struct {
+    int device;
+    int power; // -1 if the scene does not change it
+    int brightness; // -1 if the scene does not change it
+    int warmth; // -1 if the scene does not change it
+    int hasColor;
+    uint32_t color; // Packed 0x00RRGGBB
+} configPtr_sceneTarget_t;
+
+typedef struct {
+    char* prettyName;
+    char* name;
+    int targetCount;
+    configPtr_sceneTarget_t* targets;
+} configPtr_scene_t;
+
 int configHandler_read();
+int configHandler_registerDevice(const char* mode, const char* prettyName, const char* name, const char* type);
+int configHandler_findDevice(const char* name);
 int configHandler_checkExists(cJSON* obj, const char* root, const char* name);
 int configHandler_callocSuccess(char* callocPtr);
 void configHandler_freeConfigObjects();
@@ -0,0 +1,463 @@
+/*
+// IoT Controller
+// Control Socket Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "control.h"
+#include "config.h"
+#include "driver.h"
+#include "shadow.h"
+#include "states.h"
+#include "color.h"
+#include "mqtt.h"
+#include "queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+/* Info
+// One request per line, every request gets exactly one reply line in the same order ("ok ..." or "err <reason>"),
+// so a client can write many requests at once and read the replies afterwards.
+// <targets> is a comma separated list of device and/or group names
+// ping --> ok
+// on <targets> / off <targets> / toggle <targets> --> ok <devices>
+// dim <targets> <0 - 100> / warmth <targets> <0 - 100> --> ok <devices>
+// color <targets> <RRGGBB> --> ok <devices>
+// state <device> --> ok <name> online=<0|1> stale=<0|1> power=<ON|OFF|-> dimmer=<n> signal=<n>
+*/
+
+// NOTE: Requests go through the same paths as the interface: one device only changes its shadow (The reconciler sends it),
+// several devices are a fan-out. Everything runs on the control thread, one epoll loop for the socket and every client.
+// The running instance holds an flock on the lock file for its whole lifetime, so a command line client can tell
+// an instance that is still starting (Lock held, no socket yet) from no instance at all (See cli.c).
+
+// Devices
+extern int deviceCount;
+extern configPtr_device_t configPtr_devices[];
+
+// Groups
+extern int groupCount;
+extern configPtr_group_t configPtr_groups[];
+
+static int targets[MAX_DEVICES];
+static unsigned int targetStamp[MAX_DEVICES]; // Request that last added the device, drops duplicates
+static unsigned int requestStamp = 0;
+
+static void controlHandler_runtimePath(const char* name, char path[CONTROL_MAX_PATH]) {
+    const char* runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime != NULL && runtime[0] != '\0') {
+        snprintf(path, CONTROL_MAX_PATH, "%s/%s", runtime, name);
+    } else {
+        snprintf(path, CONTROL_MAX_PATH, "/tmp/%s.%u", name, (unsigned int)getuid());
+    }
+}
+
+void controlHandler_socketPath(char path[CONTROL_MAX_PATH]) {
+    controlHandler_runtimePath(CONTROL_SOCKET_NAME, path);
+}
+
+void controlHandler_lockPath(char path[CONTROL_MAX_PATH]) {
+    controlHandler_runtimePath(CONTROL_LOCK_NAME, path);
+}
+
+// Take the single instance lock, it stays held until the process exits. Returns 1 if another instance holds it
+int controlHandler_lock() {
+    char path[CONTROL_MAX_PATH];
+    controlHandler_lockPath(path);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        printf("ERROR: Could not open the instance lock %s.\n", path);
+        return 1;
+    }
+
+    // A command line client only holds it for a moment while checking (controlHandler_instanceRunning)
+    for (int waited = 0; flock(fd, LOCK_EX | LOCK_NB) != 0; waited += 10) {
+        if (errno != EWOULDBLOCK || waited >= CONTROL_LOCK_WAIT_MS) {
+            close(fd);
+            return 1;
+        }
+        usleep(10 * 1000);
+    }
+    return 0;
+}
+
+// Returns 1 if a running (or starting) instance holds the lock
+int controlHandler_instanceRunning() {
+    char path[CONTROL_MAX_PATH];
+    controlHandler_lockPath(path);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { return 0; }
+    int held = flock(fd, LOCK_SH | LOCK_NB) != 0 && errno == EWOULDBLOCK;
+    close(fd);
+    return held;
+}
+
+// Without a running instance there is no dispatcher or reconciler, the command line client sends requests right away
+static int direct = 0;
+
+void controlHandler_setDirect(int enabled) {
+    direct = enabled;
+}
+
+static void controlHandler_addTarget(int device, int* count) {
+    if (targetStamp[device] == requestStamp) { return; }
+    targetStamp[device] = requestStamp;
+    targets[(*count)++] = device;
+}
+
+// Resolve a comma separated list of device/group names into 'targets', returns the amount of devices or -1 if a name is unknown
+static int controlHandler_resolveTargets(char* list, char* reply, int replySize) {
+    int count = 0;
+    requestStamp++;
+
+    char* save = NULL;
+    for (char* name = strtok_r(list, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+        int device = driverHandler_findDevice(name);
+        if (device != -1) {
+            controlHandler_addTarget(device, &count);
+            continue;
+        }
+
+        int group = -1;
+        for (int i = 0; i < groupCount; i++) {
+            if (strcmp(configPtr_groups[i].name, name) == 0) { group = i; break; }
+        }
+        if (group == -1) {
+            snprintf(reply, replySize, "err unknown device or group '%s'", name);
+            return -1;
+        }
+        for (int i = 0; i < configPtr_groups[group].memberCount; i++) {
+            controlHandler_addTarget(configPtr_groups[group].members[i], &count);
+        }
+    }
+    if (count == 0) { snprintf(reply, replySize, "err no targets"); }
+    return count == 0 ? -1 : count;
+}
+
+// Same as the interface, a single device through its shadow and several as a fan-out. Returns the amount of commands that failed
+static int controlHandler_apply(int count, int field, int action, int value) {
+    if (direct == 1) {
+        int failed = 0;
+        for (int i = 0; i < count; i++) {
+            queueHandler_command_t command = { FLAG_DISPATCH_TYPE_OPENBK_LIGHT, action, targets[i], 0, (uint32_t)value };
+            failed += mqttHandler_dispatchCommand(&command) != 0;
+        }
+        return failed;
+    }
+    if (count == 1) {
+        shadowHandler_setDesired(targets[0], field, value, 0);
+        return 0;
+    }
+    return mqttHandler_fanoutCommand(FLAG_DISPATCH_TYPE_OPENBK_LIGHT, action, targets, count, (uint32_t)value);
+}
+
+// Power the targets should end up at for 'toggle', off if any of them is on
+static int controlHandler_toggleValue(int count) {
+    for (int i = 0; i < count; i++) {
+        shadowHandler_device_t shadow;
+        shadowHandler_get(targets[i], &shadow);
+        if (shadowHandler_displayValue(&shadow, SHADOW_FIELD_POWER) == 1) { return 0; }
+    }
+    return 1;
+}
+
+static int controlHandler_parsePercent(const char* str, int* value) {
+    if (str == NULL) { return 1; }
+    char* end = NULL;
+    long parsed = strtol(str, &end, 10);
+    if (end == str || *end != '\0' || parsed < 0 || parsed > 100) { return 1; }
+    *value = (int)parsed;
+    return 0;
+}
+
+// Run one request line (Modified in place), the reply is written without a newline. Returns 1 if the request failed
+int controlHandler_execute(char* line, char* reply, int replySize) {
+    char* save = NULL;
+    char* verb = strtok_r(line, " \t", &save);
+    char* list = strtok_r(NULL, " \t", &save);
+    char* argument = strtok_r(NULL, " \t", &save);
+
+    if (verb == NULL) {
+        snprintf(reply, replySize, "err empty request");
+        return 1;
+    }
+    if (strcmp(verb, "ping") == 0) {
+        snprintf(reply, replySize, "ok");
+        return 0;
+    }
+    if (list == NULL) {
+        snprintf(reply, replySize, "err '%s' needs a target", verb);
+        return 1;
+    }
+    if (direct == 1 && (strcmp(verb, "state") == 0 || strcmp(verb, "toggle") == 0)) {
+        snprintf(reply, replySize, "err '%s' needs a running instance", verb);
+        return 1;
+    }
+
+    if (strcmp(verb, "state") == 0) {
+        int device = driverHandler_findDevice(list);
+        if (device == -1) {
+            snprintf(reply, replySize, "err unknown device '%s'", list);
+            return 1;
+        }
+        // The MQTT thread frees and replaces the power string while handling messages, the reply is written under the state lock
+        configPtr_device_t* obj = &configPtr_devices[device];
+        driverHandler_lockState();
+        snprintf(reply, replySize, "ok %s online=%d stale=%d power=%s dimmer=%d signal=%d", obj->name, obj->online, obj->stale,
+            obj->deviceState.power != NULL ? obj->deviceState.power : "-", obj->deviceState.dimmer, obj->deviceState.wifi_signal);
+        driverHandler_unlockState();
+        return 0;
+    }
+
+    int count = controlHandler_resolveTargets(list, reply, replySize);
+    if (count < 0) { return 1; }
+    int failed = 0;
+
+    if (strcmp(verb, "on") == 0 || strcmp(verb, "off") == 0 || strcmp(verb, "toggle") == 0) {
+        int power = verb[1] == 'n' ? 1 : (verb[1] == 'f' ? 0 : controlHandler_toggleValue(count));
+        failed = controlHandler_apply(count, SHADOW_FIELD_POWER, power ? FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_ON : FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_OFF, power);
+    } else if (strcmp(verb, "dim") == 0 || strcmp(verb, "warmth") == 0) {
+        int value = 0;
+        if (controlHandler_parsePercent(argument, &value) != 0) {
+            snprintf(reply, replySize, "err '%s' needs a value from 0 to 100", verb);
+            return 1;
+        }
+        if (verb[0] == 'd') {
+            failed = controlHandler_apply(count, SHADOW_FIELD_BRIGHTNESS, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_BRIGHTNESS, value);
+        } else {
+            failed = controlHandler_apply(count, SHADOW_FIELD_WARMTH, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_WARMTH, value);
+        }
+    } else if (strcmp(verb, "color") == 0) {
+        float rgb[3];
+        if (argument == NULL || colorHandler_decodeColor(argument, rgb) != 0) {
+            snprintf(reply, replySize, "err 'color' needs a RRGGBB color");
+            return 1;
+        }
+        failed = controlHandler_apply(count, SHADOW_FIELD_COLOR, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_COLOR, (int)colorHandler_packRgb(rgb));
+    } else {
+        snprintf(reply, replySize, "err unknown request '%s'", verb);
+        return 1;
+    }
+
+    if (failed > 0) {
+        snprintf(reply, replySize, "err %d of %d commands could not be sent", failed, count);
+        return 1;
+    }
+    snprintf(reply, replySize, "ok %d", count);
+    return 0;
+}
+
+#ifdef __linux__
+static int controlHandler_append(controlHandler_client_t* client, const char* data, size_t length) {
+    if (client->outLength + length > client->outCapacity) {
+        size_t capacity = client->outCapacity == 0 ? 4096 : client->outCapacity;
+        while (capacity < client->outLength + length) { capacity *= 2; }
+        char* grown = (char*)realloc(client->out, capacity);
+        if (grown == NULL) {
+            printf("ERROR: Could not allocate memory on the heap.\n");
+            return 1;
+        }
+        client->out = grown;
+        client->outCapacity = capacity;
+    }
+    memcpy(client->out + client->outLength, data, length);
+    client->outLength += length;
+    return 0;
+}
+
+// Run every complete line received so far, returns 1 if the client has to be dropped
+static int controlHandler_processLines(controlHandler_client_t* client) {
+    char reply[CONTROL_MAX_LINE];
+    int start = 0;
+    for (int i = 0; i < client->inLength; i++) {
+        if (client->in[i] != '\n') { continue; }
+        client->in[i] = '\0';
+        if (i > start && client->in[i - 1] == '\r') { client->in[i - 1] = '\0'; }
+
+        controlHandler_execute(client->in + start, reply, sizeof(reply) - 1);
+        size_t length = strlen(reply);
+        reply[length++] = '\n';
+        if (controlHandler_append(client, reply, length) != 0) { return 1; }
+        start = i + 1;
+    }
+
+    // Keep the unfinished line, a full buffer without a newline is a line that is too long
+    memmove(client->in, client->in + start, client->inLength - start);
+    client->inLength -= start;
+    return client->inLength == CONTROL_MAX_LINE;
+}
+
+// Send as much of the pending output as the socket takes, returns 1 if the client has to be dropped
+static int controlHandler_flush(controlHandler_client_t* client) {
+    while (client->outSent < client->outLength) {
+        ssize_t written = send(client->fd, client->out + client->outSent, client->outLength - client->outSent, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) { continue; }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { return 0; }
+            return 1;
+        }
+        client->outSent += (size_t)written;
+    }
+    client->outSent = 0;
+    client->outLength = 0;
+    return 0;
+}
+
+// Only ask for writability while output is pending, and stop reading from clients that do not read their replies
+static int controlHandler_updateEvents(int epollFd, controlHandler_client_t* client) {
+    size_t pending = client->outLength - client->outSent;
+    uint32_t events = pending > CONTROL_MAX_PENDING_OUTPUT || client->closing == 1 ? 0 : EPOLLIN;
+    if (pending > 0) { events |= EPOLLOUT; }
+    if (events == client->events) { return 0; }
+
+    struct epoll_event event = { 0 };
+    event.events = events;
+    event.data.ptr = client;
+    client->events = events;
+    return epoll_ctl(epollFd, EPOLL_CTL_MOD, client->fd, &event) != 0;
+}
+
+static void controlHandler_close(int epollFd, controlHandler_client_t* client) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    client->fd = -1;
+    client->closing = 0;
+    client->inLength = 0;
+    client->outLength = 0;
+    client->outSent = 0;
+}
+
+// Create the listening socket, replacing a socket file left behind by an instance that is gone. Returns the fd or -1
+static int controlHandler_listen(const char* path) {
+    struct sockaddr_un address = { 0 };
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("ERROR: Control socket path '%s' is too long.\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        printf("ERROR: Could not create the control socket.\n");
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 && errno == EADDRINUSE) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int inUse = probe >= 0 && connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0;
+        if (probe >= 0) { close(probe); }
+        if (inUse) {
+            printf("ERROR: Control socket %s is in use by another instance.\n", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+        if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+            printf("ERROR: Could not bind the control socket to %s.\n", path);
+            close(fd);
+            return -1;
+        }
+    }
+    chmod(path, 0600);
+    if (listen(fd, CONTROL_MAX_CLIENTS) != 0) {
+        printf("ERROR: Could not listen on the control socket.\n");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Control socket thread
+void* controlHandler_thread(void*) {
+    static controlHandler_client_t clients[CONTROL_MAX_CLIENTS];
+    struct epoll_event events[CONTROL_MAX_CLIENTS + 1];
+    char path[CONTROL_MAX_PATH];
+    controlHandler_socketPath(path);
+
+    int listenFd = controlHandler_listen(path);
+    if (listenFd < 0) { return NULL; }
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        printf("ERROR: Could not create the control socket epoll instance.\n");
+        close(listenFd);
+        return NULL;
+    }
+    struct epoll_event event = { 0 };
+    event.events = EPOLLIN;
+    event.data.ptr = NULL; // The listening socket
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) { clients[i].fd = -1; }
+    printf("Control socket listening on %s.\n", path);
+
+    while (1 == 1) {
+        int count = epoll_wait(epollFd, events, CONTROL_MAX_CLIENTS + 1, -1);
+        for (int i = 0; i < count; i++) {
+            controlHandler_client_t* client = (controlHandler_client_t*)events[i].data.ptr;
+
+            if (client == NULL) {
+                int fd;
+                while ((fd = accept(listenFd, NULL, NULL)) >= 0) {
+                    fcntl(fd, F_SETFL, O_NONBLOCK);
+                    fcntl(fd, F_SETFD, FD_CLOEXEC);
+                    controlHandler_client_t* slot = NULL;
+                    for (int j = 0; j < CONTROL_MAX_CLIENTS && slot == NULL; j++) {
+                        if (clients[j].fd == -1) { slot = &clients[j]; }
+                    }
+                    if (slot == NULL) {
+                        close(fd);
+                        continue;
+                    }
+                    slot->fd = fd;
+                    slot->events = EPOLLIN;
+                    slot->closing = 0;
+                    struct epoll_event clientEvent = { 0 };
+                    clientEvent.events = EPOLLIN;
+                    clientEvent.data.ptr = slot;
+                    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &clientEvent);
+                }
+                continue;
+            }
+
+            int drop = 0;
+            if (events[i].events & EPOLLIN) {
+                // One read per wake, so a client pipelining a lot does not starve the others (The event stays ready)
+                ssize_t length = recv(client->fd, client->in + client->inLength, CONTROL_MAX_LINE - client->inLength, 0);
+                if (length > 0) {
+                    client->inLength += (int)length;
+                    drop = controlHandler_processLines(client);
+                } else if (length == 0) {
+                    client->closing = 1;
+                } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    drop = 1;
+                }
+            } else if ((events[i].events & (EPOLLHUP | EPOLLERR)) && (events[i].events & EPOLLOUT) == 0) {
+                drop = 1;
+            }
+
+            // Replies are sent right away, EPOLLOUT is only waited for if the socket is full
+            if (drop == 0) { drop = controlHandler_flush(client); }
+            if (drop == 0 && client->closing == 1 && client->outLength == 0) { drop = 1; }
+            if (drop == 0) { drop = controlHandler_updateEvents(epollFd, client); }
+            if (drop == 1) { controlHandler_close(epollFd, client); }
+        }
+    }
+}
+#else
+void* controlHandler_thread(void*) {
+    printf("WARNING: The control socket is only available on Linux.\n");
+    return NULL;
+}
+#endif
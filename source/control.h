@@ -0,0 +1,45 @@
+#ifndef _CONTROL_H
+#define _CONTROL_H
+#include <stddef.h>
+#include <stdint.h>
+
+// Socket file, in $XDG_RUNTIME_DIR (Falls back to /tmp with the user id appended)
+#define CONTROL_SOCKET_NAME "iot-controller.sock"
+#define CONTROL_MAX_PATH 256
+
+// Single instance lock file, next to the socket
+#define CONTROL_LOCK_NAME "iot-controller.lock"
+
+// How long a starting instance retries the lock while a command line client briefly holds it (Milliseconds)
+#define CONTROL_LOCK_WAIT_MS 200
+
+// Connected clients served at once, further connections are closed right away
+#define CONTROL_MAX_CLIENTS 64
+
+// Longest request line, a client sending a longer one is disconnected
+#define CONTROL_MAX_LINE 4096
+
+// Replies a client may leave unread before its requests stop being read (Bytes)
+#define CONTROL_MAX_PENDING_OUTPUT (1024 * 1024)
+
+typedef struct {
+    int fd;
+    char in[CONTROL_MAX_LINE];
+    int inLength;
+    char* out;
+    size_t outLength;
+    size_t outSent;
+    size_t outCapacity;
+    uint32_t events; // Currently registered epoll events
+    int closing; // Client finished sending, dropped once its replies are sent
+} controlHandler_client_t;
+
+void controlHandler_socketPath(char path[CONTROL_MAX_PATH]);
+void controlHandler_lockPath(char path[CONTROL_MAX_PATH]);
+int controlHandler_lock();
+int controlHandler_instanceRunning();
+void controlHandler_setDirect(int enabled);
+int controlHandler_execute(char* line, char* reply, int replySize);
+void* controlHandler_thread(void*);
+
+#endif
@@ -0,0 +1,160 @@
+/*
+// IoT Controller
+// Driver Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "driver.h"
+#include "config.h"
+#include "wait.h"
+#include "shm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// NOTE: Incoming messages are routed in two steps, independent of the amount of devices:
+// - Every registered driver gets to claim the topic and name the device it is about
+// - The name is looked up in an open addressing hash table (Device index + 1, 0 = empty)
+// Drivers free and replace the state strings of a device while handling its messages, so messages are handled with the
+// state lock held. Threads other than the MQTT thread copy what they need out of a device's state under the same lock.
+
+// Devices
+extern int deviceCount;
+extern configPtr_device_t configPtr_devices[];
+
+// Driver used for devices with an unknown mode, does nothing
+static const driverHandler_driver_t unknownDriver = { "unknown", NULL, NULL, NULL, NULL, NULL, NULL };
+
+#define DRIVER_TABLE_ENTRY(id, driver, control, info) &driver,
+static const driverHandler_driver_t* drivers[DRIVER_COUNT] = {
+    &unknownDriver,
+    DRIVER_LIST(DRIVER_TABLE_ENTRY)
+};
+
+static int nameTable[DRIVER_NAME_BUCKETS];
+static pthread_mutex_t stateMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint32_t driverHandler_hash(const char* str, size_t len) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Find the driver id for a config 'mode', DRIVER_UNKNOWN if no driver handles it
+int driverHandler_resolve(const char* mode) {
+    for (int i = 1; i < DRIVER_COUNT; i++) {
+        if (strcmp(mode, drivers[i]->mode) == 0) { return i; }
+    }
+    return DRIVER_UNKNOWN;
+}
+
+const driverHandler_driver_t* driverHandler_get(int device) {
+    if (device < 0 || device >= deviceCount) { return &unknownDriver; }
+    return drivers[configPtr_devices[device].driver];
+}
+
+void driverHandler_clearIndex() {
+    memset(nameTable, 0, sizeof(nameTable));
+}
+
+// Add a device to the name lookup table, fails if another device already has the name
+int driverHandler_indexDevice(int device) {
+    const char* name = configPtr_devices[device].name;
+    uint32_t bucket = driverHandler_hash(name, strlen(name)) & (DRIVER_NAME_BUCKETS - 1);
+    while (nameTable[bucket] != 0) {
+        if (strcmp(configPtr_devices[nameTable[bucket] - 1].name, name) == 0) {
+            printf("ERROR: Device name '%s' is used more than once.\n", name);
+            return 1;
+        }
+        bucket = (bucket + 1) & (DRIVER_NAME_BUCKETS - 1);
+    }
+    nameTable[bucket] = device + 1;
+    return 0;
+}
+
+int driverHandler_findDevice(const char* name) {
+    if (name == NULL) { return -1; }
+    uint32_t bucket = driverHandler_hash(name, strlen(name)) & (DRIVER_NAME_BUCKETS - 1);
+    while (nameTable[bucket] != 0) {
+        if (strcmp(configPtr_devices[nameTable[bucket] - 1].name, name) == 0) {
+            return nameTable[bucket] - 1;
+        }
+        bucket = (bucket + 1) & (DRIVER_NAME_BUCKETS - 1);
+    }
+    return -1;
+}
+
+// Hand an incoming message to the driver of the device it is about. Returns 1 if no driver/device took it
+int driverHandler_route(const char* topic, char* content) {
+    // Split a copy of the topic by '/'
+    char buffer[DRIVER_MAX_TOPIC_LENGTH];
+    size_t length = strlen(topic);
+    if (length >= sizeof(buffer)) { return 1; }
+    memcpy(buffer, topic, length + 1);
+
+    char* levels[DRIVER_MAX_TOPIC_LEVELS];
+    int levelCount = 0;
+    levels[levelCount++] = buffer;
+    for (char* c = buffer; *c != '\0' && levelCount < DRIVER_MAX_TOPIC_LEVELS; c++) {
+        if (*c == '/') {
+            *c = '\0';
+            levels[levelCount++] = c + 1;
+        }
+    }
+
+    for (int i = 1; i < DRIVER_COUNT; i++) {
+        const char* name = NULL;
+        int kind = drivers[i]->route(levels, levelCount, &name);
+        if (kind < 0) { continue; }
+
+        // Messages that are not about a single device (e.g. a bridge's device list) go to the driver as device -1
+        if (name == NULL) {
+            pthread_mutex_lock(&stateMutex);
+            drivers[i]->handleMessage(-1, kind, content);
+            pthread_mutex_unlock(&stateMutex);
+            return 0;
+        }
+
+        // The topic looks like this driver's, but it only counts if it is about one of its devices
+        int device = driverHandler_findDevice(name);
+        if (device == -1 || configPtr_devices[device].driver != i) { continue; }
+
+        configPtr_devices[device].lastSeen = waitHandler_monotonicNs();
+        configPtr_devices[device].stale = 0;
+        pthread_mutex_lock(&stateMutex);
+        drivers[i]->handleMessage(device, kind, content);
+        pthread_mutex_unlock(&stateMutex);
+        shmHandler_update(device);
+        return 0;
+    }
+    return 1;
+}
+
+// Hold off the MQTT thread while reading device state strings from another thread
+void driverHandler_lockState() {
+    pthread_mutex_lock(&stateMutex);
+}
+
+void driverHandler_unlockState() {
+    pthread_mutex_unlock(&stateMutex);
+}
+
+// Replace a device state string, only allocating if the value changed (Telemetry mostly repeats itself)
+int driverHandler_setString(char** field, const char* value) {
+    if (*field != NULL && strcmp(*field, value) == 0) { return 0; }
+    char* copy = strdup(value);
+    if (copy == NULL) {
+        printf("ERROR: Could not allocate memory on the heap.\n");
+        return 1;
+    }
+    if (*field != NULL) { free(*field); }
+    *field = copy;
+    return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef _DRIVER_H
+#define _DRIVER_H
+#include "queue.h"
+
+// Deepest topic the router splits, further levels stay joined in the last one
+#define DRIVER_MAX_TOPIC_LEVELS 8
+
+// Longest topic the router handles
+#define DRIVER_MAX_TOPIC_LENGTH 256
+
+// Buckets of the device name lookup table (Power of 2, kept at least twice MAX_DEVICES so probes stay short)
+#define DRIVER_NAME_BUCKETS 32768
+
+// A driver handles every device of one config 'mode'. Anything a driver does not support is NULL
+typedef struct {
+    const char* mode;
+
+    // Find out whether a topic belongs to this driver. Returns a driver specific message kind and sets 'name'
+    // to the device it is about (Left NULL for messages about no device in particular), or -1 if the topic is not for this driver
+    int (*route)(char** levels, int levelCount, const char** name);
+
+    // Handle a routed message, 'content' is NUL terminated and owned by the caller
+    int (*handleMessage)(int device, int kind, char* content);
+
+    // Convert a queued command into a command name and payload, and send it to a device name or group topic
+    int (*encodeCommand)(const queueHandler_command_t* command, const char** cmnd, char payload[16]);
+    int (*sendCommand)(const char* target, const char* cmnd, const char* payload);
+
+    // Command that runs several ';' separated commands at once, NULL if the firmware can not merge commands
+    const char* backlogCommand;
+
+    // Ask a device to report its full state (Sent to every device on startup)
+    int (*requestState)(int device);
+} driverHandler_driver_t;
+
+// Compile time driver registration, one line per driver: X(Id, Driver object, Control panel, Info panel)
+// The panels are only expanded by the window, so drivers never depend on the interface
+#define DRIVER_LIST(X) \
+    X(OPENBK_LIGHT, openbkDriver, windowHandler_drawLightDeviceControl, windowHandler_drawLightDeviceInfo) \
+    X(OPENBK_POWERMON, openbkPowermonDriver, windowHandler_drawPowermonDeviceControl, windowHandler_drawPowermonDeviceInfo) \
+    X(TASMOTA, tasmotaDriver, windowHandler_drawLightDeviceControl, windowHandler_drawTasmotaDeviceInfo) \
+    X(ZIGBEE2MQTT, zigbeeDriver, windowHandler_drawLightDeviceControl, windowHandler_drawZigbeeDeviceInfo)
+
+#define DRIVER_ENUM_ENTRY(id, driver, control, info) DRIVER_##id,
+enum {
+    DRIVER_UNKNOWN = 0,
+    DRIVER_LIST(DRIVER_ENUM_ENTRY)
+    DRIVER_COUNT
+};
+
+#define DRIVER_DECLARE_ENTRY(id, driver, control, info) extern const driverHandler_driver_t driver;
+DRIVER_LIST(DRIVER_DECLARE_ENTRY)
+
+int driverHandler_resolve(const char* mode);
+const driverHandler_driver_t* driverHandler_get(int device);
+void driverHandler_clearIndex();
+int driverHandler_indexDevice(int device);
+int driverHandler_findDevice(const char* name);
+int driverHandler_route(const char* topic, char* content);
+int driverHandler_setString(char** field, const char* value);
+void driverHandler_lockState();
+void driverHandler_unlockState();
+
+#endif
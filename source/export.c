@@ -0,0 +1,301 @@
+/*
+// IoT Controller
+// Export Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "export.h"
+#include "history.h"
+#include "config.h"
+#include "driver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Info
+// CSV --> device,series,time,value (Time in unix seconds)
+// JSON lines --> {"device":"<name>","series":"<series>","time":<unix seconds>,"value":<value>}
+// State exports have one row per device instead
+*/
+
+// NOTE: History is streamed from the archive/memory one block at a time and formatted into a fixed buffer that is written
+// out whenever it fills, so memory use stays the same no matter how many samples are exported.
+
+// Devices
+extern configPtr_device_t configPtr_devices[];
+
+// Status of the export started from the interface
+static atomic_int exportRunning = 0;
+static atomic_int exportFailed = 0;
+static atomic_ullong exportRows = 0;
+static char exportPath[EXPORT_MAX_PATH] = { 0 };
+
+typedef struct {
+    int* devices;
+    int count;
+    int state;
+    int format;
+    char path[EXPORT_MAX_PATH];
+} exportHandler_job_t;
+
+static int exportHandler_flush(exportHandler_writer_t* writer) {
+    size_t written = 0;
+    while (written < writer->used) {
+        ssize_t length = write(writer->fd, writer->buffer + written, writer->used - written);
+        if (length <= 0) {
+            printf("ERROR: Could not write the export.\n");
+            writer->failed = 1;
+            return 1;
+        }
+        written += (size_t)length;
+    }
+    writer->used = 0;
+    return 0;
+}
+
+static void exportHandler_append(exportHandler_writer_t* writer, const char* text, size_t length) {
+    if (writer->used + length > EXPORT_BUFFER_BYTES && exportHandler_flush(writer) != 0) { return; }
+    memcpy(writer->buffer + writer->used, text, length);
+    writer->used += length;
+}
+
+// Bytes snprintf put into a buffer of 'size' bytes (It returns what it wanted to write, or a negative value on failure)
+static size_t exportHandler_written(int length, size_t size) {
+    if (length < 0) { return 0; }
+    return (size_t)length < size ? (size_t)length : size - 1;
+}
+
+// Integers are formatted by hand, snprintf is most of the time otherwise
+static size_t exportHandler_formatInt(char* out, int64_t value) {
+    char digits[24];
+    size_t count = 0;
+    uint64_t magnitude = value < 0 ? (uint64_t)(-(value + 1)) + 1 : (uint64_t)value;
+    do {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    size_t length = 0;
+    if (value < 0) { out[length++] = '-'; }
+    while (count > 0) { out[length++] = digits[--count]; }
+    return length;
+}
+
+static size_t exportHandler_formatValue(char* out, double value) {
+    if (value == (double)(int64_t)value && value > -1e15 && value < 1e15) {
+        return exportHandler_formatInt(out, (int64_t)value);
+    }
+    // Samples are mostly floats, 7 significant digits is all they have
+    int length = snprintf(out, 32, "%.7g", value);
+    return length > 0 ? (size_t)length : 0;
+}
+
+// Device names quoted for the format (CSV only quotes when needed)
+static void exportHandler_appendName(exportHandler_writer_t* writer, const char* name) {
+    int quote = writer->format == EXPORT_FORMAT_JSONL || strpbrk(name, ",\"\n") != NULL;
+    if (quote) { exportHandler_append(writer, "\"", 1); }
+    for (const char* c = name; *c != '\0'; c++) {
+        if (*c == '"') {
+            exportHandler_append(writer, writer->format == EXPORT_FORMAT_JSONL ? "\\\"" : "\"\"", 2);
+        } else if (*c == '\\' && writer->format == EXPORT_FORMAT_JSONL) {
+            exportHandler_append(writer, "\\\\", 2);
+        } else {
+            exportHandler_append(writer, c, 1);
+        }
+    }
+    if (quote) { exportHandler_append(writer, "\"", 1); }
+}
+
+static int exportHandler_sink(void* context, const historyHandler_sample_t* samples, int count) {
+    exportHandler_writer_t* writer = (exportHandler_writer_t*)context;
+    char row[128];
+
+    for (int i = 0; i < count && writer->failed == 0; i++) {
+        if (writer->format == EXPORT_FORMAT_JSONL) {
+            exportHandler_append(writer, "{\"device\":", 10);
+            exportHandler_appendName(writer, writer->device);
+            size_t length = (size_t)snprintf(row, sizeof(row), ",\"series\":\"%s\",\"time\":", writer->series);
+            length += exportHandler_formatInt(row + length, samples[i].time);
+            memcpy(row + length, ",\"value\":", 9);
+            length += 9;
+            length += exportHandler_formatValue(row + length, samples[i].value);
+            row[length++] = '}';
+            row[length++] = '\n';
+            exportHandler_append(writer, row, length);
+        } else {
+            exportHandler_appendName(writer, writer->device);
+            size_t length = (size_t)snprintf(row, sizeof(row), ",%s,", writer->series);
+            length += exportHandler_formatInt(row + length, samples[i].time);
+            row[length++] = ',';
+            length += exportHandler_formatValue(row + length, samples[i].value);
+            row[length++] = '\n';
+            exportHandler_append(writer, row, length);
+        }
+        writer->rows++;
+    }
+    atomic_store(&exportRows, writer->rows);
+    return writer->failed;
+}
+
+static int exportHandler_open(exportHandler_writer_t* writer, int format, const char* path) {
+    memset(writer, 0, sizeof(exportHandler_writer_t));
+    writer->format = format;
+    writer->buffer = (char*)malloc(EXPORT_BUFFER_BYTES);
+    if (writer->buffer == NULL) {
+        printf("ERROR: Could not allocate memory on the heap.\n");
+        return 1;
+    }
+
+    writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (writer->fd < 0) {
+        printf("ERROR: Could not open export file %s.\n", path);
+        free(writer->buffer);
+        return 1;
+    }
+    return 0;
+}
+
+static int exportHandler_close(exportHandler_writer_t* writer) {
+    exportHandler_flush(writer);
+    close(writer->fd);
+    free(writer->buffer);
+    return writer->failed;
+}
+
+// Export the history of devices within [from, to], returns 0 on success
+int exportHandler_history(const int* devices, int count, int series, int64_t from, int64_t to, int format, const char* path) {
+    exportHandler_writer_t writer;
+    if (exportHandler_open(&writer, format, path) != 0) { return 1; }
+
+    if (format == EXPORT_FORMAT_CSV) {
+        exportHandler_append(&writer, "device,series,time,value\n", 25);
+    }
+    for (int i = 0; i < count && writer.failed == 0; i++) {
+        for (int s = 0; s < HISTORY_SERIES_COUNT && writer.failed == 0; s++) {
+            if (series != EXPORT_SERIES_ALL && series != s) { continue; }
+            writer.device = configPtr_devices[devices[i]].name;
+            writer.series = historyHandler_seriesName(s);
+            if (historyHandler_stream(devices[i], s, from, to, exportHandler_sink, &writer) != 0) { writer.failed = 1; }
+        }
+    }
+
+    printf("Exported %llu samples to %s.\n", (unsigned long long)writer.rows, path);
+    return exportHandler_close(&writer);
+}
+
+// Export the current state of devices, one row per device
+int exportHandler_state(const int* devices, int count, int format, const char* path) {
+    exportHandler_writer_t writer;
+    if (exportHandler_open(&writer, format, path) != 0) { return 1; }
+
+    char row[256];
+    if (format == EXPORT_FORMAT_CSV) {
+        exportHandler_append(&writer, "device,online,power,dimmer,signal,lastSeenMs\n", 45);
+    }
+    uint64_t now = 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+
+    for (int i = 0; i < count && writer.failed == 0; i++) {
+        configPtr_device_t* device = &configPtr_devices[devices[i]];
+
+        // The MQTT thread frees and replaces the power string while handling messages, it is copied out under the state lock
+        char power[16];
+        driverHandler_lockState();
+        snprintf(power, sizeof(power), "%s", device->deviceState.power != NULL ? device->deviceState.power : "");
+        int online = device->online;
+        int dimmer = device->deviceState.dimmer;
+        int signal = device->deviceState.wifi_signal;
+        uint64_t lastSeen = device->lastSeen;
+        driverHandler_unlockState();
+
+        long long lastSeenMs = lastSeen != 0 ? (long long)((now - lastSeen) / 1000000ULL) : -1;
+        int length = 0;
+        if (format == EXPORT_FORMAT_JSONL) {
+            exportHandler_append(&writer, "{\"device\":", 10);
+            exportHandler_appendName(&writer, device->name);
+            length = snprintf(row, sizeof(row), ",\"online\":%d,\"power\":", online);
+            exportHandler_append(&writer, row, exportHandler_written(length, sizeof(row)));
+            exportHandler_appendName(&writer, power);
+            length = snprintf(row, sizeof(row), ",\"dimmer\":%d,\"signal\":%d,\"lastSeenMs\":%lld}\n", dimmer, signal, lastSeenMs);
+        } else {
+            exportHandler_appendName(&writer, device->name);
+            length = snprintf(row, sizeof(row), ",%d,", online);
+            exportHandler_append(&writer, row, exportHandler_written(length, sizeof(row)));
+            exportHandler_appendName(&writer, power);
+            length = snprintf(row, sizeof(row), ",%d,%d,%lld\n", dimmer, signal, lastSeenMs);
+        }
+        exportHandler_append(&writer, row, exportHandler_written(length, sizeof(row)));
+        writer.rows++;
+    }
+
+    atomic_store(&exportRows, writer.rows);
+    printf("Exported the state of %llu devices to %s.\n", (unsigned long long)writer.rows, path);
+    return exportHandler_close(&writer);
+}
+
+static void* exportHandler_thread(void* arg) {
+    exportHandler_job_t* job = (exportHandler_job_t*)arg;
+    int rc = 0;
+    if (job->state == 1) {
+        rc = exportHandler_state(job->devices, job->count, job->format, job->path);
+    } else {
+        rc = exportHandler_history(job->devices, job->count, EXPORT_SERIES_ALL, 0, INT64_MAX, job->format, job->path);
+    }
+    atomic_store(&exportFailed, rc);
+    atomic_store(&exportRunning, 0);
+    free(job->devices);
+    free(job);
+    return NULL;
+}
+
+// Export devices in the background (From the interface) to export-<unix time>.csv/.jsonl, returns 1 if an export is already running
+int exportHandler_start(const int* devices, int count, int state, int format) {
+    if (count <= 0) { return 1; }
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&exportRunning, &expected, 1) == 0) { return 1; }
+
+    exportHandler_job_t* job = (exportHandler_job_t*)calloc(1, sizeof(exportHandler_job_t));
+    if (job != NULL) { job->devices = (int*)malloc(count * sizeof(int)); }
+    if (job == NULL || job->devices == NULL) {
+        printf("ERROR: Could not allocate memory on the heap.\n");
+        free(job);
+        atomic_store(&exportRunning, 0);
+        return 1;
+    }
+    memcpy(job->devices, devices, count * sizeof(int));
+    job->count = count;
+    job->state = state;
+    job->format = format;
+    snprintf(job->path, sizeof(job->path), "export-%s%lld.%s", state == 1 ? "state-" : "", (long long)historyHandler_now(), format == EXPORT_FORMAT_JSONL ? "jsonl" : "csv");
+
+    // Only read by the interface while no export is running
+    memcpy(exportPath, job->path, sizeof(exportPath));
+    atomic_store(&exportRows, 0);
+    atomic_store(&exportFailed, 0);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, exportHandler_thread, job) != 0) {
+        printf("ERROR: Could not start the export thread.\n");
+        free(job->devices);
+        free(job);
+        atomic_store(&exportRunning, 0);
+        return 1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+void exportHandler_getStatus(exportHandler_status_t* out) {
+    out->running = atomic_load(&exportRunning);
+    out->failed = atomic_load(&exportFailed);
+    out->rows = atomic_load(&exportRows);
+    memcpy(out->path, exportPath, sizeof(out->path));
+}
@@ -0,0 +1,40 @@
+#ifndef _EXPORT_H
+#define _EXPORT_H
+#include <stdint.h>
+#include <stddef.h>
+
+#define EXPORT_FORMAT_CSV 0
+#define EXPORT_FORMAT_JSONL 1
+
+// Export every series of a device
+#define EXPORT_SERIES_ALL -1
+
+// Rows are formatted into a buffer of this size and written in one go
+#define EXPORT_BUFFER_BYTES (1 << 20)
+
+#define EXPORT_MAX_PATH 256
+
+typedef struct {
+    int fd;
+    int format;
+    const char* device;
+    const char* series;
+    char* buffer;
+    size_t used;
+    uint64_t rows;
+    int failed;
+} exportHandler_writer_t;
+
+typedef struct {
+    int running;
+    int failed;
+    uint64_t rows;
+    char path[EXPORT_MAX_PATH];
+} exportHandler_status_t;
+
+int exportHandler_history(const int* devices, int count, int series, int64_t from, int64_t to, int format, const char* path);
+int exportHandler_state(const int* devices, int count, int format, const char* path);
+int exportHandler_start(const int* devices, int count, int state, int format);
+void exportHandler_getStatus(exportHandler_status_t* out);
+
+#endif
@@ -0,0 +1,531 @@
+/*
+// IoT Controller
+// History Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "history.h"
+#include "config.h"
+#include "archive.h"
+#include "rollup.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// NOTE: Samples are compressed as they are appended (Gorilla style):
+// - Timestamps are stored as the difference between consecutive deltas, regular reports cost a single bit
+// - Values are XOR'd with the previous one, unchanged values cost a single bit, small changes only store the bits that differ
+// A block is never modified once full, so appending is O(1) and reading copies whole blocks out under the lock.
+// Series and blocks are only allocated once a device reports something.
+// The history thread writes blocks to the archive (Full blocks once, the block being appended to every flush interval),
+// reads of anything older than what is still in memory go to the archive (Compacted ranges come back as one sample per minute).
+
+// Devices
+extern int deviceCount;
+
+static pthread_mutex_t historyMutex = PTHREAD_MUTEX_INITIALIZER;
+static historyHandler_series_t* history[MAX_DEVICES][HISTORY_SERIES_COUNT] = { { NULL } };
+static uint64_t historySamples = 0;
+static int historySeries = 0;
+
+typedef struct {
+    const uint8_t* data;
+    uint32_t position;
+} historyHandler_reader_t;
+
+// Samples collected from a stream into a growing array
+typedef struct {
+    historyHandler_sample_t* samples;
+    int count;
+    int capacity;
+} historyHandler_collector_t;
+
+int64_t historyHandler_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec;
+}
+
+const char* historyHandler_seriesName(int series) {
+    static const char* names[HISTORY_SERIES_COUNT] = { "dimmer", "power", "rssi" };
+    return series >= 0 && series < HISTORY_SERIES_COUNT ? names[series] : "unknown";
+}
+
+static uint64_t historyHandler_toBits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double historyHandler_fromBits(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void historyHandler_writeBits(historyHandler_block_t* block, uint64_t value, int bits) {
+    for (int i = bits - 1; i >= 0; i--) {
+        if ((value >> i) & 1) {
+            block->data[block->bitCount >> 3] |= (uint8_t)(0x80 >> (block->bitCount & 7));
+        }
+        block->bitCount++;
+    }
+}
+
+static uint64_t historyHandler_readBits(historyHandler_reader_t* reader, int bits) {
+    uint64_t value = 0;
+    for (int i = 0; i < bits; i++) {
+        value = (value << 1) | ((reader->data[reader->position >> 3] >> (7 - (reader->position & 7))) & 1);
+        reader->position++;
+    }
+    return value;
+}
+
+static void historyHandler_resetBlock(historyHandler_block_t* block, int64_t time, double value) {
+    memset(block->data, 0, sizeof(block->data));
+    block->firstTime = time;
+    block->lastTime = time;
+    block->firstValue = historyHandler_toBits(value);
+    block->lastValue = block->firstValue;
+    block->lastDelta = 0;
+    block->leading = 0xFF; // No previous meaningful bit window yet
+    block->trailing = 0;
+    block->count = 1;
+    block->bitCount = 0;
+}
+
+static void historyHandler_encode(historyHandler_block_t* block, int64_t time, double value) {
+    // Timestamp
+    int64_t delta = time - block->lastTime;
+    int64_t dod = delta - block->lastDelta;
+    if (dod == 0) {
+        historyHandler_writeBits(block, 0x0, 1);
+    } else if (dod >= -63 && dod <= 64) {
+        historyHandler_writeBits(block, 0x2, 2);
+        historyHandler_writeBits(block, (uint64_t)(dod + 63), 7);
+    } else if (dod >= -255 && dod <= 256) {
+        historyHandler_writeBits(block, 0x6, 3);
+        historyHandler_writeBits(block, (uint64_t)(dod + 255), 9);
+    } else if (dod >= -2047 && dod <= 2048) {
+        historyHandler_writeBits(block, 0xE, 4);
+        historyHandler_writeBits(block, (uint64_t)(dod + 2047), 12);
+    } else {
+        historyHandler_writeBits(block, 0xF, 4);
+        historyHandler_writeBits(block, (uint64_t)(uint32_t)(int32_t)dod, 32);
+    }
+    block->lastDelta = delta;
+    block->lastTime = time;
+
+    // Value
+    uint64_t bits = historyHandler_toBits(value);
+    uint64_t changed = bits ^ block->lastValue;
+    if (changed == 0) {
+        historyHandler_writeBits(block, 0x0, 1);
+    } else {
+        int leading = __builtin_clzll(changed);
+        int trailing = __builtin_ctzll(changed);
+        if (leading > 31) { leading = 31; }
+        if (block->leading != 0xFF && leading >= block->leading && trailing >= block->trailing) {
+            // Fits the previous window
+            historyHandler_writeBits(block, 0x2, 2);
+            historyHandler_writeBits(block, changed >> block->trailing, 64 - block->leading - block->trailing);
+        } else {
+            int length = 64 - leading - trailing;
+            historyHandler_writeBits(block, 0x3, 2);
+            historyHandler_writeBits(block, (uint64_t)leading, 5);
+            historyHandler_writeBits(block, (uint64_t)(length - 1), 6);
+            historyHandler_writeBits(block, changed >> trailing, length);
+            block->leading = (uint8_t)leading;
+            block->trailing = (uint8_t)trailing;
+        }
+    }
+    block->lastValue = bits;
+    block->count++;
+}
+
+// Decode a whole block, 'out' has to hold block->count samples
+void historyHandler_decode(const historyHandler_block_t* block, historyHandler_sample_t* out) {
+    historyHandler_reader_t reader = { block->data, 0 };
+    int64_t time = block->firstTime;
+    int64_t delta = 0;
+    uint64_t value = block->firstValue;
+    int leading = 0;
+    int trailing = 0;
+
+    out[0] = (historyHandler_sample_t){ time, historyHandler_fromBits(value) };
+    for (uint32_t i = 1; i < block->count; i++) {
+        int64_t dod = 0;
+        if (historyHandler_readBits(&reader, 1) == 1) {
+            if (historyHandler_readBits(&reader, 1) == 0) {
+                dod = (int64_t)historyHandler_readBits(&reader, 7) - 63;
+            } else if (historyHandler_readBits(&reader, 1) == 0) {
+                dod = (int64_t)historyHandler_readBits(&reader, 9) - 255;
+            } else if (historyHandler_readBits(&reader, 1) == 0) {
+                dod = (int64_t)historyHandler_readBits(&reader, 12) - 2047;
+            } else {
+                dod = (int32_t)(uint32_t)historyHandler_readBits(&reader, 32);
+            }
+        }
+        delta += dod;
+        time += delta;
+
+        if (historyHandler_readBits(&reader, 1) == 1) {
+            if (historyHandler_readBits(&reader, 1) == 1) {
+                leading = (int)historyHandler_readBits(&reader, 5);
+                int length = (int)historyHandler_readBits(&reader, 6) + 1;
+                trailing = 64 - leading - length;
+            }
+            value ^= historyHandler_readBits(&reader, 64 - leading - trailing) << trailing;
+        }
+        out[i] = (historyHandler_sample_t){ time, historyHandler_fromBits(value) };
+    }
+}
+
+// Append a sample (Called from the ingestion path)
+int historyHandler_append(int device, int series, int64_t time, double value) {
+    if (device < 0 || device >= MAX_DEVICES || series < 0 || series >= HISTORY_SERIES_COUNT) { return 1; }
+
+    pthread_mutex_lock(&historyMutex);
+    historyHandler_series_t* seriesObj = history[device][series];
+    if (seriesObj == NULL) {
+        seriesObj = (historyHandler_series_t*)calloc(1, sizeof(historyHandler_series_t));
+        if (seriesObj == NULL) { goto append_cleanup_fail; }
+        history[device][series] = seriesObj;
+        historySeries++;
+    }
+
+    historyHandler_block_t* block = seriesObj->used > 0 ? seriesObj->blocks[seriesObj->head] : NULL;
+    if (block != NULL && time < block->lastTime) {
+        // Clock went backwards, keep the series ordered
+        time = block->lastTime;
+    }
+
+    if (block != NULL && block->bitCount + HISTORY_MAX_SAMPLE_BITS <= HISTORY_BLOCK_BYTES * 8) {
+        historyHandler_encode(block, time, value);
+    } else {
+        // Start a new block, reusing the oldest one once the ring is full
+        int next = (int)(seriesObj->sequence % HISTORY_BLOCKS_PER_SERIES);
+        if (seriesObj->blocks[next] == NULL) {
+            seriesObj->blocks[next] = (historyHandler_block_t*)malloc(sizeof(historyHandler_block_t));
+            if (seriesObj->blocks[next] == NULL) { goto append_cleanup_fail; }
+            seriesObj->used++;
+        } else {
+            historySamples -= seriesObj->blocks[next]->count;
+        }
+        seriesObj->head = next;
+        seriesObj->sequence++;
+        historyHandler_resetBlock(seriesObj->blocks[next], time, value);
+    }
+    historySamples++;
+    pthread_mutex_unlock(&historyMutex);
+
+    rollupHandler_add(device, series, time, value);
+    return 0;
+
+append_cleanup_fail:
+    pthread_mutex_unlock(&historyMutex);
+    printf("ERROR: Could not allocate memory on the heap.\n");
+    return 1;
+}
+
+// Decode blocks and append the samples within [from, to] to 'samples'
+static int historyHandler_decodeRange(const historyHandler_block_t* blocks, int blockCount, int64_t from, int64_t to, historyHandler_sample_t* samples, int count) {
+    for (int i = 0; i < blockCount; i++) {
+        historyHandler_decode(&blocks[i], &samples[count]);
+        int kept = count;
+        for (uint32_t j = 0; j < blocks[i].count; j++) {
+            if (samples[count + j].time >= from && samples[count + j].time <= to) {
+                samples[kept++] = samples[count + j];
+            }
+        }
+        count = kept;
+    }
+    return count;
+}
+
+static int historyHandler_collect(void* context, const historyHandler_sample_t* samples, int count) {
+    historyHandler_collector_t* collector = (historyHandler_collector_t*)context;
+    if (collector->count + count > collector->capacity) {
+        int capacity = collector->capacity == 0 ? count : collector->capacity * 2;
+        if (capacity < collector->count + count) { capacity = collector->count + count; }
+        historyHandler_sample_t* grown = (historyHandler_sample_t*)realloc(collector->samples, capacity * sizeof(historyHandler_sample_t));
+        if (grown == NULL) {
+            printf("ERROR: Could not allocate memory on the heap.\n");
+            return 1;
+        }
+        collector->samples = grown;
+        collector->capacity = capacity;
+    }
+    memcpy(&collector->samples[collector->count], samples, count * sizeof(historyHandler_sample_t));
+    collector->count += count;
+    return 0;
+}
+
+// Read the samples of a series within [from, to] into a newly allocated array (Freed by the caller),
+// returns the amount of samples or -1 on failure
+int historyHandler_read(int device, int series, int64_t from, int64_t to, historyHandler_sample_t** out) {
+    *out = NULL;
+    if (device < 0 || device >= MAX_DEVICES || series < 0 || series >= HISTORY_SERIES_COUNT) { return -1; }
+
+    // Copy the overlapping blocks (Oldest first) so decoding happens without the lock
+    historyHandler_block_t* copies = NULL;
+    int copyCount = 0;
+    historyHandler_block_t* archived = NULL;
+    int archivedCount = 0;
+    historyHandler_collector_t minutes = { NULL, 0, 0 };
+    uint64_t total = 0;
+    uint64_t limit = UINT64_MAX; // Archived blocks from this one on are still in memory
+    int inMemory = 0; // Memory reaches back to 'from'
+
+    pthread_mutex_lock(&historyMutex);
+    historyHandler_series_t* seriesObj = history[device][series];
+    if (seriesObj != NULL) {
+        copies = (historyHandler_block_t*)malloc(seriesObj->used * sizeof(historyHandler_block_t));
+        if (copies == NULL) {
+            pthread_mutex_unlock(&historyMutex);
+            printf("ERROR: Could not allocate memory on the heap.\n");
+            return -1;
+        }
+        uint64_t oldest = seriesObj->sequence - seriesObj->used;
+        for (int i = 0; i < seriesObj->used; i++) {
+            historyHandler_block_t* block = seriesObj->blocks[(oldest + i) % HISTORY_BLOCKS_PER_SERIES];
+            if (i == 0 && block->firstTime <= from) { inMemory = 1; }
+            if (block->lastTime < from || block->firstTime > to) { continue; }
+            memcpy(&copies[copyCount++], block, sizeof(historyHandler_block_t));
+            total += block->count;
+        }
+        if (seriesObj->recovered == 1) { limit = seriesObj->base + oldest; }
+    }
+    pthread_mutex_unlock(&historyMutex);
+
+    if (inMemory == 0) {
+        archivedCount = archiveHandler_read(device, series, limit, from, to, &archived);
+        if (archivedCount < 0) { archivedCount = 0; }
+        for (int i = 0; i < archivedCount; i++) { total += archived[i].count; }
+        if (archiveHandler_streamMinutes(device, series, from, to, historyHandler_collect, &minutes) != 0) { minutes.count = 0; }
+        total += minutes.count;
+    }
+
+    if (total == 0) {
+        free(copies);
+        free(archived);
+        free(minutes.samples);
+        return 0;
+    }
+
+    historyHandler_sample_t* samples = (historyHandler_sample_t*)malloc(total * sizeof(historyHandler_sample_t));
+    if (samples == NULL) {
+        free(copies);
+        free(archived);
+        free(minutes.samples);
+        printf("ERROR: Could not allocate memory on the heap.\n");
+        return -1;
+    }
+
+    // Compacted minutes are the oldest, then the archived blocks, then memory. Blocks are decoded in place, dropping what falls outside the range
+    if (minutes.count > 0) { memcpy(samples, minutes.samples, minutes.count * sizeof(historyHandler_sample_t)); }
+    int count = historyHandler_decodeRange(archived, archivedCount, from, to, samples, minutes.count);
+    count = historyHandler_decodeRange(copies, copyCount, from, to, samples, count);
+    free(copies);
+    free(archived);
+    free(minutes.samples);
+
+    *out = samples;
+    return count;
+}
+
+// Decode a block and pass the samples within [from, to] on, 'samples' has to hold HISTORY_MAX_BLOCK_SAMPLES
+int historyHandler_streamBlock(const historyHandler_block_t* block, int64_t from, int64_t to, historyHandler_sample_t* samples, historyHandler_sink_t sink, void* context) {
+    if (block->count > HISTORY_MAX_BLOCK_SAMPLES) { return 1; }
+    historyHandler_decode(block, samples);
+    int first = 0;
+    int last = (int)block->count;
+    while (first < last && samples[first].time < from) { first++; }
+    while (last > first && samples[last - 1].time > to) { last--; }
+    if (last == first) { return 0; }
+    return sink(context, &samples[first], last - first);
+}
+
+// Stream the samples of a series within [from, to] (Oldest first) to 'sink', one block at a time.
+// Unlike historyHandler_read, memory use does not depend on the size of the range
+int historyHandler_stream(int device, int series, int64_t from, int64_t to, historyHandler_sink_t sink, void* context) {
+    if (device < 0 || device >= MAX_DEVICES || series < 0 || series >= HISTORY_SERIES_COUNT) { return 1; }
+
+    historyHandler_block_t* copies = NULL;
+    int copyCount = 0;
+    uint64_t limit = UINT64_MAX;
+    int inMemory = 0;
+    int rc = 0;
+
+    historyHandler_sample_t* samples = (historyHandler_sample_t*)malloc(HISTORY_MAX_BLOCK_SAMPLES * sizeof(historyHandler_sample_t));
+    if (samples == NULL) {
+        printf("ERROR: Could not allocate memory on the heap.\n");
+        return 1;
+    }
+
+    // Snapshot of the blocks still in memory, everything older comes from the archive
+    pthread_mutex_lock(&historyMutex);
+    historyHandler_series_t* seriesObj = history[device][series];
+    if (seriesObj != NULL) {
+        copies = (historyHandler_block_t*)malloc(seriesObj->used * sizeof(historyHandler_block_t));
+        if (copies == NULL) {
+            pthread_mutex_unlock(&historyMutex);
+            free(samples);
+            printf("ERROR: Could not allocate memory on the heap.\n");
+            return 1;
+        }
+        uint64_t oldest = seriesObj->sequence - seriesObj->used;
+        for (int i = 0; i < seriesObj->used; i++) {
+            historyHandler_block_t* block = seriesObj->blocks[(oldest + i) % HISTORY_BLOCKS_PER_SERIES];
+            if (i == 0 && block->firstTime <= from) { inMemory = 1; }
+            if (block->lastTime < from || block->firstTime > to) { continue; }
+            memcpy(&copies[copyCount++], block, sizeof(historyHandler_block_t));
+        }
+        if (seriesObj->recovered == 1) { limit = seriesObj->base + oldest; }
+    }
+    pthread_mutex_unlock(&historyMutex);
+
+    if (inMemory == 0) {
+        rc = archiveHandler_streamMinutes(device, series, from, to, sink, context);
+        if (rc == 0) { rc = archiveHandler_stream(device, series, limit, from, to, sink, context); }
+    }
+    for (int i = 0; i < copyCount && rc == 0; i++) {
+        rc = historyHandler_streamBlock(&copies[i], from, to, samples, sink, context);
+    }
+
+    free(copies);
+    free(samples);
+    return rc;
+}
+
+// Time of the oldest sample of a series still in memory, INT64_MAX if there is none
+static int64_t historyHandler_memoryStart(int device, int series) {
+    if (device < 0 || device >= MAX_DEVICES || series < 0 || series >= HISTORY_SERIES_COUNT) { return INT64_MAX; }
+    int64_t start = INT64_MAX;
+    pthread_mutex_lock(&historyMutex);
+    historyHandler_series_t* seriesObj = history[device][series];
+    if (seriesObj != NULL && seriesObj->used > 0) {
+        start = seriesObj->blocks[(seriesObj->sequence - seriesObj->used) % HISTORY_BLOCKS_PER_SERIES]->firstTime;
+    }
+    pthread_mutex_unlock(&historyMutex);
+    return start;
+}
+
+// Memory used by all series, to keep an eye on how well the samples compress
+void historyHandler_getStats(historyHandler_stats_t* out) {
+    pthread_mutex_lock(&historyMutex);
+    out->samples = historySamples;
+    out->series = historySeries;
+    out->bytes = 0;
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        for (int j = 0; j < HISTORY_SERIES_COUNT; j++) {
+            historyHandler_series_t* seriesObj = history[i][j];
+            if (seriesObj == NULL) { continue; }
+            for (int k = 0; k < seriesObj->used; k++) {
+                // Full blocks count as their encoded size, the block being appended to as what it holds so far
+                out->bytes += (seriesObj->blocks[k]->bitCount + 7) / 8 + sizeof(int64_t) + sizeof(uint64_t);
+            }
+        }
+    }
+    pthread_mutex_unlock(&historyMutex);
+}
+
+// Write new blocks to the archive. Full blocks are written once, the block being appended to is rewritten while it grows
+void historyHandler_flush() {
+    static historyHandler_block_t copies[HISTORY_BLOCKS_PER_SERIES];
+    static pthread_mutex_t flushMutex = PTHREAD_MUTEX_INITIALIZER; // The final flush on exit may overlap the history thread's
+    pthread_mutex_lock(&flushMutex);
+
+    for (int device = 0; device < deviceCount; device++) {
+        for (int series = 0; series < HISTORY_SERIES_COUNT; series++) {
+            pthread_mutex_lock(&historyMutex);
+            historyHandler_series_t* seriesObj = history[device][series];
+            int recovered = seriesObj != NULL ? seriesObj->recovered : 1;
+            pthread_mutex_unlock(&historyMutex);
+            if (seriesObj == NULL) { continue; }
+
+            // Continue after whatever earlier runs left in the archive (Only done once, appends carry on meanwhile)
+            if (recovered == 0) {
+                uint64_t base = 0;
+                if (archiveHandler_recover(device, series, &base) != 0) { continue; }
+                pthread_mutex_lock(&historyMutex);
+                seriesObj->base = base;
+                seriesObj->recovered = 1;
+                pthread_mutex_unlock(&historyMutex);
+            }
+
+            // Copy what has to be written, blocks that were overwritten before they could be written are lost
+            pthread_mutex_lock(&historyMutex);
+            if (seriesObj->sequence == 0) {
+                pthread_mutex_unlock(&historyMutex);
+                continue;
+            }
+            uint64_t base = seriesObj->base;
+            uint64_t head = seriesObj->sequence - 1;
+            uint64_t first = seriesObj->persisted;
+            if (first < seriesObj->sequence - seriesObj->used) {
+                printf("ERROR: History of device %d lost %llu blocks before they were archived.\n", device, (unsigned long long)(seriesObj->sequence - seriesObj->used - first));
+                first = seriesObj->sequence - seriesObj->used;
+            }
+            int fullCount = 0;
+            for (uint64_t i = first; i < head; i++) {
+                copies[fullCount++] = *seriesObj->blocks[i % HISTORY_BLOCKS_PER_SERIES];
+            }
+            int partial = 0;
+            const historyHandler_block_t* headBlock = seriesObj->blocks[head % HISTORY_BLOCKS_PER_SERIES];
+            if (seriesObj->flushedSequence != head || seriesObj->flushedCount != headBlock->count) {
+                copies[fullCount] = *headBlock;
+                partial = 1;
+            }
+            pthread_mutex_unlock(&historyMutex);
+
+            uint64_t persisted = first;
+            for (int i = 0; i < fullCount; i++) {
+                if (archiveHandler_writeBlock(device, series, base + first + i, &copies[i], 1) != 0) { break; }
+                persisted++;
+            }
+            int flushed = 0;
+            if (partial == 1 && persisted == head) {
+                flushed = archiveHandler_writeBlock(device, series, base + head, &copies[fullCount], 0) == 0;
+            }
+
+            pthread_mutex_lock(&historyMutex);
+            seriesObj->persisted = persisted;
+            if (flushed == 1) {
+                seriesObj->flushedSequence = head;
+                seriesObj->flushedCount = copies[fullCount].count;
+            }
+            pthread_mutex_unlock(&historyMutex);
+        }
+    }
+    archiveHandler_closeFiles();
+    pthread_mutex_unlock(&flushMutex);
+}
+
+// History thread, archives new samples and compacts old segments
+void* historyHandler_thread(void*) {
+    uint64_t compactedAt = 0;
+    archiveHandler_init();
+
+    while (1 == 1) {
+        usleep(ARCHIVE_FLUSH_INTERVAL_MS * 1000);
+        historyHandler_flush();
+
+        uint64_t now = (uint64_t)historyHandler_now();
+        if (now - compactedAt >= ARCHIVE_COMPACT_INTERVAL) {
+            compactedAt = now;
+            for (int device = 0; device < deviceCount; device++) {
+                for (int series = 0; series < HISTORY_SERIES_COUNT; series++) {
+                    // Samples still in memory are read from there, compacting them too would count them twice
+                    int64_t before = (int64_t)now - ARCHIVE_RAW_RETENTION;
+                    int64_t memoryStart = historyHandler_memoryStart(device, series);
+                    archiveHandler_compact(device, series, before < memoryStart ? before : memoryStart);
+                }
+            }
+        }
+    }
+}
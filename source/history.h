@@ -0,0 +1,78 @@
+#ifndef _HISTORY_H
+#define _HISTORY_H
+#include <stdint.h>
+
+#define HISTORY_SERIES_DIMMER 0 // 0 - 100
+#define HISTORY_SERIES_POWER 1 // W
+#define HISTORY_SERIES_RSSI 2 // dBm
+#define HISTORY_SERIES_COUNT 3
+
+// Compressed bytes per block, and blocks kept per series before the oldest is overwritten
+// (A series never uses more than HISTORY_BLOCK_BYTES * HISTORY_BLOCKS_PER_SERIES)
+#define HISTORY_BLOCK_BYTES 4096
+#define HISTORY_BLOCKS_PER_SERIES 256
+
+// Largest encoded sample: '1111' + 32 bit timestamp, '11' + 5 + 6 + 64 bit value
+#define HISTORY_MAX_SAMPLE_BITS 113
+
+// Most samples a block can hold (Every sample after the first takes at least 2 bits)
+#define HISTORY_MAX_BLOCK_SAMPLES (HISTORY_BLOCK_BYTES * 4 + 1)
+
+typedef struct {
+    int64_t time; // Unix seconds
+    double value;
+} historyHandler_sample_t;
+
+// One block of delta-of-delta timestamps and XOR'd values, decodable on its own
+typedef struct {
+    int64_t firstTime;
+    int64_t lastTime;
+    uint64_t firstValue; // Bits of the first value
+    uint32_t count;
+    uint32_t bitCount;
+
+    // Encoder state
+    int64_t lastDelta;
+    uint64_t lastValue;
+    uint8_t leading;
+    uint8_t trailing;
+
+    uint8_t data[HISTORY_BLOCK_BYTES];
+} historyHandler_block_t;
+
+// Ring of blocks, blocks are allocated as the series grows. Block 'n' of a run lives at blocks[n % HISTORY_BLOCKS_PER_SERIES]
+typedef struct {
+    historyHandler_block_t* blocks[HISTORY_BLOCKS_PER_SERIES];
+    int head; // Block currently appended to
+    int used;
+    uint64_t sequence; // Blocks started this run
+
+    // Persistence (Block 'n' of this run is block 'base + n' on disk)
+    int recovered; // Set once 'base' is known
+    uint64_t base;
+    uint64_t persisted; // Blocks of this run written to disk in full
+    uint64_t flushedSequence; // Partial block last written, and how many samples it had
+    uint32_t flushedCount;
+} historyHandler_series_t;
+
+// Receives streamed samples, returns non zero to stop the stream
+typedef int (*historyHandler_sink_t)(void* context, const historyHandler_sample_t* samples, int count);
+
+typedef struct {
+    uint64_t samples;
+    uint64_t bytes;
+    int series;
+} historyHandler_stats_t;
+
+int64_t historyHandler_now();
+const char* historyHandler_seriesName(int series);
+void historyHandler_decode(const historyHandler_block_t* block, historyHandler_sample_t* out);
+int historyHandler_append(int device, int series, int64_t time, double value);
+int historyHandler_read(int device, int series, int64_t from, int64_t to, historyHandler_sample_t** out);
+int historyHandler_streamBlock(const historyHandler_block_t* block, int64_t from, int64_t to, historyHandler_sample_t* samples, historyHandler_sink_t sink, void* context);
+int historyHandler_stream(int device, int series, int64_t from, int64_t to, historyHandler_sink_t sink, void* context);
+void historyHandler_getStats(historyHandler_stats_t* out);
+void historyHandler_flush();
+void* historyHandler_thread(void*);
+
+#endif
@@ -7,42 +7,268 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
 #include <pthread.h>
+#ifndef IOT_HEADLESS
 #include "window.hpp"
+#endif
 #include "mqtt.h"
 #include "config.h"
+#include "scene.h"
+#include "shadow.h"
+#include "search.h"
+#include "history.h"
+#include "export.h"
+#include "snapshot.h"
+#include "startup.h"
+#include "control.h"
+#include "cli.h"
+#include "shm.h"
+#include "statusbar.h"
 
 static int rc = 0;
 
-int main() {
-    printf("IoT Controller\n");
-    printf("Goldenkrew3000 2025\n");
+// Groups
+extern int groupCount;
+extern configPtr_group_t configPtr_groups[];
+
+/* Command line export (Runs without connecting to the broker or opening a window)
+// --export <device or group name> --> What to export
+// --state --> Export the current state instead of history
+// --series <dimmer|power|rssi> --> Only one series (Default: All)
+// --from <unix seconds> --to <unix seconds> --> Time range (Default: Everything)
+// --format <csv|jsonl> --> Output format (Default: csv)
+// --output <path> --> Output file (Default: export.csv / export.jsonl)
+*/
+static int main_export(int argc, char** argv) {
+    const char* name = NULL;
+    const char* path = NULL;
+    int state = 0;
+    int series = EXPORT_SERIES_ALL;
+    int format = EXPORT_FORMAT_CSV;
+    int64_t from = 0;
+    int64_t to = INT64_MAX;
+
+    for (int i = 1; i < argc; i++) {
+        int hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--export") == 0 && hasValue) {
+            name = argv[++i];
+        } else if (strcmp(argv[i], "--state") == 0) {
+            state = 1;
+        } else if (strcmp(argv[i], "--series") == 0 && hasValue) {
+            i++;
+            for (int s = 0; s < HISTORY_SERIES_COUNT; s++) {
+                if (strcmp(argv[i], historyHandler_seriesName(s)) == 0) { series = s; }
+            }
+            if (series == EXPORT_SERIES_ALL) {
+                printf("ERROR: Unknown series '%s'.\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--from") == 0 && hasValue) {
+            from = strtoll(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--to") == 0 && hasValue) {
+            to = strtoll(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--format") == 0 && hasValue) {
+            format = strcmp(argv[++i], "jsonl") == 0 ? EXPORT_FORMAT_JSONL : EXPORT_FORMAT_CSV;
+        } else if (strcmp(argv[i], "--output") == 0 && hasValue) {
+            path = argv[++i];
+        } else {
+            printf("ERROR: Unknown argument '%s'.\n", argv[i]);
+            return 1;
+        }
+    }
+    if (name == NULL) {
+        printf("ERROR: --export needs a device or group name.\n");
+        return 1;
+    }
 
+    // A device, or else a group
+    int device = configHandler_findDevice(name);
+    const int* devices = &device;
+    int count = 1;
+    if (device == -1) {
+        count = 0;
+        for (int i = 0; i < groupCount; i++) {
+            if (strcmp(configPtr_groups[i].name, name) == 0) {
+                devices = configPtr_groups[i].members;
+                count = configPtr_groups[i].memberCount;
+                break;
+            }
+        }
+        if (count == 0) {
+            printf("ERROR: No device or group called '%s'.\n", name);
+            return 1;
+        }
+    }
+
+    if (path == NULL) { path = format == EXPORT_FORMAT_JSONL ? "export.jsonl" : "export.csv"; }
+
+    if (state == 1) {
+        return exportHandler_state(devices, count, format, path);
+    }
+    return exportHandler_history(devices, count, series, from, to, format, path);
+}
+
+// Everything the devices need, run next to the window initialization so neither waits for the other
+// NOTE: The window only touches device data once STARTUP_PHASE_READY is reached
+static void* main_startup(void*) {
     // Read config file
     rc = configHandler_read();
     if (rc != 0) {
         printf("MAIN: Ran into critical error, exiting.\n");
         exit(EXIT_FAILURE);
     }
+    startupHandler_mark(STARTUP_PHASE_CONFIG);
+
+    // Show the last known device states until the devices report in
+    rc = snapshotHandler_load();
+    if (rc != 0) {
+        printf("MAIN: Ran into a critical error, exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+    startupHandler_mark(STARTUP_PHASE_SNAPSHOT);
+
+    // Every device starts out with an empty shadow
+    shadowHandler_init();
+
+    // Share the device states with status bars and other local readers (They only miss out if this fails)
+    shmHandler_init();
+
+    // Build the device list search index
+    rc = searchHandler_build();
+    if (rc != 0) {
+        printf("MAIN: Ran into a critical error, exiting.\n");
+        exit(EXIT_FAILURE);
+    }
 
-    // Connect to the MQTT broker
+    // Create the MQTT client
     rc = mqttHandler_init();
     if (rc != 0) {
         printf("MAIN: Ran into a critical error, exiting.\n");
         exit(EXIT_FAILURE);
     }
+    startupHandler_mark(STARTUP_PHASE_READY);
 
-    // Start a thread to initially request device information about all the devices specified in the config
-    // NOTE: At this point, no modification is taking place on the variables, so no mutex's needed
-    pthread_t thr_device_info;
-    pthread_create(&thr_device_info, NULL, mqttHandler_initDeviceInfo, NULL);
+    // Start the broker connection thread (Connects, reconnects, and requests every device's state once connected)
+    pthread_t thr_mqtt_connection;
+    pthread_create(&thr_mqtt_connection, NULL, mqttHandler_connectionThread, NULL);
 
     // Start the MQTT command dispatcher thread
     pthread_t thr_mqtt_cmd_dispatcher;
     pthread_create(&thr_mqtt_cmd_dispatcher, NULL, mqttHandler_commandDispatcher, NULL);
 
+    // Start the scene engine thread
+    pthread_t thr_scene_engine;
+    pthread_create(&thr_scene_engine, NULL, sceneHandler_thread, NULL);
+
+    // Start the device shadow reconciler thread
+    pthread_t thr_shadow_reconciler;
+    pthread_create(&thr_shadow_reconciler, NULL, shadowHandler_thread, NULL);
+
+    // Start the history thread (Archives samples to disk)
+    pthread_t thr_history;
+    pthread_create(&thr_history, NULL, historyHandler_thread, NULL);
+
+    // Start the snapshot thread (Saves the device states periodically)
+    pthread_t thr_snapshot;
+    pthread_create(&thr_snapshot, NULL, snapshotHandler_thread, NULL);
+
+    // Start the control socket thread (Scripts/hotkeys control devices through it)
+    pthread_t thr_control;
+    pthread_create(&thr_control, NULL, controlHandler_thread, NULL);
+
+    return NULL;
+}
+
+// Run without a window until SIGINT/SIGTERM (--headless, or always in the headless build)
+static int main_headless() {
+    // The shutdown signals are only taken by sigwait below, every thread started after this inherits the mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    // Nothing to run next to, so the devices are set up on this thread
+    main_startup(NULL);
+    printf("Running headless, stop with SIGINT or SIGTERM.\n");
+
+    int received = 0;
+    sigwait(&signals, &received);
+    printf("MAIN: Received signal %d, shutting down.\n", received);
+
+    // Archive what was recorded since the last flush, and keep the latest device states for the next start
+    historyHandler_flush();
+    snapshotHandler_save();
+    shmHandler_deinit();
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    // Status bar output (--statusbar [i3bar|waybar]), stdout belongs to the bar so nothing is printed before it
+    if (argc >= 2 && strcmp(argv[1], "--statusbar") == 0) {
+        int format = argc > 2 && strcmp(argv[2], "waybar") == 0 ? STATUSBAR_FORMAT_WAYBAR : STATUSBAR_FORMAT_I3BAR;
+        rc = statusbarHandler_run(format);
+        exit(rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // Anything other than an option is a command for the devices (Forwarded to the running instance if there is one)
+    if (argc > 1 && strncmp(argv[1], "--", 2) != 0) {
+        rc = cliHandler_run(argc - 1, argv + 1);
+        exit(rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    printf("IoT Controller\n");
+    printf("Goldenkrew3000 2025\n");
+    startupHandler_begin();
+
+#ifdef IOT_HEADLESS
+    int headless = 1;
+#else
+    int headless = 0;
+#endif
+    if (argc == 2 && strcmp(argv[1], "--headless") == 0) {
+        headless = 1;
+    } else if (argc > 1) {
+        // Command line export, exits once done
+        rc = configHandler_read();
+        if (rc == 0) { rc = snapshotHandler_load(); } // '--export --state' exports the last known states
+        if (rc == 0) { rc = main_export(argc, argv); }
+        exit(rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // Only one instance controls the devices, anything else has to go through its control socket
+    if (controlHandler_lock() != 0) {
+        printf("ERROR: Another instance is already running.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (headless == 1) {
+        rc = main_headless();
+        exit(rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+#ifndef IOT_HEADLESS
+    pthread_t thr_startup;
+    pthread_create(&thr_startup, NULL, main_startup, NULL);
+
     // Start the window (Has to be on the main thread)
     windowHandler_init();
 
+    // Nothing to save if the window was closed before the devices were set up
+    if (startupHandler_reached(STARTUP_PHASE_READY)) {
+        // Archive what was recorded since the last flush
+        historyHandler_flush();
+
+        // Keep the latest device states for the next start
+        snapshotHandler_save();
+
+        // Readers of the shared state table have to know nothing updates it anymore
+        shmHandler_deinit();
+    }
+#endif
+
     exit(EXIT_SUCCESS);
 }
@@ -9,13 +9,18 @@
 #include "config.h"
 #include "wait.h"
 #include "states.h"
+#include "queue.h"
+#include "shadow.h"
+#include "driver.h"
+#include "startup.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <stdatomic.h>
+#include <pthread.h>
 #include <MQTTClient.h>
-#include <cjson/cJSON.h>
 
 // MQTT Settings
 extern char* configPtr_mqtt_broker;
@@ -29,18 +34,38 @@ char MQTT_Address[128];
 extern int deviceCount;
 extern configPtr_device_t configPtr_devices[];
 
-// Window signal objects
-extern atomic_int dispatchFlag;
-extern atomic_int dispatchType;
-extern atomic_int dispatchAction;
-extern atomic_int dispatchDevice;
-extern _Atomic uint32_t dispatchContent;
+// Dispatcher settings
+extern int configPtr_dispatch_backlogWindowMs;
+extern int configPtr_dispatch_backlogMax;
+
+// Bumped whenever any device's state changes, so views only rebuild their caches when needed
+atomic_uint stateGeneration = 0;
+
+// Broker message counters
+atomic_int mqttMessagesSent = 0;
+atomic_int mqttMessagesSaved = 0; // Messages that did not need to be sent thanks to backlog merging
+
+// Fan-out tracking (Fan-outs are started from the interface and control threads, the mutex keeps two starts from interleaving)
+static pthread_mutex_t fanoutMutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_ullong fanoutStart = 0;
+static atomic_int fanoutRemaining = 0;
+atomic_int fanoutCount = 0;
+atomic_int fanoutLatency = -1; // Milliseconds from the fan-out to the last member acknowledging, -1 while waiting
 
-#define ARRAY_MAX_DEPTH 3
 MQTTClient client;
 static int rc = 0;
-static int json_rc = 0;
 
+// Connection status shown in the window
+static atomic_int connectionState = MQTT_STATE_DISCONNECTED;
+static atomic_int connectionAttempts = 0; // Failed attempts since the last successful connection
+static atomic_int connectionError = MQTTCLIENT_SUCCESS;
+static atomic_llong connectionRetryAt = 0; // Monotonic ns of the next attempt while disconnected
+
+// Futex words, the dispatcher sleeps while not connected and the connection thread sleeps while connected
+static atomic_int connected = 0;
+static atomic_int connectionLost = 0;
+
+// Create the client, connecting is left to mqttHandler_connectionThread so nothing has to wait for the broker
 int mqttHandler_init() {
     printf("%s +\n", __func__);
 
@@ -61,29 +86,85 @@ int mqttHandler_init() {
         return 1;
     }
 
+    return 0;
+}
+
+// Connect to the broker without subscribing (One-shot command line publish), returns the client's error code
+int mqttHandler_connectOnce() {
     // Connect to broker and perform login
     MQTTClient_connectOptions mqtt_options = MQTTClient_connectOptions_initializer;
     mqtt_options.keepAliveInterval = 20;
     mqtt_options.cleansession = 1;
+    mqtt_options.connectTimeout = MQTT_CONNECT_TIMEOUT;
     mqtt_options.username = configPtr_mqtt_username;
     mqtt_options.password = configPtr_mqtt_password;
 
-    if ((rc = MQTTClient_connect(client, &mqtt_options)) != MQTTCLIENT_SUCCESS) {
-        printf("ERROR: Could not connect to MQTT broker (%s).\n", MQTTClient_strerror(rc));
-        MQTTClient_destroy(&client);
-        return 1;
+    int result = MQTTClient_connect(client, &mqtt_options);
+    if (result != MQTTCLIENT_SUCCESS) {
+        printf("ERROR: Could not connect to MQTT broker (%s).\n", MQTTClient_strerror(result));
+        return result;
     }
     printf("Connected to MQTT broker.\n");
+    return MQTTCLIENT_SUCCESS;
+}
+
+// Connect to the broker and subscribe, returns the client's error code
+static int mqttHandler_connect() {
+    int result = mqttHandler_connectOnce();
+    if (result != MQTTCLIENT_SUCCESS) { return result; }
 
     // Subscribe to # (Root topic)
-    if ((rc = MQTTClient_subscribe(client, "#", 1)) != MQTTCLIENT_SUCCESS) {
+    result = MQTTClient_subscribe(client, "#", 1);
+    if (result != MQTTCLIENT_SUCCESS) {
         printf("ERROR: Could not subscribe to MQTT broker\n");
-        MQTTClient_disconnect(client, 10000);
-        MQTTClient_destroy(&client);
-        return 1;
+        MQTTClient_disconnect(client, 1000);
+        return result;
     }
+    return MQTTCLIENT_SUCCESS;
+}
 
-    return 0;
+// Broker connection thread, keeps (re)connecting with backoff. The interface works offline in the meantime,
+// commands wait in the queue until the dispatcher can send them
+void* mqttHandler_connectionThread(void*) {
+    uint64_t backoff = MQTT_RETRY_BASE_MS;
+
+    while (1 == 1) {
+        atomic_store(&connectionState, MQTT_STATE_CONNECTING);
+        int result = mqttHandler_connect();
+        atomic_store(&connectionError, result);
+        if (result != MQTTCLIENT_SUCCESS) {
+            atomic_fetch_add(&connectionAttempts, 1);
+            atomic_store(&connectionRetryAt, (long long)(waitHandler_monotonicNs() + backoff * 1000000ULL));
+            atomic_store(&connectionState, MQTT_STATE_DISCONNECTED);
+            usleep(backoff * 1000);
+            backoff = backoff * 2 > MQTT_RETRY_MAX_MS ? MQTT_RETRY_MAX_MS : backoff * 2;
+            continue;
+        }
+
+        backoff = MQTT_RETRY_BASE_MS;
+        atomic_store(&connectionAttempts, 0);
+        atomic_store(&connectionLost, 0);
+        atomic_store(&connectionState, MQTT_STATE_CONNECTED);
+        atomic_store(&connected, 1);
+        waitHandler_wake(&connected);
+        startupHandler_mark(STARTUP_PHASE_BROKER);
+
+        // Ask every device for its state (Again after a reconnect, anything could have changed in between)
+        mqttHandler_initDeviceInfo(NULL);
+
+        while (atomic_load(&connectionLost) == 0) {
+            waitHandler_wait(&connectionLost);
+        }
+    }
+}
+
+void mqttHandler_getStatus(mqttHandler_status_t* status) {
+    status->state = atomic_load(&connectionState);
+    status->attempts = atomic_load(&connectionAttempts);
+    status->error = atomic_load(&connectionError);
+    long long retryAt = atomic_load(&connectionRetryAt);
+    long long now = (long long)waitHandler_monotonicNs();
+    status->retryInMs = retryAt > now ? (int)((retryAt - now) / 1000000LL) : 0;
 }
 
 void mqttHandler_deinit() {
@@ -96,297 +177,327 @@ void mqttHandler_deinit() {
 
 int message_arrived_callback(void* context, char* topicName, int topicLen, MQTTClient_message* message) {
     printf("Topic: %s -- Content: %.*s\n", topicName, message->payloadlen, (char*)message->payload);
-    
-    // Make a copy of the topic and content to send to the processMessage function
-    char* topic_ptr = NULL;
-    char* content_ptr = NULL;
-    topic_ptr = strdup(topicName);
-    content_ptr = strdup(message->payload);
-    if (topic_ptr == NULL) {
-        printf("ERROR: Could not malloc memory for topic copy.\n");
-    }
-    if (content_ptr == NULL) {
+
+    // The payload is not NUL terminated, make a terminated copy for the drivers
+    char* content = (char*)malloc(message->payloadlen + 1);
+    if (content == NULL) {
         printf("ERROR: Could not malloc memory for content copy.\n");
-    }
-    if (topic_ptr != NULL && content_ptr != NULL) {
-        mqttHandler_processMessage(topic_ptr, content_ptr);
     } else {
-        if (topic_ptr != NULL) { free(topic_ptr); }
-        if (content_ptr != NULL) { free(content_ptr); }
+        memcpy(content, message->payload, message->payloadlen);
+        content[message->payloadlen] = '\0';
+        driverHandler_route(topicName, content);
+        free(content);
     }
+
+    // Returning 1 tells the client the message was handled, so both have to be freed here
+    MQTTClient_freeMessage(&message);
+    MQTTClient_free(topicName);
+    return 1;
 }
 
 void connection_lost_callback(void* context, char* cause) {
     printf("WARNING: Connection to MQTT broker lost, cause: %s\n", cause);
+
+    // Hold back the dispatcher and let the connection thread reconnect
+    atomic_store(&connected, 0);
+    atomic_store(&connectionState, MQTT_STATE_DISCONNECTED);
+    atomic_store(&connectionLost, 1);
+    waitHandler_wake(&connectionLost);
+}
+
+// Orders commands by target, keeping the push order of commands to the same target
+static int mqttHandler_compareTarget(const void* a, const void* b) {
+    const mqttHandler_pendingCommand_t* ca = (const mqttHandler_pendingCommand_t*)a;
+    const mqttHandler_pendingCommand_t* cb = (const mqttHandler_pendingCommand_t*)b;
+    if (ca->command.flags != cb->command.flags) { return ca->command.flags - cb->command.flags; }
+    if (ca->command.device != cb->command.device) { return ca->command.device - cb->command.device; }
+    return ca->order - cb->order;
 }
 
-int mqttHandler_processMessage(char* topic, char* content) {
-    /* Info
-    // deviceName/ --> Status Update
-    // cmnd/ --> Command sent (from here or other device)
-    */
-
-    // TODO: Reform this, many memory leaks
-
-    // Split string into array, sliced by '/'
-    // TODO handle freeing etc
-    char* token = NULL;
-    char* array[ARRAY_MAX_DEPTH] = { NULL };
-    int split_idx = 0;
-    token = strtok(topic, "/");
-    while (token != NULL) {
-        if (split_idx == ARRAY_MAX_DEPTH) {
-            printf("OVERFLOW WARNING!!\n"); // TODO
-            break;
+// MQTT Command Dispatcher Thread
+void* mqttHandler_commandDispatcher(void*) {
+    static queueHandler_command_t batch[QUEUE_MAX_COMMANDS];
+    static mqttHandler_pendingCommand_t pending[QUEUE_MAX_COMMANDS];
+
+    while (1 == 1) {
+        queueHandler_waitPending();
+
+        // Commands pushed while offline stay queued until there is a broker to send them to
+        while (atomic_load(&connected) == 0) {
+            waitHandler_wait(&connected);
         }
-        array[split_idx++] = token;
-        token = strtok(NULL, "/");
-    }
 
+        // Give other commands for the same devices a short window to arrive, so they can share a backlog message
+        if (configPtr_dispatch_backlogWindowMs > 0) {
+            usleep(configPtr_dispatch_backlogWindowMs * 1000);
+        }
 
-    // Check for general response
-    for (int i = 0; i < deviceCount; i++) {
-        if (strcmp(array[0], configPtr_devices[i].name) == 0) {
-            printf("Device %s sent a general status update.\n", configPtr_devices[i].prettyName);
-            if (strcmp(array[1], "connected") == 0) {
-                // Device sent a connection status update
-                if (strcmp(content, "online") == 0) {
-                    // Device is online
-                    configPtr_devices[i].online = 1;
-                }
+        // Send everything that piled up since the last wake in one go
+        int count = queueHandler_drain(batch, QUEUE_MAX_COMMANDS);
+        for (int i = 0; i < count; i++) {
+            pending[i].command = batch[i];
+            pending[i].order = i;
+        }
+        qsort(pending, count, sizeof(mqttHandler_pendingCommand_t), mqttHandler_compareTarget);
+
+        // Merge every run of commands to the same target into backlog messages
+        int runStart = 0;
+        while (runStart < count) {
+            int runEnd = runStart + 1;
+            while (runEnd < count && runEnd - runStart < configPtr_dispatch_backlogMax &&
+                pending[runEnd].command.device == pending[runStart].command.device &&
+                pending[runEnd].command.flags == pending[runStart].command.flags) {
+                runEnd++;
+            }
+
+            if (runEnd - runStart == 1) {
+                mqttHandler_dispatchCommand(&pending[runStart].command);
+            } else {
+                mqttHandler_dispatchBacklog(&pending[runStart], runEnd - runStart);
             }
+            runStart = runEnd;
         }
     }
+}
+
+// Find the topic to send to, either the device itself or its group topic
+static const char* mqttHandler_commandTarget(const queueHandler_command_t* command) {
+    if (command->device < 0 || command->device >= deviceCount) {
+        return NULL;
+    }
+    if (command->flags & QUEUE_FLAG_GROUP_TOPIC) {
+        return configPtr_devices[command->device].groupTopic;
+    }
+    return configPtr_devices[command->device].name;
+}
 
-    // Check for state/status response
-    if (strcmp(array[0], "stat") == 0) {
-        // Received state/status command response
-        // Find which device sent the response
+// Start the acknowledgement timer of every device the command reaches (Only if the last command was already acknowledged)
+static void mqttHandler_markCommandSent(const queueHandler_command_t* command, const char* target) {
+    uint64_t now = waitHandler_monotonicNs();
+    unsigned long long idle = 0;
+    if (command->flags & QUEUE_FLAG_GROUP_TOPIC) {
         for (int i = 0; i < deviceCount; i++) {
-            if (strcmp(array[1], configPtr_devices[i].name) == 0) {
-                // Find whether the response is from a state or status command
-                if (strcmp(array[2], "RESULT") == 0) {
-                    // Device sent a State response
-                    printf("Device %s sent a State response.\n", configPtr_devices[i].prettyName);
-                    mqttHandler_processStateResponse(content, i);
-                } else if (strcmp(array[2], "STATUS") == 0) {
-                    // Device sent a Status response
-                    printf("Device %s sent a Status response.\n", configPtr_devices[i].prettyName);
-                    mqttHandler_processStatusResponse(content);
-                }
+            if (configPtr_devices[i].groupTopic != NULL && strcmp(configPtr_devices[i].groupTopic, target) == 0) {
+                idle = 0;
+                atomic_compare_exchange_strong(&configPtr_devices[i].commandSentAt, &idle, now);
             }
         }
-        
+    } else {
+        atomic_compare_exchange_strong(&configPtr_devices[command->device].commandSentAt, &idle, now);
     }
+}
 
-processMessage_cleanup:
-    free(topic);
-    free(content);
+// Encode a command with the driver of the target device
+static int mqttHandler_encodeForDevice(const queueHandler_command_t* command, const char** cmnd, char payload[16]) {
+    const driverHandler_driver_t* driver = driverHandler_get(command->device);
+    if (driver->encodeCommand == NULL || driver->sendCommand == NULL) {
+        printf("ERROR: Devices with mode '%s' do not take commands.\n", driver->mode);
+        return 1;
+    }
+    return driver->encodeCommand(command, cmnd, payload);
 }
 
-// MQTT Command Dispatcher Thread
-void* mqttHandler_commandDispatcher(void*) {
-    while (1 == 1) {
-        while (atomic_load(&dispatchFlag) == 0) {
-            waitHandler_wait(&dispatchFlag);
+int mqttHandler_dispatchCommand(const queueHandler_command_t* command) {
+    printf("Performing action. Device %d, Type %d, Action %d, Flags %d, Content: 0x%.4x\n",
+        command->device, command->type, command->action, command->flags, command->content);
+
+    const char* target = mqttHandler_commandTarget(command);
+    const char* cmnd = NULL;
+    char payload[16];
+    if (target == NULL || mqttHandler_encodeForDevice(command, &cmnd, payload) != 0) {
+        return 1;
+    }
+
+    mqttHandler_markCommandSent(command, target);
+    return driverHandler_get(command->device)->sendCommand(target, cmnd, payload);
+}
+
+// Send the commands collected in 'backlog' as one message
+static int mqttHandler_sendBacklog(const driverHandler_driver_t* driver, const queueHandler_command_t* first, const char* target, const char* backlog, int merged) {
+    printf("Merged %d commands for %s into one backlog message.\n", merged, target);
+    atomic_fetch_add(&mqttMessagesSaved, merged - 1);
+    mqttHandler_markCommandSent(first, target);
+    return driver->sendCommand(target, driver->backlogCommand, backlog);
+}
+
+// Send several commands to the same target as a single 'backlog' message ("cmnd1 payload1;cmnd2 payload2;...")
+// NOTE: Commands that do not fit start the next message, so they still arrive in the order they were pushed
+int mqttHandler_dispatchBacklog(const mqttHandler_pendingCommand_t* commands, int count) {
+    const char* target = mqttHandler_commandTarget(&commands[0].command);
+    if (target == NULL) { return 1; }
+
+    // Drivers without a backlog command get every command on its own
+    const driverHandler_driver_t* driver = driverHandler_get(commands[0].command.device);
+    if (driver->backlogCommand == NULL) {
+        for (int i = 0; i < count; i++) {
+            mqttHandler_dispatchCommand(&commands[i].command);
+        }
+        return 0;
+    }
+
+    char backlog[MQTT_BACKLOG_MAX_LENGTH];
+    int length = 0;
+    int merged = 0;
+    int first = 0; // First command in the backlog being collected
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        const char* cmnd = NULL;
+        char payload[16];
+        if (mqttHandler_encodeForDevice(&commands[i].command, &cmnd, payload) != 0) {
+            failed = 1;
+            continue;
         }
 
-        printf("Performing action. Device %d, Type %d, Action %d, Content: 0x%.4x\n",
-            atomic_load(&dispatchDevice), atomic_load(&dispatchType), atomic_load(&dispatchAction), atomic_load(&dispatchContent));
-
-        if (atomic_load(&dispatchType) == FLAG_DISPATCH_TYPE_OPENBK_LIGHT) {
-            // Dispatch request is for an OpenBK Light
-            if (atomic_load(&dispatchAction) == FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_ON) {
-                // Turn on light
-                mqttHandler_sendOpenBKLightCommand(atomic_load(&dispatchDevice), "led_enableAll", 1, 1);
-            } else if (atomic_load(&dispatchAction) == FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_OFF) {
-                // Turn off light
-                mqttHandler_sendOpenBKLightCommand(atomic_load(&dispatchDevice), "led_enableAll", 1, 0);
-            } else if (atomic_load(&dispatchAction) == FLAG_DISPATCH_ACTION_OPENBK_LIGHT_BRIGHTNESS) {
-                // Brightness change
-                mqttHandler_sendOpenBKLightCommand(atomic_load(&dispatchDevice), "led_dimmer", 1, atomic_load(&dispatchContent));
+        int written = snprintf(backlog + length, sizeof(backlog) - length, "%s%s%s%s", merged > 0 ? ";" : "", cmnd, payload[0] != '\0' ? " " : "", payload);
+        if (written < 0 || written >= (int)sizeof(backlog) - length) {
+            backlog[length] = '\0';
+            if (merged == 0) {
+                // Too long for a backlog message even on its own
+                failed |= mqttHandler_dispatchCommand(&commands[i].command);
+                continue;
             }
+
+            // Out of space, send what was collected and start over with this command
+            failed |= mqttHandler_sendBacklog(driver, &commands[first].command, target, backlog, merged);
+            length = 0;
+            merged = 0;
+            i--;
+            continue;
         }
-        
-        // Reset atomic contents/flag
-        atomic_store(&dispatchType, 0);
-        atomic_store(&dispatchAction, 0);
-        atomic_store(&dispatchContent, 0x0);
-        atomic_store(&dispatchDevice, -1);
-        atomic_store(&dispatchFlag, 0);
+        if (merged == 0) { first = i; }
+        length += written;
+        merged++;
     }
+    if (merged > 0) {
+        failed |= mqttHandler_sendBacklog(driver, &commands[first].command, target, backlog, merged);
+    }
+    return failed;
 }
 
-// Send an OpenBK Light Command over MQTT
-int mqttHandler_sendOpenBKLightCommand(int device, char* cmnd, int useContent, uint32_t content) {
-    // Form command and payload
-    char* topic = NULL;
-    char* payload = NULL;
-    asprintf(&topic, "cmnd/%s/%s", configPtr_devices[device].name, cmnd);
-    asprintf(&payload, "%d", content);
+// Publish a message, an empty payload sends no content
+int mqttHandler_publish(const char* topic, const char* payload) {
     printf("Topic: %s\n", topic);
     printf("Payload: %s\n", payload);
 
     // Send MQTT message
     MQTTClient_message obj = MQTTClient_message_initializer;
     MQTTClient_deliveryToken token;
-    if (useContent == 1) {
-        obj.payload = payload;
-        obj.payloadlen = strlen(payload);
+    obj.payload = (void*)payload;
+    obj.payloadlen = strlen(payload);
+    obj.qos = 0;
+    obj.retained = 0;
+    if ((rc = MQTTClient_publishMessage(client, topic, &obj, &token)) != MQTTCLIENT_SUCCESS) {
+        printf("ERROR: Could not publish to %s (%s).\n", topic, MQTTClient_strerror(rc));
+        return 1;
     }
-	obj.qos = 0;
-	obj.retained = 0;
-    MQTTClient_publishMessage(client, topic, &obj, &token); // TODO handle response?
+    atomic_fetch_add(&mqttMessagesSent, 1);
 
-    // Free objects
-    if (topic != NULL) { free(topic); }
-    if (payload != NULL) { free(payload); }
+    return 0;
 }
 
-int mqttHandler_processStateResponse(char* content, int device) {
-    // Clean the deviceState struct
-    mqttHandler_cleanState(device);
-
-    // Parse JSON
-    cJSON* jobj_state = cJSON_Parse(content);
-    if (jobj_state == NULL) {
-        const char* jerr_ptr = cJSON_GetErrorPtr();
-        if (jerr_ptr != NULL) {
-            printf("ERROR: Parsing JSON returned error: (%s)\n", jerr_ptr);
-        } else {
-            printf("ERROR: Parsing JSON returned unknown error.\n");
+// Returns the OpenBK group topic if every device given shares it, and no device outside of them has it,
+// so a single publish to it reaches exactly these devices. Otherwise returns -1
+static int mqttHandler_findSharedGroupTopic(const int* devices, int count) {
+    if (count < 2 || configPtr_devices[devices[0]].groupTopic == NULL) { return -1; }
+    const char* groupTopic = configPtr_devices[devices[0]].groupTopic;
+
+    for (int i = 1; i < count; i++) {
+        if (configPtr_devices[devices[i]].groupTopic == NULL || strcmp(configPtr_devices[devices[i]].groupTopic, groupTopic) != 0) {
+            return -1;
         }
-        goto processStateResponse_cleanup_fail;
     }
 
-    cJSON* jobj_uptime = cJSON_GetObjectItemCaseSensitive(jobj_state, "Uptime");
-    cJSON* jobj_mqttCount = cJSON_GetObjectItemCaseSensitive(jobj_state, "MqttCount");
-    cJSON* jobj_dimmer = cJSON_GetObjectItemCaseSensitive(jobj_state, "Dimmer");
-    cJSON* jobj_color = cJSON_GetObjectItemCaseSensitive(jobj_state, "Color");
-    cJSON* jobj_hsbcolor = cJSON_GetObjectItemCaseSensitive(jobj_state, "HSBColor");
-    cJSON* jobj_channel = cJSON_GetObjectItemCaseSensitive(jobj_state, "Channel");
-    cJSON* jobj_power = cJSON_GetObjectItemCaseSensitive(jobj_state, "POWER");
-    cJSON* jobj_wifi_root = cJSON_GetObjectItemCaseSensitive(jobj_state, "Wifi");
-
-    json_rc = configHandler_checkExists(jobj_uptime, "root", "Uptime");
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    json_rc = configHandler_checkExists(jobj_mqttCount, "root", "MqttCount");
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    json_rc = configHandler_checkExists(jobj_dimmer, "root", "Dimmer");
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    json_rc = configHandler_checkExists(jobj_color, "root", "Color");
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    json_rc = configHandler_checkExists(jobj_hsbcolor, "root", "HSBColor");
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    json_rc = configHandler_checkExists(jobj_channel, "root", "Channel");
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    json_rc = configHandler_checkExists(jobj_power, "root", "POWER");
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    json_rc = configHandler_checkExists(jobj_wifi_root, "root", "Wifi");
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-
-    cJSON* jobj_wifi_ssid = cJSON_GetObjectItemCaseSensitive(jobj_wifi_root, "SSId");
-    cJSON* jobj_wifi_bssid = cJSON_GetObjectItemCaseSensitive(jobj_wifi_root, "BSSId");
-    cJSON* jobj_wifi_channel = cJSON_GetObjectItemCaseSensitive(jobj_wifi_root, "Channel");
-    cJSON* jobj_wifi_mode = cJSON_GetObjectItemCaseSensitive(jobj_wifi_root, "Mode");
-    cJSON* jobj_wifi_rssi = cJSON_GetObjectItemCaseSensitive(jobj_wifi_root, "RSSI");
-    cJSON* jobj_wifi_signal = cJSON_GetObjectItemCaseSensitive(jobj_wifi_root, "Signal");
-
-    json_rc = configHandler_checkExists(jobj_wifi_ssid, "Wifi", "SSId");
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    json_rc = configHandler_checkExists(jobj_wifi_bssid, "Wifi", "BSSId");
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    json_rc = configHandler_checkExists(jobj_wifi_channel, "Wifi", "Channel");
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    json_rc = configHandler_checkExists(jobj_wifi_mode, "Wifi", "Mode");
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    json_rc = configHandler_checkExists(jobj_wifi_rssi, "Wifi", "RSSI");
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    json_rc = configHandler_checkExists(jobj_wifi_signal, "Wifi", "Signal");
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-
-    configPtr_devices[device].deviceState.uptime = strdup(jobj_uptime->valuestring);
-    json_rc = configHandler_callocSuccess(configPtr_devices[device].deviceState.uptime);
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    configPtr_devices[device].deviceState.color = strdup(jobj_color->valuestring);
-    json_rc = configHandler_callocSuccess(configPtr_devices[device].deviceState.color);
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    configPtr_devices[device].deviceState.hsbcolor = strdup(jobj_hsbcolor->valuestring);
-    json_rc = configHandler_callocSuccess(configPtr_devices[device].deviceState.hsbcolor);
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    configPtr_devices[device].deviceState.power = strdup(jobj_power->valuestring);
-    json_rc = configHandler_callocSuccess(configPtr_devices[device].deviceState.power);
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    configPtr_devices[device].deviceState.wifi_ssid = strdup(jobj_wifi_ssid->valuestring);
-    json_rc = configHandler_callocSuccess(configPtr_devices[device].deviceState.wifi_ssid);
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    configPtr_devices[device].deviceState.wifi_bssid = strdup(jobj_wifi_bssid->valuestring);
-    json_rc = configHandler_callocSuccess(configPtr_devices[device].deviceState.wifi_bssid);
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-    configPtr_devices[device].deviceState.wifi_mode = strdup(jobj_wifi_mode->valuestring);
-    json_rc = configHandler_callocSuccess(configPtr_devices[device].deviceState.wifi_mode);
-    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
-
-    configPtr_devices[device].deviceState.mqttCount = jobj_mqttCount->valueint;
-    configPtr_devices[device].deviceState.dimmer = jobj_dimmer->valueint;
-    configPtr_devices[device].deviceState.wifi_channel = jobj_wifi_channel->valueint;
-    configPtr_devices[device].deviceState.wifi_rssi = jobj_wifi_rssi->valueint;
-    configPtr_devices[device].deviceState.wifi_signal = jobj_wifi_signal->valueint;
-
-    // Update states
-    configPtr_devices[device].brightness = configPtr_devices[device].deviceState.dimmer;
-    //configPtr_devices[device].color[0] = configPtr_devices[device].deviceState.dimmer;
-
-    goto processStateResponse_cleanup_success;
-
-processStateResponse_cleanup_fail:
-    cJSON_Delete(jobj_state);
-    mqttHandler_cleanState(device);
-    return 1;
-processStateResponse_cleanup_success:
-    cJSON_Delete(jobj_state);
-    return 0;
+    int holders = 0;
+    for (int i = 0; i < deviceCount; i++) {
+        if (configPtr_devices[i].groupTopic != NULL && strcmp(configPtr_devices[i].groupTopic, groupTopic) == 0) {
+            holders++;
+        }
+    }
+    return holders == count ? devices[0] : -1;
 }
 
-void mqttHandler_cleanState(int device) {
-    printf("%s +\n", __func__);
-    if (configPtr_devices[device].deviceState.uptime != NULL) { free(configPtr_devices[device].deviceState.uptime); }
-    if (configPtr_devices[device].deviceState.color != NULL) { free(configPtr_devices[device].deviceState.color); }
-    if (configPtr_devices[device].deviceState.hsbcolor != NULL) { free(configPtr_devices[device].deviceState.hsbcolor); }
-    if (configPtr_devices[device].deviceState.power != NULL) { free(configPtr_devices[device].deviceState.power); }
-    if (configPtr_devices[device].deviceState.wifi_ssid != NULL) { free(configPtr_devices[device].deviceState.wifi_ssid); }
-    if (configPtr_devices[device].deviceState.wifi_bssid != NULL) { free(configPtr_devices[device].deviceState.wifi_bssid); }
-    if (configPtr_devices[device].deviceState.wifi_mode != NULL) { free(configPtr_devices[device].deviceState.wifi_mode); }
-    configPtr_devices[device].deviceState.mqttCount = 0;
-    configPtr_devices[device].deviceState.dimmer = 0;
-    configPtr_devices[device].deviceState.wifi_channel = 0;
-    configPtr_devices[device].deviceState.wifi_rssi = 0;
-    configPtr_devices[device].deviceState.wifi_signal = 0;
+// Send the same command to several devices in one batch, and time until every one of them has acknowledged it
+int mqttHandler_fanoutCommand(int type, int action, const int* devices, int count, uint32_t content) {
+    if (count <= 0) { return 1; }
+
+    // Start tracking, the members are only marked once the counters are set (The MQTT thread acknowledges members as soon as they are marked)
+    pthread_mutex_lock(&fanoutMutex);
+    for (int i = 0; i < deviceCount; i++) {
+        atomic_store(&configPtr_devices[i].fanoutPending, 0);
+    }
+    atomic_store(&fanoutStart, waitHandler_monotonicNs());
+    atomic_store(&fanoutRemaining, count);
+    atomic_store(&fanoutCount, count);
+    atomic_store(&fanoutLatency, -1);
+    for (int i = 0; i < count; i++) {
+        atomic_store(&configPtr_devices[devices[i]].fanoutPending, 1);
+    }
+    pthread_mutex_unlock(&fanoutMutex);
+
+    // The commands are sent right away, the shadow only has to know what the devices should end up at
+    for (int i = 0; i < count; i++) {
+        if (action == FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_ON || action == FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_OFF) {
+            shadowHandler_setDesired(devices[i], SHADOW_FIELD_POWER, action == FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_ON, 1);
+        } else if (action == FLAG_DISPATCH_ACTION_OPENBK_LIGHT_BRIGHTNESS) {
+            shadowHandler_setDesired(devices[i], SHADOW_FIELD_BRIGHTNESS, (int)content, 1);
+        } else if (action == FLAG_DISPATCH_ACTION_OPENBK_LIGHT_WARMTH) {
+            shadowHandler_setDesired(devices[i], SHADOW_FIELD_WARMTH, (int)content, 1);
+        } else if (action == FLAG_DISPATCH_ACTION_OPENBK_LIGHT_COLOR) {
+            shadowHandler_setDesired(devices[i], SHADOW_FIELD_COLOR, (int)content, 1);
+        }
+    }
+
+    // A state request is sent after the command so every device answers with a State response, which is the acknowledgement
+    int groupDevice = mqttHandler_findSharedGroupTopic(devices, count);
+    if (groupDevice != -1) {
+        printf("Fan-out to %d devices through group topic %s.\n", count, configPtr_devices[groupDevice].groupTopic);
+        queueHandler_command_t commands[2] = {
+            { type, action, groupDevice, QUEUE_FLAG_GROUP_TOPIC, content },
+            { type, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_REQUEST_STATE, groupDevice, QUEUE_FLAG_GROUP_TOPIC, 0 }
+        };
+        return queueHandler_pushBatch(commands, 2);
+    }
+
+    queueHandler_command_t* commands = (queueHandler_command_t*)calloc(count * 2, sizeof(queueHandler_command_t));
+    if (commands == NULL) {
+        printf("ERROR: Could not allocate memory on the heap.\n");
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        commands[i] = (queueHandler_command_t){ type, action, devices[i], 0, content };
+        commands[count + i] = (queueHandler_command_t){ type, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_REQUEST_STATE, devices[i], 0, 0 };
+    }
+    rc = queueHandler_pushBatch(commands, count * 2);
+    free(commands);
+    return rc;
 }
 
-int mqttHandler_processStatusResponse(char* content) {
-    printf("\n\n\nStatus Content: %s\n\n\n", content);
+// Called when a device sends a State response
+void mqttHandler_acknowledge(int device) {
+    uint64_t now = waitHandler_monotonicNs();
+
+    uint64_t sentAt = atomic_exchange(&configPtr_devices[device].commandSentAt, 0);
+    if (sentAt != 0) {
+        configPtr_devices[device].commandLatency = (int)((now - sentAt) / 1000000ULL);
+    }
+
+    if (atomic_exchange(&configPtr_devices[device].fanoutPending, 0) == 1) {
+        if (atomic_fetch_sub(&fanoutRemaining, 1) == 1) {
+            atomic_store(&fanoutLatency, (int)((now - atomic_load(&fanoutStart)) / 1000000ULL));
+            printf("Fan-out to %d devices fully acknowledged in %d ms.\n", atomic_load(&fanoutCount), atomic_load(&fanoutLatency));
+        }
+    }
 }
 
-// This thread's only purpose is to run once on startup, sending an MQTT request for the state of each device configured in the config
+// Ask each device configured in the config for its state, run by the connection thread every time it connects
 void* mqttHandler_initDeviceInfo(void*) {
     printf("%s +\n", __func__);
 
     for (int i = 0; i < deviceCount; i++) {
-        // Create topic
-        char* topic = NULL;
-        asprintf(&topic, "cmnd/%s/state", configPtr_devices[i].name);
-
-        // Send MQTT message
-        MQTTClient_message obj = MQTTClient_message_initializer;
-        MQTTClient_deliveryToken token;
-        obj.qos = 0;
-        obj.retained = 0;
-        MQTTClient_publishMessage(client, topic, &obj, &token); // TODO handle response?
-
-        // Cleanup
-        if (topic != NULL) { free(topic); } else { 
-            printf("Non-critical ERROR: Something went wrong in mqttHandler_initDeviceInfo, could not allocate memory.\n");
+        const driverHandler_driver_t* driver = driverHandler_get(i);
+        if (driver->requestState != NULL) {
+            driver->requestState(i); // TODO handle response?
         }
     }
+    return NULL;
 }
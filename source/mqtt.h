@@ -1,17 +1,47 @@
 #ifndef _MQTT_H
 #define _MQTT_H
 #include <MQTTClient.h>
+#include "queue.h"
+
+// Longest payload of a merged 'backlog' message
+#define MQTT_BACKLOG_MAX_LENGTH 512
+
+// Seconds a single connection attempt may take
+#define MQTT_CONNECT_TIMEOUT 5
+
+// Reconnect backoff (Doubles every failed attempt up to the maximum)
+#define MQTT_RETRY_BASE_MS 1000
+#define MQTT_RETRY_MAX_MS 30000
+
+#define MQTT_STATE_DISCONNECTED 0
+#define MQTT_STATE_CONNECTING 1
+#define MQTT_STATE_CONNECTED 2
+
+typedef struct {
+    int state; // MQTT_STATE_*
+    int attempts; // Failed attempts since the last successful connection
+    int error; // Client error code of the last attempt
+    int retryInMs; // Until the next attempt, while disconnected
+} mqttHandler_status_t;
+
+typedef struct {
+    queueHandler_command_t command;
+    int order; // Position in the drained batch, to keep the order of commands stable when merging
+} mqttHandler_pendingCommand_t;
 
 int mqttHandler_init();
+int mqttHandler_connectOnce();
+void* mqttHandler_connectionThread(void*);
+void mqttHandler_getStatus(mqttHandler_status_t* status);
 void mqttHandler_deinit();
 int message_arrived_callback(void* context, char* topicName, int topicLen, MQTTClient_message* message);
 void connection_lost_callback(void* context, char* cause);
-int mqttHandler_processMessage(char* topic, char* content);
 void* mqttHandler_commandDispatcher(void*);
-int mqttHandler_sendOpenBKLightCommand(int device, char* cmnd, int useContent, uint32_t content);
-int mqttHandler_processStateResponse(char* content, int device);
-void mqttHandler_cleanState(int device);
-int mqttHandler_processStatusResponse(char* content);
+int mqttHandler_dispatchCommand(const queueHandler_command_t* command);
+int mqttHandler_dispatchBacklog(const mqttHandler_pendingCommand_t* commands, int count);
+int mqttHandler_publish(const char* topic, const char* payload);
+int mqttHandler_fanoutCommand(int type, int action, const int* devices, int count, uint32_t content);
+void mqttHandler_acknowledge(int device);
 void* mqttHandler_initDeviceInfo(void*);
 
 #endif
@@ -0,0 +1,389 @@
+/*
+// IoT Controller
+// OpenBK Light / Power Monitor Driver
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "openbk.h"
+#include "driver.h"
+#include "config.h"
+#include "mqtt.h"
+#include "states.h"
+#include "color.h"
+#include "scene.h"
+#include "shadow.h"
+#include "powermon.h"
+#include "history.h"
+#include "scan.h"
+#include "wait.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdatomic.h>
+#include <cjson/cJSON.h>
+
+/* Info
+// <name>/connected --> Connection status ("online")
+// <name>/... --> General status update
+// stat/<name>/RESULT --> State response
+// stat/<name>/STATUS --> Status response
+// cmnd/<name or group topic>/<command> --> Commands
+// Power monitors (BL0937/BL0942) additionally publish:
+// <name>/voltage/get, <name>/current/get, <name>/power/get --> Samples (Plain numbers, about once a second)
+// <name>/energycounter/get --> Energy counter in Wh
+// <name>/1/get --> Relay state ("1" / "0")
+*/
+
+// Devices
+extern int deviceCount;
+extern configPtr_device_t configPtr_devices[];
+
+extern atomic_uint stateGeneration;
+
+static int json_rc = 0;
+
+const driverHandler_driver_t openbkDriver = {
+    "openbk_light",
+    openbkDriver_route,
+    openbkDriver_handleMessage,
+    openbkDriver_encodeCommand,
+    openbkDriver_sendCommand,
+    "backlog",
+    openbkDriver_requestState
+};
+
+const driverHandler_driver_t openbkPowermonDriver = {
+    "openbk_powermon",
+    openbkPowermonDriver_route,
+    openbkPowermonDriver_handleMessage,
+    openbkPowermonDriver_encodeCommand,
+    openbkDriver_sendCommand,
+    "backlog",
+    openbkDriver_requestState
+};
+
+int openbkDriver_route(char** levels, int levelCount, const char** name) {
+    if (levelCount >= 3 && strcmp(levels[0], "stat") == 0) {
+        *name = levels[1];
+        if (strcmp(levels[2], "RESULT") == 0) { return OPENBK_MESSAGE_RESULT; }
+        if (strcmp(levels[2], "STATUS") == 0) { return OPENBK_MESSAGE_STATUS; }
+        return -1;
+    }
+    if (levelCount >= 2 && strcmp(levels[0], "cmnd") != 0 && strcmp(levels[0], "tele") != 0) {
+        *name = levels[0];
+        return strcmp(levels[1], "connected") == 0 ? OPENBK_MESSAGE_CONNECTED : OPENBK_MESSAGE_GENERAL;
+    }
+    return -1;
+}
+
+int openbkDriver_handleMessage(int device, int kind, char* content) {
+    switch (kind) {
+        case OPENBK_MESSAGE_CONNECTED:
+            printf("Device %s sent a general status update.\n", configPtr_devices[device].prettyName);
+            if (strcmp(content, "online") == 0) {
+                // Device is online
+                configPtr_devices[device].online = 1;
+                atomic_fetch_add(&stateGeneration, 1);
+                shadowHandler_onOnline(device);
+            }
+            break;
+        case OPENBK_MESSAGE_GENERAL:
+            printf("Device %s sent a general status update.\n", configPtr_devices[device].prettyName);
+            break;
+        case OPENBK_MESSAGE_RESULT:
+            printf("Device %s sent a State response.\n", configPtr_devices[device].prettyName);
+            openbkDriver_processStateResponse(content, device);
+            atomic_fetch_add(&stateGeneration, 1);
+            mqttHandler_acknowledge(device);
+            sceneHandler_onStateResponse(device);
+            break;
+        case OPENBK_MESSAGE_STATUS:
+            printf("Device %s sent a Status response.\n", configPtr_devices[device].prettyName);
+            openbkDriver_processStatusResponse(content);
+            break;
+        default:
+            return 1;
+    }
+    return 0;
+}
+
+// Convert a queued command into an OpenBK command name and payload
+int openbkDriver_encodeCommand(const queueHandler_command_t* command, const char** cmnd, char payload[16]) {
+    payload[0] = '\0';
+    switch (command->action) {
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_ON:
+            *cmnd = "led_enableAll";
+            strcpy(payload, "1");
+            break;
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_OFF:
+            *cmnd = "led_enableAll";
+            strcpy(payload, "0");
+            break;
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_BRIGHTNESS:
+            *cmnd = "led_dimmer";
+            snprintf(payload, 16, "%u", command->content);
+            break;
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_WARMTH:
+            // Warmth (0 - 100) is mapped onto OpenBK's color temperature range in mireds
+            *cmnd = "led_temperature";
+            snprintf(payload, 16, "%u", OPENBK_TEMPERATURE_MIN + ((command->content > 100 ? 100 : command->content) * (OPENBK_TEMPERATURE_MAX - OPENBK_TEMPERATURE_MIN) / 100));
+            break;
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_COLOR:
+            *cmnd = "led_basecolor_rgb";
+            payload[0] = '#';
+            colorHandler_encodeHex(command->content, payload + 1);
+            break;
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_REQUEST_STATE:
+            *cmnd = "state";
+            break;
+        default:
+            return 1;
+    }
+    return 0;
+}
+
+// Send an OpenBK command to a device name or group topic, an empty payload sends no content
+int openbkDriver_sendCommand(const char* target, const char* cmnd, const char* payload) {
+    char topic[256];
+    snprintf(topic, sizeof(topic), "cmnd/%s/%s", target, cmnd);
+    return mqttHandler_publish(topic, payload);
+}
+
+int openbkDriver_requestState(int device) {
+    return openbkDriver_sendCommand(configPtr_devices[device].name, "state", "");
+}
+
+int openbkDriver_processStateResponse(char* content, int device) {
+    // Clean the deviceState struct
+    openbkDriver_cleanState(device);
+
+    // Parse JSON
+    cJSON* jobj_state = cJSON_Parse(content);
+    if (jobj_state == NULL) {
+        const char* jerr_ptr = cJSON_GetErrorPtr();
+        if (jerr_ptr != NULL) {
+            printf("ERROR: Parsing JSON returned error: (%s)\n", jerr_ptr);
+        } else {
+            printf("ERROR: Parsing JSON returned unknown error.\n");
+        }
+        goto processStateResponse_cleanup_fail;
+    }
+
+    cJSON* jobj_uptime = cJSON_GetObjectItemCaseSensitive(jobj_state, "Uptime");
+    cJSON* jobj_mqttCount = cJSON_GetObjectItemCaseSensitive(jobj_state, "MqttCount");
+    cJSON* jobj_dimmer = cJSON_GetObjectItemCaseSensitive(jobj_state, "Dimmer");
+    cJSON* jobj_color = cJSON_GetObjectItemCaseSensitive(jobj_state, "Color");
+    cJSON* jobj_hsbcolor = cJSON_GetObjectItemCaseSensitive(jobj_state, "HSBColor");
+    cJSON* jobj_channel = cJSON_GetObjectItemCaseSensitive(jobj_state, "Channel");
+    cJSON* jobj_power = cJSON_GetObjectItemCaseSensitive(jobj_state, "POWER");
+    cJSON* jobj_wifi_root = cJSON_GetObjectItemCaseSensitive(jobj_state, "Wifi");
+
+    json_rc = configHandler_checkExists(jobj_uptime, "root", "Uptime");
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    json_rc = configHandler_checkExists(jobj_mqttCount, "root", "MqttCount");
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    json_rc = configHandler_checkExists(jobj_dimmer, "root", "Dimmer");
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    json_rc = configHandler_checkExists(jobj_color, "root", "Color");
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    json_rc = configHandler_checkExists(jobj_hsbcolor, "root", "HSBColor");
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    json_rc = configHandler_checkExists(jobj_channel, "root", "Channel");
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    json_rc = configHandler_checkExists(jobj_power, "root", "POWER");
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    json_rc = configHandler_checkExists(jobj_wifi_root, "root", "Wifi");
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+
+    cJSON* jobj_wifi_ssid = cJSON_GetObjectItemCaseSensitive(jobj_wifi_root, "SSId");
+    cJSON* jobj_wifi_bssid = cJSON_GetObjectItemCaseSensitive(jobj_wifi_root, "BSSId");
+    cJSON* jobj_wifi_channel = cJSON_GetObjectItemCaseSensitive(jobj_wifi_root, "Channel");
+    cJSON* jobj_wifi_mode = cJSON_GetObjectItemCaseSensitive(jobj_wifi_root, "Mode");
+    cJSON* jobj_wifi_rssi = cJSON_GetObjectItemCaseSensitive(jobj_wifi_root, "RSSI");
+    cJSON* jobj_wifi_signal = cJSON_GetObjectItemCaseSensitive(jobj_wifi_root, "Signal");
+
+    json_rc = configHandler_checkExists(jobj_wifi_ssid, "Wifi", "SSId");
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    json_rc = configHandler_checkExists(jobj_wifi_bssid, "Wifi", "BSSId");
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    json_rc = configHandler_checkExists(jobj_wifi_channel, "Wifi", "Channel");
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    json_rc = configHandler_checkExists(jobj_wifi_mode, "Wifi", "Mode");
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    json_rc = configHandler_checkExists(jobj_wifi_rssi, "Wifi", "RSSI");
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    json_rc = configHandler_checkExists(jobj_wifi_signal, "Wifi", "Signal");
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+
+    configPtr_devices[device].deviceState.uptime = strdup(jobj_uptime->valuestring);
+    json_rc = configHandler_callocSuccess(configPtr_devices[device].deviceState.uptime);
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    configPtr_devices[device].deviceState.color = strdup(jobj_color->valuestring);
+    json_rc = configHandler_callocSuccess(configPtr_devices[device].deviceState.color);
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    configPtr_devices[device].deviceState.hsbcolor = strdup(jobj_hsbcolor->valuestring);
+    json_rc = configHandler_callocSuccess(configPtr_devices[device].deviceState.hsbcolor);
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    configPtr_devices[device].deviceState.power = strdup(jobj_power->valuestring);
+    json_rc = configHandler_callocSuccess(configPtr_devices[device].deviceState.power);
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    configPtr_devices[device].deviceState.wifi_ssid = strdup(jobj_wifi_ssid->valuestring);
+    json_rc = configHandler_callocSuccess(configPtr_devices[device].deviceState.wifi_ssid);
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    configPtr_devices[device].deviceState.wifi_bssid = strdup(jobj_wifi_bssid->valuestring);
+    json_rc = configHandler_callocSuccess(configPtr_devices[device].deviceState.wifi_bssid);
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+    configPtr_devices[device].deviceState.wifi_mode = strdup(jobj_wifi_mode->valuestring);
+    json_rc = configHandler_callocSuccess(configPtr_devices[device].deviceState.wifi_mode);
+    if (json_rc == 1) { goto processStateResponse_cleanup_fail; }
+
+    configPtr_devices[device].deviceState.mqttCount = jobj_mqttCount->valueint;
+    configPtr_devices[device].deviceState.dimmer = jobj_dimmer->valueint;
+    configPtr_devices[device].deviceState.wifi_channel = jobj_wifi_channel->valueint;
+    configPtr_devices[device].deviceState.wifi_rssi = jobj_wifi_rssi->valueint;
+    configPtr_devices[device].deviceState.wifi_signal = jobj_wifi_signal->valueint;
+
+    int64_t now = historyHandler_now();
+    historyHandler_append(device, HISTORY_SERIES_DIMMER, now, configPtr_devices[device].deviceState.dimmer);
+    historyHandler_append(device, HISTORY_SERIES_RSSI, now, configPtr_devices[device].deviceState.wifi_signal);
+
+    // Update the reported side of the device shadow (Never the desired side, that belongs to the interface/scenes)
+    int reported[SHADOW_FIELD_COUNT] = { SHADOW_UNKNOWN, SHADOW_UNKNOWN, SHADOW_UNKNOWN, SHADOW_UNKNOWN };
+    reported[SHADOW_FIELD_POWER] = strcasecmp(configPtr_devices[device].deviceState.power, "ON") == 0 ? 1 : 0;
+    reported[SHADOW_FIELD_BRIGHTNESS] = configPtr_devices[device].deviceState.dimmer;
+
+    // Decode the reported color, falling back to HSB if 'Color' is not in a known format
+    float rgb[3];
+    if (colorHandler_decodeColor(configPtr_devices[device].deviceState.color, rgb) == 0 ||
+        colorHandler_decodeHsb(configPtr_devices[device].deviceState.hsbcolor, rgb) == 0) {
+        reported[SHADOW_FIELD_COLOR] = (int)colorHandler_packRgb(rgb);
+    }
+    shadowHandler_report(device, reported);
+
+    goto processStateResponse_cleanup_success;
+
+processStateResponse_cleanup_fail:
+    cJSON_Delete(jobj_state);
+    openbkDriver_cleanState(device);
+    return 1;
+processStateResponse_cleanup_success:
+    cJSON_Delete(jobj_state);
+    return 0;
+}
+
+void openbkDriver_cleanState(int device) {
+    printf("%s +\n", __func__);
+    if (configPtr_devices[device].deviceState.uptime != NULL) { free(configPtr_devices[device].deviceState.uptime); configPtr_devices[device].deviceState.uptime = NULL; }
+    if (configPtr_devices[device].deviceState.color != NULL) { free(configPtr_devices[device].deviceState.color); configPtr_devices[device].deviceState.color = NULL; }
+    if (configPtr_devices[device].deviceState.hsbcolor != NULL) { free(configPtr_devices[device].deviceState.hsbcolor); configPtr_devices[device].deviceState.hsbcolor = NULL; }
+    if (configPtr_devices[device].deviceState.power != NULL) { free(configPtr_devices[device].deviceState.power); configPtr_devices[device].deviceState.power = NULL; }
+    if (configPtr_devices[device].deviceState.wifi_ssid != NULL) { free(configPtr_devices[device].deviceState.wifi_ssid); configPtr_devices[device].deviceState.wifi_ssid = NULL; }
+    if (configPtr_devices[device].deviceState.wifi_bssid != NULL) { free(configPtr_devices[device].deviceState.wifi_bssid); configPtr_devices[device].deviceState.wifi_bssid = NULL; }
+    if (configPtr_devices[device].deviceState.wifi_mode != NULL) { free(configPtr_devices[device].deviceState.wifi_mode); configPtr_devices[device].deviceState.wifi_mode = NULL; }
+    configPtr_devices[device].deviceState.mqttCount = 0;
+    configPtr_devices[device].deviceState.dimmer = 0;
+    configPtr_devices[device].deviceState.wifi_channel = 0;
+    configPtr_devices[device].deviceState.wifi_rssi = 0;
+    configPtr_devices[device].deviceState.wifi_signal = 0;
+}
+
+int openbkDriver_processStatusResponse(char* content) {
+    printf("\n\n\nStatus Content: %s\n\n\n", content);
+    return 0;
+}
+
+int openbkPowermonDriver_route(char** levels, int levelCount, const char** name) {
+    if (levelCount == 3 && strcmp(levels[2], "get") == 0) {
+        *name = levels[0];
+        if (strcmp(levels[1], "voltage") == 0) { return OPENBK_MESSAGE_VOLTAGE; }
+        if (strcmp(levels[1], "current") == 0) { return OPENBK_MESSAGE_CURRENT; }
+        if (strcmp(levels[1], "power") == 0) { return OPENBK_MESSAGE_POWER; }
+        if (strcmp(levels[1], "energycounter") == 0) { return OPENBK_MESSAGE_ENERGY; }
+        if (strcmp(levels[1], "1") == 0) { return OPENBK_MESSAGE_RELAY; }
+        return -1;
+    }
+    if (levelCount >= 3 && strcmp(levels[0], "stat") == 0 && strcmp(levels[2], "RESULT") == 0) {
+        *name = levels[1];
+        return OPENBK_MESSAGE_RESULT;
+    }
+    if (levelCount == 2 && strcmp(levels[1], "connected") == 0) {
+        *name = levels[0];
+        return OPENBK_MESSAGE_CONNECTED;
+    }
+    return -1;
+}
+
+static void openbkPowermonDriver_reportPower(int device, int power) {
+    if (configPtr_devices[device].deviceState.power == NULL || strcasecmp(configPtr_devices[device].deviceState.power, power ? "ON" : "OFF") != 0) {
+        driverHandler_setString(&configPtr_devices[device].deviceState.power, power ? "ON" : "OFF");
+        atomic_fetch_add(&stateGeneration, 1);
+    }
+    int reported[SHADOW_FIELD_COUNT] = { power, SHADOW_UNKNOWN, SHADOW_UNKNOWN, SHADOW_UNKNOWN };
+    shadowHandler_report(device, reported);
+}
+
+int openbkPowermonDriver_handleMessage(int device, int kind, char* content) {
+    // NOTE: Samples arrive every second from every plug, so they are folded into the aggregates without logging,
+    // and do not bump stateGeneration (The info panel reads the aggregates directly)
+    switch (kind) {
+        case OPENBK_MESSAGE_CONNECTED:
+            if (strcmp(content, "online") == 0) {
+                configPtr_devices[device].online = 1;
+                atomic_fetch_add(&stateGeneration, 1);
+                shadowHandler_onOnline(device);
+            }
+            break;
+        case OPENBK_MESSAGE_VOLTAGE:
+            powermonHandler_addSample(device, POWERMON_QUANTITY_VOLTAGE, strtof(content, NULL), configPtr_devices[device].lastSeen);
+            break;
+        case OPENBK_MESSAGE_CURRENT:
+            powermonHandler_addSample(device, POWERMON_QUANTITY_CURRENT, strtof(content, NULL), configPtr_devices[device].lastSeen);
+            break;
+        case OPENBK_MESSAGE_POWER:
+            powermonHandler_addSample(device, POWERMON_QUANTITY_POWER, strtof(content, NULL), configPtr_devices[device].lastSeen);
+            break;
+        case OPENBK_MESSAGE_ENERGY:
+            powermonHandler_setCounter(device, strtod(content, NULL) / 1000.0);
+            break;
+        case OPENBK_MESSAGE_RELAY:
+            openbkPowermonDriver_reportPower(device, strcmp(content, "0") != 0 ? 1 : 0);
+            break;
+        case OPENBK_MESSAGE_RESULT: {
+            // Only the relay state is of interest here
+            char power[8];
+            scanHandler_field_t fields[] = { { .key = "POWER", .type = SCAN_TYPE_STRING, .string = power, .stringSize = sizeof(power) } };
+            if (scanHandler_scan(content, strlen(content), fields, 1) == 1) {
+                openbkPowermonDriver_reportPower(device, strcasecmp(power, "ON") == 0 ? 1 : 0);
+            }
+            mqttHandler_acknowledge(device);
+            sceneHandler_onStateResponse(device);
+            break;
+        }
+        default:
+            return 1;
+    }
+    return 0;
+}
+
+// Power monitors only have a relay, everything else a light supports is rejected
+int openbkPowermonDriver_encodeCommand(const queueHandler_command_t* command, const char** cmnd, char payload[16]) {
+    payload[0] = '\0';
+    switch (command->action) {
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_ON:
+            *cmnd = "POWER";
+            strcpy(payload, "ON");
+            break;
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_OFF:
+            *cmnd = "POWER";
+            strcpy(payload, "OFF");
+            break;
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_REQUEST_STATE:
+            *cmnd = "state";
+            break;
+        default:
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef _OPENBK_H
+#define _OPENBK_H
+#include "queue.h"
+
+// OpenBK color temperature range in mireds (Cold - Warm)
+#define OPENBK_TEMPERATURE_MIN 154
+#define OPENBK_TEMPERATURE_MAX 500
+
+// Message kinds reported by the router
+#define OPENBK_MESSAGE_CONNECTED 0
+#define OPENBK_MESSAGE_GENERAL 1
+#define OPENBK_MESSAGE_RESULT 2
+#define OPENBK_MESSAGE_STATUS 3
+#define OPENBK_MESSAGE_VOLTAGE 4
+#define OPENBK_MESSAGE_CURRENT 5
+#define OPENBK_MESSAGE_POWER 6
+#define OPENBK_MESSAGE_ENERGY 7
+#define OPENBK_MESSAGE_RELAY 8
+
+int openbkDriver_route(char** levels, int levelCount, const char** name);
+int openbkDriver_handleMessage(int device, int kind, char* content);
+int openbkDriver_encodeCommand(const queueHandler_command_t* command, const char** cmnd, char payload[16]);
+int openbkDriver_sendCommand(const char* target, const char* cmnd, const char* payload);
+int openbkDriver_requestState(int device);
+int openbkDriver_processStateResponse(char* content, int device);
+void openbkDriver_cleanState(int device);
+int openbkDriver_processStatusResponse(char* content);
+int openbkPowermonDriver_route(char** levels, int levelCount, const char** name);
+int openbkPowermonDriver_handleMessage(int device, int kind, char* content);
+int openbkPowermonDriver_encodeCommand(const queueHandler_command_t* command, const char** cmnd, char payload[16]);
+
+#endif
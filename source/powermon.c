@@ -0,0 +1,133 @@
+/*
+// IoT Controller
+// Power Monitor Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "powermon.h"
+#include "config.h"
+#include "wait.h"
+#include "history.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// NOTE: Samples are folded into the aggregates as they arrive and then dropped, so memory per device is fixed:
+// - Totals (min/max/mean/count) are updated incrementally
+// - The rolling window keeps one bucket per minute, a bucket is reset when its slot comes around again
+// - Energy is integrated from consecutive power samples (Trapezoidal)
+// Aggregates are only allocated for devices that actually send samples.
+
+static pthread_mutex_t powermonMutex = PTHREAD_MUTEX_INITIALIZER;
+static powermonHandler_device_t* powermons[MAX_DEVICES] = { NULL };
+
+static powermonHandler_device_t* powermonHandler_getDevice(int device) {
+    if (powermons[device] != NULL) { return powermons[device]; }
+
+    powermonHandler_device_t* powermon = (powermonHandler_device_t*)calloc(1, sizeof(powermonHandler_device_t));
+    if (powermon == NULL) {
+        printf("ERROR: Could not allocate memory on the heap.\n");
+        return NULL;
+    }
+    powermon->counterKWh = -1;
+    powermons[device] = powermon;
+    return powermon;
+}
+
+static void powermonHandler_fold(powermonHandler_stats_t* stats, float value) {
+    if (stats->count == 0 || value < stats->min) { stats->min = value; }
+    if (stats->count == 0 || value > stats->max) { stats->max = value; }
+    stats->count++;
+    stats->mean += (value - stats->mean) / (float)stats->count;
+    stats->last = value;
+}
+
+// Add a sample (Timestamp in monotonic ns)
+int powermonHandler_addSample(int device, int quantity, float value, uint64_t timestamp) {
+    if (device < 0 || device >= MAX_DEVICES || quantity < 0 || quantity >= POWERMON_QUANTITY_COUNT) { return 1; }
+
+    pthread_mutex_lock(&powermonMutex);
+    powermonHandler_device_t* powermon = powermonHandler_getDevice(device);
+    if (powermon == NULL) {
+        pthread_mutex_unlock(&powermonMutex);
+        return 1;
+    }
+
+    powermonHandler_fold(&powermon->total[quantity], value);
+
+    uint32_t minute = (uint32_t)(timestamp / 60000000000ULL) + 1;
+    powermonHandler_bucket_t* bucket = &powermon->buckets[quantity][minute % POWERMON_WINDOW_MINUTES];
+    if (bucket->minute != minute) {
+        bucket->minute = minute;
+        bucket->count = 0;
+        bucket->sum = 0;
+        bucket->min = value;
+        bucket->max = value;
+    }
+    if (value < bucket->min) { bucket->min = value; }
+    if (value > bucket->max) { bucket->max = value; }
+    bucket->sum += value;
+    bucket->count++;
+
+    if (quantity == POWERMON_QUANTITY_POWER) {
+        historyHandler_append(device, HISTORY_SERIES_POWER, historyHandler_now(), value);
+        if (powermon->lastPowerAt != 0 && timestamp > powermon->lastPowerAt &&
+            timestamp - powermon->lastPowerAt <= POWERMON_MAX_GAP_SECONDS * 1000000000ULL) {
+            double hours = (double)(timestamp - powermon->lastPowerAt) / 3600e9;
+            powermon->energyWh += (powermon->lastPower + value) * 0.5 * hours;
+        }
+        powermon->lastPowerAt = timestamp;
+        powermon->lastPower = value;
+    }
+
+    pthread_mutex_unlock(&powermonMutex);
+    return 0;
+}
+
+// Store the device's own energy counter
+int powermonHandler_setCounter(int device, double kWh) {
+    if (device < 0 || device >= MAX_DEVICES) { return 1; }
+
+    pthread_mutex_lock(&powermonMutex);
+    powermonHandler_device_t* powermon = powermonHandler_getDevice(device);
+    if (powermon != NULL) { powermon->counterKWh = kWh; }
+    pthread_mutex_unlock(&powermonMutex);
+    return powermon == NULL ? 1 : 0;
+}
+
+void powermonHandler_getSummary(int device, powermonHandler_summary_t* out) {
+    out->hasSamples = 0;
+    out->energyKWh = 0;
+    out->counterKWh = -1;
+    if (device < 0 || device >= MAX_DEVICES) { return; }
+
+    uint32_t oldest = (uint32_t)(waitHandler_monotonicNs() / 60000000000ULL) + 1;
+    oldest = oldest >= POWERMON_WINDOW_MINUTES ? oldest - (POWERMON_WINDOW_MINUTES - 1) : 1;
+
+    pthread_mutex_lock(&powermonMutex);
+    powermonHandler_device_t* powermon = powermons[device];
+    if (powermon != NULL) {
+        out->hasSamples = 1;
+        out->energyKWh = powermon->energyWh / 1000.0;
+        out->counterKWh = powermon->counterKWh;
+        for (int q = 0; q < POWERMON_QUANTITY_COUNT; q++) {
+            out->total[q] = powermon->total[q];
+
+            // Combine the buckets still inside the window
+            powermonHandler_stats_t* window = &out->window[q];
+            double sum = 0;
+            *window = (powermonHandler_stats_t){ powermon->total[q].last, 0, 0, 0, 0 };
+            for (int b = 0; b < POWERMON_WINDOW_MINUTES; b++) {
+                powermonHandler_bucket_t* bucket = &powermon->buckets[q][b];
+                if (bucket->minute < oldest || bucket->count == 0) { continue; }
+                if (window->count == 0 || bucket->min < window->min) { window->min = bucket->min; }
+                if (window->count == 0 || bucket->max > window->max) { window->max = bucket->max; }
+                window->count += bucket->count;
+                sum += bucket->sum;
+            }
+            window->mean = window->count > 0 ? (float)(sum / (double)window->count) : 0;
+        }
+    }
+    pthread_mutex_unlock(&powermonMutex);
+}
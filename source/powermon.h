@@ -0,0 +1,55 @@
+#ifndef _POWERMON_H
+#define _POWERMON_H
+#include <stdint.h>
+
+#define POWERMON_QUANTITY_VOLTAGE 0 // V
+#define POWERMON_QUANTITY_CURRENT 1 // A
+#define POWERMON_QUANTITY_POWER 2 // W
+#define POWERMON_QUANTITY_COUNT 3
+
+// Rolling window, kept as one bucket per minute
+#define POWERMON_WINDOW_MINUTES 60
+
+// Power samples further apart than this are not integrated into energy (Device was offline)
+#define POWERMON_MAX_GAP_SECONDS 300
+
+typedef struct {
+    float last;
+    float min;
+    float max;
+    float mean;
+    uint64_t count;
+} powermonHandler_stats_t;
+
+typedef struct {
+    uint32_t minute; // Minute the bucket holds (Monotonic minutes + 1, 0 = empty)
+    uint32_t count;
+    float min;
+    float max;
+    double sum;
+} powermonHandler_bucket_t;
+
+// Aggregates of one device, constant size no matter how many samples arrive
+typedef struct {
+    powermonHandler_stats_t total[POWERMON_QUANTITY_COUNT]; // Since the first sample
+    powermonHandler_bucket_t buckets[POWERMON_QUANTITY_COUNT][POWERMON_WINDOW_MINUTES];
+    double energyWh; // Integrated from power samples
+    double counterKWh; // Energy counter reported by the device, -1 if it has none
+    uint64_t lastPowerAt;
+    float lastPower;
+} powermonHandler_device_t;
+
+// Copy handed to the interface
+typedef struct {
+    int hasSamples;
+    powermonHandler_stats_t total[POWERMON_QUANTITY_COUNT];
+    powermonHandler_stats_t window[POWERMON_QUANTITY_COUNT]; // Last POWERMON_WINDOW_MINUTES
+    double energyKWh;
+    double counterKWh;
+} powermonHandler_summary_t;
+
+int powermonHandler_addSample(int device, int quantity, float value, uint64_t timestamp);
+int powermonHandler_setCounter(int device, double kWh);
+void powermonHandler_getSummary(int device, powermonHandler_summary_t* out);
+
+#endif
@@ -0,0 +1,125 @@
+/*
+// IoT Controller
+// Command Queue Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "queue.h"
+#include "config.h"
+#include "states.h"
+#include "wait.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// NOTE: Commands are coalesced, if a command with the same device/action/target is still waiting, only its content is replaced.
+// This is what keeps slider and color picker drags from flooding the broker, only the latest value is ever sent.
+// Power on and off share one slot, so a quick on -> off -> on ends up as a single "on" instead of "on, off".
+// A coalesced command moves to the tail, as if it was only pushed now. Otherwise a waiting state request would absorb a later one
+// and go out before the commands its answer is supposed to reflect.
+
+static pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+static queueHandler_command_t queue[QUEUE_MAX_COMMANDS];
+static int queueCount = 0;
+static atomic_int queuePending = 0; // Futex word for the dispatcher
+
+// Index into the queue of the waiting command for every device/action (Offset by MAX_DEVICES for group topic commands), or -1
+static int coalesceSlot[MAX_DEVICES * 2][FLAG_DISPATCH_ACTION_COUNT];
+static int coalesceInitialized = 0;
+
+static inline int* queueHandler_slot(int device, int action, int flags) {
+    if (device < 0 || device >= MAX_DEVICES || action < 0 || action >= FLAG_DISPATCH_ACTION_COUNT) {
+        return NULL;
+    }
+    if (action == FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_OFF) { action = FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_ON; }
+    return &coalesceSlot[device + ((flags & QUEUE_FLAG_GROUP_TOPIC) ? MAX_DEVICES : 0)][action];
+}
+
+// Must be called with the mutex held
+static int queueHandler_pushLocked(const queueHandler_command_t* command) {
+    if (coalesceInitialized == 0) {
+        memset(coalesceSlot, 0xFF, sizeof(coalesceSlot));
+        coalesceInitialized = 1;
+    }
+
+    int* slot = queueHandler_slot(command->device, command->action, command->flags);
+    if (slot != NULL && *slot != -1) {
+        // Close the gap and reindex the commands behind it
+        int index = *slot;
+        memmove(queue + index, queue + index + 1, (queueCount - index - 1) * sizeof(queueHandler_command_t));
+        for (int i = index; i < queueCount - 1; i++) {
+            int* moved = queueHandler_slot(queue[i].device, queue[i].action, queue[i].flags);
+            if (moved != NULL) { *moved = i; }
+        }
+        queue[queueCount - 1] = *command; // The latest power action and content win
+        *slot = queueCount - 1;
+        return 0;
+    }
+
+    if (queueCount == QUEUE_MAX_COMMANDS) {
+        printf("ERROR: Command queue is full, dropping command (Device %d, Action %d).\n", command->device, command->action);
+        return 1;
+    }
+
+    if (slot != NULL) { *slot = queueCount; }
+    queue[queueCount++] = *command;
+    return 0;
+}
+
+int queueHandler_push(int type, int action, int device, int flags, uint32_t content) {
+    queueHandler_command_t command = { type, action, device, flags, content };
+    return queueHandler_pushBatch(&command, 1);
+}
+
+// Push several commands at once, the dispatcher is only woken once for the whole batch
+int queueHandler_pushBatch(const queueHandler_command_t* commands, int count) {
+    int failed = 0;
+
+    pthread_mutex_lock(&queueMutex);
+    for (int i = 0; i < count; i++) {
+        failed += queueHandler_pushLocked(&commands[i]);
+    }
+    pthread_mutex_unlock(&queueMutex);
+
+    atomic_store(&queuePending, 1);
+    waitHandler_wake(&queuePending);
+    return failed;
+}
+
+// Move up to 'max' waiting commands into 'commands' (In the order they were pushed), returns the amount moved
+int queueHandler_drain(queueHandler_command_t* commands, int max) {
+    pthread_mutex_lock(&queueMutex);
+
+    int count = queueCount < max ? queueCount : max;
+    memcpy(commands, queue, count * sizeof(queueHandler_command_t));
+    for (int i = 0; i < count; i++) {
+        int* slot = queueHandler_slot(commands[i].device, commands[i].action, commands[i].flags);
+        if (slot != NULL) { *slot = -1; }
+    }
+
+    // Shift any leftovers to the front
+    if (count < queueCount) {
+        memmove(queue, queue + count, (queueCount - count) * sizeof(queueHandler_command_t));
+        for (int i = 0; i < queueCount - count; i++) {
+            int* slot = queueHandler_slot(queue[i].device, queue[i].action, queue[i].flags);
+            if (slot != NULL) { *slot = i; }
+        }
+    }
+    queueCount -= count;
+
+    if (queueCount == 0) {
+        atomic_store(&queuePending, 0);
+    }
+    pthread_mutex_unlock(&queueMutex);
+
+    return count;
+}
+
+// Sleep until something has been pushed
+void queueHandler_waitPending() {
+    while (atomic_load(&queuePending) == 0) {
+        waitHandler_wait(&queuePending);
+    }
+}
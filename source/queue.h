@@ -0,0 +1,25 @@
+#ifndef _QUEUE_H
+#define _QUEUE_H
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Maximum amount of commands waiting for the dispatcher
+#define QUEUE_MAX_COMMANDS 4096
+
+// Command is sent to the device's OpenBK group topic instead of its own topic
+#define QUEUE_FLAG_GROUP_TOPIC 0x1
+
+typedef struct {
+    int type;
+    int action;
+    int device;
+    int flags;
+    uint32_t content;
+} queueHandler_command_t;
+
+int queueHandler_push(int type, int action, int device, int flags, uint32_t content);
+int queueHandler_pushBatch(const queueHandler_command_t* commands, int count);
+int queueHandler_drain(queueHandler_command_t* commands, int max);
+void queueHandler_waitPending();
+
+#endif
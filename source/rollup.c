@@ -0,0 +1,201 @@
+/*
+// IoT Controller
+// Rollup Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "rollup.h"
+#include "history.h"
+#include "archive.h"
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Info
+// history/<device name>.<series>.minutes|hours|days --> Memory mapped ring of rollup buckets
+*/
+
+// NOTE: Every sample is folded into its minute, hour and day bucket as it is appended (O(1), three bucket updates).
+// The rings are memory mapped files, so they survive restarts and only the pages that are touched take memory.
+// They are derived data, a crash can at worst lose the last few updates of the current buckets.
+// Queries use the coarsest resolution that divides the requested bucket size and still reaches back far enough.
+
+static const uint32_t rollupSeconds[ROLLUP_RESOLUTION_COUNT] = { 60, 3600, 86400 };
+static const uint32_t rollupCapacity[ROLLUP_RESOLUTION_COUNT] = { ROLLUP_MINUTE_BUCKETS, ROLLUP_HOUR_BUCKETS, ROLLUP_DAY_BUCKETS };
+static const char* rollupSuffix[ROLLUP_RESOLUTION_COUNT] = { "minutes", "hours", "days" };
+
+static pthread_mutex_t rollupMutex = PTHREAD_MUTEX_INITIALIZER;
+static rollupHandler_ring_t* rings[MAX_DEVICES][HISTORY_SERIES_COUNT][ROLLUP_RESOLUTION_COUNT] = { { { NULL } } };
+static unsigned char ringFailed[MAX_DEVICES][HISTORY_SERIES_COUNT] = { { 0 } }; // Do not retry opening on every sample
+
+static size_t rollupHandler_ringBytes(int resolution) {
+    return sizeof(rollupHandler_ring_t) + rollupCapacity[resolution] * sizeof(rollupHandler_bucket_t);
+}
+
+// Map (Creating if needed) the rings of a series, must be called with the mutex held
+static int rollupHandler_open(int device, int series) {
+    if (archiveHandler_init() != 0) { return 1; }
+
+    for (int r = 0; r < ROLLUP_RESOLUTION_COUNT; r++) {
+        if (rings[device][series][r] != NULL) { continue; }
+
+        char path[ARCHIVE_MAX_PATH];
+        archiveHandler_seriesPath(path, device, series, rollupSuffix[r]);
+        int fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            printf("ERROR: Could not open rollup file %s.\n", path);
+            return 1;
+        }
+
+        struct stat info;
+        int created = fstat(fd, &info) == 0 && info.st_size == 0;
+        if (created == 1 && ftruncate(fd, rollupHandler_ringBytes(r)) != 0) {
+            printf("ERROR: Could not size rollup file %s.\n", path);
+            close(fd);
+            return 1;
+        }
+        void* map = mmap(NULL, rollupHandler_ringBytes(r), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            printf("ERROR: Could not map rollup file %s.\n", path);
+            return 1;
+        }
+
+        rollupHandler_ring_t* ring = (rollupHandler_ring_t*)map;
+        if (created == 0 && (ring->magic != ROLLUP_MAGIC || ring->resolution != rollupSeconds[r] || ring->capacity != rollupCapacity[r])) {
+            printf("ERROR: Rollup file %s does not match, starting it over.\n", path);
+            memset(ring, 0, rollupHandler_ringBytes(r));
+        }
+        if (ring->magic != ROLLUP_MAGIC) {
+            ring->version = ROLLUP_VERSION;
+            ring->resolution = rollupSeconds[r];
+            ring->capacity = rollupCapacity[r];
+            ring->magic = ROLLUP_MAGIC;
+        }
+        rings[device][series][r] = ring;
+    }
+    return 0;
+}
+
+// Fold a sample into every resolution (Called from history appends)
+int rollupHandler_add(int device, int series, int64_t time, double value) {
+    if (device < 0 || device >= MAX_DEVICES || series < 0 || series >= HISTORY_SERIES_COUNT || time <= 0) { return 1; }
+
+    pthread_mutex_lock(&rollupMutex);
+    if (rings[device][series][ROLLUP_RESOLUTION_COUNT - 1] == NULL) {
+        if (ringFailed[device][series] == 1 || rollupHandler_open(device, series) != 0) {
+            ringFailed[device][series] = 1;
+            pthread_mutex_unlock(&rollupMutex);
+            return 1;
+        }
+    }
+
+    for (int r = 0; r < ROLLUP_RESOLUTION_COUNT; r++) {
+        rollupHandler_ring_t* ring = rings[device][series][r];
+        int64_t start = time - (time % ring->resolution);
+        rollupHandler_bucket_t* bucket = &ring->buckets[(start / ring->resolution) % ring->capacity];
+        if (bucket->start != start) {
+            // Older than what the slot holds (Clock went backwards far), or a slot being reused
+            if (bucket->start > start) { continue; }
+            *bucket = (rollupHandler_bucket_t){ start, 0, (float)value, (float)value, 0, 0 };
+        }
+        if ((float)value < bucket->min) { bucket->min = (float)value; }
+        if ((float)value > bucket->max) { bucket->max = (float)value; }
+        bucket->sum += value;
+        bucket->count++;
+
+        if (ring->first == 0 || start < ring->first) { ring->first = start; }
+        if (start > ring->latest) { ring->latest = start; }
+    }
+    pthread_mutex_unlock(&rollupMutex);
+    return 0;
+}
+
+static void rollupHandler_fold(rollupHandler_bucket_t* out, int* count, int maxBuckets, int64_t bucketSeconds, int64_t start, uint32_t samples, float min, float max, double sum) {
+    int64_t outStart = start - (start % bucketSeconds);
+    if (*count > 0 && out[*count - 1].start == outStart) {
+        rollupHandler_bucket_t* bucket = &out[*count - 1];
+        if (min < bucket->min) { bucket->min = min; }
+        if (max > bucket->max) { bucket->max = max; }
+        bucket->sum += sum;
+        bucket->count += samples;
+        return;
+    }
+    if (*count >= maxBuckets) { return; }
+    out[(*count)++] = (rollupHandler_bucket_t){ outStart, samples, min, max, 0, sum };
+}
+
+// Aggregate a series into 'bucketSeconds' buckets over [from, to]. Only buckets with samples are returned (Oldest first),
+// 'resolution' is set to the ROLLUP_RESOLUTION_* the query was answered from. Returns the amount of buckets or -1 on failure
+int rollupHandler_query(int device, int series, int64_t from, int64_t to, int64_t bucketSeconds, rollupHandler_bucket_t* out, int maxBuckets, int* resolution) {
+    if (device < 0 || device >= MAX_DEVICES || series < 0 || series >= HISTORY_SERIES_COUNT || bucketSeconds <= 0 || from > to) { return -1; }
+    if (from < 0) { from = 0; }
+    int count = 0;
+    int used = ROLLUP_RESOLUTION_RAW;
+
+    pthread_mutex_lock(&rollupMutex);
+    if (rings[device][series][ROLLUP_RESOLUTION_COUNT - 1] == NULL && ringFailed[device][series] == 0) {
+        // Rings of a device that has not reported yet this run
+        char path[ARCHIVE_MAX_PATH];
+        archiveHandler_seriesPath(path, device, series, rollupSuffix[ROLLUP_RESOLUTION_DAY]);
+        if (access(path, F_OK) == 0 && rollupHandler_open(device, series) != 0) { ringFailed[device][series] = 1; }
+    }
+
+    for (int r = ROLLUP_RESOLUTION_COUNT - 1; r >= 0 && rings[device][series][r] != NULL; r--) {
+        rollupHandler_ring_t* ring = rings[device][series][r];
+        if (bucketSeconds % ring->resolution != 0) { continue; }
+
+        // The ring has to reach back to 'from', unless it holds everything since the first sample
+        int64_t oldest = ring->latest - (int64_t)(ring->capacity - 1) * ring->resolution;
+        if (ring->first < oldest && from < oldest) { continue; }
+
+        // Only the slots between the oldest and the newest bucket ever written can hold anything
+        int64_t start = from > ring->first ? from - (from % ring->resolution) : ring->first;
+        int64_t end = to < ring->latest ? to : ring->latest;
+        for (int64_t time = start; time <= end; time += ring->resolution) {
+            const rollupHandler_bucket_t* bucket = &ring->buckets[(time / ring->resolution) % ring->capacity];
+            if (bucket->start != time || bucket->count == 0) { continue; }
+            rollupHandler_fold(out, &count, maxBuckets, bucketSeconds, bucket->start, bucket->count, bucket->min, bucket->max, bucket->sum);
+        }
+        used = r;
+        break;
+    }
+    pthread_mutex_unlock(&rollupMutex);
+
+    if (used == ROLLUP_RESOLUTION_RAW) {
+        // Finer than a minute, or older than the rollups reach. Compacted history only has its minute rollups left,
+        // those are folded with their own count/min/max, the samples after them are read as they are
+        archiveHandler_minute_t* minutes = (archiveHandler_minute_t*)malloc(ARCHIVE_MINUTE_CHUNK * sizeof(archiveHandler_minute_t));
+        if (minutes == NULL) {
+            printf("ERROR: Could not allocate memory on the heap.\n");
+            return -1;
+        }
+        int minuteCount = 0;
+        if (from > 0) { from -= from % 60; } // Like the rings, the minute 'from' falls in counts
+        while ((minuteCount = archiveHandler_readMinutes(device, series, from, to, minutes, ARCHIVE_MINUTE_CHUNK)) > 0) {
+            for (int i = 0; i < minuteCount; i++) {
+                rollupHandler_fold(out, &count, maxBuckets, bucketSeconds, minutes[i].minute, minutes[i].count, minutes[i].min, minutes[i].max, minutes[i].sum);
+            }
+            from = minutes[minuteCount - 1].minute + 1;
+        }
+        free(minutes);
+
+        historyHandler_sample_t* samples = NULL;
+        int sampleCount = historyHandler_read(device, series, from, to, &samples);
+        if (sampleCount < 0) { return -1; }
+        for (int i = 0; i < sampleCount; i++) {
+            rollupHandler_fold(out, &count, maxBuckets, bucketSeconds, samples[i].time, 1, (float)samples[i].value, (float)samples[i].value, samples[i].value);
+        }
+        free(samples);
+    }
+
+    if (resolution != NULL) { *resolution = used; }
+    return count;
+}
@@ -0,0 +1,42 @@
+#ifndef _ROLLUP_H
+#define _ROLLUP_H
+#include <stdint.h>
+
+#define ROLLUP_RESOLUTION_MINUTE 0
+#define ROLLUP_RESOLUTION_HOUR 1
+#define ROLLUP_RESOLUTION_DAY 2
+#define ROLLUP_RESOLUTION_COUNT 3
+#define ROLLUP_RESOLUTION_RAW -1 // Query answered from the samples themselves
+
+// Buckets kept per resolution (A week of minutes, 400 days of hours, 10 years of days)
+#define ROLLUP_MINUTE_BUCKETS (7 * 1440)
+#define ROLLUP_HOUR_BUCKETS (400 * 24)
+#define ROLLUP_DAY_BUCKETS (10 * 366)
+
+#define ROLLUP_MAGIC 0x42544F49 // "IOTB"
+#define ROLLUP_VERSION 1
+
+typedef struct {
+    int64_t start; // Unix seconds, 0 if the bucket is empty
+    uint32_t count;
+    float min;
+    float max;
+    uint32_t reserved;
+    double sum;
+} rollupHandler_bucket_t;
+
+// Ring of buckets, the bucket of time 't' is (t / resolution) % capacity
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t resolution; // Seconds
+    uint32_t capacity;
+    int64_t first; // Start of the oldest bucket ever written, 0 if none
+    int64_t latest; // Start of the newest bucket written
+    rollupHandler_bucket_t buckets[];
+} rollupHandler_ring_t;
+
+int rollupHandler_add(int device, int series, int64_t time, double value);
+int rollupHandler_query(int device, int series, int64_t from, int64_t to, int64_t bucketSeconds, rollupHandler_bucket_t* out, int maxBuckets, int* resolution);
+
+#endif
@@ -0,0 +1,180 @@
+/*
+// IoT Controller
+// JSON Scan Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "scan.h"
+#include <string.h>
+#include <stdlib.h>
+
+// NOTE: Telemetry arrives constantly and only a handful of keys are needed from each message, so instead of building
+// a cJSON tree (One allocation per value) the document is walked once and only the requested values are copied out.
+// The scanner does not validate the document, malformed input just ends up with fewer fields found.
+// Documents have to be NUL terminated (Numbers are read with strtod).
+
+// Move 'pos' from an opening quote to just past the closing quote. Returns 1 if the string is not terminated
+int scanHandler_skipString(const char* json, size_t length, size_t* pos) {
+    size_t i = *pos + 1;
+    while (i < length && json[i] != '"') {
+        if (json[i] == '\\') { i++; }
+        i++;
+    }
+    if (i >= length) { return 1; }
+    *pos = i + 1;
+    return 0;
+}
+
+static size_t scanHandler_skipSpace(const char* json, size_t length, size_t pos) {
+    while (pos < length && (json[pos] == ' ' || json[pos] == '\t' || json[pos] == '\n' || json[pos] == '\r')) { pos++; }
+    return pos;
+}
+
+// Read the value starting at 'pos' into a field, leaves 'pos' alone if the value is an object/array (So its keys are scanned too)
+static void scanHandler_readValue(const char* json, size_t length, size_t* pos, scanHandler_field_t* field) {
+    size_t i = *pos;
+
+    if (json[i] == '"') {
+        size_t start = i + 1;
+        if (scanHandler_skipString(json, length, &i) != 0) { *pos = length; return; }
+        if (field->type != SCAN_TYPE_STRING || field->string == NULL || field->stringSize == 0) { *pos = i; return; }
+
+        // Escapes are copied without the backslash, which is enough for names/colors/times
+        size_t out = 0;
+        for (size_t c = start; c < i - 1 && out + 1 < field->stringSize; c++) {
+            if (json[c] == '\\') { c++; }
+            field->string[out++] = json[c];
+        }
+        field->string[out] = '\0';
+        field->found = 1;
+        *pos = i;
+        return;
+    }
+
+    if (field->type == SCAN_TYPE_NUMBER) {
+        if (length - i >= 4 && strncmp(json + i, "true", 4) == 0) {
+            field->number = 1;
+            field->found = 1;
+        } else if (length - i >= 5 && strncmp(json + i, "false", 5) == 0) {
+            field->number = 0;
+            field->found = 1;
+        } else if (json[i] == '-' || (json[i] >= '0' && json[i] <= '9')) {
+            char* end = NULL;
+            field->number = strtod(json + i, &end);
+            field->found = 1;
+            *pos = (size_t)(end - json);
+        }
+    }
+}
+
+// Move 'pos' past the value starting at it (Any type, nested objects/arrays included). Returns 1 if the value is cut off
+int scanHandler_skipValue(const char* json, size_t length, size_t* pos) {
+    size_t i = *pos;
+    if (i >= length) { return 1; }
+
+    if (json[i] == '"') {
+        return scanHandler_skipString(json, length, pos);
+    }
+
+    if (json[i] == '{' || json[i] == '[') {
+        int depth = 0;
+        while (i < length) {
+            if (json[i] == '"') {
+                if (scanHandler_skipString(json, length, &i) != 0) { return 1; }
+                continue;
+            }
+            if (json[i] == '{' || json[i] == '[') { depth++; }
+            if (json[i] == '}' || json[i] == ']') {
+                depth--;
+                if (depth == 0) {
+                    *pos = i + 1;
+                    return 0;
+                }
+            }
+            i++;
+        }
+        return 1;
+    }
+
+    // Number/literal
+    while (i < length && json[i] != ',' && json[i] != '}' && json[i] != ']' && json[i] != ' ' && json[i] != '\n' && json[i] != '\r' && json[i] != '\t') { i++; }
+    *pos = i;
+    return 0;
+}
+
+// Walk the elements of the array starting at 'pos' one by one. On the first call 'pos' has to point at the '[',
+// every call then sets 'start'/'end' to the next element. Returns 1 once there are no more elements
+int scanHandler_nextElement(const char* json, size_t length, size_t* pos, size_t* start, size_t* end) {
+    size_t i = scanHandler_skipSpace(json, length, *pos);
+    if (i >= length) { return 1; }
+    if (json[i] == '[' || json[i] == ',') { i = scanHandler_skipSpace(json, length, i + 1); }
+    if (i >= length || json[i] == ']') { return 1; }
+
+    *start = i;
+    if (scanHandler_skipValue(json, length, &i) != 0) { return 1; }
+    *end = i;
+    *pos = i;
+    return 0;
+}
+
+// Check whether any occurrence of a key (At any depth) has the given string value
+int scanHandler_hasValue(const char* json, size_t length, const char* key, const char* value) {
+    size_t keyLength = strlen(key);
+    size_t valueLength = strlen(value);
+    size_t pos = 0;
+    while (pos < length) {
+        if (json[pos] != '"') {
+            pos++;
+            continue;
+        }
+        size_t keyStart = pos + 1;
+        if (scanHandler_skipString(json, length, &pos) != 0) { return 0; }
+        if (pos - keyStart - 1 != keyLength || strncmp(json + keyStart, key, keyLength) != 0) { continue; }
+
+        size_t valuePos = scanHandler_skipSpace(json, length, pos);
+        if (valuePos >= length || json[valuePos] != ':') { continue; }
+        valuePos = scanHandler_skipSpace(json, length, valuePos + 1);
+        if (valuePos < length && json[valuePos] == '"' && length - valuePos > valueLength + 1 &&
+            strncmp(json + valuePos + 1, value, valueLength) == 0 && json[valuePos + 1 + valueLength] == '"') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Pick the requested fields out of a JSON document in a single pass, returns the amount of fields found
+int scanHandler_scan(const char* json, size_t length, scanHandler_field_t* fields, int count) {
+    int found = 0;
+    for (int i = 0; i < count; i++) { fields[i].found = 0; }
+
+    size_t pos = 0;
+    int depth = 0; // Strings are skipped as a whole, so every bracket seen here is structural
+    while (pos < length && found < count) {
+        if (json[pos] != '"') {
+            if (json[pos] == '{' || json[pos] == '[') { depth++; }
+            if (json[pos] == '}' || json[pos] == ']') { depth--; }
+            pos++;
+            continue;
+        }
+
+        // A string followed by ':' is a key
+        size_t keyStart = pos + 1;
+        if (scanHandler_skipString(json, length, &pos) != 0) { break; }
+        size_t keyLength = pos - keyStart - 1;
+        size_t valuePos = scanHandler_skipSpace(json, length, pos);
+        if (valuePos >= length || json[valuePos] != ':') { continue; }
+        valuePos = scanHandler_skipSpace(json, length, valuePos + 1);
+        if (valuePos >= length) { break; }
+
+        for (int i = 0; i < count; i++) {
+            if (fields[i].found == 1 || strncmp(fields[i].key, json + keyStart, keyLength) != 0 || fields[i].key[keyLength] != '\0') { continue; }
+            if (fields[i].topLevel == 1 && depth != 1) { continue; }
+            scanHandler_readValue(json, length, &valuePos, &fields[i]);
+            if (fields[i].found == 1) { found++; }
+            break;
+        }
+        pos = valuePos;
+    }
+    return found;
+}
@@ -0,0 +1,25 @@
+#ifndef _SCAN_H
+#define _SCAN_H
+#include <stddef.h>
+
+#define SCAN_TYPE_NUMBER 0 // Numbers and booleans (true = 1, false = 0)
+#define SCAN_TYPE_STRING 1
+
+// A key to pick out of a JSON document. Keys are matched at any depth unless 'topLevel' is set, the first match wins
+typedef struct {
+    const char* key;
+    int type;
+    double number;
+    char* string; // Caller provided buffer for string values (Truncated to fit, always NUL terminated)
+    size_t stringSize;
+    int topLevel; // Only match keys of the outermost object (For keys that nested objects reuse with another meaning)
+    int found;
+} scanHandler_field_t;
+
+int scanHandler_scan(const char* json, size_t length, scanHandler_field_t* fields, int count);
+int scanHandler_skipString(const char* json, size_t length, size_t* pos);
+int scanHandler_skipValue(const char* json, size_t length, size_t* pos);
+int scanHandler_nextElement(const char* json, size_t length, size_t* pos, size_t* start, size_t* end);
+int scanHandler_hasValue(const char* json, size_t length, const char* key, const char* value);
+
+#endif
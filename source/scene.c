@@ -0,0 +1,215 @@
+/*
+// IoT Controller
+// Scene Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "scene.h"
+#include "config.h"
+#include "queue.h"
+#include "shadow.h"
+#include "states.h"
+#include "wait.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+// NOTE: Scenes run on their own thread, the window only sets sceneRequest and reads the status atomics.
+// A device counts as confirmed once its State response (stat/<name>/RESULT) matches the scene's power/brightness.
+
+// Devices
+extern int deviceCount;
+extern configPtr_device_t configPtr_devices[];
+
+// Scenes
+extern int sceneCount;
+extern configPtr_scene_t configPtr_scenes[];
+
+static atomic_int sceneRequest = 0; // Scene index + 1 waiting to be applied, 0 if none (Futex word)
+static atomic_int sceneActive = -1; // Scene currently being applied, read by the MQTT callback thread
+static atomic_int sceneAck[MAX_DEVICES];
+static int sceneTargetOf[MAX_DEVICES]; // Index of the device in the active scene's targets, or -1
+
+// Per target retry state, only touched by the scene thread
+static int sceneAttempts[MAX_DEVICES];
+static uint64_t sceneLastSent[MAX_DEVICES];
+
+// Status shown in the window
+static atomic_int statusScene = -1;
+static atomic_int statusRunning = 0;
+static atomic_int statusTotal = 0;
+static atomic_int statusConfirmed = 0;
+static atomic_int statusFailed = 0;
+static atomic_int statusElapsedMs = 0;
+
+// Request a scene to be applied, returns immediately. A scene that is still running is abandoned
+void sceneHandler_apply(int scene) {
+    if (scene < 0 || scene >= sceneCount) { return; }
+    atomic_store(&sceneRequest, scene + 1);
+    waitHandler_wake(&sceneRequest);
+}
+
+// Called from the MQTT callback thread after a device's State response has been processed
+void sceneHandler_onStateResponse(int device) {
+    int scene = atomic_load(&sceneActive);
+    if (scene < 0 || device < 0 || device >= MAX_DEVICES || sceneTargetOf[device] < 0) { return; }
+
+    configPtr_sceneTarget_t* target = &configPtr_scenes[scene].targets[sceneTargetOf[device]];
+    mqttHandler_state_t* state = &configPtr_devices[device].deviceState;
+
+    if (target->power != -1) {
+        if (state->power == NULL || strcasecmp(state->power, target->power ? "ON" : "OFF") != 0) { return; }
+    }
+    if (target->brightness != -1 && target->power != 0) {
+        if (state->dimmer != target->brightness) { return; }
+    }
+
+    atomic_store(&sceneAck[device], 1);
+}
+
+void sceneHandler_getStatus(sceneHandler_status_t* status) {
+    status->scene = atomic_load(&statusScene);
+    status->running = atomic_load(&statusRunning);
+    status->total = atomic_load(&statusTotal);
+    status->confirmed = atomic_load(&statusConfirmed);
+    status->failed = atomic_load(&statusFailed);
+    status->elapsedMs = atomic_load(&statusElapsedMs);
+}
+
+// Convert a scene target into queue commands, the state request at the end is what makes the device confirm
+static int sceneHandler_buildCommands(const configPtr_sceneTarget_t* target, queueHandler_command_t* commands) {
+    int count = 0;
+    if (target->power == 0) {
+        commands[count++] = (queueHandler_command_t){ FLAG_DISPATCH_TYPE_OPENBK_LIGHT, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_OFF, target->device, 0, 0 };
+    } else {
+        if (target->power == 1) {
+            commands[count++] = (queueHandler_command_t){ FLAG_DISPATCH_TYPE_OPENBK_LIGHT, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_ON, target->device, 0, 0 };
+        }
+        if (target->brightness != -1) {
+            commands[count++] = (queueHandler_command_t){ FLAG_DISPATCH_TYPE_OPENBK_LIGHT, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_BRIGHTNESS, target->device, 0, (uint32_t)target->brightness };
+        }
+        if (target->warmth != -1) {
+            commands[count++] = (queueHandler_command_t){ FLAG_DISPATCH_TYPE_OPENBK_LIGHT, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_WARMTH, target->device, 0, (uint32_t)target->warmth };
+        }
+        if (target->hasColor == 1) {
+            commands[count++] = (queueHandler_command_t){ FLAG_DISPATCH_TYPE_OPENBK_LIGHT, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_COLOR, target->device, 0, target->color };
+        }
+    }
+    commands[count++] = (queueHandler_command_t){ FLAG_DISPATCH_TYPE_OPENBK_LIGHT, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_REQUEST_STATE, target->device, 0, 0 };
+    return count;
+}
+
+// The scene sends its own commands, but the shadow has to know about the new targets so it does not revert them
+static void sceneHandler_setDesired(const configPtr_sceneTarget_t* target) {
+    if (target->power != -1) { shadowHandler_setDesired(target->device, SHADOW_FIELD_POWER, target->power, 1); }
+    if (target->brightness != -1) { shadowHandler_setDesired(target->device, SHADOW_FIELD_BRIGHTNESS, target->brightness, 1); }
+    if (target->warmth != -1) { shadowHandler_setDesired(target->device, SHADOW_FIELD_WARMTH, target->warmth, 1); }
+    if (target->hasColor == 1) { shadowHandler_setDesired(target->device, SHADOW_FIELD_COLOR, (int)target->color, 1); }
+}
+
+static void sceneHandler_run(int scene) {
+    static queueHandler_command_t commands[SCENE_BATCH_SIZE * 6];
+    configPtr_scene_t* sceneObj = &configPtr_scenes[scene];
+    int total = sceneObj->targetCount < MAX_DEVICES ? sceneObj->targetCount : MAX_DEVICES;
+
+    // Reset tracking, the callback thread ignores everything until sceneActive is set again
+    atomic_store(&sceneActive, -1);
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        sceneTargetOf[i] = -1;
+        atomic_store(&sceneAck[i], 0);
+    }
+    for (int i = 0; i < total; i++) {
+        sceneTargetOf[sceneObj->targets[i].device] = i;
+        sceneAttempts[i] = 0;
+        sceneLastSent[i] = 0;
+    }
+    atomic_store(&sceneActive, scene);
+
+    atomic_store(&statusScene, scene);
+    atomic_store(&statusTotal, total);
+    atomic_store(&statusConfirmed, 0);
+    atomic_store(&statusFailed, 0);
+    atomic_store(&statusElapsedMs, 0);
+    atomic_store(&statusRunning, 1);
+
+    printf("Applying scene '%s' to %d devices.\n", sceneObj->prettyName, total);
+    uint64_t start = waitHandler_monotonicNs();
+    uint64_t nextBatchAt = start;
+    int sent = 0;
+
+    while (1 == 1) {
+        if (atomic_load(&sceneRequest) != 0) {
+            printf("Scene '%s' was replaced before it finished.\n", sceneObj->prettyName);
+            break;
+        }
+        uint64_t now = waitHandler_monotonicNs();
+        int commandCount = 0;
+
+        // Send the next batch of devices for the first time
+        if (sent < total && now >= nextBatchAt) {
+            int batchEnd = sent + SCENE_BATCH_SIZE < total ? sent + SCENE_BATCH_SIZE : total;
+            for (; sent < batchEnd; sent++) {
+                sceneHandler_setDesired(&sceneObj->targets[sent]);
+                commandCount += sceneHandler_buildCommands(&sceneObj->targets[sent], &commands[commandCount]);
+                sceneAttempts[sent] = 1;
+                sceneLastSent[sent] = now;
+            }
+            nextBatchAt = now + (SCENE_BATCH_INTERVAL_MS * 1000000ULL);
+        }
+
+        // Count confirmations, and resend to stragglers that timed out
+        int confirmed = 0;
+        int failed = 0;
+        for (int i = 0; i < sent; i++) {
+            if (atomic_load(&sceneAck[sceneObj->targets[i].device]) == 1) {
+                confirmed++;
+            } else if (now - sceneLastSent[i] > SCENE_ACK_TIMEOUT_MS * 1000000ULL) {
+                if (sceneAttempts[i] >= SCENE_MAX_ATTEMPTS) {
+                    failed++;
+                } else if (commandCount <= (SCENE_BATCH_SIZE - 1) * 6) {
+                    commandCount += sceneHandler_buildCommands(&sceneObj->targets[i], &commands[commandCount]);
+                    sceneAttempts[i]++;
+                    sceneLastSent[i] = now;
+                }
+            }
+        }
+
+        if (commandCount > 0) {
+            queueHandler_pushBatch(commands, commandCount);
+        }
+
+        atomic_store(&statusConfirmed, confirmed);
+        atomic_store(&statusFailed, failed);
+        atomic_store(&statusElapsedMs, (int)((now - start) / 1000000ULL));
+
+        if (confirmed + failed == total) {
+            printf("Scene '%s' finished in %d ms: %d confirmed, %d failed.\n", sceneObj->prettyName, atomic_load(&statusElapsedMs), confirmed, failed);
+            for (int i = 0; i < total; i++) {
+                if (atomic_load(&sceneAck[sceneObj->targets[i].device]) == 0) {
+                    printf("Scene '%s': Device %s did not confirm after %d attempts.\n", sceneObj->prettyName, configPtr_devices[sceneObj->targets[i].device].prettyName, sceneAttempts[i]);
+                }
+            }
+            break;
+        }
+
+        usleep(SCENE_POLL_MS * 1000);
+    }
+
+    atomic_store(&sceneActive, -1);
+    atomic_store(&statusRunning, 0);
+}
+
+// Scene engine thread
+void* sceneHandler_thread(void*) {
+    while (1 == 1) {
+        while (atomic_load(&sceneRequest) == 0) {
+            waitHandler_wait(&sceneRequest);
+        }
+
+        int scene = atomic_exchange(&sceneRequest, 0) - 1;
+        sceneHandler_run(scene);
+    }
+}
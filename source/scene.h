@@ -0,0 +1,29 @@
+#ifndef _SCENE_H
+#define _SCENE_H
+
+// Amount of devices sent to at once, and the delay before the next batch
+#define SCENE_BATCH_SIZE 32
+#define SCENE_BATCH_INTERVAL_MS 50
+
+// How long a device has to confirm the scene before it is sent again, and how often that is tried
+#define SCENE_ACK_TIMEOUT_MS 2000
+#define SCENE_MAX_ATTEMPTS 3
+
+// How often the engine checks confirmations while a scene is being applied
+#define SCENE_POLL_MS 20
+
+typedef struct {
+    int scene; // -1 if no scene has been applied yet
+    int running;
+    int total;
+    int confirmed;
+    int failed;
+    int elapsedMs;
+} sceneHandler_status_t;
+
+void sceneHandler_apply(int scene);
+void sceneHandler_onStateResponse(int device);
+void sceneHandler_getStatus(sceneHandler_status_t* status);
+void* sceneHandler_thread(void*);
+
+#endif
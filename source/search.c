@@ -0,0 +1,270 @@
+/*
+// IoT Controller
+// Device Search Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "search.h"
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// NOTE: Every device gets a lowercase key ("prettyname\x01name"), which is indexed two ways:
+// - Queries shorter than 3 characters binary search a sorted prefix index of both names
+// - Longer queries take the smallest trigram posting list as candidates, and check those with strstr
+// When a query only extends the previous one (Typing), the previous results are filtered instead of looking anything up again.
+
+// Devices
+extern int deviceCount;
+extern configPtr_device_t configPtr_devices[];
+
+typedef struct {
+    int count;
+    int capacity;
+    int* devices;
+} searchHandler_posting_t;
+
+typedef struct {
+    const char* key;
+    int device;
+} searchHandler_prefix_t;
+
+static char* searchKeys[MAX_DEVICES] = { NULL };
+static searchHandler_posting_t trigrams[SEARCH_TRIGRAM_BUCKETS];
+static searchHandler_prefix_t* prefixes = NULL;
+static int prefixCount = 0;
+
+static int indexedCount = 0; // Devices [0, indexedCount) are in the index
+
+static int results[MAX_DEVICES];
+static int resultCount = 0;
+static char lastQuery[SEARCH_MAX_QUERY] = { 0 };
+static int lastQueryValid = 0;
+
+static inline unsigned int searchHandler_trigramHash(const char* str) {
+    unsigned int hash = ((unsigned char)str[0] * 961u) + ((unsigned char)str[1] * 31u) + (unsigned char)str[2];
+    return hash & (SEARCH_TRIGRAM_BUCKETS - 1);
+}
+
+static int searchHandler_comparePrefix(const void* a, const void* b) {
+    return strcmp(((const searchHandler_prefix_t*)a)->key, ((const searchHandler_prefix_t*)b)->key);
+}
+
+static int searchHandler_compareInt(const void* a, const void* b) {
+    return *(const int*)a - *(const int*)b;
+}
+
+static int searchHandler_postingAdd(searchHandler_posting_t* posting, int device) {
+    // Devices are added in order, so a device already at the end means its key has this trigram twice
+    if (posting->count > 0 && posting->devices[posting->count - 1] == device) { return 0; }
+
+    if (posting->count == posting->capacity) {
+        int capacity = posting->capacity == 0 ? 8 : posting->capacity * 2;
+        int* devices = (int*)realloc(posting->devices, capacity * sizeof(int));
+        if (devices == NULL) {
+            printf("ERROR: Could not allocate memory on the heap.\n");
+            return 1;
+        }
+        posting->devices = devices;
+        posting->capacity = capacity;
+    }
+    posting->devices[posting->count++] = device;
+    return 0;
+}
+
+// Build the lowercase key of a device and add it to the trigram index, returns the key or NULL on failure
+static char* searchHandler_indexKey(int device, size_t* prettyLenOut) {
+    const char* prettyName = configPtr_devices[device].prettyName;
+    const char* name = configPtr_devices[device].name;
+    size_t prettyLen = strlen(prettyName);
+    size_t nameLen = strlen(name);
+
+    // The separator keeps matches from spanning both names
+    char* key = (char*)calloc(prettyLen + nameLen + 2, sizeof(char));
+    if (key == NULL) {
+        printf("ERROR: Could not allocate memory on the heap.\n");
+        return NULL;
+    }
+    for (size_t i = 0; i < prettyLen; i++) { key[i] = (char)tolower((unsigned char)prettyName[i]); }
+    key[prettyLen] = '\x01';
+    for (size_t i = 0; i < nameLen; i++) { key[prettyLen + 1 + i] = (char)tolower((unsigned char)name[i]); }
+    if (searchKeys[device] != NULL) { free(searchKeys[device]); }
+    searchKeys[device] = key;
+
+    for (size_t i = 0; i + 2 < prettyLen + nameLen + 1; i++) {
+        if (key[i] == '\x01' || key[i + 1] == '\x01' || key[i + 2] == '\x01') { continue; }
+        if (searchHandler_postingAdd(&trigrams[searchHandler_trigramHash(key + i)], device) != 0) { return NULL; }
+    }
+
+    *prettyLenOut = prettyLen;
+    return key;
+}
+
+// Index a single new device (e.g. registered at runtime), devices have to be added in ascending order
+int searchHandler_addDevice(int device) {
+    size_t prettyLen = 0;
+    char* key = searchHandler_indexKey(device, &prettyLen);
+    if (key == NULL) { return 1; }
+
+    // Both names are inserted in sorted position
+    searchHandler_prefix_t* grown = (searchHandler_prefix_t*)realloc(prefixes, (prefixCount + 2) * sizeof(searchHandler_prefix_t));
+    if (grown == NULL) {
+        printf("ERROR: Could not allocate memory on the heap.\n");
+        return 1;
+    }
+    prefixes = grown;
+    searchHandler_prefix_t entries[2] = { { key, device }, { key + prettyLen + 1, device } };
+    for (int i = 0; i < 2; i++) {
+        int low = 0;
+        int high = prefixCount;
+        while (low < high) {
+            int mid = (low + high) / 2;
+            if (strcmp(prefixes[mid].key, entries[i].key) < 0) { low = mid + 1; } else { high = mid; }
+        }
+        memmove(&prefixes[low + 1], &prefixes[low], (prefixCount - low) * sizeof(searchHandler_prefix_t));
+        prefixes[low] = entries[i];
+        prefixCount++;
+    }
+
+    // Previous results no longer cover every device
+    lastQueryValid = 0;
+    return 0;
+}
+
+// Index devices registered since the last call (Imported by a driver at runtime), and re-run the current query
+// so they show up. Has to be called from the thread that queries, returns 1 if the results changed
+int searchHandler_sync() {
+    int count = deviceCount;
+    if (count == indexedCount) { return 0; }
+
+    for (int i = indexedCount; i < count; i++) {
+        if (searchHandler_addDevice(i) != 0) { break; }
+        indexedCount = i + 1;
+    }
+
+    char query[SEARCH_MAX_QUERY];
+    memcpy(query, lastQuery, sizeof(query));
+    searchHandler_query(query);
+    return 1;
+}
+
+// (Re)build the index for every device
+int searchHandler_build() {
+    searchHandler_free();
+
+    // Bulk build, the prefix index is sorted once at the end instead of inserting
+    prefixes = (searchHandler_prefix_t*)calloc(deviceCount * 2 + 1, sizeof(searchHandler_prefix_t));
+    if (prefixes == NULL) {
+        printf("ERROR: Could not allocate memory on the heap.\n");
+        return 1;
+    }
+    for (int i = 0; i < deviceCount; i++) {
+        size_t prettyLen = 0;
+        char* key = searchHandler_indexKey(i, &prettyLen);
+        if (key == NULL) { return 1; }
+        prefixes[prefixCount++] = (searchHandler_prefix_t){ key, i };
+        prefixes[prefixCount++] = (searchHandler_prefix_t){ key + prettyLen + 1, i };
+    }
+    qsort(prefixes, prefixCount, sizeof(searchHandler_prefix_t), searchHandler_comparePrefix);
+    indexedCount = deviceCount;
+
+    searchHandler_query("");
+    return 0;
+}
+
+// Update the results for a new query, returns the amount of matching devices
+int searchHandler_query(const char* query) {
+    char lower[SEARCH_MAX_QUERY];
+    size_t len = strlen(query);
+    if (len >= SEARCH_MAX_QUERY) { len = SEARCH_MAX_QUERY - 1; }
+    for (size_t i = 0; i < len; i++) { lower[i] = (char)tolower((unsigned char)query[i]); }
+    lower[len] = '\0';
+
+    size_t lastLen = strlen(lastQuery);
+
+    if (len == 0) {
+        // Everything
+        for (int i = 0; i < deviceCount; i++) { results[i] = i; }
+        resultCount = deviceCount;
+    } else if (lastQueryValid == 1 && lastLen > 0 && len > lastLen && strncmp(lower, lastQuery, lastLen) == 0 && (lastLen >= 3 || len < 3)) {
+        // Typing more of the same query (In the same mode), narrow down the previous results
+        int kept = 0;
+        for (int i = 0; i < resultCount; i++) {
+            const char* key = searchKeys[results[i]];
+            int match = 0;
+            if (len >= 3) {
+                match = strstr(key, lower) != NULL;
+            } else {
+                match = strncmp(key, lower, len) == 0 || strncmp(strchr(key, '\x01') + 1, lower, len) == 0;
+            }
+            if (match) { results[kept++] = results[i]; }
+        }
+        resultCount = kept;
+    } else if (len < 3) {
+        // Binary search the first prefix entry, then walk every entry starting with the query
+        int low = 0;
+        int high = prefixCount;
+        while (low < high) {
+            int mid = (low + high) / 2;
+            if (strncmp(prefixes[mid].key, lower, len) < 0) { low = mid + 1; } else { high = mid; }
+        }
+        resultCount = 0;
+        for (int i = low; i < prefixCount && strncmp(prefixes[i].key, lower, len) == 0; i++) {
+            results[resultCount++] = prefixes[i].device;
+        }
+
+        // Keep the config order, and drop devices matched by both names
+        qsort(results, resultCount, sizeof(int), searchHandler_compareInt);
+        int unique = 0;
+        for (int i = 0; i < resultCount; i++) {
+            if (unique == 0 || results[unique - 1] != results[i]) { results[unique++] = results[i]; }
+        }
+        resultCount = unique;
+    } else {
+        // Use the rarest trigram of the query as the candidate list
+        searchHandler_posting_t* smallest = NULL;
+        for (size_t i = 0; i + 2 < len; i++) {
+            searchHandler_posting_t* posting = &trigrams[searchHandler_trigramHash(lower + i)];
+            if (smallest == NULL || posting->count < smallest->count) { smallest = posting; }
+        }
+        resultCount = 0;
+        for (int i = 0; i < smallest->count; i++) {
+            if (strstr(searchKeys[smallest->devices[i]], lower) != NULL) {
+                results[resultCount++] = smallest->devices[i];
+            }
+        }
+    }
+
+    memcpy(lastQuery, lower, len + 1);
+    lastQueryValid = 1;
+    return resultCount;
+}
+
+const int* searchHandler_results() {
+    return results;
+}
+
+int searchHandler_resultCount() {
+    return resultCount;
+}
+
+void searchHandler_free() {
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (searchKeys[i] != NULL) { free(searchKeys[i]); searchKeys[i] = NULL; }
+    }
+    for (int i = 0; i < SEARCH_TRIGRAM_BUCKETS; i++) {
+        if (trigrams[i].devices != NULL) { free(trigrams[i].devices); }
+        trigrams[i].devices = NULL;
+        trigrams[i].count = 0;
+        trigrams[i].capacity = 0;
+    }
+    if (prefixes != NULL) { free(prefixes); prefixes = NULL; }
+    prefixCount = 0;
+    indexedCount = 0;
+    resultCount = 0;
+    lastQuery[0] = '\0';
+    lastQueryValid = 0;
+}
@@ -0,0 +1,18 @@
+#ifndef _SEARCH_H
+#define _SEARCH_H
+
+// Amount of hash buckets of the trigram index (Power of 2)
+#define SEARCH_TRIGRAM_BUCKETS 4096
+
+// Longest query that is kept for incremental filtering
+#define SEARCH_MAX_QUERY 128
+
+int searchHandler_build();
+int searchHandler_addDevice(int device);
+int searchHandler_sync();
+int searchHandler_query(const char* query);
+const int* searchHandler_results();
+int searchHandler_resultCount();
+void searchHandler_free();
+
+#endif
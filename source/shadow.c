@@ -0,0 +1,273 @@
+/*
+// IoT Controller
+// Device Shadow Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "shadow.h"
+#include "config.h"
+#include "queue.h"
+#include "states.h"
+#include "wait.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// NOTE: Every device has a desired state (What the interface/scenes asked for) and a reported state (What the device last said).
+// The reconciler thread only sends commands for fields that differ, retries with backoff until they match, and then goes back to sleep.
+
+// Devices
+extern int deviceCount;
+extern configPtr_device_t configPtr_devices[];
+
+static pthread_mutex_t shadowMutex = PTHREAD_MUTEX_INITIALIZER;
+static shadowHandler_device_t shadows[MAX_DEVICES];
+static atomic_int shadowWake = 0; // Futex word for the reconciler
+
+void shadowHandler_init() {
+    pthread_mutex_lock(&shadowMutex);
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        for (int j = 0; j < SHADOW_FIELD_COUNT; j++) {
+            shadows[i].desired.fields[j] = SHADOW_UNKNOWN;
+            shadows[i].reported.fields[j] = SHADOW_UNKNOWN;
+        }
+        shadows[i].desired.version = 0;
+        shadows[i].reported.version = 0;
+        shadows[i].sentFields = 0;
+        shadows[i].attempts = 0;
+        shadows[i].nextAttemptAt = 0;
+        shadows[i].converged = 1;
+        shadows[i].drift = 0;
+    }
+    pthread_mutex_unlock(&shadowMutex);
+}
+
+static uint64_t shadowHandler_backoffNs(int attempts) {
+    uint64_t backoff = SHADOW_BACKOFF_BASE_MS;
+    for (int i = 1; i < attempts && backoff < SHADOW_BACKOFF_MAX_MS; i++) {
+        backoff *= 2;
+    }
+    if (backoff > SHADOW_BACKOFF_MAX_MS) { backoff = SHADOW_BACKOFF_MAX_MS; }
+    return backoff * 1000000ULL;
+}
+
+static int shadowHandler_fieldMatches(int field, int desired, int reported) {
+    if (field == SHADOW_FIELD_COLOR) {
+        for (int shift = 0; shift <= 16; shift += 8) {
+            if (abs(((desired >> shift) & 0xFF) - ((reported >> shift) & 0xFF)) > SHADOW_COLOR_TOLERANCE) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    return desired == reported;
+}
+
+// Bitmask of the desired fields that still have to be sent, must be called with the mutex held
+static uint32_t shadowHandler_diff(const shadowHandler_device_t* shadow) {
+    uint32_t mask = 0;
+    for (int i = 0; i < SHADOW_FIELD_COUNT; i++) {
+        int desired = shadow->desired.fields[i];
+        int reported = shadow->reported.fields[i];
+        if (desired == SHADOW_UNKNOWN) { continue; }
+
+        // Nothing but power matters while the light is meant to be off
+        if (i != SHADOW_FIELD_POWER && shadow->desired.fields[SHADOW_FIELD_POWER] == 0) { continue; }
+
+        if (reported == SHADOW_UNKNOWN) {
+            // Devices that never report this field can only be sent it once
+            if ((shadow->sentFields & (1u << i)) == 0) { mask |= (1u << i); }
+        } else if (shadowHandler_fieldMatches(i, desired, reported) == 0) {
+            mask |= (1u << i);
+        }
+    }
+    return mask;
+}
+
+static void shadowHandler_wakeReconciler() {
+    atomic_store(&shadowWake, 1);
+    waitHandler_wake(&shadowWake);
+}
+
+// Change what a device should be set to. 'alreadySent' is used by paths that send the command themselves (Scenes, fan-out),
+// so the reconciler only steps in if the device has not caught up after the first backoff
+void shadowHandler_setDesired(int device, int field, int value, int alreadySent) {
+    if (device < 0 || device >= MAX_DEVICES || field < 0 || field >= SHADOW_FIELD_COUNT) { return; }
+    uint64_t now = waitHandler_monotonicNs();
+
+    pthread_mutex_lock(&shadowMutex);
+    shadowHandler_device_t* shadow = &shadows[device];
+    if (shadow->desired.fields[field] == value) {
+        pthread_mutex_unlock(&shadowMutex);
+        return;
+    }
+
+    shadow->desired.fields[field] = value;
+    shadow->desired.version++;
+    shadow->sentFields &= ~(1u << field);
+    shadow->converged = 0;
+    if (alreadySent == 1) {
+        shadow->sentFields |= (1u << field);
+        shadow->attempts = 1;
+        shadow->nextAttemptAt = now + shadowHandler_backoffNs(1);
+    } else {
+        shadow->attempts = 0;
+        shadow->nextAttemptAt = now;
+    }
+    pthread_mutex_unlock(&shadowMutex);
+
+    shadowHandler_wakeReconciler();
+}
+
+// Store what a device reported, fields set to SHADOW_UNKNOWN are left untouched
+void shadowHandler_report(int device, const int fields[SHADOW_FIELD_COUNT]) {
+    if (device < 0 || device >= MAX_DEVICES) { return; }
+    int wake = 0;
+
+    pthread_mutex_lock(&shadowMutex);
+    shadowHandler_device_t* shadow = &shadows[device];
+    for (int i = 0; i < SHADOW_FIELD_COUNT; i++) {
+        if (fields[i] != SHADOW_UNKNOWN) {
+            shadow->reported.fields[i] = fields[i];
+        }
+    }
+    shadow->reported.version++;
+
+    if (shadowHandler_diff(shadow) == 0) {
+        shadow->converged = 1;
+        shadow->attempts = 0;
+    } else if (shadow->converged == 1) {
+        // Something else changed the device (Wall switch, another controller), bring it back to the desired state
+        shadow->drift++;
+        shadow->converged = 0;
+        shadow->attempts = 0;
+        shadow->nextAttemptAt = waitHandler_monotonicNs();
+        wake = 1;
+    }
+    pthread_mutex_unlock(&shadowMutex);
+
+    if (wake == 1) {
+        shadowHandler_wakeReconciler();
+    }
+}
+
+// Called by drivers when a device comes (back) online, the reconciler skips offline devices until then
+void shadowHandler_onOnline(int device) {
+    if (device < 0 || device >= MAX_DEVICES) { return; }
+    int wake = 0;
+
+    pthread_mutex_lock(&shadowMutex);
+    if (shadows[device].converged == 0) {
+        // Whatever was sent while it was gone did not arrive, no need to wait out the backoff
+        shadows[device].nextAttemptAt = waitHandler_monotonicNs();
+        wake = 1;
+    }
+    pthread_mutex_unlock(&shadowMutex);
+
+    if (wake == 1) {
+        shadowHandler_wakeReconciler();
+    }
+}
+
+void shadowHandler_get(int device, shadowHandler_device_t* out) {
+    pthread_mutex_lock(&shadowMutex);
+    *out = shadows[device];
+    pthread_mutex_unlock(&shadowMutex);
+}
+
+// Copy the reported state of 'count' devices starting at 'first' under one lock (Views that show the whole fleet)
+void shadowHandler_getReported(int first, int count, shadowHandler_state_t* out) {
+    pthread_mutex_lock(&shadowMutex);
+    for (int i = 0; i < count; i++) {
+        out[i] = shadows[first + i].reported;
+    }
+    pthread_mutex_unlock(&shadowMutex);
+}
+
+// Value to show in the interface, the desired value if one was set, otherwise what the device reported
+int shadowHandler_displayValue(const shadowHandler_device_t* shadow, int field) {
+    if (shadow->desired.fields[field] != SHADOW_UNKNOWN) {
+        return shadow->desired.fields[field];
+    }
+    return shadow->reported.fields[field];
+}
+
+// Convert the differing fields of a device into queue commands, followed by a state request so the device reports back
+static int shadowHandler_buildCommands(int device, const shadowHandler_device_t* shadow, uint32_t mask, queueHandler_command_t* commands) {
+    int count = 0;
+    if (mask & (1u << SHADOW_FIELD_POWER)) {
+        int action = shadow->desired.fields[SHADOW_FIELD_POWER] ? FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_ON : FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_OFF;
+        commands[count++] = (queueHandler_command_t){ FLAG_DISPATCH_TYPE_OPENBK_LIGHT, action, device, 0, 0 };
+    }
+    if (mask & (1u << SHADOW_FIELD_BRIGHTNESS)) {
+        commands[count++] = (queueHandler_command_t){ FLAG_DISPATCH_TYPE_OPENBK_LIGHT, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_BRIGHTNESS, device, 0, (uint32_t)shadow->desired.fields[SHADOW_FIELD_BRIGHTNESS] };
+    }
+    if (mask & (1u << SHADOW_FIELD_WARMTH)) {
+        commands[count++] = (queueHandler_command_t){ FLAG_DISPATCH_TYPE_OPENBK_LIGHT, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_WARMTH, device, 0, (uint32_t)shadow->desired.fields[SHADOW_FIELD_WARMTH] };
+    }
+    if (mask & (1u << SHADOW_FIELD_COLOR)) {
+        commands[count++] = (queueHandler_command_t){ FLAG_DISPATCH_TYPE_OPENBK_LIGHT, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_COLOR, device, 0, (uint32_t)shadow->desired.fields[SHADOW_FIELD_COLOR] };
+    }
+    commands[count++] = (queueHandler_command_t){ FLAG_DISPATCH_TYPE_OPENBK_LIGHT, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_REQUEST_STATE, device, 0, 0 };
+    return count;
+}
+
+// Reconciler thread
+void* shadowHandler_thread(void*) {
+    static queueHandler_command_t commands[QUEUE_MAX_COMMANDS];
+
+    while (1 == 1) {
+        atomic_store(&shadowWake, 0);
+        int unconverged = 0; // Online devices only, offline ones wake the reconciler when they come back (shadowHandler_onOnline)
+        int commandCount = 0;
+        uint64_t now = waitHandler_monotonicNs();
+        uint64_t nextRetryAt = UINT64_MAX;
+
+        pthread_mutex_lock(&shadowMutex);
+        for (int i = 0; i < deviceCount; i++) {
+            shadowHandler_device_t* shadow = &shadows[i];
+            if (shadow->converged == 1) { continue; }
+
+            uint32_t mask = shadowHandler_diff(shadow);
+            if (mask == 0) {
+                shadow->converged = 1;
+                shadow->attempts = 0;
+                continue;
+            }
+
+            // Offline devices are picked up again once they come back
+            if (configPtr_devices[i].online != 1) { continue; }
+            unconverged++;
+            if (now < shadow->nextAttemptAt || commandCount + SHADOW_FIELD_COUNT + 1 > QUEUE_MAX_COMMANDS) {
+                uint64_t retryAt = now < shadow->nextAttemptAt ? shadow->nextAttemptAt : now;
+                if (retryAt < nextRetryAt) { nextRetryAt = retryAt; }
+                continue;
+            }
+
+            commandCount += shadowHandler_buildCommands(i, shadow, mask, &commands[commandCount]);
+            shadow->sentFields |= mask;
+            shadow->attempts++;
+            shadow->nextAttemptAt = now + shadowHandler_backoffNs(shadow->attempts);
+            if (shadow->nextAttemptAt < nextRetryAt) { nextRetryAt = shadow->nextAttemptAt; }
+        }
+        pthread_mutex_unlock(&shadowMutex);
+
+        if (commandCount > 0) {
+            queueHandler_pushBatch(commands, commandCount);
+        }
+
+        if (unconverged == 0) {
+            // Nothing to do until something changes
+            while (atomic_load(&shadowWake) == 0) {
+                waitHandler_wait(&shadowWake);
+            }
+        } else {
+            // Sleep until the earliest retry is due, a new desired state still goes out right away
+            uint64_t waitMs = nextRetryAt > now ? (nextRetryAt - now + 999999ULL) / 1000000ULL : 0;
+            waitHandler_waitTimeout(&shadowWake, waitMs > SHADOW_TICK_MS ? (uint32_t)waitMs : SHADOW_TICK_MS);
+        }
+    }
+}
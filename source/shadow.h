@@ -0,0 +1,48 @@
+#ifndef _SHADOW_H
+#define _SHADOW_H
+#include <stdint.h>
+
+// Value of a shadow field that has not been set/reported
+#define SHADOW_UNKNOWN -1
+
+// Shortest sleep of the reconciler while an online device has not converged (Retries due within a tick go out together)
+#define SHADOW_TICK_MS 50
+
+// Retry backoff (Doubles every attempt up to the maximum)
+#define SHADOW_BACKOFF_BASE_MS 1000
+#define SHADOW_BACKOFF_MAX_MS 60000
+
+// Tolerance per color channel when comparing reported and desired color (Firmware rounds)
+#define SHADOW_COLOR_TOLERANCE 3
+
+#define SHADOW_FIELD_POWER 0
+#define SHADOW_FIELD_BRIGHTNESS 1
+#define SHADOW_FIELD_WARMTH 2
+#define SHADOW_FIELD_COLOR 3 // Packed 0x00RRGGBB
+#define SHADOW_FIELD_COUNT 4
+
+typedef struct {
+    int fields[SHADOW_FIELD_COUNT];
+    uint32_t version;
+} shadowHandler_state_t;
+
+typedef struct {
+    shadowHandler_state_t desired;
+    shadowHandler_state_t reported;
+    uint32_t sentFields; // Bitmask of desired fields sent since they last changed (Used for fields the device never reports)
+    int attempts;
+    uint64_t nextAttemptAt;
+    int converged;
+    int drift; // Times the reported state moved away from an already converged desired state
+} shadowHandler_device_t;
+
+void shadowHandler_init();
+void shadowHandler_setDesired(int device, int field, int value, int alreadySent);
+void shadowHandler_report(int device, const int fields[SHADOW_FIELD_COUNT]);
+void shadowHandler_onOnline(int device);
+void shadowHandler_get(int device, shadowHandler_device_t* out);
+void shadowHandler_getReported(int first, int count, shadowHandler_state_t* out);
+int shadowHandler_displayValue(const shadowHandler_device_t* shadow, int field);
+void* shadowHandler_thread(void*);
+
+#endif
@@ -0,0 +1,178 @@
+/*
+// IoT Controller
+// Shared State Table Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "shm.h"
+#include "config.h"
+#include "color.h"
+#include "wait.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Info
+// /dev/shm/iot-controller-state.<uid> --> Header (64 bytes), then SHM_CAPACITY records (128 bytes each), record i is device i
+// Writing a record (Seqlock): sequence + 1 (Odd), fields, sequence + 1 (Even again), then the header generation + 1
+// and a futex wake on it (Readers can sleep until the generation moves, see shmReader_wait)
+// Reading a record: sequence (Retry while odd), fields, sequence again (Retry if it moved). See shmreader.c
+*/
+
+// NOTE: Status bars and other local readers map the segment read-only and read device states without any syscall or lock,
+// instead of each polling the broker. Only the MQTT thread writes records (From driverHandler_route, after a device's message
+// was handled), so writers never race each other. A record is only rewritten if something a reader can see changed, telemetry
+// that repeats itself does not make readers retry.
+
+// Devices
+extern int deviceCount;
+extern configPtr_device_t configPtr_devices[];
+
+static shmHandler_header_t* header = NULL;
+static shmHandler_record_t* records = NULL;
+static size_t segmentSize = 0;
+
+void shmHandler_path(char path[SHM_MAX_PATH]) {
+    snprintf(path, SHM_MAX_PATH, "%s.%u", SHM_NAME, (unsigned int)getuid());
+}
+
+static int64_t shmHandler_nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// What readers see of a device, everything but the sequence and change time
+static void shmHandler_fill(int device, shmHandler_record_t* record) {
+    configPtr_device_t* obj = &configPtr_devices[device];
+    const char* power = obj->deviceState.power;
+    float rgb[3];
+
+    memset(record, 0, sizeof(*record));
+    record->flags = (obj->online == 1 ? SHM_FLAG_ONLINE : 0) | (obj->stale == 1 ? SHM_FLAG_STALE : 0);
+    record->power = power == NULL ? SHM_UNKNOWN : strcasecmp(power, "ON") == 0;
+    record->dimmer = obj->deviceState.dimmer;
+    record->color = obj->deviceState.color != NULL && colorHandler_decodeColor(obj->deviceState.color, rgb) == 0 ? colorHandler_packRgb(rgb) : SHM_NO_COLOR;
+    record->wifi_rssi = obj->deviceState.wifi_rssi;
+    record->wifi_signal = obj->deviceState.wifi_signal;
+    snprintf(record->name, SHM_NAME_LENGTH, "%s", obj->name);
+    snprintf(record->prettyName, SHM_PRETTY_NAME_LENGTH, "%s", obj->prettyName != NULL ? obj->prettyName : obj->name);
+}
+
+// Everything a reader sees but the sequence and the change time
+static int shmHandler_same(const shmHandler_record_t* a, const shmHandler_record_t* b) {
+    size_t valuesStart = offsetof(shmHandler_record_t, flags);
+    size_t valuesEnd = offsetof(shmHandler_record_t, changedAt);
+    size_t namesStart = offsetof(shmHandler_record_t, name);
+    return memcmp((const char*)a + valuesStart, (const char*)b + valuesStart, valuesEnd - valuesStart) == 0 &&
+        memcmp((const char*)a + namesStart, (const char*)b + namesStart, sizeof(shmHandler_record_t) - namesStart) == 0;
+}
+
+// Seqlock write, readers that overlap it see an odd or changed sequence and read again
+static void shmHandler_write(shmHandler_record_t* record, const shmHandler_record_t* value) {
+    size_t start = offsetof(shmHandler_record_t, flags);
+    uint32_t sequence = atomic_load_explicit(&record->sequence, memory_order_relaxed);
+    atomic_store_explicit(&record->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    memcpy((char*)record + start, (const char*)value + start, sizeof(shmHandler_record_t) - start);
+
+    atomic_store_explicit(&record->sequence, sequence + 2, memory_order_release);
+}
+
+// Create the segment and publish every device's current state (After the snapshot is loaded, before the broker connects)
+int shmHandler_init() {
+    char path[SHM_MAX_PATH];
+    shmHandler_path(path);
+    segmentSize = sizeof(shmHandler_header_t) + SHM_CAPACITY * sizeof(shmHandler_record_t);
+
+    // A segment left behind by an instance that crashed is replaced, readers still mapping it see 'running' stay 0 there
+    shm_unlink(path);
+    int fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        printf("ERROR: Could not create the shared state table %s.\n", path);
+        return 1;
+    }
+    if (ftruncate(fd, (off_t)segmentSize) != 0) {
+        printf("ERROR: Could not size the shared state table %s.\n", path);
+        goto init_cleanup_fail;
+    }
+    void* segment = mmap(NULL, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (segment == MAP_FAILED) {
+        printf("ERROR: Could not map the shared state table %s.\n", path);
+        goto init_cleanup_fail;
+    }
+    close(fd);
+
+    header = (shmHandler_header_t*)segment;
+    records = (shmHandler_record_t*)((char*)segment + sizeof(shmHandler_header_t));
+    header->magic = SHM_MAGIC;
+    header->version = SHM_VERSION;
+    header->headerSize = sizeof(shmHandler_header_t);
+    header->recordSize = sizeof(shmHandler_record_t);
+    header->capacity = SHM_CAPACITY;
+    header->startedAt = shmHandler_nowMs() / 1000;
+    header->pid = (int32_t)getpid();
+
+    int64_t now = shmHandler_nowMs();
+    int count = deviceCount < SHM_CAPACITY ? deviceCount : SHM_CAPACITY;
+    for (int i = 0; i < count; i++) {
+        shmHandler_fill(i, &records[i]);
+        records[i].changedAt = now;
+    }
+    atomic_store_explicit(&header->count, (uint32_t)count, memory_order_release);
+    atomic_store_explicit(&header->running, 1, memory_order_release);
+    return 0;
+
+init_cleanup_fail:
+    close(fd);
+    shm_unlink(path);
+    return 1;
+}
+
+// Publish a device's state if a reader would see a difference. Only called from the MQTT thread
+void shmHandler_update(int device) {
+    if (header == NULL || device < 0 || device >= SHM_CAPACITY) { return; }
+
+    shmHandler_record_t value;
+    shmHandler_fill(device, &value);
+    uint32_t count = atomic_load_explicit(&header->count, memory_order_relaxed);
+    if ((uint32_t)device < count && shmHandler_same(&records[device], &value)) { return; }
+
+    int64_t now = shmHandler_nowMs();
+    value.changedAt = now;
+    shmHandler_write(&records[device], &value);
+
+    // Devices registered since (Network scan, Zigbee bridge) show up with their first message, along with any before them
+    if ((uint32_t)device >= count) {
+        for (int i = (int)count; i < device; i++) {
+            shmHandler_fill(i, &value);
+            value.changedAt = now;
+            shmHandler_write(&records[i], &value);
+        }
+        atomic_store_explicit(&header->count, (uint32_t)device + 1, memory_order_release);
+    }
+    atomic_fetch_add_explicit(&header->generation, 1, memory_order_release);
+    waitHandler_wakeShared(&header->generation);
+}
+
+// Tell readers the table is no longer updated and remove it (Mappings stay valid until the readers unmap them)
+// NOTE: The segment stays mapped in this process, the MQTT thread may still be in shmHandler_update while shutting down.
+// Writes after this only land in the unlinked segment, the mapping goes away with the process.
+void shmHandler_deinit() {
+    if (header == NULL || atomic_load_explicit(&header->running, memory_order_acquire) == 0) { return; }
+    char path[SHM_MAX_PATH];
+    shmHandler_path(path);
+
+    atomic_store_explicit(&header->running, 0, memory_order_release);
+    atomic_fetch_add_explicit(&header->generation, 1, memory_order_release);
+    waitHandler_wakeShared(&header->generation);
+    shm_unlink(path);
+}
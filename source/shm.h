@@ -0,0 +1,62 @@
+#ifndef _SHM_H
+#define _SHM_H
+#include <stdint.h>
+#include <stdatomic.h>
+
+// POSIX shared memory segment name, the user id is appended ("/iot-controller-state.<uid>")
+#define SHM_NAME "/iot-controller-state"
+#define SHM_MAX_PATH 64
+
+#define SHM_MAGIC 0x4D485349 // "ISHM"
+#define SHM_VERSION 1
+
+// Records allocated in the segment, one per possible device (Pages are only backed once touched)
+#define SHM_CAPACITY 16384
+
+#define SHM_NAME_LENGTH 40
+#define SHM_PRETTY_NAME_LENGTH 48
+
+// Record flags
+#define SHM_FLAG_ONLINE 0x1
+#define SHM_FLAG_STALE 0x2 // Last known state from the snapshot, the device has not sent anything since
+
+// Record values that are not known
+#define SHM_UNKNOWN -1
+#define SHM_NO_COLOR 0xFFFFFFFF
+
+// 64 bytes, at the start of the segment
+typedef struct {
+    uint32_t magic;
+    uint32_t version; // Readers refuse any other version, the layout only changes together with it
+    uint32_t headerSize;
+    uint32_t recordSize;
+    uint32_t capacity;
+    _Atomic uint32_t count; // Records in use, only ever grows
+    _Atomic uint32_t generation; // Bumped after any record changed
+    _Atomic uint32_t running; // 0 once the instance exited, readers have to open the segment again
+    int64_t startedAt; // Unix seconds
+    int32_t pid;
+    uint32_t reserved[5];
+} shmHandler_header_t;
+
+// 128 bytes, exactly two cache lines (Records start right after the header, so none shares a line with another)
+typedef struct {
+    _Atomic uint32_t sequence; // Odd while the record is being written
+    uint32_t flags; // SHM_FLAG_*
+    int32_t power; // 1 / 0, SHM_UNKNOWN
+    int32_t dimmer; // 0 - 100, SHM_UNKNOWN
+    uint32_t color; // Packed 0x00RRGGBB, SHM_NO_COLOR
+    int32_t wifi_rssi;
+    int32_t wifi_signal;
+    uint32_t reserved;
+    int64_t changedAt; // Unix milliseconds of the last change
+    char name[SHM_NAME_LENGTH]; // Truncated, always terminated
+    char prettyName[SHM_PRETTY_NAME_LENGTH];
+} shmHandler_record_t;
+
+void shmHandler_path(char path[SHM_MAX_PATH]);
+int shmHandler_init();
+void shmHandler_update(int device);
+void shmHandler_deinit();
+
+#endif
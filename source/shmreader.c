@@ -0,0 +1,110 @@
+/*
+// IoT Controller
+// Shared State Table Reader
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "shmreader.h"
+#include "wait.h"
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// NOTE: Built on its own (iot_state_reader, with wait.c) for status bars and other local tools, it only needs shm.h and wait.h.
+// Opening the table costs a few syscalls, reading it afterwards costs none: a record is copied out and the copy is only kept
+// if its sequence was even and did not move meanwhile. Typical use is to keep the generation and only read again once it changed
+// (shmReader_wait sleeps until then),
+// and to open the table again once it is no longer running (The instance exited or restarted).
+
+// Map the table of the running instance read-only, returns 1 if there is none
+int shmReader_open(shmReader_t* reader) {
+    char path[SHM_MAX_PATH];
+    snprintf(path, SHM_MAX_PATH, "%s.%u", SHM_NAME, (unsigned int)getuid());
+    memset(reader, 0, sizeof(*reader));
+
+    int fd = shm_open(path, O_RDONLY, 0);
+    if (fd < 0) { return 1; }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(shmHandler_header_t)) {
+        close(fd);
+        return 1;
+    }
+    void* segment = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) { return 1; }
+
+    const shmHandler_header_t* header = (const shmHandler_header_t*)segment;
+    if (header->magic != SHM_MAGIC || header->version != SHM_VERSION || header->recordSize != sizeof(shmHandler_record_t) ||
+        header->headerSize != sizeof(shmHandler_header_t) ||
+        (size_t)st.st_size < sizeof(shmHandler_header_t) + (size_t)header->capacity * sizeof(shmHandler_record_t) ||
+        atomic_load_explicit(&header->running, memory_order_acquire) == 0) {
+        printf("ERROR: %s is not a shared state table this reader understands.\n", path);
+        munmap(segment, (size_t)st.st_size);
+        return 1;
+    }
+
+    reader->header = header;
+    reader->records = (const shmHandler_record_t*)((const char*)segment + sizeof(shmHandler_header_t));
+    reader->size = (size_t)st.st_size;
+    return 0;
+}
+
+// Consistent copy of a device's record, returns 1 if there is no such device
+int shmReader_read(const shmReader_t* reader, int device, shmHandler_record_t* out) {
+    if (device < 0 || (uint32_t)device >= atomic_load_explicit(&reader->header->count, memory_order_acquire)) { return 1; }
+    const shmHandler_record_t* record = &reader->records[device];
+
+    for (int i = 0; i < SHMREADER_MAX_RETRIES; i++) {
+        uint32_t before = atomic_load_explicit(&record->sequence, memory_order_acquire);
+        if (before & 1) { continue; }
+        memcpy(out, (const void*)record, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&record->sequence, memory_order_relaxed) == before) {
+            out->sequence = before;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Index of the device called 'name', -1 if there is none. Device indexes never change while the instance runs, look them up once
+int shmReader_find(const shmReader_t* reader, const char* name) {
+    int count = shmReader_count(reader);
+    shmHandler_record_t record;
+    for (int i = 0; i < count; i++) {
+        if (shmReader_read(reader, i, &record) == 0 && strcmp(record.name, name) == 0) { return i; }
+    }
+    return -1;
+}
+
+int shmReader_count(const shmReader_t* reader) {
+    return (int)atomic_load_explicit(&reader->header->count, memory_order_acquire);
+}
+
+// Changes whenever any record changed
+uint32_t shmReader_generation(const shmReader_t* reader) {
+    return atomic_load_explicit(&reader->header->generation, memory_order_acquire);
+}
+
+// Sleep until the generation moves on from 'generation', at most 'timeoutMs' (Returns right away if it already did)
+void shmReader_wait(const shmReader_t* reader, uint32_t generation, uint32_t timeoutMs) {
+    waitHandler_waitShared((atomic_uint*)&reader->header->generation, generation, timeoutMs);
+}
+
+// 0 once the instance exited, also if it crashed without saying so
+int shmReader_running(const shmReader_t* reader) {
+    if (atomic_load_explicit(&reader->header->running, memory_order_acquire) == 0) { return 0; }
+    return kill((pid_t)reader->header->pid, 0) == 0 || errno != ESRCH;
+}
+
+void shmReader_close(shmReader_t* reader) {
+    if (reader->header == NULL) { return; }
+    munmap((void*)reader->header, reader->size);
+    memset(reader, 0, sizeof(*reader));
+}
@@ -0,0 +1,24 @@
+#ifndef _SHMREADER_H
+#define _SHMREADER_H
+#include <stddef.h>
+#include "shm.h"
+
+// Reads before giving up on a record that keeps changing under the reader (Only if the writer died mid-write)
+#define SHMREADER_MAX_RETRIES 1000000
+
+typedef struct {
+    const shmHandler_header_t* header;
+    const shmHandler_record_t* records;
+    size_t size;
+} shmReader_t;
+
+int shmReader_open(shmReader_t* reader);
+int shmReader_read(const shmReader_t* reader, int device, shmHandler_record_t* out);
+int shmReader_find(const shmReader_t* reader, const char* name);
+int shmReader_count(const shmReader_t* reader);
+uint32_t shmReader_generation(const shmReader_t* reader);
+void shmReader_wait(const shmReader_t* reader, uint32_t generation, uint32_t timeoutMs);
+int shmReader_running(const shmReader_t* reader);
+void shmReader_close(shmReader_t* reader);
+
+#endif
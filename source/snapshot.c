@@ -0,0 +1,269 @@
+/*
+// IoT Controller
+// State Snapshot Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "snapshot.h"
+#include "config.h"
+#include "driver.h"
+#include "wait.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+/* Info
+// snapshot.bin --> Header, then one record per device, then a string table of NUL terminated strings
+*/
+
+// NOTE: The snapshot is loaded before connecting to the broker, so the interface has every device's last known state right away.
+// Loaded devices are marked stale until they send something. Saving writes a temporary file and renames it over the old one,
+// so a crash while saving leaves the previous snapshot intact.
+
+// Devices
+extern int deviceCount;
+extern configPtr_device_t configPtr_devices[];
+
+extern atomic_uint stateGeneration;
+
+static pthread_mutex_t snapshotMutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t* buffer = NULL; // Serialized snapshot, reused between saves
+static size_t bufferCapacity = 0;
+
+// FNV-1a over 8 byte words (The whole file is checked on every start, bytewise would be most of the load time)
+static uint32_t snapshotHandler_checksum(const uint8_t* data, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    for (; i < length; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static char** snapshotHandler_string(mqttHandler_state_t* state, int string) {
+    switch (string) {
+        case SNAPSHOT_STRING_UPTIME: return &state->uptime;
+        case SNAPSHOT_STRING_COLOR: return &state->color;
+        case SNAPSHOT_STRING_HSBCOLOR: return &state->hsbcolor;
+        case SNAPSHOT_STRING_POWER: return &state->power;
+        case SNAPSHOT_STRING_WIFI_SSID: return &state->wifi_ssid;
+        case SNAPSHOT_STRING_WIFI_BSSID: return &state->wifi_bssid;
+        default: return &state->wifi_mode;
+    }
+}
+
+// Make room for 'length' more bytes after 'used', returns 1 on failure
+static int snapshotHandler_reserve(size_t used, size_t length) {
+    if (used + length <= bufferCapacity) { return 0; }
+    size_t capacity = bufferCapacity == 0 ? 65536 : bufferCapacity;
+    while (capacity < used + length) { capacity *= 2; }
+    uint8_t* grown = (uint8_t*)realloc(buffer, capacity);
+    if (grown == NULL) {
+        printf("ERROR: Could not allocate memory on the heap.\n");
+        return 1;
+    }
+    buffer = grown;
+    bufferCapacity = capacity;
+    return 0;
+}
+
+// Add a string to the table, returns its offset
+static uint32_t snapshotHandler_addString(size_t* used, size_t tableStart, const char* string) {
+    if (string == NULL) { return SNAPSHOT_NO_STRING; }
+    size_t length = strlen(string) + 1;
+    if (snapshotHandler_reserve(*used, length) != 0) { return SNAPSHOT_NO_STRING; }
+    uint32_t offset = (uint32_t)(*used - tableStart);
+    memcpy(buffer + *used, string, length);
+    *used += length;
+    return offset;
+}
+
+// Write the state of every device to the snapshot file
+// NOTE: The MQTT thread frees and replaces state strings while handling messages, so every device is serialized under
+// the state lock (One device at a time, message handling is only held off for the length of a record)
+int snapshotHandler_save() {
+    int count = deviceCount;
+    size_t recordsStart = sizeof(snapshotHandler_header_t);
+    size_t tableStart = recordsStart + count * sizeof(snapshotHandler_record_t);
+    int fd = -1;
+
+    pthread_mutex_lock(&snapshotMutex);
+    if (snapshotHandler_reserve(0, tableStart) != 0) { goto save_cleanup_fail; }
+
+    size_t used = tableStart;
+    for (int i = 0; i < count; i++) {
+        mqttHandler_state_t* state = &configPtr_devices[i].deviceState;
+        snapshotHandler_record_t record;
+        driverHandler_lockState();
+        record.name = snapshotHandler_addString(&used, tableStart, configPtr_devices[i].name);
+        record.online = configPtr_devices[i].online;
+        record.mqttCount = state->mqttCount;
+        record.dimmer = state->dimmer;
+        record.wifi_channel = state->wifi_channel;
+        record.wifi_rssi = state->wifi_rssi;
+        record.wifi_signal = state->wifi_signal;
+        for (int j = 0; j < SNAPSHOT_STRING_COUNT; j++) {
+            record.strings[j] = snapshotHandler_addString(&used, tableStart, *snapshotHandler_string(state, j));
+        }
+        driverHandler_unlockState();
+        if (record.name == SNAPSHOT_NO_STRING) { goto save_cleanup_fail; }
+
+        // The buffer may have moved while adding strings
+        memcpy(buffer + recordsStart + i * sizeof(snapshotHandler_record_t), &record, sizeof(record));
+    }
+
+    snapshotHandler_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.count = (uint32_t)count;
+    header.stringBytes = (uint32_t)(used - tableStart);
+    header.savedAt = (int64_t)time(NULL);
+    header.checksum = snapshotHandler_checksum(buffer + recordsStart, used - recordsStart);
+    memcpy(buffer, &header, sizeof(header));
+
+    fd = open(SNAPSHOT_TEMP_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("ERROR: Could not create %s.\n", SNAPSHOT_TEMP_PATH);
+        goto save_cleanup_fail;
+    }
+    size_t written = 0;
+    while (written < used) {
+        ssize_t length = write(fd, buffer + written, used - written);
+        if (length <= 0) {
+            printf("ERROR: Could not write %s.\n", SNAPSHOT_TEMP_PATH);
+            goto save_cleanup_fail;
+        }
+        written += (size_t)length;
+    }
+    if (fdatasync(fd) != 0 || close(fd) != 0) {
+        fd = -1;
+        printf("ERROR: Could not write %s.\n", SNAPSHOT_TEMP_PATH);
+        goto save_cleanup_fail;
+    }
+    fd = -1;
+    if (rename(SNAPSHOT_TEMP_PATH, SNAPSHOT_PATH) != 0) {
+        printf("ERROR: Could not replace %s.\n", SNAPSHOT_PATH);
+        goto save_cleanup_fail;
+    }
+
+    pthread_mutex_unlock(&snapshotMutex);
+    return 0;
+
+save_cleanup_fail:
+    if (fd >= 0) { close(fd); }
+    pthread_mutex_unlock(&snapshotMutex);
+    return 1;
+}
+
+// Fill in the last known state of the configured devices, has to be called before anything else touches the device states.
+// A missing snapshot is not an error (First start)
+int snapshotHandler_load() {
+    uint64_t start = waitHandler_monotonicNs();
+    uint8_t* data = NULL;
+    int loaded = 0;
+
+    int fd = open(SNAPSHOT_PATH, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) { return 0; }
+        printf("ERROR: Could not open %s.\n", SNAPSHOT_PATH);
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snapshotHandler_header_t)) { goto load_cleanup_invalid; }
+    size_t size = (size_t)st.st_size;
+    data = (uint8_t*)malloc(size);
+    if (data == NULL) {
+        printf("ERROR: Could not allocate memory on the heap.\n");
+        close(fd);
+        return 1;
+    }
+    size_t got = 0;
+    while (got < size) {
+        ssize_t length = read(fd, data + got, size - got);
+        if (length <= 0) { goto load_cleanup_invalid; }
+        got += (size_t)length;
+    }
+
+    // Everything is checked up front, so the records below can trust their offsets
+    snapshotHandler_header_t header;
+    memcpy(&header, data, sizeof(header));
+    size_t recordsStart = sizeof(snapshotHandler_header_t);
+    size_t tableStart = recordsStart + (size_t)header.count * sizeof(snapshotHandler_record_t);
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION || header.count > MAX_DEVICES ||
+        tableStart + header.stringBytes != size || (header.stringBytes > 0 && data[size - 1] != '\0') ||
+        header.checksum != snapshotHandler_checksum(data + recordsStart, size - recordsStart)) {
+        goto load_cleanup_invalid;
+    }
+    const char* table = (const char*)(data + tableStart);
+
+    for (uint32_t i = 0; i < header.count; i++) {
+        snapshotHandler_record_t record;
+        memcpy(&record, data + recordsStart + i * sizeof(snapshotHandler_record_t), sizeof(record));
+        if (record.name >= header.stringBytes) { continue; }
+
+        // Unless the config changed, records are in device order
+        const char* name = table + record.name;
+        int device = (int)i < deviceCount && strcmp(configPtr_devices[i].name, name) == 0 ? (int)i : driverHandler_findDevice(name);
+        if (device == -1) { continue; }
+
+        mqttHandler_state_t* state = &configPtr_devices[device].deviceState;
+        for (int j = 0; j < SNAPSHOT_STRING_COUNT; j++) {
+            if (record.strings[j] >= header.stringBytes) { continue; }
+            char** field = snapshotHandler_string(state, j);
+            *field = strdup(table + record.strings[j]);
+            if (*field == NULL) {
+                printf("ERROR: Could not allocate memory on the heap.\n");
+                free(data);
+                close(fd);
+                return 1;
+            }
+        }
+        configPtr_devices[device].online = record.online;
+        state->mqttCount = record.mqttCount;
+        state->dimmer = record.dimmer;
+        state->wifi_channel = record.wifi_channel;
+        state->wifi_rssi = record.wifi_rssi;
+        state->wifi_signal = record.wifi_signal;
+        configPtr_devices[device].stale = 1;
+        loaded++;
+    }
+
+    printf("Loaded the last known state of %d devices (Saved %lld seconds ago) in %.2f ms.\n", loaded,
+        (long long)(time(NULL) - header.savedAt), (waitHandler_monotonicNs() - start) / 1000000.0);
+    free(data);
+    close(fd);
+    return 0;
+
+load_cleanup_invalid:
+    // A damaged snapshot only costs the warm start
+    printf("ERROR: %s is damaged, ignoring it.\n", SNAPSHOT_PATH);
+    if (data != NULL) { free(data); }
+    close(fd);
+    return 0;
+}
+
+// Rewrites the snapshot every SNAPSHOT_INTERVAL_MS, if any state changed since the last save
+void* snapshotHandler_thread(void*) {
+    unsigned int savedGeneration = atomic_load(&stateGeneration);
+    while (1 == 1) {
+        usleep(SNAPSHOT_INTERVAL_MS * 1000);
+        unsigned int generation = atomic_load(&stateGeneration);
+        if (generation == savedGeneration) { continue; }
+        if (snapshotHandler_save() == 0) { savedGeneration = generation; }
+    }
+}
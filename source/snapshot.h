@@ -0,0 +1,53 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+#include <stdint.h>
+
+// Last known device states (Relative to the working directory, like config.json)
+#define SNAPSHOT_PATH "snapshot.bin"
+#define SNAPSHOT_TEMP_PATH "snapshot.bin.tmp"
+
+#define SNAPSHOT_MAGIC 0x53544F49 // "IOTS"
+#define SNAPSHOT_VERSION 1
+
+// How often the snapshot is rewritten if any state changed
+#define SNAPSHOT_INTERVAL_MS 30000
+
+// String table offset of a NULL string
+#define SNAPSHOT_NO_STRING 0xFFFFFFFF
+
+#define SNAPSHOT_STRING_UPTIME 0
+#define SNAPSHOT_STRING_COLOR 1
+#define SNAPSHOT_STRING_HSBCOLOR 2
+#define SNAPSHOT_STRING_POWER 3
+#define SNAPSHOT_STRING_WIFI_SSID 4
+#define SNAPSHOT_STRING_WIFI_BSSID 5
+#define SNAPSHOT_STRING_WIFI_MODE 6
+#define SNAPSHOT_STRING_COUNT 7
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count; // Records
+    uint32_t stringBytes; // Size of the string table after the records
+    int64_t savedAt; // Unix seconds
+    uint32_t checksum; // Of the records and the string table
+    uint32_t reserved;
+} snapshotHandler_header_t;
+
+// One device, strings are offsets into the string table
+typedef struct {
+    uint32_t name;
+    int32_t online;
+    int32_t mqttCount;
+    int32_t dimmer;
+    int32_t wifi_channel;
+    int32_t wifi_rssi;
+    int32_t wifi_signal;
+    uint32_t strings[SNAPSHOT_STRING_COUNT];
+} snapshotHandler_record_t;
+
+int snapshotHandler_load();
+int snapshotHandler_save();
+void* snapshotHandler_thread(void*);
+
+#endif
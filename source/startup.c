@@ -0,0 +1,53 @@
+/*
+// IoT Controller
+// Startup Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "startup.h"
+#include "wait.h"
+#include <stdio.h>
+#include <stdatomic.h>
+
+// NOTE: Records when each startup phase first finished (Microseconds since startupHandler_begin), so time to first frame
+// and time to a usable interface can be read from the log or the interface. Phases are only recorded once.
+
+static uint64_t startedAt = 0;
+static atomic_llong phaseUs[STARTUP_PHASE_COUNT] = { -1, -1, -1, -1, -1, -1 };
+
+static const char* phaseNames[STARTUP_PHASE_COUNT] = {
+    "Config read",
+    "Snapshot loaded",
+    "Devices ready",
+    "Window initialized",
+    "First frame",
+    "Broker connected"
+};
+
+// Has to be called before any other thread is started
+void startupHandler_begin() {
+    startedAt = waitHandler_monotonicNs();
+}
+
+void startupHandler_mark(int phase) {
+    if (phase < 0 || phase >= STARTUP_PHASE_COUNT) { return; }
+    long long expected = -1;
+    long long elapsed = (long long)((waitHandler_monotonicNs() - startedAt) / 1000ULL);
+    if (atomic_compare_exchange_strong(&phaseUs[phase], &expected, elapsed)) {
+        printf("STARTUP: %s after %.1f ms.\n", phaseNames[phase], elapsed / 1000.0);
+    }
+}
+
+int startupHandler_reached(int phase) {
+    return atomic_load(&phaseUs[phase]) >= 0;
+}
+
+// Microseconds from startup until the phase finished, -1 if it has not yet
+int64_t startupHandler_elapsedUs(int phase) {
+    return atomic_load(&phaseUs[phase]);
+}
+
+const char* startupHandler_phaseName(int phase) {
+    return phaseNames[phase];
+}
@@ -0,0 +1,21 @@
+#ifndef _STARTUP_H
+#define _STARTUP_H
+#include <stdint.h>
+
+// Startup phases, in the order they usually finish
+// (Config through index run on the startup thread, window/first frame on the main thread, both at the same time)
+#define STARTUP_PHASE_CONFIG 0 // config.json read
+#define STARTUP_PHASE_SNAPSHOT 1 // Last known states loaded
+#define STARTUP_PHASE_READY 2 // Search index built, the interface can show the devices
+#define STARTUP_PHASE_WINDOW 3 // GLFW/ImGui initialized
+#define STARTUP_PHASE_FIRST_FRAME 4 // First frame on screen
+#define STARTUP_PHASE_BROKER 5 // First connection to the broker
+#define STARTUP_PHASE_COUNT 6
+
+void startupHandler_begin();
+void startupHandler_mark(int phase);
+int startupHandler_reached(int phase);
+int64_t startupHandler_elapsedUs(int phase);
+const char* startupHandler_phaseName(int phase);
+
+#endif
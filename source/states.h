@@ -9,5 +9,10 @@
 #define FLAG_DISPATCH_ACTION_OPENBK_LIGHT_WARMTH 4
 #define FLAG_DISPATCH_ACTION_OPENBK_LIGHT_MODE_WHITE 5
 #define FLAG_DISPATCH_ACTION_OPENBK_LIGHT_MODE_COLOR 6
+#define FLAG_DISPATCH_ACTION_OPENBK_LIGHT_COLOR 7 // Content is packed 0x00RRGGBB
+#define FLAG_DISPATCH_ACTION_OPENBK_LIGHT_REQUEST_STATE 8
+
+// Upper bound of the action values above, used to size per-action tables
+#define FLAG_DISPATCH_ACTION_COUNT 16
 
 #endif
@@ -0,0 +1,192 @@
+/*
+// IoT Controller
+// Status Bar Handler
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "statusbar.h"
+#include "shmreader.h"
+#include "config.h"
+#include "wait.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Info
+// i3bar: {"version":1} and "[", then one array of blocks per line (",[...]" after the first)
+//   {"name":"iot","full_text":"<on> on, <online>/<devices> online"}, then per group
+//   {"name":"iot_room","instance":"<group>","full_text":"<group> <on>/<members>","color":...} (Lit rooms yellow, offline rooms grey)
+// waybar: {"text":"<on> on, <online>/<devices> online","tooltip":"<group>: <on>/<members> on\n...","class":"on|off|offline"}
+*/
+
+// NOTE: Runs as its own process started by the bar (--statusbar [i3bar|waybar]), reading the shared state table of the running
+// instance. It sleeps on the table's generation futex, so it only wakes when a device changed, and looks at most once per
+// STATUSBAR_MIN_INTERVAL_MS however much the devices chatter. A line is only written if it differs from the last one.
+// stdout belongs to the bar, anything else printed ends up on stderr.
+
+// Devices
+extern int deviceCount;
+extern configPtr_device_t configPtr_devices[];
+
+// Groups
+extern int groupCount;
+extern configPtr_group_t configPtr_groups[];
+
+static int shmIndex[MAX_DEVICES]; // Table record of each configured device, -1 if the instance does not have it
+
+// Match configured devices to table records, the instance indexes them in config order unless the config changed since it started
+static void statusbarHandler_mapDevices(const shmReader_t* reader) {
+    shmHandler_record_t record;
+    for (int i = 0; i < deviceCount; i++) {
+        if (shmReader_read(reader, i, &record) == 0 && strncmp(record.name, configPtr_devices[i].name, SHM_NAME_LENGTH - 1) == 0) {
+            shmIndex[i] = i;
+        } else {
+            shmIndex[i] = shmReader_find(reader, configPtr_devices[i].name);
+        }
+    }
+}
+
+// Append 'str' as the inside of a JSON string
+static int statusbarHandler_escape(char* out, int length, const char* str) {
+    for (const char* c = str; *c != '\0' && length < STATUSBAR_MAX_OUTPUT - 8; c++) {
+        if (*c == '"' || *c == '\\') { out[length++] = '\\'; }
+        if ((unsigned char)*c < 0x20) { continue; }
+        out[length++] = *c;
+    }
+    out[length] = '\0';
+    return length;
+}
+
+// Append to 'out', returns the new length (Output that does not fit is cut off)
+static int statusbarHandler_append(char* out, int length, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(out + length, STATUSBAR_MAX_OUTPUT - length, format, args);
+    va_end(args);
+    return written < STATUSBAR_MAX_OUTPUT - length ? length + written : STATUSBAR_MAX_OUTPUT - 1;
+}
+
+// Render the current state into 'out' (Without a newline), 'reader' is NULL while no instance is running
+static void statusbarHandler_render(const shmReader_t* reader, int format, char out[STATUSBAR_MAX_OUTPUT]) {
+    int length = 0;
+
+    if (reader == NULL) {
+        if (format == STATUSBAR_FORMAT_I3BAR) {
+            length = statusbarHandler_append(out, length, "[{\"name\":\"iot\",\"full_text\":\"IoT offline\",\"color\":\"#808080\"}]");
+        } else {
+            length = statusbarHandler_append(out, length, "{\"text\":\"IoT offline\",\"tooltip\":\"The IoT Controller is not running\",\"class\":\"offline\"}");
+        }
+        return;
+    }
+
+    int count = shmReader_count(reader);
+    int online = 0;
+    int on = 0;
+    shmHandler_record_t record;
+    for (int i = 0; i < count; i++) {
+        if (shmReader_read(reader, i, &record) != 0 || (record.flags & SHM_FLAG_ONLINE) == 0) { continue; }
+        online++;
+        on += record.power == 1;
+    }
+
+    if (format == STATUSBAR_FORMAT_I3BAR) {
+        length = statusbarHandler_append(out, length, "[{\"name\":\"iot\",\"full_text\":\"%d on, %d/%d online\"}", on, online, count);
+    } else {
+        length = statusbarHandler_append(out, length, "{\"text\":\"%d on, %d/%d online\",\"tooltip\":\"", on, online, count);
+    }
+
+    for (int g = 0; g < groupCount; g++) {
+        int memberOn = 0;
+        int memberOnline = 0;
+        for (int m = 0; m < configPtr_groups[g].memberCount; m++) {
+            int index = shmIndex[configPtr_groups[g].members[m]];
+            if (index == -1 || shmReader_read(reader, index, &record) != 0 || (record.flags & SHM_FLAG_ONLINE) == 0) { continue; }
+            memberOnline++;
+            memberOn += record.power == 1;
+        }
+        const char* name = configPtr_groups[g].prettyName != NULL ? configPtr_groups[g].prettyName : configPtr_groups[g].name;
+
+        if (format == STATUSBAR_FORMAT_I3BAR) {
+            length = statusbarHandler_append(out, length, ",{\"name\":\"iot_room\",\"instance\":\"");
+            length = statusbarHandler_escape(out, length, configPtr_groups[g].name);
+            length = statusbarHandler_append(out, length, "\",\"full_text\":\"");
+            length = statusbarHandler_escape(out, length, name);
+            length = statusbarHandler_append(out, length, " %d/%d\"", memberOn, configPtr_groups[g].memberCount);
+            if (memberOnline == 0) {
+                length = statusbarHandler_append(out, length, ",\"color\":\"#808080\"");
+            } else if (memberOn > 0) {
+                length = statusbarHandler_append(out, length, ",\"color\":\"#FFD866\"");
+            }
+            length = statusbarHandler_append(out, length, "}");
+        } else {
+            if (g > 0) { length = statusbarHandler_append(out, length, "\\n"); }
+            length = statusbarHandler_escape(out, length, name);
+            length = statusbarHandler_append(out, length, ": %d/%d on%s", memberOn, configPtr_groups[g].memberCount, memberOnline == 0 ? " (Offline)" : "");
+        }
+    }
+
+    if (format == STATUSBAR_FORMAT_I3BAR) {
+        length = statusbarHandler_append(out, length, "]");
+    } else {
+        length = statusbarHandler_append(out, length, "\",\"class\":\"%s\"}", on > 0 ? "on" : "off");
+    }
+}
+
+int statusbarHandler_run(int format) {
+    static char line[STATUSBAR_MAX_OUTPUT];
+    static char last[STATUSBAR_MAX_OUTPUT];
+
+    // Keep stdout for the bar and send everything else (Config errors etc.) to stderr
+    int outFd = dup(STDOUT_FILENO);
+    FILE* out = outFd < 0 ? NULL : fdopen(outFd, "w");
+    if (out == NULL || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+        fprintf(stderr, "ERROR: Could not set up the status bar output.\n");
+        return 1;
+    }
+
+    // The groups are the rooms
+    if (configHandler_read() != 0) { return 1; }
+
+    if (format == STATUSBAR_FORMAT_I3BAR) {
+        fprintf(out, "{\"version\":1}\n[\n");
+    }
+
+    shmReader_t reader;
+    int opened = 0;
+    int lines = 0;
+    last[0] = '\0';
+    while (1 == 1) {
+        if (opened == 1 && shmReader_running(&reader) == 0) {
+            shmReader_close(&reader);
+            opened = 0;
+        }
+        if (opened == 0 && shmReader_open(&reader) == 0) {
+            opened = 1;
+            statusbarHandler_mapDevices(&reader);
+        }
+
+        uint64_t lookedAt = waitHandler_monotonicNs();
+        uint32_t generation = opened == 1 ? shmReader_generation(&reader) : 0;
+        statusbarHandler_render(opened == 1 ? &reader : NULL, format, line);
+        if (strcmp(line, last) != 0) {
+            fprintf(out, "%s%s\n", format == STATUSBAR_FORMAT_I3BAR && lines > 0 ? "," : "", line);
+            if (fflush(out) != 0) { return 1; } // The bar is gone
+            strcpy(last, line);
+            lines++;
+        }
+
+        // Rate limit first, then sleep until something changes (Returns right away if something already did)
+        uint64_t elapsedMs = (waitHandler_monotonicNs() - lookedAt) / 1000000;
+        if (elapsedMs < STATUSBAR_MIN_INTERVAL_MS) {
+            usleep((STATUSBAR_MIN_INTERVAL_MS - elapsedMs) * 1000);
+        }
+        if (opened == 1) {
+            shmReader_wait(&reader, generation, STATUSBAR_RECHECK_MS);
+        } else {
+            usleep(STATUSBAR_RECHECK_MS * 1000);
+        }
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef _STATUSBAR_H
+#define _STATUSBAR_H
+
+#define STATUSBAR_FORMAT_I3BAR 0 // i3bar protocol (Also swaybar, and waybar's i3bar compatible modules)
+#define STATUSBAR_FORMAT_WAYBAR 1 // One JSON object per line, for a waybar custom module with "return-type": "json"
+
+// Least time between two looks at the table, changes in between are folded into the next look
+#define STATUSBAR_MIN_INTERVAL_MS 250
+
+// How often the instance is checked on while nothing changes, and how often a missing table is looked for
+#define STATUSBAR_RECHECK_MS 5000
+
+// Longest line written to the bar
+#define STATUSBAR_MAX_OUTPUT 16384
+
+int statusbarHandler_run(int format);
+
+#endif
@@ -0,0 +1,268 @@
+/*
+// IoT Controller
+// Tasmota Driver
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "tasmota.h"
+#include "driver.h"
+#include "config.h"
+#include "mqtt.h"
+#include "states.h"
+#include "color.h"
+#include "scan.h"
+#include "scene.h"
+#include "shadow.h"
+#include "powermon.h"
+#include "history.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdatomic.h>
+
+/* Info
+// tele/<name>/STATE --> Periodic state (Same fields as a State response)
+// tele/<name>/SENSOR --> Periodic sensor readings (ENERGY on plugs with a power monitor)
+// tele/<name>/LWT --> Connection status ("Online"/"Offline")
+// stat/<name>/RESULT --> Command response
+// stat/<name>/POWER --> Power state ("ON"/"OFF")
+// cmnd/<name or group topic>/<command> --> Commands
+*/
+
+// NOTE: Telemetry is parsed with the scan handler into fixed buffers, and the device's state strings are only
+// reallocated when their value actually changed (driverHandler_setString), so periodic telemetry does not allocate at all.
+
+// Devices
+extern int deviceCount;
+extern configPtr_device_t configPtr_devices[];
+
+extern atomic_uint stateGeneration;
+
+static tasmotaDriver_energy_t energy[MAX_DEVICES];
+static unsigned char energyReported[MAX_DEVICES];
+
+const driverHandler_driver_t tasmotaDriver = {
+    "tasmota",
+    tasmotaDriver_route,
+    tasmotaDriver_handleMessage,
+    tasmotaDriver_encodeCommand,
+    tasmotaDriver_sendCommand,
+    "Backlog",
+    tasmotaDriver_requestState
+};
+
+int tasmotaDriver_route(char** levels, int levelCount, const char** name) {
+    if (levelCount < 3) { return -1; }
+    if (strcmp(levels[0], "tele") == 0) {
+        *name = levels[1];
+        if (strcmp(levels[2], "STATE") == 0) { return TASMOTA_MESSAGE_STATE; }
+        if (strcmp(levels[2], "SENSOR") == 0) { return TASMOTA_MESSAGE_SENSOR; }
+        if (strcmp(levels[2], "LWT") == 0) { return TASMOTA_MESSAGE_LWT; }
+    } else if (strcmp(levels[0], "stat") == 0) {
+        *name = levels[1];
+        if (strcmp(levels[2], "RESULT") == 0) { return TASMOTA_MESSAGE_RESULT; }
+        if (strcmp(levels[2], "POWER") == 0) { return TASMOTA_MESSAGE_POWER; }
+    }
+    return -1;
+}
+
+static void tasmotaDriver_reportPower(int device, int power) {
+    int reported[SHADOW_FIELD_COUNT] = { SHADOW_UNKNOWN, SHADOW_UNKNOWN, SHADOW_UNKNOWN, SHADOW_UNKNOWN };
+    reported[SHADOW_FIELD_POWER] = power;
+    shadowHandler_report(device, reported);
+}
+
+int tasmotaDriver_handleMessage(int device, int kind, char* content) {
+    switch (kind) {
+        case TASMOTA_MESSAGE_STATE:
+            tasmotaDriver_processState(content, device);
+            break;
+        case TASMOTA_MESSAGE_SENSOR:
+            tasmotaDriver_processSensor(content, device);
+            break;
+        case TASMOTA_MESSAGE_LWT:
+            configPtr_devices[device].online = strcmp(content, "Online") == 0 ? 1 : 0;
+            atomic_fetch_add(&stateGeneration, 1);
+            if (configPtr_devices[device].online == 1) { shadowHandler_onOnline(device); }
+            break;
+        case TASMOTA_MESSAGE_RESULT:
+            // Responses to a single command only carry the fields it changed, the rest of the state is kept
+            tasmotaDriver_processState(content, device);
+            mqttHandler_acknowledge(device);
+            sceneHandler_onStateResponse(device);
+            break;
+        case TASMOTA_MESSAGE_POWER: {
+            int power = strcasecmp(content, "ON") == 0 ? 1 : 0;
+            driverHandler_setString(&configPtr_devices[device].deviceState.power, power ? "ON" : "OFF");
+            tasmotaDriver_reportPower(device, power);
+            atomic_fetch_add(&stateGeneration, 1);
+            break;
+        }
+        default:
+            return 1;
+    }
+    return 0;
+}
+
+// Convert a queued command into a Tasmota command name and payload
+int tasmotaDriver_encodeCommand(const queueHandler_command_t* command, const char** cmnd, char payload[16]) {
+    payload[0] = '\0';
+    switch (command->action) {
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_ON:
+            *cmnd = "POWER";
+            strcpy(payload, "ON");
+            break;
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_OFF:
+            *cmnd = "POWER";
+            strcpy(payload, "OFF");
+            break;
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_BRIGHTNESS:
+            *cmnd = "Dimmer";
+            snprintf(payload, 16, "%u", command->content > 100 ? 100 : command->content);
+            break;
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_WARMTH:
+            // Warmth (0 - 100) is mapped onto Tasmota's color temperature range in mireds
+            *cmnd = "CT";
+            snprintf(payload, 16, "%u", TASMOTA_CT_MIN + (((command->content > 100 ? 100 : command->content) * (TASMOTA_CT_MAX - TASMOTA_CT_MIN) + 50) / 100));
+            break;
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_COLOR:
+            *cmnd = "Color";
+            payload[0] = '#';
+            colorHandler_encodeHex(command->content, payload + 1);
+            break;
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_REQUEST_STATE:
+            *cmnd = "STATE";
+            break;
+        default:
+            return 1;
+    }
+    return 0;
+}
+
+// Send a Tasmota command to a device topic or group topic, an empty payload sends no content
+int tasmotaDriver_sendCommand(const char* target, const char* cmnd, const char* payload) {
+    char topic[256];
+    snprintf(topic, sizeof(topic), "cmnd/%s/%s", target, cmnd);
+    return mqttHandler_publish(topic, payload);
+}
+
+int tasmotaDriver_requestState(int device) {
+    return tasmotaDriver_sendCommand(configPtr_devices[device].name, "STATE", "");
+}
+
+// Parse a State/RESULT message, only the fields present are updated
+int tasmotaDriver_processState(char* content, int device) {
+    char uptime[32];
+    char power[8];
+    char color[16];
+    char hsbcolor[32];
+    char ssid[64];
+    char bssid[32];
+    char wifiMode[16];
+    scanHandler_field_t fields[] = {
+        { .key = "Uptime", .type = SCAN_TYPE_STRING, .string = uptime, .stringSize = sizeof(uptime) },
+        { .key = "MqttCount", .type = SCAN_TYPE_NUMBER },
+        { .key = "POWER", .type = SCAN_TYPE_STRING, .string = power, .stringSize = sizeof(power) },
+        { .key = "Dimmer", .type = SCAN_TYPE_NUMBER },
+        { .key = "CT", .type = SCAN_TYPE_NUMBER },
+        { .key = "Color", .type = SCAN_TYPE_STRING, .string = color, .stringSize = sizeof(color) },
+        { .key = "HSBColor", .type = SCAN_TYPE_STRING, .string = hsbcolor, .stringSize = sizeof(hsbcolor) },
+        { .key = "SSId", .type = SCAN_TYPE_STRING, .string = ssid, .stringSize = sizeof(ssid) },
+        { .key = "BSSId", .type = SCAN_TYPE_STRING, .string = bssid, .stringSize = sizeof(bssid) },
+        { .key = "Channel", .type = SCAN_TYPE_NUMBER }, // The top level 'Channel' is an array, so this ends up being the Wifi channel
+        { .key = "Mode", .type = SCAN_TYPE_STRING, .string = wifiMode, .stringSize = sizeof(wifiMode) },
+        { .key = "RSSI", .type = SCAN_TYPE_NUMBER },
+        { .key = "Signal", .type = SCAN_TYPE_NUMBER }
+    };
+    int fieldCount = sizeof(fields) / sizeof(fields[0]);
+    if (scanHandler_scan(content, strlen(content), fields, fieldCount) == 0) {
+        return 1;
+    }
+
+    mqttHandler_state_t* state = &configPtr_devices[device].deviceState;
+    int rc = 0;
+    if (fields[0].found) { rc |= driverHandler_setString(&state->uptime, uptime); }
+    if (fields[1].found) { state->mqttCount = (int)fields[1].number; }
+    if (fields[2].found) { rc |= driverHandler_setString(&state->power, strcasecmp(power, "ON") == 0 ? "ON" : "OFF"); }
+    if (fields[3].found) {
+        state->dimmer = (int)fields[3].number;
+        historyHandler_append(device, HISTORY_SERIES_DIMMER, historyHandler_now(), state->dimmer);
+    }
+    if (fields[5].found) { rc |= driverHandler_setString(&state->color, color); }
+    if (fields[6].found) { rc |= driverHandler_setString(&state->hsbcolor, hsbcolor); }
+    if (fields[7].found) { rc |= driverHandler_setString(&state->wifi_ssid, ssid); }
+    if (fields[8].found) { rc |= driverHandler_setString(&state->wifi_bssid, bssid); }
+    if (fields[9].found) { state->wifi_channel = (int)fields[9].number; }
+    if (fields[10].found) { rc |= driverHandler_setString(&state->wifi_mode, wifiMode); }
+    if (fields[11].found) { state->wifi_rssi = (int)fields[11].number; }
+    if (fields[12].found) {
+        state->wifi_signal = (int)fields[12].number;
+        historyHandler_append(device, HISTORY_SERIES_RSSI, historyHandler_now(), state->wifi_signal);
+    }
+
+    // Update the reported side of the device shadow
+    int reported[SHADOW_FIELD_COUNT] = { SHADOW_UNKNOWN, SHADOW_UNKNOWN, SHADOW_UNKNOWN, SHADOW_UNKNOWN };
+    if (fields[2].found) { reported[SHADOW_FIELD_POWER] = strcasecmp(power, "ON") == 0 ? 1 : 0; }
+    if (fields[3].found) { reported[SHADOW_FIELD_BRIGHTNESS] = (int)fields[3].number; }
+    if (fields[4].found) {
+        int ct = (int)fields[4].number;
+        if (ct < TASMOTA_CT_MIN) { ct = TASMOTA_CT_MIN; }
+        if (ct > TASMOTA_CT_MAX) { ct = TASMOTA_CT_MAX; }
+        // Rounded both ways, so a warmth sent by us comes back as the same value
+        reported[SHADOW_FIELD_WARMTH] = ((ct - TASMOTA_CT_MIN) * 100 + (TASMOTA_CT_MAX - TASMOTA_CT_MIN) / 2) / (TASMOTA_CT_MAX - TASMOTA_CT_MIN);
+    }
+    float rgb[3];
+    // 'Color' can carry white channels after the RGB ones ("RRGGBBCCWW"), only the first 6 digits are decoded
+    if ((fields[5].found && colorHandler_decodeHex(color, rgb) == 0) || (fields[6].found && colorHandler_decodeHsb(hsbcolor, rgb) == 0)) {
+        reported[SHADOW_FIELD_COLOR] = (int)colorHandler_packRgb(rgb);
+    }
+    shadowHandler_report(device, reported);
+
+    atomic_fetch_add(&stateGeneration, 1);
+    return rc;
+}
+
+// Parse a SENSOR message (Only the energy monitor is used)
+int tasmotaDriver_processSensor(char* content, int device) {
+    scanHandler_field_t fields[] = {
+        { .key = "Power", .type = SCAN_TYPE_NUMBER },
+        { .key = "Voltage", .type = SCAN_TYPE_NUMBER },
+        { .key = "Current", .type = SCAN_TYPE_NUMBER },
+        { .key = "Today", .type = SCAN_TYPE_NUMBER },
+        { .key = "Total", .type = SCAN_TYPE_NUMBER }
+    };
+    if (scanHandler_scan(content, strlen(content), fields, 5) == 0) {
+        return 1;
+    }
+
+    tasmotaDriver_energy_t* reading = &energy[device];
+    if (energyReported[device] == 0) {
+        *reading = (tasmotaDriver_energy_t){ -1, -1, -1, -1, -1 };
+        energyReported[device] = 1;
+    }
+    if (fields[0].found) { reading->power = (float)fields[0].number; }
+    if (fields[1].found) { reading->voltage = (float)fields[1].number; }
+    if (fields[2].found) { reading->current = (float)fields[2].number; }
+    if (fields[3].found) { reading->today = (float)fields[3].number; }
+    if (fields[4].found) { reading->total = (float)fields[4].number; }
+
+    // Feed the rolling aggregates as well
+    uint64_t now = configPtr_devices[device].lastSeen;
+    if (fields[0].found) { powermonHandler_addSample(device, POWERMON_QUANTITY_POWER, reading->power, now); }
+    if (fields[1].found) { powermonHandler_addSample(device, POWERMON_QUANTITY_VOLTAGE, reading->voltage, now); }
+    if (fields[2].found) { powermonHandler_addSample(device, POWERMON_QUANTITY_CURRENT, reading->current, now); }
+    if (fields[4].found) { powermonHandler_setCounter(device, fields[4].number); }
+
+    atomic_fetch_add(&stateGeneration, 1);
+    return 0;
+}
+
+void tasmotaDriver_getEnergy(int device, tasmotaDriver_energy_t* out) {
+    if (device < 0 || device >= MAX_DEVICES || energyReported[device] == 0) {
+        *out = (tasmotaDriver_energy_t){ -1, -1, -1, -1, -1 };
+        return;
+    }
+    *out = energy[device];
+}
@@ -0,0 +1,34 @@
+#ifndef _TASMOTA_H
+#define _TASMOTA_H
+#include "queue.h"
+
+// Tasmota color temperature range in mireds (Cold - Warm)
+#define TASMOTA_CT_MIN 153
+#define TASMOTA_CT_MAX 500
+
+// Message kinds reported by the router
+#define TASMOTA_MESSAGE_STATE 0 // tele/<name>/STATE
+#define TASMOTA_MESSAGE_SENSOR 1 // tele/<name>/SENSOR
+#define TASMOTA_MESSAGE_LWT 2 // tele/<name>/LWT
+#define TASMOTA_MESSAGE_RESULT 3 // stat/<name>/RESULT
+#define TASMOTA_MESSAGE_POWER 4 // stat/<name>/POWER
+
+// Energy telemetry of devices with a power monitor, -1 if never reported
+typedef struct {
+    float power; // W
+    float voltage; // V
+    float current; // A
+    float today; // kWh
+    float total; // kWh
+} tasmotaDriver_energy_t;
+
+int tasmotaDriver_route(char** levels, int levelCount, const char** name);
+int tasmotaDriver_handleMessage(int device, int kind, char* content);
+int tasmotaDriver_encodeCommand(const queueHandler_command_t* command, const char** cmnd, char payload[16]);
+int tasmotaDriver_sendCommand(const char* target, const char* cmnd, const char* payload);
+int tasmotaDriver_requestState(int device);
+int tasmotaDriver_processState(char* content, int device);
+int tasmotaDriver_processSensor(char* content, int device);
+void tasmotaDriver_getEnergy(int device, tasmotaDriver_energy_t* out);
+
+#endif
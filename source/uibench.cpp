@@ -0,0 +1,223 @@
+/*
+// IoT Controller
+// Interface Benchmark Entry Point
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "imgui.h"
+#include "window.hpp"
+extern "C" {
+#include "config.h"
+#include "color.h"
+#include "shadow.h"
+#include "search.h"
+#include "driver.h"
+#include "wait.h"
+}
+
+/* Info
+// iot_controller_uibench [devices] [frames] --> Registers 'devices' devices (Default: UIBENCH_DEVICES, every driver in turn)
+// and prints the CPU cost of 'frames' frames (Default: UIBENCH_FRAMES) per view, from ImGui::NewFrame() to ImGui::Render()
+*/
+
+// NOTE: There is no window or GPU, the ImGui context is driven directly with a fixed display size and frame time.
+// That is the part of a frame the interface code is responsible for, the OpenGL backend only uploads what Render() built.
+// Views marked 'telemetry' change the state of UIBENCH_CHURN_PERCENT of the devices before every frame, like a busy fleet does.
+
+// Defaults, and how much of the fleet reports new state per frame in the telemetry views
+#define UIBENCH_DEVICES 10000
+#define UIBENCH_FRAMES 600
+#define UIBENCH_CHURN_PERCENT 1
+
+// Large enough that 10k heatmap tiles are all on screen
+#define UIBENCH_DISPLAY_WIDTH 2560.0f
+#define UIBENCH_DISPLAY_HEIGHT 1440.0f
+
+// Devices
+extern int deviceCount;
+extern configPtr_device_t configPtr_devices[];
+extern atomic_uint stateGeneration;
+
+// Interface state
+extern int deviceList_selectedItem;
+extern float halfChildHeight;
+extern int heatmapColumns;
+
+#define UIBENCH_DRIVER_ENTRY(id, driver, control, info) &driver,
+static const driverHandler_driver_t* drivers[DRIVER_COUNT] = {
+    nullptr, // DRIVER_UNKNOWN
+    DRIVER_LIST(UIBENCH_DRIVER_ENTRY)
+};
+
+typedef struct {
+    const char* name;
+    void (*draw)();
+    int telemetry;
+    int driver; // Device control views only select devices of this driver (DRIVER_UNKNOWN: every driver in turn)
+} uibench_view_t;
+
+static int frame = 0;
+static int controlDriver = DRIVER_UNKNOWN;
+static uint32_t seed = 1;
+
+static uint32_t uibench_random() {
+    // xorshift32
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+// A plausible state for a device, reported the way drivers report it
+static void uibench_report(int device) {
+    mqttHandler_state_t* state = &configPtr_devices[device].deviceState;
+    int power = uibench_random() % 4 != 0;
+    int dimmer = (int)(uibench_random() % 101);
+    uint32_t color = uibench_random() & 0xFFFFFF;
+    char hex[COLOR_HEX_LEN + 1];
+    char uptime[32];
+    colorHandler_encodeHex(color, hex);
+    snprintf(uptime, sizeof(uptime), "%uT%02u:%02u:%02u", uibench_random() % 30, uibench_random() % 24, uibench_random() % 60, uibench_random() % 60);
+
+    driverHandler_setString(&state->power, power ? "ON" : "OFF");
+    driverHandler_setString(&state->color, hex);
+    driverHandler_setString(&state->uptime, uptime);
+    state->dimmer = dimmer;
+    state->wifi_signal = -30 - (int)(uibench_random() % 60);
+    state->wifi_rssi = 2 * (state->wifi_signal + 100);
+    configPtr_devices[device].online = uibench_random() % 10 != 0;
+    configPtr_devices[device].lastSeen = waitHandler_monotonicNs();
+
+    int reported[SHADOW_FIELD_COUNT] = { power, dimmer, SHADOW_UNKNOWN, (int)color };
+    shadowHandler_report(device, reported);
+}
+
+static void uibench_drawList() {
+    windowHandler_drawDeviceList();
+}
+
+// Typing into the search box, a different query every frame
+static void uibench_drawListSearch() {
+    char query[16];
+    snprintf(query, sizeof(query), "bench-%d", frame % 1000);
+    searchHandler_query(query);
+    windowHandler_drawDeviceList();
+}
+
+// Clicking through devices of every type, or of one driver (Devices are registered for every driver in turn)
+static void uibench_drawControl() {
+    if (controlDriver == DRIVER_UNKNOWN) {
+        deviceList_selectedItem = frame % deviceCount;
+    } else {
+        int perDriver = deviceCount / (DRIVER_COUNT - 1) > 0 ? deviceCount / (DRIVER_COUNT - 1) : 1;
+        deviceList_selectedItem = (frame % perDriver) * (DRIVER_COUNT - 1) + controlDriver - 1;
+    }
+    windowHandler_handleDeviceControl();
+}
+
+#define UIBENCH_CONTROL_VIEW(id, driver, control, info) { "Device control, " #id, uibench_drawControl, 0, DRIVER_##id },
+static const uibench_view_t views[] = {
+    { "Device list", uibench_drawList, 0, DRIVER_UNKNOWN },
+    { "Device list, new query per frame", uibench_drawListSearch, 0, DRIVER_UNKNOWN },
+    { "Fleet table", windowHandler_drawFleetTable, 0, DRIVER_UNKNOWN },
+    { "Fleet table, telemetry", windowHandler_drawFleetTable, 1, DRIVER_UNKNOWN },
+    { "Heatmap", windowHandler_drawHeatmap, 0, DRIVER_UNKNOWN },
+    { "Heatmap, telemetry", windowHandler_drawHeatmap, 1, DRIVER_UNKNOWN },
+    { "Device control, mixed types", uibench_drawControl, 0, DRIVER_UNKNOWN },
+    DRIVER_LIST(UIBENCH_CONTROL_VIEW)
+};
+
+static int uibench_compareU64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// One frame of a view, returns its cost in ns
+static uint64_t uibench_frame(const uibench_view_t* view) {
+    ImGuiWindowFlags windowFlags = ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoSavedSettings;
+
+    uint64_t start = waitHandler_monotonicNs();
+    ImGui::NewFrame();
+    ImGui::SetNextWindowPos(ImVec2(0, 0));
+    ImGui::SetNextWindowSize(ImGui::GetIO().DisplaySize);
+    ImGui::Begin("IoT Controller", nullptr, windowFlags);
+    view->draw();
+    ImGui::End();
+    ImGui::Render();
+    return waitHandler_monotonicNs() - start;
+}
+
+int main(int argc, char** argv) {
+    int devices = argc > 1 ? atoi(argv[1]) : UIBENCH_DEVICES;
+    int frames = argc > 2 ? atoi(argv[2]) : UIBENCH_FRAMES;
+    if (devices < 1 || devices > MAX_DEVICES || frames < 1) {
+        printf("ERROR: Usage: %s [devices (1 - %d)] [frames]\n", argv[0], MAX_DEVICES);
+        return 1;
+    }
+
+    // Devices of every driver in turn
+    shadowHandler_init();
+    char name[64];
+    for (int i = 0; i < devices; i++) {
+        int driver = 1 + i % (DRIVER_COUNT - 1);
+        snprintf(name, sizeof(name), "bench-%d", i);
+        if (configHandler_registerDevice(drivers[driver]->mode, name, name, "light") == -1) { return 1; }
+        uibench_report(i);
+    }
+    if (searchHandler_build() != 0) { return 1; }
+
+    // Headless ImGui context
+    IMGUI_CHECKVERSION();
+    ImGui::CreateContext();
+    ImGuiIO& io = ImGui::GetIO();
+    io.IniFilename = nullptr;
+    io.DisplaySize = ImVec2(UIBENCH_DISPLAY_WIDTH, UIBENCH_DISPLAY_HEIGHT);
+    io.DeltaTime = 1.0f / 60.0f;
+    unsigned char* pixels = nullptr;
+    int width = 0;
+    int height = 0;
+    io.Fonts->GetTexDataAsRGBA32(&pixels, &width, &height);
+    halfChildHeight = UIBENCH_DISPLAY_WIDTH * 0.473f;
+
+    uint64_t* timings = (uint64_t*)malloc(frames * sizeof(uint64_t));
+    if (timings == NULL) {
+        printf("ERROR: Could not allocate memory on the heap.\n");
+        return 1;
+    }
+
+    printf("%d devices, %d frames per view, us per frame:\n", devices, frames);
+    printf("%-36s %8s %8s %8s\n", "View", "Median", "99%", "Worst");
+    int churn = devices * UIBENCH_CHURN_PERCENT / 100 > 0 ? devices * UIBENCH_CHURN_PERCENT / 100 : 1;
+    for (size_t v = 0; v < sizeof(views) / sizeof(views[0]); v++) {
+        controlDriver = views[v].driver;
+
+        // Warm up (Window layout settles, caches are built)
+        for (int i = 0; i < 3; i++) { uibench_frame(&views[v]); }
+
+        for (frame = 0; frame < frames; frame++) {
+            if (views[v].telemetry == 1) {
+                for (int i = 0; i < churn; i++) { uibench_report((int)(uibench_random() % devices)); }
+                atomic_fetch_add(&stateGeneration, 1);
+            }
+            timings[frame] = uibench_frame(&views[v]);
+        }
+
+        qsort(timings, frames, sizeof(uint64_t), uibench_compareU64);
+        printf("%-36s %8.1f %8.1f %8.1f\n", views[v].name, timings[frames / 2] / 1000.0, timings[frames * 99 / 100] / 1000.0, timings[frames - 1] / 1000.0);
+    }
+
+    // What a heatmap rebuild costs on its own (Telemetry views only pay it every HEATMAP_REBUILD_INTERVAL)
+    uint64_t start = waitHandler_monotonicNs();
+    for (int i = 0; i < frames; i++) { windowHandler_buildHeatmap(heatmapColumns); }
+    printf("%-36s %8.1f\n", "Heatmap rebuild", (waitHandler_monotonicNs() - start) / 1000.0 / frames);
+
+    free(timings);
+    ImGui::DestroyContext();
+    return 0;
+}
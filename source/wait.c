@@ -6,12 +6,24 @@
 */
 
 #include "wait.h"
+#include <time.h>
 
 void waitHandler_wait(atomic_int* addr) {
 #if __DARWIN__
     _ulock_wait(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO, (void*)addr, 0, 0);
 #elif __linux__
-    // TODO
+    // Sleeps only while the value is still 0, so a wake that raced ahead of us is never lost
+    __futex(addr, FUTEX_WAIT_PRIVATE, 0);
+#endif
+}
+
+// Same as waitHandler_wait, but gives up after 'timeoutMs'
+void waitHandler_waitTimeout(atomic_int* addr, uint32_t timeoutMs) {
+#if __DARWIN__
+    __ulock_wait(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO, (void*)addr, 0, timeoutMs * 1000);
+#elif __linux__
+    struct timespec timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+    __futexTimed(addr, FUTEX_WAIT_PRIVATE, 0, &timeout);
 #endif
 }
 
@@ -19,6 +31,32 @@ void waitHandler_wake(atomic_int* addr) {
 #if __DARWIN__
     __ulock_wake(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO, (void*)addr, 0);
 #elif __linux__
-    // TODO
+    __futex(addr, FUTEX_WAKE_PRIVATE, 1);
 #endif
 }
+
+// Between processes (A word in shared memory): sleeps while the value is still 'expected', at most 'timeoutMs'
+void waitHandler_waitShared(atomic_uint* addr, uint32_t expected, uint32_t timeoutMs) {
+#if __DARWIN__
+    __ulock_wait(UL_COMPARE_AND_WAIT_SHARED | ULF_NO_ERRNO, (void*)addr, expected, timeoutMs * 1000);
+#elif __linux__
+    struct timespec timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+    __futexTimed((atomic_int*)addr, FUTEX_WAIT, (int)expected, &timeout);
+#endif
+}
+
+// Wakes every process sleeping in waitHandler_waitShared on 'addr'
+void waitHandler_wakeShared(atomic_uint* addr) {
+#if __DARWIN__
+    __ulock_wake(UL_COMPARE_AND_WAIT_SHARED | ULF_WAKE_ALL | ULF_NO_ERRNO, (void*)addr, 0);
+#elif __linux__
+    __futex((atomic_int*)addr, FUTEX_WAKE, INT_MAX);
+#endif
+}
+
+// Monotonic timestamp used for latency measurements
+uint64_t waitHandler_monotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
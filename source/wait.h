@@ -1,6 +1,7 @@
 #ifndef _WAIT_H
 #define _WAIT_H
 #include <unistd.h>
+#include <stdint.h>
 #include <stdatomic.h>
 
 // Efficient thread sleeping/waking methods used here
@@ -9,6 +10,8 @@
 
 #ifdef __DARWIN__
 #define UL_COMPARE_AND_WAIT 1
+#define UL_COMPARE_AND_WAIT_SHARED 3
+#define ULF_WAKE_ALL        0x00000100
 #define ULF_NO_ERRNO        0x01000000
 #define SYS_ulock_wait      515
 #define SYS_ulock_wake      516
@@ -21,10 +24,25 @@ static inline int __ulock_wake(uint32_t operation, void *addr, uint64_t wake_val
     return syscall(SYS_ulock_wake, operation, addr, wake_value);
 }
 #elif __linux__
-// TODO
+#include <limits.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+static inline long __futex(atomic_int* addr, int operation, int value) {
+    return syscall(SYS_futex, (int*)addr, operation, value, NULL, NULL, 0);
+}
+
+static inline long __futexTimed(atomic_int* addr, int operation, int value, const struct timespec* timeout) {
+    return syscall(SYS_futex, (int*)addr, operation, value, timeout, NULL, 0);
+}
 #endif
 
 void waitHandler_wait(atomic_int* addr);
+void waitHandler_waitTimeout(atomic_int* addr, uint32_t timeoutMs);
 void waitHandler_wake(atomic_int* addr);
+void waitHandler_waitShared(atomic_uint* addr, uint32_t expected, uint32_t timeoutMs);
+void waitHandler_wakeShared(atomic_uint* addr);
+uint64_t waitHandler_monotonicNs();
 
 #endif
@@ -6,6 +6,9 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
 #include <stdatomic.h>
 #include <GLFW/glfw3.h>
 #include "imgui.h"
@@ -17,6 +20,19 @@ extern "C" {
 #include "wait.h"
 #include "states.h"
 #include "config.h"
+#include "color.h"
+#include "queue.h"
+#include "scene.h"
+#include "shadow.h"
+#include "search.h"
+#include "driver.h"
+#include "tasmota.h"
+#include "zigbee.h"
+#include "powermon.h"
+#include "history.h"
+#include "rollup.h"
+#include "export.h"
+#include "startup.h"
 }
 
 // Window objects
@@ -31,12 +47,78 @@ float halfChildHeight = 0;
 extern int deviceCount;
 extern configPtr_device_t configPtr_devices[];
 
-// Signal objects
-atomic_int dispatchFlag = 0; // Main flag to activate the MQTT dispatch function
-atomic_int dispatchType = 0; // Type of device
-atomic_int dispatchAction = 0; // Action to perform
-atomic_int dispatchDevice = -1; // Device index
-_Atomic uint32_t dispatchContent = 0x0; // Payload to send, if any
+// Groups
+extern int groupCount;
+extern configPtr_group_t configPtr_groups[];
+
+// Scenes
+extern int sceneCount;
+extern configPtr_scene_t configPtr_scenes[];
+
+// Fleet table sort cache (Keys are only rebuilt and re-sorted when the state generation or sort order changes)
+extern atomic_uint stateGeneration;
+windowHandler_fleetKey_t fleetKeys[MAX_DEVICES];
+int fleetNameRanks[MAX_DEVICES]; // Position of every device when sorted by name (Names never change, only ranked when devices are added)
+int fleetOrder[MAX_DEVICES];
+int fleetCount = 0;
+unsigned int fleetGeneration = 0;
+double fleetSortedAt = 0;
+int fleetSortColumn = FLEET_COLUMN_NAME;
+int fleetSortDescending = 0;
+
+// Heatmap vertex cache (8 vertices per tile: border quad + fill quad, relative to the grid origin)
+ImVector<ImDrawVert> heatmapVertices;
+ImVector<shadowHandler_state_t> heatmapReported;
+int heatmapMode = HEATMAP_MODE_COLOR;
+int heatmapBuiltMode = -1;
+int heatmapColumns = 0;
+int heatmapTiles = 0;
+unsigned int heatmapGeneration = 0;
+double heatmapBuiltAt = 0.0;
+
+// History chart, the samples of the charted series and one LTTB downsampled copy per zoom level.
+// Levels are only extended when new samples arrive, and only built once they are first looked at
+ImVector<historyHandler_sample_t> chartSamples;
+ImVector<historyHandler_sample_t> chartLevels[CHART_LEVELS];
+unsigned char chartLevelDirty[CHART_LEVELS] = { 0 };
+ImVector<ImVec2> chartPolyline;
+int chartDevice = -1;
+int chartSeries = HISTORY_SERIES_POWER;
+int chartLoadedSeries = -1;
+int chartTailCount = 0; // Cached samples sharing the newest timestamp (More can still arrive within that second)
+double chartRefreshedAt = 0;
+double chartViewEnd = 0;
+double chartViewSpan = 3600;
+bool chartFollow = true; // Keep the right edge at the newest sample
+
+// Rollup points of views older than the cached samples. A view's span is queried on either side of it as well,
+// so panning only queries again once the view leaves what was queried
+ImVector<historyHandler_sample_t> chartRollupPoints;
+ImVector<rollupHandler_bucket_t> chartRollupBuckets;
+int64_t chartRollupFrom = 0;
+int64_t chartRollupTo = 0;
+int64_t chartRollupBucket = 0;
+double chartRollupQueriedAt = 0;
+
+// Control/info panels of every driver (Indexed by DRIVER_*, registered together with the driver in DRIVER_LIST)
+#define WINDOW_DRIVER_PANEL(id, driver, control, info) { control, info },
+const windowHandler_driverPanel_t windowHandler_driverPanels[DRIVER_COUNT] = {
+    { NULL, NULL }, // DRIVER_UNKNOWN
+    DRIVER_LIST(WINDOW_DRIVER_PANEL)
+};
+
+// Device list search text
+char deviceList_search[SEARCH_MAX_QUERY] = { 0 };
+
+// Multi-selection (Ctrl+Click in the device list, or clicking a group)
+unsigned char deviceList_selected[MAX_DEVICES] = { 0 };
+int deviceList_selectedCount = 0;
+
+// Fan-out status
+extern atomic_int fanoutCount;
+extern atomic_int fanoutLatency;
+extern atomic_int mqttMessagesSent;
+extern atomic_int mqttMessagesSaved;
 
 static void windowHandler_glfw_error_callback(int error, const char* desc) {
     printf("GLFW Error: %d: %s\n", error, desc);
@@ -93,6 +175,8 @@ int windowHandler_init() {
 
     // NOTE: LOAD FONTS HERE
 
+    startupHandler_mark(STARTUP_PHASE_WINDOW);
+
     // Start the window loop
     // NOTE: Cannot put this into a separate thread due to the polling
     windowHandler_loop();
@@ -125,23 +209,51 @@ void windowHandler_loop() {
         ImGui::SetNextWindowSize(viewport->Size);
 
         // Actually draw the window
-        {
+        // NOTE: The devices are set up on another thread while the window starts, nothing can touch them until they are ready
+        if (!startupHandler_reached(STARTUP_PHASE_READY)) {
+            ImGui::Begin("IoT Controller", nullptr, windowFlags);
+            ImGui::TextDisabled("Loading devices...");
+            ImGui::End();
+        } else {
             ImGui::Begin("IoT Controller", nullptr, windowFlags);
             windowHandler_drawDeviceList();
             ImGui::SameLine();
 
             ImGui::BeginChild("rightSide", ImVec2(0, 0), true);
 
-            ImVec2 left_avail = ImGui::GetContentRegionAvail();
-            halfChildHeight = left_avail.x * 0.473f; // HACK: Make 2 children aligned vertically
-            
-            //ImGui::BeginChild("UpSide", ImVec2(0, half_width), true);
-            //ImGui::EndChild();
-            //ImGui::BeginChild("DownSide", ImVec2(0, half_width), true);
-            //ImGui::EndChild();
+            windowHandler_drawConnectionStatus();
+
+            if (ImGui::BeginTabBar("rightSideTabs")) {
+                if (ImGui::BeginTabItem("Control")) {
+                    ImVec2 left_avail = ImGui::GetContentRegionAvail();
+                    halfChildHeight = left_avail.x * 0.473f; // HACK: Make 2 children aligned vertically
 
-            windowHandler_handleDeviceControl();
+                    //ImGui::BeginChild("UpSide", ImVec2(0, half_width), true);
+                    //ImGui::EndChild();
+                    //ImGui::BeginChild("DownSide", ImVec2(0, half_width), true);
+                    //ImGui::EndChild();
 
+                    windowHandler_handleDeviceControl();
+                    ImGui::EndTabItem();
+                }
+
+                if (ImGui::BeginTabItem("Fleet")) {
+                    windowHandler_drawFleetTable();
+                    ImGui::EndTabItem();
+                }
+
+                if (ImGui::BeginTabItem("Heatmap")) {
+                    windowHandler_drawHeatmap();
+                    ImGui::EndTabItem();
+                }
+
+                if (ImGui::BeginTabItem("History")) {
+                    windowHandler_drawHistoryChart();
+                    ImGui::EndTabItem();
+                }
+
+                ImGui::EndTabBar();
+            }
 
             ImGui::EndChild();
             
@@ -157,6 +269,7 @@ void windowHandler_loop() {
         glClear(GL_COLOR_BUFFER_BIT);
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
         glfwSwapBuffers(window);
+        startupHandler_mark(STARTUP_PHASE_FIRST_FRAME);
     }
 
     // Cleanup
@@ -168,6 +281,33 @@ void windowHandler_loop() {
     return;
 }
 
+// One line of broker status above the tabs, hovering it shows how long each startup phase took
+void windowHandler_drawConnectionStatus() {
+    mqttHandler_status_t status;
+    mqttHandler_getStatus(&status);
+    if (status.state == MQTT_STATE_CONNECTED) {
+        ImGui::TextColored(ImVec4(0, 1, 0, 1), "Broker: Connected");
+    } else if (status.state == MQTT_STATE_CONNECTING) {
+        ImGui::TextColored(ImVec4(1, 1, 0, 1), "Broker: Connecting (Attempt %d)... Showing last known states", status.attempts + 1);
+    } else {
+        ImGui::TextColored(ImVec4(1, 0, 0, 1), "Broker: Offline (%s), retrying in %d s. Commands are queued until then",
+            MQTTClient_strerror(status.error), (status.retryInMs + 999) / 1000);
+    }
+
+    if (ImGui::IsItemHovered()) {
+        ImGui::BeginTooltip();
+        for (int i = 0; i < STARTUP_PHASE_COUNT; i++) {
+            int64_t elapsedUs = startupHandler_elapsedUs(i);
+            if (elapsedUs < 0) {
+                ImGui::TextDisabled("%s: -", startupHandler_phaseName(i));
+            } else {
+                ImGui::Text("%s: %.1f ms", startupHandler_phaseName(i), elapsedUs / 1000.0);
+            }
+        }
+        ImGui::EndTooltip();
+    }
+}
+
 void windowHandler_drawDeviceList() {
     ImGui::BeginChild("devicePanel", ImVec2(150, 0), true);
 
@@ -175,53 +315,153 @@ void windowHandler_drawDeviceList() {
     ImGui::TextColored(ImVec4(1, 0, 1, 1), "Devices");
     ImGui::Separator();
 
-    // Add devices from the config file to the list
-    for (int i = 0; i < deviceCount; i++) {
-        // Set color to red or green depending whether device has been seen online
-        if (configPtr_devices[i].online == 1) {
-            ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(0, 1, 0, 1));
-        } else {
-            ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1, 0, 0, 1));
+    // Search box, the results are only recomputed when the text changes or devices were imported
+    searchHandler_sync();
+    if (ImGui::InputTextWithHint("##deviceSearch", "Search", deviceList_search, sizeof(deviceList_search))) {
+        searchHandler_query(deviceList_search);
+    }
+
+    // Only the visible rows are built, so the list costs the same with 2 or 10k devices
+    // NOTE: The list gets most of the panel if there are groups/scenes below it
+    float listHeight = (groupCount > 0 || sceneCount > 0) ? ImGui::GetContentRegionAvail().y * 0.6f : 0.0f;
+    ImGui::BeginChild("deviceListRows", ImVec2(0, listHeight), false);
+
+    const int* results = searchHandler_results();
+    ImGuiListClipper clipper;
+    clipper.Begin(searchHandler_resultCount());
+    while (clipper.Step()) {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+            int i = results[row];
+
+            // Set color to red or green depending whether device has been seen online (Dimmed while only the snapshot says so)
+            float alpha = configPtr_devices[i].stale == 1 ? 0.5f : 1.0f;
+            if (configPtr_devices[i].online == 1) {
+                ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(0, 1, 0, alpha));
+            } else {
+                ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1, 0, 0, alpha));
+            }
+
+            ImGui::PushID(i);
+            if (ImGui::Selectable(configPtr_devices[i].prettyName, deviceList_selected[i] == 1)) {
+                if (ImGui::GetIO().KeyCtrl) {
+                    // Toggle the device in the multi-selection
+                    windowHandler_setSelected(i, !deviceList_selected[i]);
+                } else {
+                    windowHandler_clearSelection();
+                    windowHandler_setSelected(i, 1);
+                }
+                deviceList_selectedItem = i;
+                printf("INTERFACE: (Device list) Item %d selected (%d total).\n", deviceList_selectedItem, deviceList_selectedCount);
+            }
+            if (configPtr_devices[i].stale == 1 && ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Last known state, the device has not reported in yet.");
+            }
+            ImGui::PopID();
+
+            // Reset color
+            ImGui::PopStyleColor();
+
+            if (i == deviceList_selectedItem) {
+                ImGui::SetItemDefaultFocus();
+            }
         }
+    }
+    clipper.End();
+
+    ImGui::EndChild();
+
+    // Groups select all of their members at once
+    if (groupCount > 0) {
+        ImGui::Spacing();
+        ImGui::TextColored(ImVec4(1, 0, 1, 1), "Groups");
+        ImGui::Separator();
 
-        if (ImGui::Selectable(configPtr_devices[i].prettyName, deviceList_selectedItem == i)) {
-            deviceList_selectedItem = i;
-            printf("INTERFACE: (Device list) Item %d selected.\n", deviceList_selectedItem);
+        for (int i = 0; i < groupCount; i++) {
+            if (ImGui::Selectable(configPtr_groups[i].prettyName, false)) {
+                windowHandler_clearSelection();
+                for (int j = 0; j < configPtr_groups[i].memberCount; j++) {
+                    windowHandler_setSelected(configPtr_groups[i].members[j], 1);
+                }
+                deviceList_selectedItem = configPtr_groups[i].memberCount > 0 ? configPtr_groups[i].members[0] : -1;
+                printf("INTERFACE: (Device list) Group %d selected (%d devices).\n", i, deviceList_selectedCount);
+            }
         }
+    }
+
+    // Scenes are applied in the background by the scene engine
+    if (sceneCount > 0) {
+        ImGui::Spacing();
+        ImGui::TextColored(ImVec4(1, 0, 1, 1), "Scenes");
+        ImGui::Separator();
 
-        // Reset color
-        ImGui::PopStyleColor();
+        for (int i = 0; i < sceneCount; i++) {
+            if (ImGui::Selectable(configPtr_scenes[i].prettyName, false)) {
+                sceneHandler_apply(i);
+                printf("INTERFACE: (Device list) Scene %d applied.\n", i);
+            }
+        }
 
-        if (deviceList_selectedItem) {
-            ImGui::SetItemDefaultFocus();
+        sceneHandler_status_t sceneStatus;
+        sceneHandler_getStatus(&sceneStatus);
+        if (sceneStatus.running == 1) {
+            ImGui::TextWrapped("Applying: %d/%d", sceneStatus.confirmed, sceneStatus.total);
+        } else if (sceneStatus.scene != -1) {
+            ImGui::TextWrapped("Done in %d ms", sceneStatus.elapsedMs);
+            if (sceneStatus.failed > 0) {
+                ImGui::TextColored(ImVec4(1, 0, 0, 1), "%d failed", sceneStatus.failed);
+            }
         }
     }
 
     ImGui::EndChild();
 }
 
-void windowHandler_handleDeviceControl() {
-    if (strcmp(configPtr_devices[deviceList_selectedItem].type, "light") == 0) {
-        if (configPtr_devices[deviceList_selectedItem].online == 1) {
-            windowHandler_drawLightDeviceControl();
-            windowHandler_drawLightDeviceInfo();
-        } else {
-            windowHandler_drawDeviceOffline();
+void windowHandler_setSelected(int device, int selected) {
+    if (deviceList_selected[device] == selected) { return; }
+    deviceList_selected[device] = selected;
+    deviceList_selectedCount += selected ? 1 : -1;
+}
+
+void windowHandler_clearSelection() {
+    memset(deviceList_selected, 0, sizeof(deviceList_selected));
+    deviceList_selectedCount = 0;
+}
+
+// Send a command to every selected device
+void windowHandler_fanoutSelection(int action, uint32_t content) {
+    int devices[MAX_DEVICES];
+    int count = 0;
+    for (int i = 0; i < deviceCount; i++) {
+        if (deviceList_selected[i] == 1) {
+            devices[count++] = i;
         }
-    } else if (strcmp(configPtr_devices[deviceList_selectedItem].type, "powermon") == 0) {
-        // NOTE Not implemented
-        printf("NOTE: Not implemented.\n");
-    } else {
+    }
+    mqttHandler_fanoutCommand(FLAG_DISPATCH_TYPE_OPENBK_LIGHT, action, devices, count, content);
+}
+
+void windowHandler_handleDeviceControl() {
+    if (deviceList_selectedCount > 1) {
+        windowHandler_drawMultiDeviceControl();
+        return;
+    }
+
+    if (deviceList_selectedItem < 0 || deviceList_selectedItem >= deviceCount) {
         // No device selected
         windowHandler_drawSelectDevice();
+        return;
+    }
+
+    const windowHandler_driverPanel_t* panel = &windowHandler_driverPanels[configPtr_devices[deviceList_selectedItem].driver];
+    if (panel->drawControl == NULL) {
+        windowHandler_drawNotSupported();
+    } else if (configPtr_devices[deviceList_selectedItem].online == 1) {
+        panel->drawControl();
+        if (panel->drawInfo != NULL) { panel->drawInfo(); }
+    } else {
+        windowHandler_drawDeviceOffline();
     }
 }
 
-//int brightness = 0;
-int brightnessOld = 0;
-//int warmth = 0;
-int warmthOld = 0;
-//float lightColor[3] = { 0.0f, 0.0f, 0.0f };
 void windowHandler_drawLightDeviceControl() {
     ImGui::BeginChild("deviceControl", ImVec2(0, halfChildHeight), true);
 
@@ -229,22 +469,18 @@ void windowHandler_drawLightDeviceControl() {
     ImGui::TextColored(ImVec4(1, 0, 1, 1), "OpenBK Light Device");
     ImGui::Separator();
 
+    // NOTE: Everything here only changes the desired state of the device shadow, the reconciler sends what actually differs
+    shadowHandler_device_t shadow;
+    shadowHandler_get(deviceList_selectedItem, &shadow);
+
     if (ImGui::Button("Turn light on")) {
-        atomic_store(&dispatchType, FLAG_DISPATCH_TYPE_OPENBK_LIGHT);
-        atomic_store(&dispatchAction, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_ON);
-        atomic_store(&dispatchDevice, deviceList_selectedItem);
-        atomic_store(&dispatchFlag, 1);
-        waitHandler_wake(&dispatchFlag);
+        shadowHandler_setDesired(deviceList_selectedItem, SHADOW_FIELD_POWER, 1, 0);
     }
 
     ImGui::SameLine();
 
     if (ImGui::Button("Turn light off")) {
-        atomic_store(&dispatchType, FLAG_DISPATCH_TYPE_OPENBK_LIGHT);
-        atomic_store(&dispatchAction, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_OFF);
-        atomic_store(&dispatchDevice, deviceList_selectedItem);
-        atomic_store(&dispatchFlag, 1);
-        waitHandler_wake(&dispatchFlag);
+        shadowHandler_setDesired(deviceList_selectedItem, SHADOW_FIELD_POWER, 0, 0);
     }
 
     if (ImGui::Button("Set to white mode")) {
@@ -257,35 +493,766 @@ void windowHandler_drawLightDeviceControl() {
         //
     }
 
-    ImGui::SliderInt("Brightness", &configPtr_devices[deviceList_selectedItem].brightness, 0, 100);
-    if (configPtr_devices[deviceList_selectedItem].brightness != brightnessOld) {
-        brightnessOld = configPtr_devices[deviceList_selectedItem].brightness;
-        atomic_store(&dispatchType, FLAG_DISPATCH_TYPE_OPENBK_LIGHT);
-        atomic_store(&dispatchAction, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_BRIGHTNESS);
-        atomic_store(&dispatchDevice, deviceList_selectedItem);
-        atomic_store(&dispatchContent, configPtr_devices[deviceList_selectedItem].brightness);
-        atomic_store(&dispatchFlag, 1);
-        waitHandler_wake(&dispatchFlag);
+    int brightness = shadowHandler_displayValue(&shadow, SHADOW_FIELD_BRIGHTNESS);
+    if (brightness == SHADOW_UNKNOWN) { brightness = 0; }
+    if (ImGui::SliderInt("Brightness", &brightness, 0, 100)) {
+        shadowHandler_setDesired(deviceList_selectedItem, SHADOW_FIELD_BRIGHTNESS, brightness, 0);
     }
 
-    ImGui::SliderInt("Warmth", &configPtr_devices[deviceList_selectedItem].warmth, 0, 100);
-    if (configPtr_devices[deviceList_selectedItem].warmth != warmthOld) {
-        warmthOld = configPtr_devices[deviceList_selectedItem].warmth;
-        atomic_store(&dispatchType, FLAG_DISPATCH_TYPE_OPENBK_LIGHT);
-        atomic_store(&dispatchAction, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_WARMTH);
-        atomic_store(&dispatchDevice, deviceList_selectedItem);
-        atomic_store(&dispatchContent, configPtr_devices[deviceList_selectedItem].warmth);
-        atomic_store(&dispatchFlag, 1);
-        waitHandler_wake(&dispatchFlag);
+    int warmth = shadowHandler_displayValue(&shadow, SHADOW_FIELD_WARMTH);
+    if (warmth == SHADOW_UNKNOWN) { warmth = 0; }
+    if (ImGui::SliderInt("Warmth", &warmth, 0, 100)) {
+        shadowHandler_setDesired(deviceList_selectedItem, SHADOW_FIELD_WARMTH, warmth, 0);
+    }
+
+    float color[3] = { 0.0f, 0.0f, 0.0f };
+    int packedColor = shadowHandler_displayValue(&shadow, SHADOW_FIELD_COLOR);
+    if (packedColor != SHADOW_UNKNOWN) {
+        colorHandler_unpackRgb((uint32_t)packedColor, color);
     }
 
     ImGui::PushItemWidth(100);
-    ImGui::ColorPicker3("ColorPicker", (float*)&configPtr_devices[deviceList_selectedItem].color, ImGuiColorEditFlags_PickerHueWheel | ImGuiColorEditFlags_NoSidePreview | ImGuiColorEditFlags_NoInputs | ImGuiColorEditFlags_NoAlpha);
+    if (ImGui::ColorPicker3("ColorPicker", color, ImGuiColorEditFlags_PickerHueWheel | ImGuiColorEditFlags_NoSidePreview | ImGuiColorEditFlags_NoInputs | ImGuiColorEditFlags_NoAlpha)) {
+        shadowHandler_setDesired(deviceList_selectedItem, SHADOW_FIELD_COLOR, (int)colorHandler_packRgb(color), 0);
+    }
     ImGui::PopItemWidth();
     
     ImGui::EndChild();
 }
 
+// Copy a device state string for drawing, "-" if it was not reported yet (Only with the state lock held)
+static void windowHandler_copyStateString(char buffer[WINDOW_STATE_STRING_LENGTH], const char* value) {
+    snprintf(buffer, WINDOW_STATE_STRING_LENGTH, "%s", value != NULL ? value : "-");
+}
+
+int multiBrightness = 0;
+void windowHandler_drawPowermonDeviceControl() {
+    ImGui::BeginChild("deviceControl", ImVec2(0, halfChildHeight), true);
+
+    // Title
+    ImGui::TextColored(ImVec4(1, 0, 1, 1), "OpenBK Power Monitor Device");
+    ImGui::Separator();
+
+    // The RESULT handler replaces the power string on the MQTT thread
+    char relay[WINDOW_STATE_STRING_LENGTH];
+    driverHandler_lockState();
+    windowHandler_copyStateString(relay, configPtr_devices[deviceList_selectedItem].deviceState.power);
+    driverHandler_unlockState();
+    ImGui::Text("Relay: %s", relay);
+
+    if (ImGui::Button("Turn relay on")) {
+        shadowHandler_setDesired(deviceList_selectedItem, SHADOW_FIELD_POWER, 1, 0);
+    }
+
+    ImGui::SameLine();
+
+    if (ImGui::Button("Turn relay off")) {
+        shadowHandler_setDesired(deviceList_selectedItem, SHADOW_FIELD_POWER, 0, 0);
+    }
+
+    ImGui::EndChild();
+}
+
+void windowHandler_drawMultiDeviceControl() {
+    ImGui::BeginChild("deviceControl", ImVec2(0, 0), true);
+
+    // Title
+    ImGui::TextColored(ImVec4(1, 0, 1, 1), "%d devices selected", deviceList_selectedCount);
+    ImGui::Separator();
+
+    if (ImGui::Button("Turn lights on")) {
+        windowHandler_fanoutSelection(FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_ON, 0);
+    }
+
+    ImGui::SameLine();
+
+    if (ImGui::Button("Turn lights off")) {
+        windowHandler_fanoutSelection(FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_OFF, 0);
+    }
+
+    if (ImGui::SliderInt("Brightness", &multiBrightness, 0, 100)) {
+        windowHandler_fanoutSelection(FLAG_DISPATCH_ACTION_OPENBK_LIGHT_BRIGHTNESS, multiBrightness);
+    }
+
+    ImGui::Separator();
+    if (atomic_load(&fanoutLatency) >= 0) {
+        ImGui::Text("Last command: %d devices acknowledged in %d ms", atomic_load(&fanoutCount), atomic_load(&fanoutLatency));
+    } else if (atomic_load(&fanoutCount) > 0) {
+        ImGui::Text("Last command: Waiting for %d devices to acknowledge", atomic_load(&fanoutCount));
+    }
+    ImGui::Text("Broker messages: %d sent, %d saved by backlog merging", atomic_load(&mqttMessagesSent), atomic_load(&mqttMessagesSaved));
+
+    ImGui::EndChild();
+}
+
+// Convert an uptime string ("1T02:03:04" or "02:03:04") to seconds for sorting
+// "<days>T<hh>:<mm>:<ss>" or "<hh>:<mm>:<ss>" to seconds, -1 if neither
+// NOTE: Parsed by hand, this runs for every device on each re-sort of the fleet table and sscanf/strtol were most of that
+static int windowHandler_parseUptime(const char* uptime) {
+    if (uptime == NULL) { return -1; }
+    int fields[4] = { 0, 0, 0, 0 };
+    int count = 1;
+    int hasDays = 0;
+    for (const char* c = uptime; *c != '\0'; c++) {
+        if (*c >= '0' && *c <= '9') {
+            fields[count - 1] = fields[count - 1] * 10 + (*c - '0');
+        } else if (*c == 'T' && count == 1) {
+            hasDays = 1;
+            count++;
+        } else if (*c == ':' && count < 4) {
+            count++;
+        } else {
+            return -1;
+        }
+    }
+    if (hasDays == 1 && count == 4) {
+        return (((fields[0] * 24) + fields[1]) * 60 + fields[2]) * 60 + fields[3];
+    }
+    if (hasDays == 0 && count == 3) {
+        return ((fields[0] * 60) + fields[1]) * 60 + fields[2];
+    }
+    return -1;
+}
+
+static int windowHandler_compareFleetNames(const void* a, const void* b) {
+    int delta = strcmp(configPtr_devices[*(const int*)a].prettyName, configPtr_devices[*(const int*)b].prettyName);
+    return delta != 0 ? delta : *(const int*)a - *(const int*)b;
+}
+
+static int windowHandler_compareFleetKeys(const void* a, const void* b) {
+    const windowHandler_fleetKey_t* ka = &fleetKeys[*(const int*)a];
+    const windowHandler_fleetKey_t* kb = &fleetKeys[*(const int*)b];
+    int64_t delta = 0;
+    switch (fleetSortColumn) {
+        case FLEET_COLUMN_NAME: delta = ka->nameRank - kb->nameRank; break;
+        case FLEET_COLUMN_ONLINE: delta = ka->online - kb->online; break;
+        case FLEET_COLUMN_POWER: delta = ka->power - kb->power; break;
+        case FLEET_COLUMN_DIMMER: delta = ka->dimmer - kb->dimmer; break;
+        case FLEET_COLUMN_RSSI: delta = ka->rssi - kb->rssi; break;
+        case FLEET_COLUMN_UPTIME: delta = ka->uptime - kb->uptime; break;
+        case FLEET_COLUMN_LAST_SEEN: delta = (ka->lastSeen > kb->lastSeen) - (ka->lastSeen < kb->lastSeen); break;
+        case FLEET_COLUMN_LATENCY: delta = ka->latency - kb->latency; break;
+    }
+    if (delta == 0) { delta = ka->device - kb->device; }
+    if (fleetSortDescending) { delta = -delta; }
+    return delta < 0 ? -1 : (delta > 0 ? 1 : 0);
+}
+
+void windowHandler_drawFleetTable() {
+    ImGuiTableFlags tableFlags = ImGuiTableFlags_Sortable | ImGuiTableFlags_ScrollY | ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersOuter | ImGuiTableFlags_BordersV | ImGuiTableFlags_Resizable | ImGuiTableFlags_NoSavedSettings;
+    if (!ImGui::BeginTable("fleetTable", FLEET_COLUMN_COUNT, tableFlags)) {
+        return;
+    }
+
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Device", ImGuiTableColumnFlags_DefaultSort, 0.0f, FLEET_COLUMN_NAME);
+    ImGui::TableSetupColumn("Online", 0, 0.0f, FLEET_COLUMN_ONLINE);
+    ImGui::TableSetupColumn("Power", 0, 0.0f, FLEET_COLUMN_POWER);
+    ImGui::TableSetupColumn("Dimmer", 0, 0.0f, FLEET_COLUMN_DIMMER);
+    ImGui::TableSetupColumn("RSSI", 0, 0.0f, FLEET_COLUMN_RSSI);
+    ImGui::TableSetupColumn("Uptime", 0, 0.0f, FLEET_COLUMN_UPTIME);
+    ImGui::TableSetupColumn("Last seen", 0, 0.0f, FLEET_COLUMN_LAST_SEEN);
+    ImGui::TableSetupColumn("Latency", 0, 0.0f, FLEET_COLUMN_LATENCY);
+    ImGui::TableHeadersRow();
+
+    // Rebuild the sort keys when any state changed (At most every FLEET_RESORT_INTERVAL, a busy fleet changes constantly),
+    // and re-sort when either the keys or the sort order changed
+    unsigned int generation = atomic_load(&stateGeneration);
+    double now = ImGui::GetTime();
+    int keysChanged = 0;
+    if (fleetCount != deviceCount) {
+        for (int i = 0; i < deviceCount; i++) { fleetOrder[i] = i; }
+        qsort(fleetOrder, deviceCount, sizeof(int), windowHandler_compareFleetNames);
+        for (int i = 0; i < deviceCount; i++) { fleetNameRanks[fleetOrder[i]] = i; }
+    }
+    // The keys are also what the rows show, the state strings can only be read under the state lock
+    if (fleetCount != deviceCount || (generation != fleetGeneration && now - fleetSortedAt >= FLEET_RESORT_INTERVAL)) {
+        driverHandler_lockState();
+        for (int i = 0; i < deviceCount; i++) {
+            const char* power = configPtr_devices[i].deviceState.power;
+            fleetKeys[i].device = i;
+            fleetKeys[i].nameRank = fleetNameRanks[i];
+            fleetKeys[i].online = configPtr_devices[i].online;
+            fleetKeys[i].power = power == NULL ? -1 : strcasecmp(power, "ON") == 0;
+            fleetKeys[i].dimmer = configPtr_devices[i].deviceState.dimmer;
+            fleetKeys[i].rssi = configPtr_devices[i].deviceState.wifi_rssi;
+            fleetKeys[i].uptime = windowHandler_parseUptime(configPtr_devices[i].deviceState.uptime);
+            fleetKeys[i].lastSeen = configPtr_devices[i].lastSeen;
+            fleetKeys[i].latency = configPtr_devices[i].commandLatency;
+            fleetOrder[i] = i;
+        }
+        driverHandler_unlockState();
+        fleetCount = deviceCount;
+        fleetGeneration = generation;
+        keysChanged = 1;
+    }
+
+    ImGuiTableSortSpecs* sortSpecs = ImGui::TableGetSortSpecs();
+    if (sortSpecs != NULL && (sortSpecs->SpecsDirty || keysChanged)) {
+        if (sortSpecs->SpecsCount > 0) {
+            fleetSortColumn = sortSpecs->Specs[0].ColumnUserID;
+            fleetSortDescending = sortSpecs->Specs[0].SortDirection == ImGuiSortDirection_Descending;
+        }
+        qsort(fleetOrder, fleetCount, sizeof(int), windowHandler_compareFleetKeys);
+        sortSpecs->SpecsDirty = false;
+        fleetSortedAt = now;
+    }
+
+    // Only visible rows are submitted
+    uint64_t nowNs = waitHandler_monotonicNs();
+    ImGuiListClipper clipper;
+    clipper.Begin(fleetCount);
+    while (clipper.Step()) {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+            int i = fleetOrder[row];
+            const windowHandler_fleetKey_t* key = &fleetKeys[i];
+
+            ImGui::PushID(i);
+            ImGui::TableNextRow();
+
+            ImGui::TableSetColumnIndex(FLEET_COLUMN_NAME);
+            if (ImGui::Selectable(configPtr_devices[i].prettyName, deviceList_selectedItem == i, ImGuiSelectableFlags_SpanAllColumns)) {
+                windowHandler_clearSelection();
+                windowHandler_setSelected(i, 1);
+                deviceList_selectedItem = i;
+            }
+
+            ImGui::TableSetColumnIndex(FLEET_COLUMN_ONLINE);
+            if (key->online == 1) {
+                ImGui::TextColored(ImVec4(0, 1, 0, 1), "Online");
+            } else {
+                ImGui::TextColored(ImVec4(1, 0, 0, 1), "Offline");
+            }
+
+            ImGui::TableSetColumnIndex(FLEET_COLUMN_POWER);
+            ImGui::TextUnformatted(key->power == -1 ? "-" : (key->power == 1 ? "ON" : "OFF"));
+
+            ImGui::TableSetColumnIndex(FLEET_COLUMN_DIMMER);
+            ImGui::Text("%d", key->dimmer);
+
+            ImGui::TableSetColumnIndex(FLEET_COLUMN_RSSI);
+            ImGui::Text("%d", key->rssi);
+
+            ImGui::TableSetColumnIndex(FLEET_COLUMN_UPTIME);
+            if (key->uptime >= 0) {
+                ImGui::Text("%dT%02d:%02d:%02d", key->uptime / 86400, (key->uptime / 3600) % 24, (key->uptime / 60) % 60, key->uptime % 60);
+            } else {
+                ImGui::TextUnformatted("-");
+            }
+
+            ImGui::TableSetColumnIndex(FLEET_COLUMN_LAST_SEEN);
+            if (key->lastSeen != 0) {
+                ImGui::Text("%llus ago", (unsigned long long)((nowNs - key->lastSeen) / 1000000000ULL));
+            } else {
+                ImGui::TextUnformatted("Never");
+            }
+
+            ImGui::TableSetColumnIndex(FLEET_COLUMN_LATENCY);
+            if (key->latency >= 0) {
+                ImGui::Text("%d ms", key->latency);
+            } else {
+                ImGui::TextUnformatted("-");
+            }
+
+            ImGui::PopID();
+        }
+    }
+    clipper.End();
+
+    ImGui::EndTable();
+}
+
+static ImU32 windowHandler_heatmapFill(int device, const shadowHandler_state_t* reported) {
+    configPtr_device_t* deviceObj = &configPtr_devices[device];
+
+    if (heatmapMode == HEATMAP_MODE_RSSI) {
+        int signal = deviceObj->deviceState.wifi_signal; // dBm (wifi_rssi is the percentage)
+        if (signal == 0) { return IM_COL32(60, 60, 60, 255); } // Not reported yet
+        float t = (float)(signal - RSSI_MIN) / (float)(RSSI_MAX - RSSI_MIN); // RSSI_MIN (Red) to RSSI_MAX (Green)
+        if (t < 0.0f) { t = 0.0f; }
+        if (t > 1.0f) { t = 1.0f; }
+        return IM_COL32((int)(255 * (1.0f - t)), (int)(255 * t), 40, 255);
+    }
+
+    if (reported->fields[SHADOW_FIELD_POWER] != 1) { return IM_COL32(30, 30, 30, 255); }
+
+    int color = reported->fields[SHADOW_FIELD_COLOR];
+    if (color == SHADOW_UNKNOWN) { color = 0xFFD9A0; } // White mode
+    int brightness = reported->fields[SHADOW_FIELD_BRIGHTNESS];
+    float scale = brightness == SHADOW_UNKNOWN ? 1.0f : 0.3f + (0.7f * (float)brightness / 100.0f);
+    return IM_COL32((int)(((color >> 16) & 0xFF) * scale), (int)(((color >> 8) & 0xFF) * scale), (int)((color & 0xFF) * scale), 255);
+}
+
+static void windowHandler_heatmapQuad(ImDrawVert* vertices, ImVec2 min, ImVec2 max, ImVec2 uv, ImU32 color) {
+    vertices[0] = { min, uv, color };
+    vertices[1] = { ImVec2(max.x, min.y), uv, color };
+    vertices[2] = { max, uv, color };
+    vertices[3] = { ImVec2(min.x, max.y), uv, color };
+}
+
+// Regenerate the tile vertices, only needed when the state, layout or mode changed
+void windowHandler_buildHeatmap(int columns) {
+    const float pitch = HEATMAP_TILE_SIZE + HEATMAP_TILE_GAP;
+    ImVec2 uv = ImGui::GetFontTexUvWhitePixel();
+
+    // One lock for the whole fleet instead of one per tile
+    heatmapReported.resize(deviceCount);
+    if (heatmapMode == HEATMAP_MODE_COLOR) { shadowHandler_getReported(0, deviceCount, heatmapReported.Data); }
+
+    heatmapVertices.resize(deviceCount * 8);
+    for (int i = 0; i < deviceCount; i++) {
+        ImVec2 min = ImVec2((i % columns) * pitch, (i / columns) * pitch);
+        ImVec2 max = ImVec2(min.x + HEATMAP_TILE_SIZE, min.y + HEATMAP_TILE_SIZE);
+        ImU32 border = configPtr_devices[i].online == 1 ? IM_COL32(0, 200, 0, 255) : IM_COL32(200, 0, 0, 255);
+        windowHandler_heatmapQuad(&heatmapVertices[i * 8], min, max, uv, border);
+        windowHandler_heatmapQuad(&heatmapVertices[i * 8 + 4], ImVec2(min.x + HEATMAP_TILE_BORDER, min.y + HEATMAP_TILE_BORDER),
+                                  ImVec2(max.x - HEATMAP_TILE_BORDER, max.y - HEATMAP_TILE_BORDER), uv, windowHandler_heatmapFill(i, &heatmapReported[i]));
+    }
+
+    heatmapColumns = columns;
+    heatmapTiles = deviceCount;
+    heatmapBuiltMode = heatmapMode;
+}
+
+void windowHandler_drawHeatmap() {
+    ImGui::RadioButton("Light color", &heatmapMode, HEATMAP_MODE_COLOR);
+    ImGui::SameLine();
+    ImGui::RadioButton("Signal", &heatmapMode, HEATMAP_MODE_RSSI);
+
+    ImGui::BeginChild("heatmapGrid", ImVec2(0, 0), false);
+    const float pitch = HEATMAP_TILE_SIZE + HEATMAP_TILE_GAP;
+    int columns = (int)((ImGui::GetContentRegionAvail().x + HEATMAP_TILE_GAP) / pitch);
+    if (columns < 1) { columns = 1; }
+    int rows = (deviceCount + columns - 1) / columns;
+
+    // Layout and mode changes rebuild right away, state changes at most every HEATMAP_REBUILD_INTERVAL (Telemetry bumps the
+    // generation nearly every frame on a busy fleet)
+    unsigned int generation = atomic_load(&stateGeneration);
+    double now = ImGui::GetTime();
+    if (columns != heatmapColumns || deviceCount != heatmapTiles || heatmapMode != heatmapBuiltMode ||
+        (generation != heatmapGeneration && now - heatmapBuiltAt >= HEATMAP_REBUILD_INTERVAL)) {
+        heatmapGeneration = generation;
+        heatmapBuiltAt = now;
+        windowHandler_buildHeatmap(columns);
+    }
+
+    // Reserve the full grid so the child scrolls, but only copy the rows that are visible
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImGui::Dummy(ImVec2(columns * pitch, rows * pitch));
+    float scrollY = ImGui::GetScrollY();
+    int firstRow = (int)(scrollY / pitch);
+    int lastRow = (int)((scrollY + ImGui::GetWindowHeight()) / pitch) + 1;
+    int firstTile = firstRow * columns;
+    int lastTile = lastRow * columns < heatmapTiles ? lastRow * columns : heatmapTiles;
+
+    // One reservation for every visible tile, 10k+ tiles are more vertices than 16 bit indices reach (ImDrawIdx is 32 bit,
+    // see CMakeLists.txt). Splitting the draw list instead needs ImGuiBackendFlags_RendererHasVtxOffset, which the OpenGL backend
+    // only sets on a 3.2+ context
+    static_assert(sizeof(ImDrawIdx) == 4, "The heatmap needs 32 bit ImDrawIdx");
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    if (lastTile > firstTile) {
+        drawList->PrimReserve((lastTile - firstTile) * 12, (lastTile - firstTile) * 8);
+        const ImDrawVert* source = &heatmapVertices[firstTile * 8];
+        for (int quad = 0; quad < (lastTile - firstTile) * 2; quad++) {
+            ImDrawIdx base = (ImDrawIdx)drawList->_VtxCurrentIdx;
+            drawList->PrimWriteIdx(base); drawList->PrimWriteIdx(base + 1); drawList->PrimWriteIdx(base + 2);
+            drawList->PrimWriteIdx(base); drawList->PrimWriteIdx(base + 2); drawList->PrimWriteIdx(base + 3);
+            for (int v = 0; v < 4; v++, source++) {
+                drawList->PrimWriteVtx(ImVec2(source->pos.x + origin.x, source->pos.y + origin.y), source->uv, source->col);
+            }
+        }
+    }
+
+    // Selection outline
+    if (deviceList_selectedItem >= firstTile && deviceList_selectedItem < lastTile) {
+        ImVec2 min = ImVec2(origin.x + (deviceList_selectedItem % columns) * pitch - 1, origin.y + (deviceList_selectedItem / columns) * pitch - 1);
+        drawList->AddRect(min, ImVec2(min.x + HEATMAP_TILE_SIZE + 2, min.y + HEATMAP_TILE_SIZE + 2), IM_COL32_WHITE);
+    }
+
+    // Hovered tile, worked out from the mouse position instead of per tile hit testing
+    if (ImGui::IsWindowHovered()) {
+        ImVec2 mouse = ImGui::GetMousePos();
+        float x = mouse.x - origin.x;
+        float y = mouse.y - origin.y;
+        int column = (int)(x / pitch);
+        int row = (int)(y / pitch);
+        int device = row * columns + column;
+        if (x >= 0 && y >= 0 && column < columns && device < heatmapTiles &&
+            x - column * pitch < HEATMAP_TILE_SIZE && y - row * pitch < HEATMAP_TILE_SIZE) {
+            // Power comes from the reported shadow, the driver's power string can only be read under the state lock
+            configPtr_device_t* deviceObj = &configPtr_devices[device];
+            shadowHandler_state_t reported;
+            shadowHandler_getReported(device, 1, &reported);
+            int power = reported.fields[SHADOW_FIELD_POWER];
+            ImGui::BeginTooltip();
+            ImGui::Text("%s (%s)", deviceObj->prettyName, deviceObj->name);
+            ImGui::Text("%s, Power: %s, Dimmer: %d", deviceObj->online == 1 ? "Online" : "Offline", power == SHADOW_UNKNOWN ? "-" : (power == 1 ? "ON" : "OFF"), deviceObj->deviceState.dimmer);
+            ImGui::Text("Signal: %d dBm (RSSI %d%%)", deviceObj->deviceState.wifi_signal, deviceObj->deviceState.wifi_rssi);
+            ImGui::EndTooltip();
+
+            if (ImGui::IsMouseClicked(ImGuiMouseButton_Left)) {
+                windowHandler_clearSelection();
+                windowHandler_setSelected(device, 1);
+                deviceList_selectedItem = device;
+            }
+        }
+    }
+
+    ImGui::EndChild();
+}
+
+// Pull new samples of the charted series out of the history store
+void windowHandler_refreshChart() {
+    int64_t now = historyHandler_now();
+    int64_t from = now - CHART_KEEP_SECONDS;
+
+    if (chartDevice != deviceList_selectedItem || chartLoadedSeries != chartSeries) {
+        // Different series, start over
+        chartDevice = deviceList_selectedItem;
+        chartLoadedSeries = chartSeries;
+        chartSamples.resize(0);
+        chartTailCount = 0;
+        for (int i = 0; i < CHART_LEVELS; i++) {
+            chartLevels[i].resize(0);
+            chartLevelDirty[i] = 1;
+        }
+        chartFollow = true;
+        chartRollupBucket = 0;
+    } else if (chartSamples.Size > 0) {
+        // Only what is newer than the cache, starting at the newest second since it may have gained samples
+        from = chartSamples.back().time;
+    }
+
+    historyHandler_sample_t* samples = NULL;
+    int count = historyHandler_read(chartDevice, chartSeries, from, INT64_MAX, &samples);
+    if (count <= 0) { return; }
+
+    int skip = 0;
+    if (chartSamples.Size > 0) {
+        skip = chartTailCount < count ? chartTailCount : count;
+    }
+    for (int i = skip; i < count; i++) {
+        if (chartSamples.Size > 0 && samples[i].time == chartSamples.back().time) {
+            chartTailCount++;
+        } else {
+            chartTailCount = 1;
+        }
+        chartSamples.push_back(samples[i]);
+    }
+    free(samples);
+
+    if (count > skip) {
+        for (int i = 0; i < CHART_LEVELS; i++) { chartLevelDirty[i] = 1; }
+    }
+
+    // Drop samples that fell out of the window once there is an hour of them, the levels are rebuilt from scratch then
+    if (chartSamples.Size > 0 && chartSamples[0].time < now - CHART_KEEP_SECONDS - 3600) {
+        int keep = 0;
+        while (keep < chartSamples.Size && chartSamples[keep].time < now - CHART_KEEP_SECONDS) { keep++; }
+        chartSamples.erase(chartSamples.begin(), chartSamples.begin() + keep);
+        for (int i = 0; i < CHART_LEVELS; i++) {
+            chartLevels[i].resize(0);
+            chartLevelDirty[i] = 1;
+        }
+    }
+}
+
+// Largest-Triangle-Three-Buckets over 2^level second buckets. Every bucket keeps the point forming the largest triangle
+// with the previously kept point and the average of the next bucket. Only the last two buckets depend on samples that
+// may still arrive, so extending a level drops those two and continues from there
+void windowHandler_buildChartLevel(int level) {
+    if (chartLevelDirty[level] == 0) { return; }
+    chartLevelDirty[level] = 0;
+
+    ImVector<historyHandler_sample_t>& points = chartLevels[level];
+    const int64_t width = (int64_t)1 << level;
+    const int n = chartSamples.Size;
+
+    int drop = points.Size < 2 ? points.Size : 2;
+    int64_t resumeAt = drop > 0 ? (points[points.Size - drop].time & ~(width - 1)) : INT64_MIN;
+    points.resize(points.Size - drop);
+
+    // First sample at or after resumeAt
+    int low = 0;
+    int high = n;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (chartSamples[mid].time < resumeAt) { low = mid + 1; } else { high = mid; }
+    }
+    int i = low;
+
+    if (points.Size == 0 && i < n) {
+        // The first bucket always keeps the first sample
+        points.push_back(chartSamples[i]);
+        int64_t bucketEnd = (chartSamples[i].time & ~(width - 1)) + width;
+        while (i < n && chartSamples[i].time < bucketEnd) { i++; }
+    }
+
+    while (i < n) {
+        int64_t bucketEnd = (chartSamples[i].time & ~(width - 1)) + width;
+        int j = i;
+        while (j < n && chartSamples[j].time < bucketEnd) { j++; }
+
+        if (j == n) {
+            // Last bucket, nothing to aim at yet
+            points.push_back(chartSamples[n - 1]);
+            break;
+        }
+
+        // Average of the next bucket
+        int64_t nextEnd = (chartSamples[j].time & ~(width - 1)) + width;
+        double averageTime = 0;
+        double averageValue = 0;
+        int k = j;
+        for (; k < n && chartSamples[k].time < nextEnd; k++) {
+            averageTime += (double)(chartSamples[k].time - chartSamples[j].time);
+            averageValue += chartSamples[k].value;
+        }
+        averageTime = averageTime / (k - j) + (double)(chartSamples[j].time - points.back().time);
+        averageValue /= (k - j);
+
+        // Times relative to the previous point, keeps the doubles precise
+        const historyHandler_sample_t& previous = points.back();
+        int best = i;
+        double bestArea = -1;
+        for (int p = i; p < j; p++) {
+            double time = (double)(chartSamples[p].time - previous.time);
+            double area = fabs(-averageTime * (chartSamples[p].value - previous.value) + time * (averageValue - previous.value));
+            if (area > bestArea) {
+                bestArea = area;
+                best = p;
+            }
+        }
+        points.push_back(chartSamples[best]);
+        i = j;
+    }
+}
+
+// Export the selected devices (The multi-selection if there is one), runs in the background
+void windowHandler_drawExportControls() {
+    static int devices[MAX_DEVICES];
+    int count = 0;
+    if (deviceList_selectedCount > 0) {
+        for (int i = 0; i < deviceCount; i++) {
+            if (deviceList_selected[i] == 1) { devices[count++] = i; }
+        }
+    } else if (deviceList_selectedItem >= 0 && deviceList_selectedItem < deviceCount) {
+        devices[count++] = deviceList_selectedItem;
+    }
+
+    exportHandler_status_t status;
+    exportHandler_getStatus(&status);
+
+    ImGui::BeginDisabled(status.running == 1 || count == 0);
+    if (ImGui::Button("Export CSV")) { exportHandler_start(devices, count, 0, EXPORT_FORMAT_CSV); }
+    ImGui::SameLine();
+    if (ImGui::Button("Export JSON lines")) { exportHandler_start(devices, count, 0, EXPORT_FORMAT_JSONL); }
+    ImGui::SameLine();
+    if (ImGui::Button("Export state")) { exportHandler_start(devices, count, 1, EXPORT_FORMAT_CSV); }
+    ImGui::EndDisabled();
+
+    if (status.path[0] != '\0') {
+        ImGui::SameLine();
+        if (status.running == 1) {
+            ImGui::Text("Exporting to %s: %llu rows", status.path, (unsigned long long)status.rows);
+        } else if (status.failed != 0) {
+            ImGui::TextColored(ImVec4(1, 0, 0, 1), "Export to %s failed", status.path);
+        } else {
+            ImGui::Text("Exported %llu rows to %s", (unsigned long long)status.rows, status.path);
+        }
+    }
+}
+
+// Mean of every 'bucketSeconds' bucket around the view, from the rollups (Only queried again once the view leaves
+// what was queried, the bucket size changes or CHART_REFRESH_INTERVAL passed)
+void windowHandler_queryChartRollups(double viewStart, double viewEnd, int64_t bucketSeconds) {
+    double time = ImGui::GetTime();
+    if (chartRollupBucket == bucketSeconds && viewStart >= (double)chartRollupFrom && viewEnd <= (double)chartRollupTo &&
+        time - chartRollupQueriedAt < CHART_REFRESH_INTERVAL) {
+        return;
+    }
+
+    // Never further back than the hourly rollups reach, older queries would be answered from the archive
+    double span = viewEnd - viewStart;
+    double oldest = (double)historyHandler_now() - CHART_ROLLUP_SECONDS;
+    int64_t from = (int64_t)(viewStart - span > oldest ? viewStart - span : oldest);
+    int64_t to = (int64_t)(viewEnd + span);
+    from -= from % bucketSeconds;
+    to += bucketSeconds - to % bucketSeconds;
+    chartRollupBuckets.resize((int)((to - from) / bucketSeconds) + 1);
+    int resolution = ROLLUP_RESOLUTION_RAW;
+    int count = rollupHandler_query(chartDevice, chartSeries, from, to, bucketSeconds, chartRollupBuckets.Data, chartRollupBuckets.Size, &resolution);
+
+    chartRollupPoints.resize(0);
+    for (int i = 0; i < count; i++) {
+        const rollupHandler_bucket_t& bucket = chartRollupBuckets[i];
+        historyHandler_sample_t point = { bucket.start + bucketSeconds / 2, bucket.sum / bucket.count };
+        chartRollupPoints.push_back(point);
+    }
+    chartRollupFrom = from;
+    chartRollupTo = to;
+    chartRollupBucket = bucketSeconds;
+    chartRollupQueriedAt = time;
+}
+
+void windowHandler_drawHistoryChart() {
+    if (deviceList_selectedItem < 0 || deviceList_selectedItem >= deviceCount) {
+        ImGui::Text("Select a device to see its history");
+        return;
+    }
+
+    ImGui::RadioButton("Power", &chartSeries, HISTORY_SERIES_POWER);
+    ImGui::SameLine();
+    ImGui::RadioButton("Dimmer", &chartSeries, HISTORY_SERIES_DIMMER);
+    ImGui::SameLine();
+    ImGui::RadioButton("Signal", &chartSeries, HISTORY_SERIES_RSSI);
+    ImGui::SameLine();
+    ImGui::Text(" | ");
+    ImGui::SameLine();
+    if (ImGui::Button("Hour")) { chartViewSpan = 3600; chartFollow = true; }
+    ImGui::SameLine();
+    if (ImGui::Button("Day")) { chartViewSpan = 86400; chartFollow = true; }
+    ImGui::SameLine();
+    if (ImGui::Button("Week")) { chartViewSpan = 7 * 86400; chartFollow = true; }
+    ImGui::SameLine();
+    if (ImGui::Button("Year")) { chartViewSpan = CHART_ROLLUP_SECONDS; chartFollow = true; }
+    ImGui::SameLine();
+    ImGui::Checkbox("Follow", &chartFollow);
+
+    windowHandler_drawExportControls();
+
+    double time = ImGui::GetTime();
+    if (chartDevice != deviceList_selectedItem || chartLoadedSeries != chartSeries || time - chartRefreshedAt >= CHART_REFRESH_INTERVAL) {
+        chartRefreshedAt = time;
+        windowHandler_refreshChart();
+    }
+
+    // Chart area, leaving a line for the time axis
+    ImVec2 size = ImGui::GetContentRegionAvail();
+    size.y -= ImGui::GetTextLineHeightWithSpacing();
+    if (size.x < 50 || size.y < 50) { return; }
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImGui::InvisibleButton("historyChart", size);
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    drawList->AddRect(origin, ImVec2(origin.x + size.x, origin.y + size.y), IM_COL32(128, 128, 128, 255));
+
+    if (chartSamples.Size == 0) {
+        drawList->AddText(ImVec2(origin.x + 8, origin.y + 8), IM_COL32_WHITE, "No history recorded for this device yet");
+        return;
+    }
+
+    // Pan by dragging, zoom around the mouse with the wheel
+    if (chartFollow) { chartViewEnd = (double)historyHandler_now(); }
+    if (ImGui::IsItemActive() && ImGui::GetIO().MouseDelta.x != 0) {
+        chartViewEnd -= ImGui::GetIO().MouseDelta.x * chartViewSpan / size.x;
+        chartFollow = false;
+    }
+    if (ImGui::IsItemHovered() && ImGui::GetIO().MouseWheel != 0) {
+        double anchor = chartViewEnd - chartViewSpan * (1.0 - (ImGui::GetMousePos().x - origin.x) / size.x);
+        double span = chartViewSpan * pow(0.8, ImGui::GetIO().MouseWheel);
+        if (span < CHART_MIN_SPAN) { span = CHART_MIN_SPAN; }
+        if (span > CHART_ROLLUP_SECONDS) { span = CHART_ROLLUP_SECONDS; }
+        chartViewEnd = anchor + (chartViewEnd - anchor) * span / chartViewSpan;
+        chartViewSpan = span;
+        if (ImGui::GetIO().MouseWheel > 0) { chartFollow = false; }
+    }
+    double now = (double)historyHandler_now();
+    if (chartViewEnd - chartViewSpan < now - CHART_ROLLUP_SECONDS) { chartViewEnd = now - CHART_ROLLUP_SECONDS + chartViewSpan; }
+    double viewStart = chartViewEnd - chartViewSpan;
+
+    // Coarsest level that still has a bucket per pixel. Views older than the cached samples use hourly (Or coarser) rollups
+    int64_t bucketSeconds = 0;
+    const ImVector<historyHandler_sample_t>* source = nullptr;
+    if (viewStart < now - CHART_KEEP_SECONDS) {
+        bucketSeconds = ((int64_t)(chartViewSpan / size.x) / CHART_ROLLUP_BUCKET + 1) * CHART_ROLLUP_BUCKET;
+        windowHandler_queryChartRollups(viewStart, chartViewEnd, bucketSeconds);
+        source = &chartRollupPoints;
+    } else {
+        int level = 0;
+        while (level < CHART_LEVELS - 1 && (double)((int64_t)1 << level) < chartViewSpan / size.x) { level++; }
+        windowHandler_buildChartLevel(level);
+        bucketSeconds = (int64_t)1 << level;
+        source = &chartLevels[level];
+    }
+    const ImVector<historyHandler_sample_t>& points = *source;
+
+    // Visible points, plus one on either side so the line reaches the edges
+    int first = 0;
+    int high = points.Size;
+    while (first < high) {
+        int mid = (first + high) / 2;
+        if ((double)points[mid].time < viewStart) { first = mid + 1; } else { high = mid; }
+    }
+    if (first > 0) { first--; }
+    int last = first;
+    while (last < points.Size && (double)points[last].time <= chartViewEnd) { last++; }
+    if (last < points.Size) { last++; }
+
+    double minValue = 0;
+    double maxValue = 0;
+    for (int i = first; i < last; i++) {
+        if (i == first || points[i].value < minValue) { minValue = points[i].value; }
+        if (i == first || points[i].value > maxValue) { maxValue = points[i].value; }
+    }
+    if (maxValue - minValue < 1e-6) { minValue -= 1; maxValue += 1; }
+    double padding = (maxValue - minValue) * 0.05;
+    minValue -= padding;
+    maxValue += padding;
+
+    const float scaleX = (float)(size.x / chartViewSpan);
+    const float scaleY = (float)(size.y / (maxValue - minValue));
+    chartPolyline.resize(0);
+    for (int i = first; i < last; i++) {
+        chartPolyline.push_back(ImVec2(origin.x + (float)((double)points[i].time - viewStart) * scaleX, origin.y + size.y - (float)(points[i].value - minValue) * scaleY));
+    }
+
+    drawList->PushClipRect(origin, ImVec2(origin.x + size.x, origin.y + size.y), true);
+    if (chartPolyline.Size > 1) {
+        drawList->AddPolyline(chartPolyline.Data, chartPolyline.Size, IM_COL32(80, 200, 255, 255), ImDrawFlags_None, 1.5f);
+    } else if (chartPolyline.Size == 1) {
+        drawList->AddCircleFilled(chartPolyline[0], 2.5f, IM_COL32(80, 200, 255, 255));
+    }
+
+    // Nearest point to the mouse
+    if (ImGui::IsItemHovered() && chartPolyline.Size > 0) {
+        float mouseX = ImGui::GetMousePos().x;
+        int nearest = 0;
+        for (int i = 1; i < chartPolyline.Size; i++) {
+            if (fabsf(chartPolyline[i].x - mouseX) < fabsf(chartPolyline[nearest].x - mouseX)) { nearest = i; }
+        }
+        drawList->AddCircle(chartPolyline[nearest], 4.0f, IM_COL32_WHITE);
+
+        char when[32];
+        time_t sampleTime = (time_t)points[first + nearest].time;
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&sampleTime));
+        ImGui::SetTooltip("%s\n%.2f", when, points[first + nearest].value);
+    }
+    drawList->PopClipRect();
+
+    // Value and time axis labels
+    char label[64];
+    snprintf(label, sizeof(label), "%.2f", maxValue);
+    drawList->AddText(ImVec2(origin.x + 4, origin.y + 2), IM_COL32(200, 200, 200, 255), label);
+    snprintf(label, sizeof(label), "%.2f", minValue);
+    drawList->AddText(ImVec2(origin.x + 4, origin.y + size.y - ImGui::GetTextLineHeight() - 2), IM_COL32(200, 200, 200, 255), label);
+
+    char startLabel[32];
+    char endLabel[32];
+    time_t startTime = (time_t)viewStart;
+    time_t endTime = (time_t)chartViewEnd;
+    strftime(startLabel, sizeof(startLabel), "%m-%d %H:%M:%S", localtime(&startTime));
+    strftime(endLabel, sizeof(endLabel), "%m-%d %H:%M:%S", localtime(&endTime));
+    ImGui::Text("%s", startLabel);
+    ImGui::SameLine(size.x - ImGui::CalcTextSize(endLabel).x);
+    ImGui::Text("%s", endLabel);
+    ImGui::SameLine(size.x * 0.5f - 120);
+    if (source == &chartRollupPoints) {
+        ImGui::TextDisabled("Rollups, %d drawn (%llds buckets)", last - first, (long long)bucketSeconds);
+    } else {
+        ImGui::TextDisabled("%d samples, %d drawn (%llds buckets)", chartSamples.Size, last - first, (long long)bucketSeconds);
+    }
+}
+
 void windowHandler_drawSelectDevice() {
     ImGui::BeginChild("deviceControl", ImVec2(0, 0), true);
 
@@ -298,6 +1265,18 @@ void windowHandler_drawSelectDevice() {
     ImGui::EndChild();
 }
 
+void windowHandler_drawNotSupported() {
+    ImGui::BeginChild("deviceControl", ImVec2(0, 0), true);
+
+    // Title
+    ImGui::TextColored(ImVec4(1, 0, 1, 1), "Not supported");
+    ImGui::Separator();
+
+    ImGui::Text("Devices with mode '%s' can not be controlled yet", configPtr_devices[deviceList_selectedItem].mode);
+
+    ImGui::EndChild();
+}
+
 void windowHandler_drawDeviceOffline() {
     ImGui::BeginChild("deviceControl", ImVec2(0, 0), true);
 
@@ -313,14 +1292,31 @@ void windowHandler_drawDeviceOffline() {
 void windowHandler_drawLightDeviceInfo() {
     ImGui::BeginChild("deviceInfo", ImVec2(0, halfChildHeight), true);
 
-    ImGui::Text("Uptime: %s", configPtr_devices[deviceList_selectedItem].deviceState.uptime);
+    // The MQTT thread frees and replaces the state strings while handling messages
+    mqttHandler_state_t* state = &configPtr_devices[deviceList_selectedItem].deviceState;
+    char uptime[WINDOW_STATE_STRING_LENGTH];
+    char wifiSsid[WINDOW_STATE_STRING_LENGTH];
+    char wifiMode[WINDOW_STATE_STRING_LENGTH];
+    char wifiBssid[WINDOW_STATE_STRING_LENGTH];
+    char color[WINDOW_STATE_STRING_LENGTH];
+    char hsbColor[WINDOW_STATE_STRING_LENGTH];
+    driverHandler_lockState();
+    windowHandler_copyStateString(uptime, state->uptime);
+    windowHandler_copyStateString(wifiSsid, state->wifi_ssid);
+    windowHandler_copyStateString(wifiMode, state->wifi_mode);
+    windowHandler_copyStateString(wifiBssid, state->wifi_bssid);
+    windowHandler_copyStateString(color, state->color);
+    windowHandler_copyStateString(hsbColor, state->hsbcolor);
+    driverHandler_unlockState();
+
+    ImGui::Text("Uptime: %s", uptime);
     ImGui::Text("MQTT Messages: %d\n", configPtr_devices[deviceList_selectedItem].deviceState.mqttCount);
     if (SHOW_MODE == 1) {
         ImGui::Text("Wifi Information: %s (Channel: %d, Mode: %s)",
-        configPtr_devices[deviceList_selectedItem].deviceState.wifi_ssid,
+        wifiSsid,
         configPtr_devices[deviceList_selectedItem].deviceState.wifi_channel,
-        configPtr_devices[deviceList_selectedItem].deviceState.wifi_mode);
-        ImGui::Text("Wifi BSSID: %s", configPtr_devices[deviceList_selectedItem].deviceState.wifi_bssid);
+        wifiMode);
+        ImGui::Text("Wifi BSSID: %s", wifiBssid);
     } else {
         ImGui::Text("Wifi Information:");
         ImGui::SameLine();
@@ -328,7 +1324,7 @@ void windowHandler_drawLightDeviceInfo() {
         ImGui::SameLine();
         ImGui::Text("(Channel: %d, Mode: %s)",
             configPtr_devices[deviceList_selectedItem].deviceState.wifi_channel,
-            configPtr_devices[deviceList_selectedItem].deviceState.wifi_mode);
+            wifiMode);
         ImGui::Text("Wifi BSSID:");
         ImGui::SameLine();
         ImGui::TextColored(ImVec4(1, 0, 0, 1), "Redacted");
@@ -339,7 +1335,117 @@ void windowHandler_drawLightDeviceInfo() {
         configPtr_devices[deviceList_selectedItem].deviceState.wifi_signal,
         configPtr_devices[deviceList_selectedItem].deviceState.wifi_rssi);
 
-    ImGui::Text("Color: %s -- HSB Color: %s -- Dimmer: %d", configPtr_devices[deviceList_selectedItem].deviceState.color, configPtr_devices[deviceList_selectedItem].deviceState.hsbcolor, configPtr_devices[deviceList_selectedItem].deviceState.dimmer);
+    ImGui::Text("Color: %s -- HSB Color: %s -- Dimmer: %d", color, hsbColor, configPtr_devices[deviceList_selectedItem].deviceState.dimmer);
+
+    shadowHandler_device_t shadow;
+    shadowHandler_get(deviceList_selectedItem, &shadow);
+    ImGui::Text("Shadow: %s (Desired v%u, Reported v%u) -- Drift: %d",
+        shadow.converged ? "In sync" : "Syncing", shadow.desired.version, shadow.reported.version, shadow.drift);
+
+    ImGui::EndChild();
+}
+
+void windowHandler_drawTasmotaDeviceInfo() {
+    ImGui::BeginChild("deviceInfo", ImVec2(0, halfChildHeight), true);
+    configPtr_device_t* device = &configPtr_devices[deviceList_selectedItem];
+
+    // The driver replaces uptime and color whenever they change (driverHandler_setString)
+    char uptime[WINDOW_STATE_STRING_LENGTH];
+    char color[WINDOW_STATE_STRING_LENGTH];
+    driverHandler_lockState();
+    windowHandler_copyStateString(uptime, device->deviceState.uptime);
+    windowHandler_copyStateString(color, device->deviceState.color);
+    driverHandler_unlockState();
+
+    ImGui::Text("Uptime: %s", uptime);
+    ImGui::Text("Wifi Signal: %d dBm (RSSI %d%%, Channel: %d)", device->deviceState.wifi_signal, device->deviceState.wifi_rssi, device->deviceState.wifi_channel);
+    ImGui::Text("Color: %s -- Dimmer: %d", color, device->deviceState.dimmer);
+
+    tasmotaDriver_energy_t energy;
+    tasmotaDriver_getEnergy(deviceList_selectedItem, &energy);
+    if (energy.power >= 0) {
+        ImGui::Separator();
+        ImGui::Text("Energy: %.3f kWh today, %.3f kWh total", energy.today, energy.total);
+        windowHandler_drawPowermonSummary(deviceList_selectedItem);
+    }
+
+    shadowHandler_device_t shadow;
+    shadowHandler_get(deviceList_selectedItem, &shadow);
+    ImGui::Text("Shadow: %s (Desired v%u, Reported v%u) -- Drift: %d",
+        shadow.converged ? "In sync" : "Syncing", shadow.desired.version, shadow.reported.version, shadow.drift);
+
+    ImGui::EndChild();
+}
+
+void windowHandler_drawZigbeeDeviceInfo() {
+    ImGui::BeginChild("deviceInfo", ImVec2(0, halfChildHeight), true);
+
+    zigbeeDriver_info_t info;
+    zigbeeDriver_getInfo(deviceList_selectedItem, &info);
+    ImGui::Text("Device: %s %s", info.vendor, info.model);
+    ImGui::Text("Link Quality: %d / 255", info.linkQuality);
+    ImGui::Text("Color: x %.3f, y %.3f -- Dimmer: %d", info.colorX, info.colorY, configPtr_devices[deviceList_selectedItem].deviceState.dimmer);
+
+    shadowHandler_device_t shadow;
+    shadowHandler_get(deviceList_selectedItem, &shadow);
+    ImGui::Text("Shadow: %s (Desired v%u, Reported v%u) -- Drift: %d",
+        shadow.converged ? "In sync" : "Syncing", shadow.desired.version, shadow.reported.version, shadow.drift);
+
+    ImGui::EndChild();
+}
+
+// Aggregates of a device with an energy monitor, shared by every driver that feeds the power monitor handler
+void windowHandler_drawPowermonSummary(int device) {
+    static const char* quantityNames[POWERMON_QUANTITY_COUNT] = { "Voltage (V)", "Current (A)", "Power (W)" };
+
+    powermonHandler_summary_t summary;
+    powermonHandler_getSummary(device, &summary);
+    if (summary.hasSamples == 0) {
+        ImGui::Text("No power samples received yet");
+        return;
+    }
+
+    if (ImGui::BeginTable("powermonTable", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+        ImGui::TableSetupColumn("Quantity");
+        ImGui::TableSetupColumn("Last");
+        ImGui::TableSetupColumn("Min");
+        ImGui::TableSetupColumn("Max");
+        ImGui::TableSetupColumn("Mean (1h)");
+        ImGui::TableSetupColumn("Mean (All)");
+        ImGui::TableHeadersRow();
+        for (int q = 0; q < POWERMON_QUANTITY_COUNT; q++) {
+            const powermonHandler_stats_t* window = &summary.window[q];
+            const powermonHandler_stats_t* total = &summary.total[q];
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0); ImGui::TextUnformatted(quantityNames[q]);
+            if (total->count == 0) { continue; }
+            ImGui::TableSetColumnIndex(1); ImGui::Text("%.3f", total->last);
+            if (window->count > 0) {
+                ImGui::TableSetColumnIndex(2); ImGui::Text("%.3f", window->min);
+                ImGui::TableSetColumnIndex(3); ImGui::Text("%.3f", window->max);
+                ImGui::TableSetColumnIndex(4); ImGui::Text("%.3f", window->mean);
+            }
+            ImGui::TableSetColumnIndex(5); ImGui::Text("%.3f", total->mean);
+        }
+        ImGui::EndTable();
+    }
+
+    ImGui::Text("Energy: %.3f kWh since start", summary.energyKWh);
+    if (summary.counterKWh >= 0) {
+        ImGui::SameLine();
+        ImGui::Text("-- Device counter: %.3f kWh", summary.counterKWh);
+    }
+}
+
+void windowHandler_drawPowermonDeviceInfo() {
+    ImGui::BeginChild("deviceInfo", ImVec2(0, halfChildHeight), true);
+
+    windowHandler_drawPowermonSummary(deviceList_selectedItem);
+
+    shadowHandler_device_t shadow;
+    shadowHandler_get(deviceList_selectedItem, &shadow);
+    ImGui::Text("Shadow: %s (Desired v%u, Reported v%u) -- Drift: %d",
+        shadow.converged ? "In sync" : "Syncing", shadow.desired.version, shadow.reported.version, shadow.drift);
 
     ImGui::EndChild();
 }
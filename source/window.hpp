@@ -1,5 +1,67 @@
 #ifndef _WINDOW_H
 #define _WINDOW_H
+#include <stdint.h>
+
+// Fleet table columns
+#define FLEET_COLUMN_NAME 0
+#define FLEET_COLUMN_ONLINE 1
+#define FLEET_COLUMN_POWER 2
+#define FLEET_COLUMN_DIMMER 3
+#define FLEET_COLUMN_RSSI 4
+#define FLEET_COLUMN_UPTIME 5
+#define FLEET_COLUMN_LAST_SEEN 6
+#define FLEET_COLUMN_LATENCY 7
+#define FLEET_COLUMN_COUNT 8
+
+// Minimum seconds between re-sorts of the fleet table caused by state changes
+#define FLEET_RESORT_INTERVAL 0.25
+
+typedef struct {
+    int device;
+    int nameRank;
+    int online;
+    int power; // 1 = ON, 0 = anything else, -1 = not reported
+    int dimmer;
+    int rssi;
+    int uptime; // Seconds, -1 if not reported/unparseable
+    uint64_t lastSeen;
+    int latency;
+} windowHandler_fleetKey_t;
+
+// Heatmap tiles (Pixels)
+#define HEATMAP_TILE_SIZE 14.0f
+#define HEATMAP_TILE_GAP 2.0f
+#define HEATMAP_TILE_BORDER 2.0f
+
+// Minimum seconds between heatmap rebuilds caused by state changes
+#define HEATMAP_REBUILD_INTERVAL 0.25
+
+#define HEATMAP_MODE_COLOR 0
+#define HEATMAP_MODE_RSSI 1
+
+// History chart zoom levels, level k picks one point per 2^k second bucket (Buckets are aligned to absolute time,
+// so panning never changes which point a bucket picks)
+#define CHART_LEVELS 32
+
+// Seconds between pulling new samples out of the history store, and how far back the chart goes
+#define CHART_REFRESH_INTERVAL 1.0
+#define CHART_KEEP_SECONDS (7 * 86400)
+
+// Narrowest span the chart zooms in to (Seconds)
+#define CHART_MIN_SPAN 60.0
+
+// Views reaching back past CHART_KEEP_SECONDS are drawn from the hourly rollups (Mean per bucket, buckets are whole hours),
+// which reach back further than the chart lets the view go
+#define CHART_ROLLUP_BUCKET 3600
+#define CHART_ROLLUP_SECONDS (365 * 86400)
+
+// Longest device state string the panels show, they draw copies taken under the state lock (Longer strings are cut)
+#define WINDOW_STATE_STRING_LENGTH 64
+
+typedef struct {
+    void (*drawControl)();
+    void (*drawInfo)();
+} windowHandler_driverPanel_t;
 
 #ifdef __cplusplus
 extern "C" {
@@ -9,11 +71,30 @@ int windowHandler_init();
 }
 #endif
 void windowHandler_loop();
+void windowHandler_drawConnectionStatus();
 void windowHandler_drawDeviceList();
+void windowHandler_setSelected(int device, int selected);
+void windowHandler_clearSelection();
+void windowHandler_fanoutSelection(int action, uint32_t content);
 void windowHandler_handleDeviceControl();
 void windowHandler_drawLightDeviceControl();
+void windowHandler_drawPowermonDeviceControl();
+void windowHandler_drawMultiDeviceControl();
+void windowHandler_drawFleetTable();
+void windowHandler_buildHeatmap(int columns);
+void windowHandler_drawHeatmap();
+void windowHandler_refreshChart();
+void windowHandler_buildChartLevel(int level);
+void windowHandler_queryChartRollups(double viewStart, double viewEnd, int64_t bucketSeconds);
+void windowHandler_drawExportControls();
+void windowHandler_drawHistoryChart();
 void windowHandler_drawSelectDevice();
+void windowHandler_drawNotSupported();
 void windowHandler_drawDeviceOffline();
 void windowHandler_drawLightDeviceInfo();
+void windowHandler_drawTasmotaDeviceInfo();
+void windowHandler_drawZigbeeDeviceInfo();
+void windowHandler_drawPowermonSummary(int device);
+void windowHandler_drawPowermonDeviceInfo();
 
 #endif
@@ -0,0 +1,270 @@
+/*
+// IoT Controller
+// Zigbee2MQTT Driver
+// Goldenkrew3000 2025
+// GPLv3
+*/
+
+#include "zigbee.h"
+#include "driver.h"
+#include "config.h"
+#include "mqtt.h"
+#include "states.h"
+#include "color.h"
+#include "scan.h"
+#include "scene.h"
+#include "shadow.h"
+#include "history.h"
+#include "wait.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdatomic.h>
+
+/* Info
+// zigbee2mqtt/<friendly name> --> Device state (JSON)
+// zigbee2mqtt/<friendly name>/availability --> Connection status ("online"/"offline", or {"state":"online"})
+// zigbee2mqtt/<friendly name>/set --> Commands (JSON)
+// zigbee2mqtt/<friendly name>/get --> State requests (JSON)
+// zigbee2mqtt/bridge/devices --> Retained list of every device paired to the bridge
+*/
+
+// NOTE: Devices do not have to be in the config, every light/switch in the bridge's device list is registered at runtime.
+// The device list can be hundreds of KB, so it is walked element by element with the scan handler instead of parsed into a tree.
+// Commands are encoded as "<set|get>/<key>" with a JSON value as the payload, sendCommand turns that into {"<key>":<value>}.
+
+// Devices
+extern int deviceCount;
+extern configPtr_device_t configPtr_devices[];
+
+extern atomic_uint stateGeneration;
+
+static zigbeeDriver_info_t info[MAX_DEVICES];
+
+const driverHandler_driver_t zigbeeDriver = {
+    "zigbee2mqtt",
+    zigbeeDriver_route,
+    zigbeeDriver_handleMessage,
+    zigbeeDriver_encodeCommand,
+    zigbeeDriver_sendCommand,
+    NULL, // No backlog, every command is its own message
+    zigbeeDriver_requestState
+};
+
+int zigbeeDriver_route(char** levels, int levelCount, const char** name) {
+    if (levelCount < 2 || strcmp(levels[0], ZIGBEE_BASE_TOPIC) != 0) { return -1; }
+
+    if (strcmp(levels[1], "bridge") == 0) {
+        if (levelCount == 3 && strcmp(levels[2], "devices") == 0) {
+            *name = NULL;
+            return ZIGBEE_MESSAGE_BRIDGE_DEVICES;
+        }
+        return -1;
+    }
+
+    // Friendly names can contain '/', so the levels in between are joined back together
+    const char* last = levels[levelCount - 1];
+    int kind = ZIGBEE_MESSAGE_STATE;
+    int nameLevels = levelCount - 1;
+    if (levelCount > 2) {
+        if (strcmp(last, "set") == 0 || strcmp(last, "get") == 0) { return -1; } // Commands, including our own
+        if (strcmp(last, "availability") == 0) {
+            kind = ZIGBEE_MESSAGE_AVAILABILITY;
+            nameLevels--;
+        }
+    }
+    for (int i = 2; i <= nameLevels; i++) {
+        levels[i][-1] = '/';
+    }
+    *name = levels[1];
+    return kind;
+}
+
+int zigbeeDriver_handleMessage(int device, int kind, char* content) {
+    switch (kind) {
+        case ZIGBEE_MESSAGE_STATE:
+            // A state message means the device is reachable, even if the bridge does not report availability
+            if (configPtr_devices[device].online != 1) {
+                configPtr_devices[device].online = 1;
+                shadowHandler_onOnline(device);
+            }
+            zigbeeDriver_processState(content, device);
+            mqttHandler_acknowledge(device);
+            sceneHandler_onStateResponse(device);
+            break;
+        case ZIGBEE_MESSAGE_AVAILABILITY:
+            // Older bridges send a plain string, newer ones {"state":"online"}
+            configPtr_devices[device].online = strstr(content, "online") != NULL ? 1 : 0;
+            atomic_fetch_add(&stateGeneration, 1);
+            if (configPtr_devices[device].online == 1) { shadowHandler_onOnline(device); }
+            break;
+        case ZIGBEE_MESSAGE_BRIDGE_DEVICES:
+            zigbeeDriver_importDevices(content);
+            break;
+        default:
+            return 1;
+    }
+    return 0;
+}
+
+// Convert a queued command into a "<set|get>/<key>" and a JSON value
+int zigbeeDriver_encodeCommand(const queueHandler_command_t* command, const char** cmnd, char payload[16]) {
+    payload[0] = '\0';
+    uint32_t content = command->content > 100 ? 100 : command->content;
+    switch (command->action) {
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_ON:
+            *cmnd = "set/state";
+            strcpy(payload, "\"ON\"");
+            break;
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_POWER_OFF:
+            *cmnd = "set/state";
+            strcpy(payload, "\"OFF\"");
+            break;
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_BRIGHTNESS:
+            // Dimmer (0 - 100) to Zigbee brightness (0 - 254), rounded so the reported value maps back to the same dimmer
+            *cmnd = "set/brightness";
+            snprintf(payload, 16, "%u", (content * ZIGBEE_BRIGHTNESS_MAX + 50) / 100);
+            break;
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_WARMTH:
+            *cmnd = "set/color_temp";
+            snprintf(payload, 16, "%u", ZIGBEE_COLOR_TEMP_MIN + ((content * (ZIGBEE_COLOR_TEMP_MAX - ZIGBEE_COLOR_TEMP_MIN) + 50) / 100));
+            break;
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_COLOR:
+            *cmnd = "set/color";
+            payload[0] = '"';
+            payload[1] = '#';
+            colorHandler_encodeHex(command->content, payload + 2);
+            payload[8] = '"';
+            payload[9] = '\0';
+            break;
+        case FLAG_DISPATCH_ACTION_OPENBK_LIGHT_REQUEST_STATE:
+            *cmnd = "get/state";
+            strcpy(payload, "\"\"");
+            break;
+        default:
+            return 1;
+    }
+    return 0;
+}
+
+// Publish {"<key>":<payload>} to zigbee2mqtt/<target>/<set|get>
+int zigbeeDriver_sendCommand(const char* target, const char* cmnd, const char* payload) {
+    const char* key = strchr(cmnd, '/');
+    if (key == NULL) { return 1; }
+
+    char topic[256];
+    char body[64];
+    snprintf(topic, sizeof(topic), "%s/%s/%.*s", ZIGBEE_BASE_TOPIC, target, (int)(key - cmnd), cmnd);
+    snprintf(body, sizeof(body), "{\"%s\":%s}", key + 1, payload);
+    return mqttHandler_publish(topic, body);
+}
+
+int zigbeeDriver_requestState(int device) {
+    return zigbeeDriver_sendCommand(configPtr_devices[device].name, "get/state", "\"\"");
+}
+
+int zigbeeDriver_processState(char* content, int device) {
+    char power[8];
+    scanHandler_field_t fields[] = {
+        { .key = "state", .type = SCAN_TYPE_STRING, .string = power, .stringSize = sizeof(power), .topLevel = 1 }, // OTA updates nest their own "state"
+        { .key = "brightness", .type = SCAN_TYPE_NUMBER },
+        { .key = "color_temp", .type = SCAN_TYPE_NUMBER },
+        { .key = "x", .type = SCAN_TYPE_NUMBER },
+        { .key = "y", .type = SCAN_TYPE_NUMBER },
+        { .key = "linkquality", .type = SCAN_TYPE_NUMBER }
+    };
+    if (scanHandler_scan(content, strlen(content), fields, 6) == 0) {
+        return 1;
+    }
+
+    mqttHandler_state_t* state = &configPtr_devices[device].deviceState;
+    int reported[SHADOW_FIELD_COUNT] = { SHADOW_UNKNOWN, SHADOW_UNKNOWN, SHADOW_UNKNOWN, SHADOW_UNKNOWN };
+    int rc = 0;
+    if (fields[0].found) {
+        int on = strcasecmp(power, "ON") == 0 ? 1 : 0;
+        rc |= driverHandler_setString(&state->power, on ? "ON" : "OFF");
+        reported[SHADOW_FIELD_POWER] = on;
+    }
+    if (fields[1].found) {
+        state->dimmer = ((int)fields[1].number * 100 + ZIGBEE_BRIGHTNESS_MAX / 2) / ZIGBEE_BRIGHTNESS_MAX;
+        reported[SHADOW_FIELD_BRIGHTNESS] = state->dimmer;
+        historyHandler_append(device, HISTORY_SERIES_DIMMER, historyHandler_now(), state->dimmer);
+    }
+    if (fields[2].found) {
+        int colorTemp = (int)fields[2].number;
+        if (colorTemp < ZIGBEE_COLOR_TEMP_MIN) { colorTemp = ZIGBEE_COLOR_TEMP_MIN; }
+        if (colorTemp > ZIGBEE_COLOR_TEMP_MAX) { colorTemp = ZIGBEE_COLOR_TEMP_MAX; }
+        reported[SHADOW_FIELD_WARMTH] = ((colorTemp - ZIGBEE_COLOR_TEMP_MIN) * 100 + (ZIGBEE_COLOR_TEMP_MAX - ZIGBEE_COLOR_TEMP_MIN) / 2) / (ZIGBEE_COLOR_TEMP_MAX - ZIGBEE_COLOR_TEMP_MIN);
+    }
+    // NOTE: Color is reported as CIE xy, which does not convert back to the exact RGB that was sent.
+    // It is only shown, not reported to the shadow, which then treats color as sent once (Like devices that never report it)
+    if (fields[3].found && fields[4].found) {
+        info[device].colorX = (float)fields[3].number;
+        info[device].colorY = (float)fields[4].number;
+    }
+    if (fields[5].found) {
+        info[device].linkQuality = (int)fields[5].number;
+    }
+    shadowHandler_report(device, reported);
+
+    atomic_fetch_add(&stateGeneration, 1);
+    return rc;
+}
+
+// Register every light/switch from the bridge's device list that is not known yet
+int zigbeeDriver_importDevices(const char* content) {
+    uint64_t start = waitHandler_monotonicNs();
+    size_t length = strlen(content);
+    size_t pos = 0;
+    size_t elementStart = 0;
+    size_t elementEnd = 0;
+    int imported = 0;
+    int firstImported = deviceCount;
+
+    while (scanHandler_nextElement(content, length, &pos, &elementStart, &elementEnd) == 0) {
+        const char* element = content + elementStart;
+        size_t elementLength = elementEnd - elementStart;
+
+        // Only devices that expose a light or a switch can be controlled
+        const char* type = NULL;
+        if (scanHandler_hasValue(element, elementLength, "type", "light")) {
+            type = "light";
+        } else if (scanHandler_hasValue(element, elementLength, "type", "switch")) {
+            type = "plug";
+        } else {
+            continue;
+        }
+
+        char friendlyName[128];
+        char vendor[32];
+        char model[32];
+        scanHandler_field_t fields[] = {
+            { .key = "friendly_name", .type = SCAN_TYPE_STRING, .string = friendlyName, .stringSize = sizeof(friendlyName) },
+            { .key = "vendor", .type = SCAN_TYPE_STRING, .string = vendor, .stringSize = sizeof(vendor) },
+            { .key = "model", .type = SCAN_TYPE_STRING, .string = model, .stringSize = sizeof(model) }
+        };
+        scanHandler_scan(element, elementLength, fields, 3);
+        if (fields[0].found == 0 || driverHandler_findDevice(friendlyName) != -1) { continue; }
+
+        int device = configHandler_registerDevice(zigbeeDriver.mode, friendlyName, friendlyName, type);
+        if (device == -1) { break; }
+        snprintf(info[device].vendor, sizeof(info[device].vendor), "%s", fields[1].found ? vendor : "");
+        snprintf(info[device].model, sizeof(info[device].model), "%s", fields[2].found ? model : "");
+        imported++;
+    }
+
+    if (imported > 0) {
+        printf("Imported %d Zigbee2MQTT devices in %llu ms.\n", imported, (unsigned long long)((waitHandler_monotonicNs() - start) / 1000000ULL));
+
+        // Ask the new devices for their state through the dispatcher
+        for (int i = firstImported; i < firstImported + imported; i++) {
+            queueHandler_push(FLAG_DISPATCH_TYPE_OPENBK_LIGHT, FLAG_DISPATCH_ACTION_OPENBK_LIGHT_REQUEST_STATE, i, 0, 0);
+        }
+        atomic_fetch_add(&stateGeneration, 1);
+    }
+    return 0;
+}
+
+void zigbeeDriver_getInfo(int device, zigbeeDriver_info_t* out) {
+    *out = info[device];
+}
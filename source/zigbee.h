@@ -0,0 +1,36 @@
+#ifndef _ZIGBEE_H
+#define _ZIGBEE_H
+#include "queue.h"
+
+// Zigbee2MQTT base topic
+#define ZIGBEE_BASE_TOPIC "zigbee2mqtt"
+
+// Zigbee2MQTT brightness and color temperature ranges
+#define ZIGBEE_BRIGHTNESS_MAX 254
+#define ZIGBEE_COLOR_TEMP_MIN 153
+#define ZIGBEE_COLOR_TEMP_MAX 500
+
+// Message kinds reported by the router
+#define ZIGBEE_MESSAGE_STATE 0 // zigbee2mqtt/<friendly name>
+#define ZIGBEE_MESSAGE_AVAILABILITY 1 // zigbee2mqtt/<friendly name>/availability
+#define ZIGBEE_MESSAGE_BRIDGE_DEVICES 2 // zigbee2mqtt/bridge/devices (Retained inventory)
+
+// Per device details that only Zigbee devices have
+typedef struct {
+    int linkQuality; // 0 - 255, 0 until reported
+    float colorX; // CIE xy of the last reported color, 0 until reported
+    float colorY;
+    char vendor[32];
+    char model[32];
+} zigbeeDriver_info_t;
+
+int zigbeeDriver_route(char** levels, int levelCount, const char** name);
+int zigbeeDriver_handleMessage(int device, int kind, char* content);
+int zigbeeDriver_encodeCommand(const queueHandler_command_t* command, const char** cmnd, char payload[16]);
+int zigbeeDriver_sendCommand(const char* target, const char* cmnd, const char* payload);
+int zigbeeDriver_requestState(int device);
+int zigbeeDriver_processState(char* content, int device);
+int zigbeeDriver_importDevices(const char* content);
+void zigbeeDriver_getInfo(int device, zigbeeDriver_info_t* out);
+
+#endif